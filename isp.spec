@@ -43,6 +43,13 @@ cp utils/ispunitsplit $RPM_BUILD_ROOT/%{_bindir}
 cp utils/ispdelay $RPM_BUILD_ROOT/%{_bindir}
 cp utils/ispprogress $RPM_BUILD_ROOT/%{_bindir}
 cp utils/ispcount $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispworkerd $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispfuse $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispunitjoin $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispprefetch $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispstage $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispsave $RPM_BUILD_ROOT/%{_bindir}
+cp utils/ispload $RPM_BUILD_ROOT/%{_bindir}
 
 cp isp/isp.h $RPM_BUILD_ROOT/%{_includedir}/isp
 cp isp/util.h $RPM_BUILD_ROOT/%{_includedir}/isp
@@ -40,6 +40,11 @@
  */
 #define HAVE_OPENSSL                1
 
+/* Configures the shared memory transport in ring.c (memfd, eventfd, and
+ * fd passing, Linux only).
+ */
+#define HAVE_SHMRING                1
+
 #endif /* _CONFIG_H */
 
 /*
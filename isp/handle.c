@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "util.h"
 #include "xml.h"
@@ -50,6 +51,8 @@ struct isp_handle_struct {
     int flags;          /* ISP_* flags */
     xout_handle_t xout; /* XML output handle */
     xin_handle_t xin;   /* XML input handle */
+    int zchecked;       /* output compression has been decided */
+    int credit;         /* write a credit mark for each unit read */
 };
 
 static int
@@ -174,6 +177,32 @@ isp_handle_read(isp_handle_t h, xml_el_t *ep)
     return res;
 }
 
+/* Before the first write, decide whether to compress output according to
+ * ISP_COMPRESS.  By default it is not: whoever knows the reader to be on 
+ * another host calls isp_handle_compress_set() before that (see isp_init()).
+ */
+static void
+_compress_check(isp_handle_t h)
+{
+    if (isp_compress_get() == COMPRESS_ALWAYS)
+        (void)xout_compress_set(h->xout, 1); /* not for regular files */
+    h->zchecked = 1;
+}
+
+/* Override the ISP_COMPRESS decision, before the first write.
+ */
+PRIVATE int
+isp_handle_compress_set(isp_handle_t h, int on)
+{
+    int res;
+
+    if (!_handle_check(h) || !h->xout)
+        return ISP_EINVAL;
+    if ((res = xout_compress_set(h->xout, on)) == ISP_ESUCCESS)
+        h->zchecked = 1;
+    return res;
+}
+
 /* note: e can be null */
 PRIVATE int
 isp_handle_write(isp_handle_t h, xml_el_t e)
@@ -182,6 +211,8 @@ isp_handle_write(isp_handle_t h, xml_el_t e)
 
     if (!_handle_check(h) || !(h->flags & ISP_SOURCE) || !h->xout)
         return ISP_EINVAL;
+    if (!h->zchecked)
+        _compress_check(h);
 
     /* if blocking, retry if no room in buffer yet */
     while ((res = xout_write_el(h->xout, e)) == ISP_EWOULDBLOCK) {
@@ -194,6 +225,65 @@ isp_handle_write(isp_handle_t h, xml_el_t e)
     return res;
 }
 
+/* Write an element already converted to XML (e.g. by isp_unit_str()).
+ * The caller vouches that buf holds exactly one well-formed element.
+ */
+PRIVATE int
+isp_handle_write_str(isp_handle_t h, char *buf, int len)
+{
+    int res = ISP_ESUCCESS;
+
+    if (!buf || !_handle_check(h) || !(h->flags & ISP_SOURCE) || !h->xout)
+        return ISP_EINVAL;
+    if (!h->zchecked)
+        _compress_check(h);
+
+    while ((res = xout_write_str(h->xout, buf, len)) == ISP_EWOULDBLOCK) {
+        if ((h->flags & ISP_NONBLOCK))
+            break;
+        if ((res = _wait_for_io(h)) != ISP_ESUCCESS)
+            break;
+    }
+
+    return res;
+}
+
+/* Have the reader of our output return a credit for each unit we read 
+ * (see isp_handle_credit()), so it can keep a bounded number of units
+ * queued to us however many we write back.
+ */
+PRIVATE int
+isp_handle_credit_set(isp_handle_t h, int on)
+{
+    if (!_handle_check(h) || !h->xin || !h->xout)
+        return ISP_EINVAL;
+    h->credit = on;
+    return ISP_ESUCCESS;
+}
+
+/* Called as each unit is read.
+ */
+PRIVATE int
+isp_handle_credit(isp_handle_t h)
+{
+    if (!_handle_check(h))
+        return ISP_EINVAL;
+    if (!h->credit)
+        return ISP_ESUCCESS;
+    return xout_write_credit(h->xout);
+}
+
+/* Assign the number of credits returned by the writer of our input.
+ */
+PRIVATE int
+isp_handle_credits_get(isp_handle_t h, unsigned long *np)
+{
+    if (!np || !_handle_check(h) || !h->xin)
+        return ISP_EINVAL;
+    *np = xin_get_credits(h->xin);
+    return ISP_ESUCCESS;
+}
+
 PRIVATE int
 isp_handle_flags_get(isp_handle_t h, int *fp)
 {
@@ -219,13 +309,94 @@ isp_handle_backlog_set(isp_handle_t h, int ibacklog, int obacklog)
 
     if (!_handle_check(h))
         return ISP_EINVAL;
-    if ((res = xin_backlog_set(h->xin, ibacklog)) != ISP_ESUCCESS)
+    if (h->xin && (res = xin_backlog_set(h->xin, ibacklog)) != ISP_ESUCCESS)
+        return res;
+    if (h->xout && (res = xout_backlog_set(h->xout, obacklog)) 
+            != ISP_ESUCCESS)
+        return res;
+    return ISP_ESUCCESS;
+}
+
+/* Limit the bytes of XML buffered, in addition to the element counts
+ * above (0 = unlimited).
+ */
+PRIVATE int
+isp_handle_backlog_bytes_set(isp_handle_t h, unsigned long ibytes, 
+                             unsigned long obytes)
+{
+    int res;
+
+    if (!_handle_check(h))
+        return ISP_EINVAL;
+    if (h->xin && (res = xin_backlog_bytes_set(h->xin, ibytes)) 
+            != ISP_ESUCCESS)
         return res;
-    if ((res = xout_backlog_set(h->xout, obacklog)) != ISP_ESUCCESS)
+    if (h->xout && (res = xout_backlog_bytes_set(h->xout, obytes)) 
+            != ISP_ESUCCESS)
         return res;
     return ISP_ESUCCESS;
 }
 
+PRIVATE int
+isp_handle_stats(isp_handle_t h, struct isp_handle_stats_struct *sp)
+{
+    if (!sp || !_handle_check(h))
+        return ISP_EINVAL;
+    memset(sp, 0, sizeof(*sp));
+    if (h->xin) {
+        sp->icount = xin_get_backlog(h->xin);
+        sp->ibytes = xin_get_backlog_bytes(h->xin, &sp->ipeak);
+        (void)xin_get_compress_stats(h->xin, &sp->izraw, &sp->izcoded,
+                                     &sp->izsecs);
+    }
+    if (h->xout) {
+        sp->ocount = xout_get_backlog(h->xout);
+        sp->obytes = xout_get_backlog_bytes(h->xout, &sp->opeak);
+        (void)xout_get_compress_stats(h->xout, &sp->ozraw, &sp->ozcoded,
+                                      &sp->ozsecs);
+    }
+    return ISP_ESUCCESS;
+}
+
+static void
+_zreport(char *name, char *verb, unsigned long raw, unsigned long coded,
+         double secs)
+{
+    isp_err("%s: %lu bytes %s %lu (%.1f:1) in %.3fs cpu", name, raw, verb,
+            coded, coded ? (double)raw / coded : 0.0, secs);
+}
+
+/* Report the most bytes of XML the handle has buffered each way.
+ */
+PRIVATE void
+isp_handle_backlog_report(isp_handle_t h, char *iname, char *oname)
+{
+    struct isp_handle_stats_struct s;
+
+    if (isp_handle_stats(h, &s) != ISP_ESUCCESS)
+        return;
+    if (h->xin)
+        isp_err("%s: at most %lu bytes buffered", iname, s.ipeak);
+    if (h->xout)
+        isp_err("%s: at most %lu bytes buffered", oname, s.opeak);
+}
+
+/* Report the compression ratio and time spent on the handle's streams,
+ * if any were compressed.
+ */
+PRIVATE void
+isp_handle_zreport(isp_handle_t h, char *iname, char *oname)
+{
+    struct isp_handle_stats_struct s;
+
+    if (isp_handle_stats(h, &s) != ISP_ESUCCESS)
+        return;
+    if (s.izraw > 0)
+        _zreport(iname, "decompressed from", s.izraw, s.izcoded, s.izsecs);
+    if (s.ozraw > 0)
+        _zreport(oname, "compressed to", s.ozraw, s.ozcoded, s.ozsecs);
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
@@ -34,6 +34,8 @@
  * stack.
  *
  * Filters contain stabs, and also some other stuff like argv and environ.
+ * The init element also carries a 'live' symbol table, which sums up the 
+ * stabs pushed so far.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -180,56 +182,6 @@ _stab_find(isp_filter_t f, xml_el_t *sp)
     return res;
 }
 
-/* Verify that someone upstream ISP_PROVIDES the specified symbol,
- * and that nobody after that ISP_REMOVES it.
- * FIXME: also need to verify that symbols we ISP_PROVIDE are not provided
- * upstream, or are ISP_REMOVED before we see them.
- */
-static int
-_stab_verify_upstream(isp_init_t i, int fid, char *name, isp_type_t type)
-{
-    isp_filter_t f;
-    xml_el_t stab;
-    int res = ISP_EBIND;
-    int id;
-    isp_type_t ntype;
-    int flags;
-
-    /* Search backward thru filter id's numbered lower than us, until
-     * we find our symbol being removed (immediate failure) or our symbol
-     * being provided (immediate success).
-     */
-    for (id = fid - 1; id >= 0; id--) {
-        res = isp_init_find(i, id, &f);     /* must find the filter id */
-        if (res != ISP_ESUCCESS)
-            break;
-        res = _stab_find(f, &stab);         /* no stab, keep looking */
-        if (res != ISP_ESUCCESS) {
-            res = ISP_EBIND;
-            continue; 
-        }
-        res = _sym_find(stab, name, &ntype, &flags);
-        if (res != ISP_ESUCCESS) {          /* no symbol entry, keep looking */
-            res = ISP_EBIND;
-            continue;
-        }
-        if (ntype != type) {                /* right name, wrong type */
-            res = ISP_EBIND;
-            break;
-        }
-        if (flags & ISP_PROVIDES) {         /* provides: immediate success */
-            res = ISP_ESUCCESS;
-            break;
-        }
-        if (flags & ISP_REMOVES) {          /* removes: immediate failure */
-            res = ISP_EBIND;
-            break;
-        }
-    }
-
-    return res;
-}
-
 static char *
 _strtotype(isp_type_t t)
 {
@@ -255,30 +207,6 @@ _strtotype(isp_type_t t)
     return str;
 }
 
-/* Verify that upstream ISP_PROVIDES all symbols that
- * we tag ISP_REQUIRES, and the types match.
- */
-static int
-_stab_verify(isp_init_t i, int fid, struct isp_stab_struct *tab)
-{
-    struct isp_stab_struct *tp;
-    int res = ISP_ESUCCESS;
-
-    for (tp = &tab[0]; tp->name != NULL; tp++) {
-        if (tp->flags & ISP_REQUIRES) {
-            int r = _stab_verify_upstream(i, fid, tp->name, tp->type);
-
-            if (r != ISP_ESUCCESS) {
-                res = r;
-                isp_err("requires key ``%s'' (%s) not found upstream", 
-                        tp->name, _strtotype(tp->type));
-            }
-        }
-    }
-
-    return res;
-}
-
 /**
  ** Filter functions
  **/
@@ -375,16 +303,6 @@ _filter_create(xml_el_t *ep, int fid, struct isp_stab_struct stab[],
         goto error;
     }
 
-#if 0
-    res = _array_create(&tmp, "envv", "env", util_argvlen(environ), environ);
-    if (res != ISP_ESUCCESS)
-        goto error;
-    if ((res = xml_el_append(e, tmp)) != ISP_ESUCCESS) {
-        xml_el_destroy(tmp);
-        goto error;
-    }
-#endif
-
     if ((res = _stab_create(&tmp, stab)) != ISP_ESUCCESS) {
         isp_dbgfail("problem with symbol table");
         goto error;
@@ -403,6 +321,425 @@ error:
     return res;
 }
 
+/**
+ ** Live symbol table (part of init element)
+ **/
+
+/* The live symbol table holds every symbol provided so far in the pipeline
+ * and not removed since, with its type and the fid of its provider.
+ * Each filter checks its ISP_REQUIRES symbols against it, then applies its
+ * own stab to it before passing the init element on.  With the table
+ * loaded into a hash, a binding check is one probe rather than a walk
+ * back through the stab of every upstream filter.
+ *
+ * The table is kept at the tail of the init element so that the filter 
+ * stack remains at the head.  If it is missing (upstream is an older ISP),
+ * it is rebuilt once from the filter stack.
+ */
+
+#define SYMHASH_MIN 64
+
+struct symhash_ent {
+    char               *key;    /* points into sym element */
+    xml_el_t            sym;
+    struct symhash_ent *next;
+};
+
+typedef struct {
+    int                  size;  /* power of 2 */
+    struct symhash_ent **tab;
+} symhash_t;
+
+static unsigned int
+_symhash_fn(char *key)
+{
+    unsigned int h = 5381;
+
+    while (*key)
+        h = h * 33 + (unsigned char)*key++;
+    return h;
+}
+
+static int
+_symhash_create(symhash_t *hp, int n)
+{
+    hp->size = SYMHASH_MIN;
+    while (hp->size < 2 * n)
+        hp->size *= 2;
+    if (!(hp->tab = calloc(hp->size, sizeof(struct symhash_ent *))))
+        return ISP_ENOMEM;
+    return ISP_ESUCCESS;
+}
+
+static void
+_symhash_destroy(symhash_t *hp)
+{
+    struct symhash_ent *e, *next;
+    int n;
+
+    for (n = 0; n < hp->size; n++) {
+        for (e = hp->tab[n]; e != NULL; e = next) {
+            next = e->next;
+            free(e);
+        }
+    }
+    free(hp->tab);
+}
+
+static struct symhash_ent **
+_symhash_lookup(symhash_t *hp, char *key)
+{
+    struct symhash_ent **ep = &hp->tab[_symhash_fn(key) & (hp->size - 1)];
+
+    while (*ep && strcmp((*ep)->key, key) != 0)
+        ep = &(*ep)->next;
+    return ep;
+}
+
+static xml_el_t
+_symhash_find(symhash_t *hp, char *key)
+{
+    struct symhash_ent *e = *_symhash_lookup(hp, key);
+
+    return e ? e->sym : NULL;
+}
+
+/* Add sym, whose key is not already present.
+ */
+static int
+_symhash_insert(symhash_t *hp, xml_el_t sym)
+{
+    struct symhash_ent *e;
+    int res;
+
+    if (!(e = malloc(sizeof(struct symhash_ent))))
+        return ISP_ENOMEM;
+    if ((res = xml_el_attr_val(sym, "key", &e->key)) != ISP_ESUCCESS) {
+        free(e);
+        return res;
+    }
+    e->sym = sym;
+    e->next = *_symhash_lookup(hp, e->key);
+    hp->tab[_symhash_fn(e->key) & (hp->size - 1)] = e;
+    return ISP_ESUCCESS;
+}
+
+static void
+_symhash_delete(symhash_t *hp, char *key)
+{
+    struct symhash_ent **ep = _symhash_lookup(hp, key);
+    struct symhash_ent *e = *ep;
+
+    if (e) {
+        *ep = e->next;
+        free(e);
+    }
+}
+
+/* Update the live table for one symbol in the stab of filter 'fid'.
+ */
+static int
+_live_apply_sym(xml_el_t live, symhash_t *hp, int fid, 
+                char *key, isp_type_t type, int flags)
+{
+    xml_el_t e = _symhash_find(hp, key);
+    int res = ISP_ESUCCESS;
+
+    if (flags & ISP_PROVIDES) {
+        if (e) {
+            if ((res = xml_el_attr_setval(e, "type", "%d", type)))
+                return res;
+            return xml_el_attr_setval(e, "fid", "%d", fid);
+        }
+        if ((res = xml_el_create("sym", &e)) != ISP_ESUCCESS)
+            return res;
+        if ((res = xml_attr_str_append(e, "key", key)) != ISP_ESUCCESS)
+            goto error;
+        if ((res = xml_attr_int_append(e, "type", type)) != ISP_ESUCCESS)
+            goto error;
+        if ((res = xml_attr_int_append(e, "fid", fid)) != ISP_ESUCCESS)
+            goto error;
+        if ((res = xml_el_append(live, e)) != ISP_ESUCCESS)
+            goto error;
+        return _symhash_insert(hp, e);
+    } else if ((flags & ISP_REMOVES) && e) {
+        _symhash_delete(hp, key);
+        if ((res = xml_el_remove(live, e)) != ISP_ESUCCESS)
+            return res;
+        xml_el_destroy(e);
+    }
+    return res;
+error:
+    xml_el_destroy(e);
+    return res;
+}
+
+static int
+_live_apply(xml_el_t live, symhash_t *hp, int fid, 
+            struct isp_stab_struct *tab)
+{
+    struct isp_stab_struct *tp;
+    int res = ISP_ESUCCESS;
+
+    for (tp = &tab[0]; res == ISP_ESUCCESS && tp->name != NULL; tp++)
+        res = _live_apply_sym(live, hp, fid, tp->name, tp->type, tp->flags);
+    return res;
+}
+
+/* Replay the stab of every filter in the stack, oldest first.
+ */
+static int
+_live_rebuild(isp_init_t i, xml_el_t live, symhash_t *hp)
+{
+    xml_el_iterator_t itr;
+    xml_el_t *fv, f, stab, sym;
+    int n = 0, res, fid;
+    isp_type_t type;
+    int flags;
+    char *key;
+
+    if (!(fv = malloc(xml_el_count(i) * sizeof(xml_el_t))))
+        return ISP_ENOMEM;
+    if ((res = xml_el_iterator_create(i, &itr)) == ISP_ESUCCESS) {
+        while ((f = xml_el_next(itr)) != NULL)
+            if (_filter_check(f))
+                fv[n++] = f;
+        xml_el_iterator_destroy(itr);
+    }
+    while (res == ISP_ESUCCESS && n-- > 0) {
+        if ((res = isp_filter_fid_get(fv[n], &fid)) != ISP_ESUCCESS)
+            break;
+        if (_stab_find(fv[n], &stab) != ISP_ESUCCESS)
+            continue;
+        if ((res = xml_el_iterator_create(stab, &itr)) != ISP_ESUCCESS)
+            break;
+        while (res == ISP_ESUCCESS && (sym = xml_el_next(itr)) != NULL) {
+            if (!_sym_check(sym))
+                continue;
+            if ((res = xml_el_attr_val(sym, "key", &key)) != ISP_ESUCCESS)
+                break;
+            res = xml_el_attr_scanval(sym, 1, "type", "%d", &type);
+            if (res != ISP_ESUCCESS)
+                break;
+            res = xml_el_attr_scanval(sym, 1, "flags", "%d", &flags);
+            if (res != ISP_ESUCCESS)
+                break;
+            res = _live_apply_sym(live, hp, fid, key, type, flags);
+        }
+        xml_el_iterator_destroy(itr);
+    }
+    free(fv);
+    return res;
+}
+
+/* Find (or create) the live table in i and load it into *hp.
+ */
+static int
+_live_load(isp_init_t i, xml_el_t *livep, symhash_t *hp)
+{
+    xml_el_iterator_t itr;
+    xml_el_t live, sym;
+    int res;
+
+    live = xml_el_find_first(i, (xml_el_match_t)_stab_match, "live");
+    if (live) {
+        if ((res = _symhash_create(hp, xml_el_count(live))) != ISP_ESUCCESS)
+            return res;
+        if ((res = xml_el_iterator_create(live, &itr)) == ISP_ESUCCESS) {
+            while (res == ISP_ESUCCESS && (sym = xml_el_next(itr)) != NULL)
+                res = _symhash_insert(hp, sym);
+            xml_el_iterator_destroy(itr);
+        }
+    } else {
+        if ((res = _symhash_create(hp, 0)) != ISP_ESUCCESS)
+            return res;
+        if ((res = xml_el_create("live", &live)) != ISP_ESUCCESS)
+            goto done;
+        if ((res = xml_el_append(i, live)) != ISP_ESUCCESS) {
+            xml_el_destroy(live);
+            goto done;
+        }
+        res = _live_rebuild(i, live, hp);
+    }
+done:
+    if (res == ISP_ESUCCESS)
+        *livep = live;
+    else
+        _symhash_destroy(hp);
+    return res;
+}
+
+/* Verify that upstream ISP_PROVIDES all symbols that
+ * we tag ISP_REQUIRES, and the types match.
+ */
+static int
+_live_verify(symhash_t *hp, struct isp_stab_struct *tab)
+{
+    struct isp_stab_struct *tp;
+    int res = ISP_ESUCCESS;
+    isp_type_t type;
+    xml_el_t e;
+
+    for (tp = &tab[0]; tp->name != NULL; tp++) {
+        if (tp->flags & ISP_REQUIRES) {
+            e = _symhash_find(hp, tp->name);
+            if (!e || xml_el_attr_scanval(e, 1, "type", "%d", &type) 
+                                                        != ISP_ESUCCESS
+                   || type != tp->type) {
+                res = ISP_EBIND;
+                isp_err("requires key ``%s'' (%s) not found upstream", 
+                        tp->name, _strtotype(tp->type));
+            }
+        }
+    }
+
+    return res;
+}
+
+/**
+ ** Environment (part of init and filter elements)
+ **/
+
+/* Only variables named in ISP_ENVKEEP (comma-separated names, where a
+ * trailing '*' matches a prefix) are recorded: the full environment of
+ * every filter would dominate the init element, which every downstream
+ * filter and isprun coprocess parses and serializes again.  The first
+ * filter to record its environment stores it once, in an 'envv' element
+ * at the tail of the init element.  Later filters store only an 'envdiff'
+ * in their filter element, with the variables whose values differ from
+ * 'envv', and no 'val' for a variable they do not have.
+ */
+
+static int
+_env_keep(char *name, int namelen, char *keep)
+{
+    char *p = keep;
+    int n;
+
+    while (*p) {
+        n = strcspn(p, ",");
+        if (n > 0 && p[n - 1] == '*') {
+            if (namelen >= n - 1 && !strncmp(name, p, n - 1))
+                return 1;
+        } else if (n == namelen && !strncmp(name, p, n))
+            return 1;
+        p += n;
+        if (*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+static int
+_env_append(xml_el_t ev, char *name, int namelen, char *val)
+{
+    xml_el_t e;
+    char *key;
+    int res;
+
+    if (!(key = strndup(name, namelen)))
+        return ISP_ENOMEM;
+    if ((res = xml_el_create("env", &e)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_attr_str_append(e, "key", key)) != ISP_ESUCCESS)
+        goto error;
+    if (val && (res = xml_attr_str_append(e, "val", val)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_el_append(ev, e)) != ISP_ESUCCESS)
+        goto error;
+done:
+    free(key);
+    return res;
+error:
+    xml_el_destroy(e);
+    goto done;
+}
+
+/* Record our environment in i (the first time) or f (as a diff).
+ */
+static int
+_env_record(isp_init_t i, isp_filter_t f)
+{
+    char *keep = getenv("ISP_ENVKEEP");
+    xml_el_t base, ev = NULL, e;
+    xml_el_iterator_t itr;
+    symhash_t hash;
+    char **ep, *eq, *key, *val;
+    int res = ISP_ESUCCESS;
+    int hashed = 0;
+
+    if (!keep || !*keep)
+        return ISP_ESUCCESS;
+
+    base = xml_el_find_first(i, (xml_el_match_t)_stab_match, "envv");
+    if ((res = xml_el_create(base ? "envdiff" : "envv", &ev)) != ISP_ESUCCESS)
+        return res;
+    if (base) {
+        if ((res = _symhash_create(&hash, xml_el_count(base))) != ISP_ESUCCESS)
+            goto done;
+        hashed = 1;
+        if ((res = xml_el_iterator_create(base, &itr)) != ISP_ESUCCESS)
+            goto done;
+        while (res == ISP_ESUCCESS && (e = xml_el_next(itr)) != NULL)
+            res = _symhash_insert(&hash, e);
+        xml_el_iterator_destroy(itr);
+        if (res != ISP_ESUCCESS)
+            goto done;
+    }
+
+    /* Our variables: all of them, or those that differ from the base.
+     */
+    for (ep = environ; res == ISP_ESUCCESS && *ep != NULL; ep++) {
+        if (!(eq = strchr(*ep, '=')) || !_env_keep(*ep, eq - *ep, keep))
+            continue;
+        if (base) {
+            if (!(key = strndup(*ep, eq - *ep))) {
+                res = ISP_ENOMEM;
+                break;
+            }
+            e = _symhash_find(&hash, key);
+            free(key);
+            if (e && xml_el_attr_val(e, "val", &val) == ISP_ESUCCESS
+                  && !strcmp(val, eq + 1))
+                continue;
+        }
+        res = _env_append(ev, *ep, eq - *ep, eq + 1);
+    }
+
+    /* Base variables we have unset.
+     */
+    if (base && res == ISP_ESUCCESS) {
+        if ((res = xml_el_iterator_create(base, &itr)) != ISP_ESUCCESS)
+            goto done;
+        while (res == ISP_ESUCCESS && (e = xml_el_next(itr)) != NULL) {
+            if (xml_el_attr_val(e, "key", &key) != ISP_ESUCCESS)
+                continue;
+            if (_env_keep(key, strlen(key), keep) && !getenv(key))
+                res = _env_append(ev, key, strlen(key), NULL);
+        }
+        xml_el_iterator_destroy(itr);
+    }
+    if (res != ISP_ESUCCESS)
+        goto done;
+
+    if (!base)
+        res = xml_el_append(i, ev);
+    else if (xml_el_count(ev) > 0)
+        res = xml_el_append(f, ev);
+    else {
+        xml_el_destroy(ev);
+        ev = NULL;
+    }
+    if (res == ISP_ESUCCESS)
+        ev = NULL;
+done:
+    if (ev)
+        xml_el_destroy(ev);
+    if (hashed)
+        _symhash_destroy(&hash);
+    return res;
+}
+
 /**
  ** Filter functions
  **/
@@ -503,18 +840,41 @@ isp_init_write(isp_handle_t h, isp_init_t i)
     return isp_handle_write(h, i);
 }
 
+/* Convert an init element to a malloc'ed XML string (not null terminated),
+ * which can be written back out with isp_handle_write_str().
+ */
+PRIVATE int
+isp_init_str(isp_init_t i, char **bufp, int *sizep)
+{
+    if (!_init_check(i) || !bufp || !sizep)
+        return ISP_EINVAL;
+    return xml_el_to_str(i, bufp, sizep);
+}
+
 
 
+/* Perform the init handshake on behalf of one or more consecutive filters
+ * hosted by this process.  Normally there is one stage (isp_init()), but
+ * ispfuse runs several map plugins back-to-back and gives each its own
+ * filter element.  Each stage's symbol table is verified against
+ * everything upstream of it, including the stages before it.
+ * On success the filter id is left at that of the first stage.
+ */
 PRIVATE int 
-isp_init_handshake(isp_handle_t h, struct isp_stab_struct stab[], 
-                   int argc, char *argv[], int sf)
+isp_init_handshake_stages(isp_handle_t h, int nstages, 
+                          struct isp_stage_struct stages[], int sf)
 {
     int res = ISP_ESUCCESS;
     isp_init_t i = NULL;
     isp_filter_t f;
+    xml_el_t live;
+    symhash_t hash;
     int fid = NO_FID;
     int flags;
+    int n;
 
+    if (nstages < 1 || !stages)
+        return ISP_EINVAL;
     if ((res = isp_handle_flags_get(h, &flags)) != ISP_ESUCCESS)
         goto done;
     assert(!(flags & ISP_NONBLOCK));
@@ -536,24 +896,42 @@ isp_init_handshake(isp_handle_t h, struct isp_stab_struct stab[],
             goto done;
         fid = 0;
     }
-    isp_filterid_set(fid);
+    if ((res = _live_load(i, &live, &hash)) != ISP_ESUCCESS)
+        goto done;
 
-    /* Check upstream symbol tables against ours.
-     */
-    if (stab) {
-        res = _stab_verify(i, fid, stab);
+    for (n = 0; n < nstages; n++) {
+        isp_filterid_set(fid + n);
+
+        /* Check upstream symbols against ours, then add ours.
+         */
+        if (stages[n].stab) {
+            res = _live_verify(&hash, stages[n].stab);
+            if (res == ISP_ESUCCESS)
+                res = _live_apply(live, &hash, fid + n, stages[n].stab);
+            if (res != ISP_ESUCCESS)
+                break;
+        }
+
+        /* Push our filter element onto init element.
+         */
+        res = _filter_create(&f, fid + n, stages[n].stab, 
+                             stages[n].argc, stages[n].argv, sf);
         if (res != ISP_ESUCCESS)
-            goto done;
+            break;
+        if ((res = _env_record(i, f)) != ISP_ESUCCESS) {
+            xml_el_destroy(f);
+            break;
+        }
+        if ((res = _init_push(i, f)) != ISP_ESUCCESS)
+            break;
     }
-
-    /* Push our filter element onto init element.
-     * Init element is stored for future use.
-     */
-    res = _filter_create(&f, fid, stab, argc, argv, sf);
+    _symhash_destroy(&hash);
     if (res != ISP_ESUCCESS)
         goto done;
-    if ((res = _init_push(i, f)) != ISP_ESUCCESS)
-        goto done;
+    isp_filterid_set(fid);
+
+    /* Init element is stored for future use.
+     */
     isp_init_set(i);
 
     if (flags & ISP_SOURCE) {
@@ -567,6 +945,174 @@ done:
     return res;
 }
 
+/**
+ ** Filter descriptions
+ **/
+
+/* A description is an init element holding only the filter element that a 
+ * filter would push, with a placeholder fid.  A filter run with ISP_DESCRIBE
+ * set writes one instead of taking part in the handshake (see isp_init()).
+ * isprun uses it to push its coprocess's filter element itself, rather than
+ * feed a probe coprocess the whole init element and wait for it to exit.
+ */
+PRIVATE int
+isp_init_describe(isp_handle_t h, struct isp_stab_struct stab[], 
+                  int argc, char *argv[], int sf)
+{
+    isp_init_t i = NULL;
+    isp_filter_t f;
+    int res;
+
+    if ((res = _init_create(&i)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _filter_create(&f, 0, stab, argc, argv, sf)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _init_push(i, f)) != ISP_ESUCCESS) {
+        xml_el_destroy(f);
+        goto done;
+    }
+    res = isp_init_write(h, i);
+done:
+    if (i)
+        isp_init_destroy(i);
+    return res;
+}
+
+/* Convert a stab element to a stab array for _live_verify/_live_apply.
+ * Keys point into the element.  Caller must free the array.
+ */
+static int
+_stab_tab(xml_el_t stab, struct isp_stab_struct **tabp)
+{
+    struct isp_stab_struct *tab;
+    xml_el_iterator_t itr;
+    xml_el_t sym;
+    int n = 0, res;
+
+    if (!(tab = calloc(xml_el_count(stab) + 1, sizeof(*tab))))
+        return ISP_ENOMEM;
+    if ((res = xml_el_iterator_create(stab, &itr)) != ISP_ESUCCESS)
+        goto done;
+    while (res == ISP_ESUCCESS && (sym = xml_el_next(itr)) != NULL) {
+        if (!_sym_check(sym))
+            continue;
+        if ((res = xml_el_attr_val(sym, "key", &tab[n].name)) != ISP_ESUCCESS)
+            break;
+        res = xml_el_attr_scanval(sym, 1, "type", "%d", &tab[n].type);
+        if (res != ISP_ESUCCESS)
+            break;
+        res = xml_el_attr_scanval(sym, 1, "flags", "%d", &tab[n].flags);
+        n++;
+    }
+    xml_el_iterator_destroy(itr);
+    tab[n].name = NULL;
+done:
+    if (res == ISP_ESUCCESS)
+        *tabp = tab;
+    else
+        free(tab);
+    return res;
+}
+
+/* A proxy such as isprun describes the filter it runs, which can change
+ * while the proxy binary does not, so it marks the description uncacheable.
+ */
+PRIVATE int
+isp_init_nocache_set(isp_init_t d)
+{
+    if (!_init_check(d))
+        return ISP_EINVAL;
+    return xml_attr_int_append(d, "nocache", 1);
+}
+
+PRIVATE int
+isp_init_nocache_get(isp_init_t d)
+{
+    int n;
+
+    if (xml_el_attr_scanval(d, 1, "nocache", "%d", &n) != ISP_ESUCCESS)
+        return 0;
+    return n;
+}
+
+/* Return in *ip a copy of 'i' with the filter described by 'd' pushed 
+ * onto it on the filter's behalf, as if it had run the handshake itself 
+ * in our current directory with the current filter id.
+ * The filter element is moved from 'd'.
+ */
+PRIVATE int
+isp_init_splice(isp_init_t i, isp_init_t d, isp_init_t *ip)
+{
+    struct isp_stab_struct *tab = NULL;
+    char cwd[MAXPATHLEN+1];
+    isp_filter_t f = NULL;
+    isp_init_t i2 = NULL;
+    xml_el_t stab, live;
+    symhash_t hash;
+    int res;
+
+    if (!_init_check(i) || !_init_check(d) || !ip)
+        return ISP_EINVAL;
+    if ((res = isp_init_peek(d, &f)) != ISP_ESUCCESS)
+        return res;
+    if ((res = xml_el_remove(d, f)) != ISP_ESUCCESS)
+        return res;
+    if ((res = xml_el_copy(&i2, i)) != ISP_ESUCCESS)
+        goto done;
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        res = ISP_EGETCWD;
+        goto done;
+    }
+    if ((res = xml_el_attr_setval(f, "fid", "%d", isp_filterid_get())))
+        goto done;
+    if ((res = xml_el_attr_setval(f, "cwd", "%s", cwd)) != ISP_ESUCCESS)
+        goto done;
+
+    /* Check upstream symbols against the filter's, then add them.
+     */
+    if ((res = _stab_find(f, &stab)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _stab_tab(stab, &tab)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _live_load(i2, &live, &hash)) != ISP_ESUCCESS)
+        goto done;
+    res = _live_verify(&hash, tab);
+    if (res == ISP_ESUCCESS)
+        res = _live_apply(live, &hash, isp_filterid_get(), tab);
+    _symhash_destroy(&hash);
+    if (res != ISP_ESUCCESS)
+        goto done;
+
+    if ((res = _env_record(i2, f)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _init_push(i2, f)) != ISP_ESUCCESS)
+        goto done;
+    f = NULL;
+    *ip = i2;
+    i2 = NULL;
+done:
+    if (tab)
+        free(tab);
+    if (f)
+        xml_el_destroy(f);
+    if (i2)
+        isp_init_destroy(i2);
+    return res;
+}
+
+PRIVATE int 
+isp_init_handshake(isp_handle_t h, struct isp_stab_struct stab[], 
+                   int argc, char *argv[], int sf)
+{
+    struct isp_stage_struct stage;
+
+    stage.stab = stab;
+    stage.argc = argc;
+    stage.argv = argv;
+
+    return isp_init_handshake_stages(h, 1, &stage, sf);
+}
+
 /*
  * vi:tabstop=4 shiftwidth=4 expandtab
  */
@@ -66,6 +66,10 @@ static char        hostname[MAXHOSTNAMELEN+1] = "localhost";
 static int         filterid = NO_FID;
 static int         md5check = 0;
 static int         dbgfail = 0;
+static unsigned long ringsize = 0;
+static int         compress = COMPRESS_AUTO;
+static int         backlog = -1;        /* ISP_BACKLOG count, -1 if unset */
+static unsigned long backlogbytes = 0;
 
 static isp_init_t  init_element = NULL;
 
@@ -81,6 +85,30 @@ isp_hostname_get(void)
     return hostname;
 }
 
+PRIVATE unsigned long
+isp_ringsize_get(void)
+{
+    return ringsize;
+}
+
+PRIVATE int
+isp_compress_get(void)
+{
+    return compress;
+}
+
+/* Return 1 and assign the ISP_BACKLOG limits if it was set, else 0.
+ */
+PRIVATE int
+isp_backlog_get(int *countp, unsigned long *bytesp)
+{
+    if (backlog < 0)
+        return 0;
+    *countp = backlog;
+    *bytesp = backlogbytes;
+    return 1;
+}
+
 PRIVATE char *
 isp_progname_get(void)
 {
@@ -135,12 +163,61 @@ _getenv_flag(char *flagname, int *flagval)
         *flagval = (int)strtol(tmpstr, NULL, 10);
 }
 
+/* helper for isp_init */
+static void
+_getenv_ringsize(char *name, unsigned long *sizep)
+{
+    char *tmpstr = getenv(name);
+    unsigned long long size;
+
+    *sizep = 0;
+    if (tmpstr && util_parse_size(tmpstr, &size) == ISP_ESUCCESS)
+        *sizep = size;
+}
+
+/* helper for isp_init */
+static void
+_getenv_compress(char *name, int *modep)
+{
+    char *tmpstr = getenv(name);
+
+    if (!tmpstr || !strcmp(tmpstr, "auto"))
+        *modep = COMPRESS_AUTO;
+    else
+        *modep = strtol(tmpstr, NULL, 10) ? COMPRESS_ALWAYS : COMPRESS_NEVER;
+}
+
+/* helper for isp_init: "count[:bytes]" */
+static void
+_getenv_backlog(char *name, int *countp, unsigned long *bytesp)
+{
+    char *tmpstr = getenv(name);
+    unsigned long long size = 0;
+    char *end;
+    long count;
+
+    *countp = -1;
+    *bytesp = 0;
+    if (!tmpstr)
+        return;
+    count = strtol(tmpstr, &end, 10);
+    if (end == tmpstr || count < 0)
+        return;
+    if (*end == ':' && util_parse_size(end + 1, &size) != ISP_ESUCCESS)
+        return;
+    if (*end != ':' && *end != '\0')
+        return;
+    *countp = count;
+    *bytesp = size;
+}
+
 PUBLIC int
 isp_init(isp_handle_t *hp, int flags, int argc, char *argv[], 
         struct isp_stab_struct stab[], int sf)
 {
     int res = ISP_ESUCCESS;
     isp_handle_t h = NULL;
+    int describe, credit, remote;
 
     (void)gethostname(hostname, sizeof(hostname) - 1);
     hostname[sizeof(hostname) - 1] = '\0';
@@ -151,6 +228,9 @@ isp_init(isp_handle_t *hp, int flags, int argc, char *argv[],
 
     _getenv_flag("ISP_DBGFAIL", &dbgfail);
     _getenv_flag("ISP_MD5CHECK", &md5check);
+    _getenv_ringsize("ISP_RING", &ringsize);
+    _getenv_compress("ISP_COMPRESS", &compress);
+    _getenv_backlog("ISP_BACKLOG", &backlog, &backlogbytes);
 
     if (hp == NULL)
         return ISP_EINVAL;
@@ -169,10 +249,42 @@ isp_init(isp_handle_t *hp, int flags, int argc, char *argv[],
         return ISP_EINVAL;
     }
 
+    /* Write our description instead of running the handshake, and exit.
+     */
+    _getenv_flag("ISP_DESCRIBE", &describe);
+    if (describe && !(flags & ISP_PROXY)) {
+        if ((res = isp_handle_create(&h, ISP_SOURCE, IBACKLOG, OBACKLOG,
+                            STDIN_FILENO, STDOUT_FILENO)) == ISP_ESUCCESS) {
+            res = isp_init_describe(h, stab, argc, argv, sf);
+            if (res == ISP_ESUCCESS)
+                res = isp_handle_write(h, NULL);
+            if (isp_fini(h) != ISP_ESUCCESS)
+                res = ISP_EWRITE;
+        }
+        if (res != ISP_ESUCCESS)
+            isp_dbgfail("describe failed");
+        exit(res == ISP_ESUCCESS ? 0 : 1);
+    }
+
     if ((res = isp_handle_create(&h, flags, IBACKLOG, OBACKLOG, 
                             STDIN_FILENO, STDOUT_FILENO)) != ISP_ESUCCESS)
         return res;
 
+    if (backlog >= 0) {
+        (void)isp_handle_backlog_set(h, backlog, backlog);
+        (void)isp_handle_backlog_bytes_set(h, backlogbytes, backlogbytes);
+    }
+
+    /* Whoever started us may know that our stdout goes to another host
+     * (ispworkerd, isprun --srun).  That is not true of filters we run.
+     */
+    _getenv_flag("ISP_STDOUT_REMOTE", &remote);
+    if (remote) {
+        (void)unsetenv("ISP_STDOUT_REMOTE");
+        if (compress == COMPRESS_AUTO && (flags & ISP_SOURCE))
+            (void)isp_handle_compress_set(h, 1);
+    }
+
     if (!(flags & ISP_PROXY)) {
         res = isp_init_handshake(h, stab, argc, argv, sf);
         if (res != ISP_ESUCCESS) {
@@ -182,6 +294,16 @@ isp_init(isp_handle_t *hp, int flags, int argc, char *argv[],
         }
     }
 
+    /* ispworkerd asks for credits to be returned to isprun, which 
+     * only our own stdin and stdout should do, not any filters we run.
+     */
+    _getenv_flag("ISP_CREDIT", &credit);
+    if (credit) {
+        (void)unsetenv("ISP_CREDIT");
+        if ((flags & ISP_SOURCE) && (flags & ISP_SINK))
+            (void)isp_handle_credit_set(h, 1);
+    }
+
     *hp = h;
     return ISP_ESUCCESS;
 }
@@ -191,8 +313,13 @@ isp_fini(isp_handle_t h)
 {
     int res = ISP_ESUCCESS;
 
-    if (h)
+    if (h) {
+        isp_handle_zreport(h, "stdin", "stdout");
+        if (backlog >= 0)
+            isp_handle_backlog_report(h, "stdin", "stdout");
         res = isp_handle_destroy(h);
+    }
+    isp_scratch_fini();
 
     return res;
 }
@@ -26,6 +26,8 @@
 #ifndef _ISP_H
 #define _HSP_H
 
+#include <stddef.h>     /* size_t */
+
 #ifdef __cplusplus
   extern "C" {
 #endif
@@ -41,6 +43,7 @@
 /* flags for isp_file_source(), isp_file_access() */
 #define ISP_RDWR                1
 #define ISP_RDONLY              2
+#define ISP_SLICEOK             4 /* isp_file_access() caller handles slices */
 
 /* Incremented when the protocol changes in an incompatable way */
 #define ISP_PROTO_VER           1
@@ -65,6 +68,21 @@ typedef struct isp_handle_struct *isp_handle_t;
 
 typedef int (*isp_mapfun_t)(isp_unit_t u, void *arg);
 
+/* A map plugin is a shared object exporting a struct isp_plugin_struct
+ * named ISP_PLUGIN_SYM.  ispfuse(1) loads plugins and runs their map 
+ * functions back-to-back on each unit, in one process.
+ * Plugins must not be linked with libisp; they use the host's copy.
+ */
+#define ISP_PLUGIN_VER          1
+#define ISP_PLUGIN_SYM          "isp_plugin"
+
+struct isp_plugin_struct {
+    int                      version;   /* ISP_PLUGIN_VER */
+    int                      flags;     /* 0 or ISP_IGNERR */
+    struct isp_stab_struct  *stab;
+    isp_mapfun_t             mapfun;
+};
+
 int   isp_init(isp_handle_t *h, int flags, int argc, char *argv[], 
                struct isp_stab_struct stab[], int splitfactor);
 int   isp_fini(isp_handle_t h);
@@ -88,6 +106,13 @@ int   isp_file_source(isp_unit_t u, char *key, char *path, int flags);
 int   isp_file_sink(isp_unit_t u, char *key);
 int   isp_file_access(isp_unit_t u, char *key, char **pathp, int flags);
 int   isp_file_rename(isp_unit_t u, char *key, char *newpath);
+int   isp_file_stage(isp_unit_t u, char *key, char *newpath);
+int   isp_file_slice_set(isp_unit_t u, char *key, unsigned long offset,
+                         unsigned long length);
+int   isp_file_slice_get(isp_unit_t u, char *key, unsigned long *offsetp,
+                         unsigned long *lengthp);
+int   isp_file_map(isp_unit_t u, char *key, void **ptrp, size_t *lenp,
+                   int flags);
 
 int   isp_meta_source(isp_unit_t u, char *key, isp_type_t type, ...);
 int   isp_meta_sink(isp_unit_t u, char *key);
@@ -35,6 +35,35 @@ typedef struct xml_el_struct *isp_filter_t;
 #define NO_FID	(-1)
 #define BACKLOG_UNLIMITED (0)
 
+#define COMPRESS_NEVER  (0)     /* ISP_COMPRESS settings */
+#define COMPRESS_ALWAYS (1)
+#define COMPRESS_AUTO   (-1)    /* if the reader is known to be remote */
+
+/* A filter hosted by this process (see isp_init_handshake_stages()).
+ */
+struct isp_stage_struct {
+    struct isp_stab_struct *stab;
+    int                     argc;
+    char                  **argv;
+};
+
+/* XML buffered by a handle (see isp_handle_stats()).
+ */
+struct isp_handle_stats_struct {
+    int                     icount;     /* input elements buffered */
+    unsigned long           ibytes;     /* bytes of them */
+    unsigned long           ipeak;      /* most input bytes buffered */
+    int                     ocount;     /* output elements buffered */
+    unsigned long           obytes;     /* bytes of them */
+    unsigned long           opeak;      /* most output bytes buffered */
+    unsigned long           izraw;      /* input decompressed (0 = none) */
+    unsigned long           izcoded;    /* compressed bytes of it */
+    double                  izsecs;     /* time spent decompressing */
+    unsigned long           ozraw;      /* output compressed (0 = none) */
+    unsigned long           ozcoded;
+    double                  ozsecs;
+};
+
 /* handle.c */
 int   isp_handle_create(isp_handle_t *hp, int flags, 
                         int ibacklog, int obacklog, int ifd, int ofd);
@@ -42,11 +71,21 @@ int   isp_handle_destroy(isp_handle_t h);
 int   isp_handle_check(isp_handle_t h);
 int   isp_handle_read(isp_handle_t h, struct xml_el_struct **ep);
 int   isp_handle_write(isp_handle_t h, struct xml_el_struct *e);
+int   isp_handle_write_str(isp_handle_t h, char *buf, int len);
 void  isp_handle_prepoll(isp_handle_t h, pfd_t pfd);
 void  isp_handle_postpoll(isp_handle_t h, pfd_t pfd);
 int   isp_handle_flags_get(isp_handle_t h, int *fp);
 int   isp_handle_flags_set(isp_handle_t h, int f);
 int   isp_handle_backlog_set(isp_handle_t h, int ibacklog, int obacklog);
+int   isp_handle_backlog_bytes_set(isp_handle_t h, unsigned long ibytes,
+                        unsigned long obytes);
+int   isp_handle_stats(isp_handle_t h, struct isp_handle_stats_struct *sp);
+int   isp_handle_compress_set(isp_handle_t h, int on);
+int   isp_handle_credit_set(isp_handle_t h, int on);
+int   isp_handle_credit(isp_handle_t h);
+int   isp_handle_credits_get(isp_handle_t h, unsigned long *np);
+void  isp_handle_zreport(isp_handle_t h, char *iname, char *oname);
+void  isp_handle_backlog_report(isp_handle_t h, char *iname, char *oname);
 
 /* isp.c */
 int   isp_filterid_get(void);
@@ -57,6 +96,9 @@ char *isp_progname_get(void);
 int   isp_dbgfail_get(void);
 int   isp_md5check_get(void);
 char *isp_hostname_get(void);
+unsigned long isp_ringsize_get(void);
+int   isp_compress_get(void);
+int   isp_backlog_get(int *countp, unsigned long *bytesp);
 
 /* error.c */
 void isp_dbgfail(const char *fmt, ...);
@@ -64,19 +106,45 @@ void isp_dbgfail(const char *fmt, ...);
 /* unit.c */
 int isp_result_get(isp_unit_t u, int fid, unsigned long *utime, 
          unsigned long *stime, unsigned long *rtime, int *result);
+int isp_result_stage_add(isp_unit_t u, int stage, unsigned long utime,
+         unsigned long stime, int code);
+int isp_rwfile_copy(isp_unit_t u);
+int isp_rwfile_move(isp_unit_t u, char *dir);
+int isp_rwfile_unlink(isp_unit_t u);
+int isp_unit_merge(isp_unit_t u, isp_unit_t piece, char *pkey, int index);
+int isp_unit_str(isp_unit_t u, char **bufp, int *sizep);
+int isp_unit_read_nowait(isp_handle_t h, isp_unit_t *up, int pending);
+int isp_meta_str_get(isp_unit_t u, char *key, char **valp);
+int isp_file_md5_get(isp_unit_t u, char *key, char **digestp);
+typedef int (*isp_filefun_t)(char *key, char *path, unsigned long offset,
+         unsigned long length, int flags, void *arg);
+int isp_file_foreach(isp_unit_t u, isp_filefun_t fun, void *arg);
 
 /* init.c */
 int isp_init_handshake(isp_handle_t h, struct isp_stab_struct stab[], 
                        int argc, char *argv[], int sf);
+int isp_init_handshake_stages(isp_handle_t h, int nstages, 
+                       struct isp_stage_struct stages[], int sf);
+int isp_init_describe(isp_handle_t h, struct isp_stab_struct stab[],
+                       int argc, char *argv[], int sf);
+int isp_init_splice(isp_init_t i, isp_init_t d, isp_init_t *ip);
+int isp_init_nocache_set(isp_init_t d);
+int isp_init_nocache_get(isp_init_t d);
 int isp_init_destroy(isp_init_t i);
 int isp_init_read(isp_handle_t h, isp_init_t *ip);
 int isp_init_write(isp_handle_t h, isp_init_t i);
+int isp_init_str(isp_init_t i, char **bufp, int *sizep);
 int isp_init_peek(isp_init_t i, isp_filter_t *fp);
 int isp_init_find(isp_init_t i, int fid, isp_filter_t *fp);
 int isp_filter_fid_get(isp_filter_t f, int *fidp);
 int isp_filter_splitfactor_get(isp_filter_t f, int *sfp);
 /* more filter accessors to be added */
 
+/* scratch.c */
+int isp_scratch_open(char *path, int len, int *fdp);
+int isp_scratch_open_dir(char *dir, char *path, int len, int *fdp);
+void isp_scratch_fini(void);
+
 #endif /* _ISP_PRIVATE_H */
 
 /*
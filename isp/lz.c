@@ -0,0 +1,434 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* LZ77 stream codec (see lz.h).
+ *
+ * Stream:  LZ_MAGIC LZ_VERSION frame...
+ * Frame:   type ('Z' or 'R') rawlen(2) codedlen(2) data[codedlen]
+ * A 'Z' frame holds LZ4-style sequences: a token (literal length << 4 | 
+ * match length - 4, 15 meaning more length bytes follow, each added until
+ * one is less than 255), the literals, then a 2 byte offset back into 
+ * the window and any more match length bytes.  The last sequence of a 
+ * frame has literals only.  An 'R' frame holds data that didn't compress.
+ * Lengths and offsets are little endian.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+
+#include "isp.h"
+#include "lz.h"
+#include "macros.h"
+
+#define LZ_HANDLE_MAGIC 0x4c5a3737
+#define LZ_VERSION      1
+#define LZ_HIST         65536           /* history kept for matches */
+#define LZ_FRAME        32768           /* max raw bytes in a frame */
+#define LZ_WINDOW       (4 * LZ_HIST)   /* history plus frames */
+#define LZ_HDRLEN       5
+#define LZ_MINMATCH     4
+#define LZ_MAXOFF       65535
+#define LZ_HASHBITS     14
+
+struct lz_struct {
+    int magic;
+    unsigned char *win;     /* history then the current frame */
+    int wpos;               /* end of history */
+    int *ht;                /* encoder: window offset by hash, -1 if none */
+    int started;            /* stream header written (read) */
+    unsigned char *in;      /* decoder: compressed input */
+    int inlen, insize, inoff;
+    int outoff, outend;     /* decoder: decoded bytes not yet returned */
+    unsigned long raw;      /* stats */
+    unsigned long coded;
+    double secs;
+};
+
+static double
+_now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+static uint32_t
+_read32(unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static int
+_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASHBITS);
+}
+
+PRIVATE int
+lz_create(lz_t *zp)
+{
+    lz_t z;
+    int i;
+
+    if (!(z = (lz_t)calloc(1, sizeof(struct lz_struct))))
+        return ISP_ENOMEM;
+    z->magic = LZ_HANDLE_MAGIC;
+    if (!(z->win = malloc(LZ_WINDOW)) 
+            || !(z->ht = malloc(sizeof(int) << LZ_HASHBITS))) {
+        lz_destroy(z);
+        return ISP_ENOMEM;
+    }
+    for (i = 0; i < (1 << LZ_HASHBITS); i++)
+        z->ht[i] = -1;
+    *zp = z;
+    return ISP_ESUCCESS;
+}
+
+PRIVATE void
+lz_destroy(lz_t z)
+{
+    assert(z->magic == LZ_HANDLE_MAGIC);
+    if (z->win)
+        free(z->win);
+    if (z->ht)
+        free(z->ht);
+    if (z->in)
+        free(z->in);
+    z->magic = 0;
+    free(z);
+}
+
+/* Make room for 'need' more bytes in the window, keeping LZ_HIST of 
+ * history.
+ */
+static void
+_slide(lz_t z, int need)
+{
+    int shift, i;
+
+    if (z->wpos + need <= LZ_WINDOW)
+        return;
+    shift = z->wpos - LZ_HIST;
+    memmove(z->win, z->win + shift, LZ_HIST);
+    z->wpos = LZ_HIST;
+    z->outoff = z->outend = z->wpos;
+    for (i = 0; i < (1 << LZ_HASHBITS); i++)
+        z->ht[i] = z->ht[i] >= shift ? z->ht[i] - shift : -1;
+}
+
+static unsigned char *
+_putlen(unsigned char *op, int n)
+{
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+/* Emit a sequence.  mlen == 0 for the last one (no match).
+ */
+static unsigned char *
+_emit(unsigned char *op, unsigned char *lit, int litlen, int off, int mlen)
+{
+    int ml = mlen - LZ_MINMATCH;
+
+    *op++ = (litlen >= 15 ? 15 : litlen) << 4 
+          | (mlen == 0 ? 0 : (ml >= 15 ? 15 : ml));
+    if (litlen >= 15)
+        op = _putlen(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+    if (mlen > 0) {
+        *op++ = off & 0xff;
+        *op++ = off >> 8;
+        if (ml >= 15)
+            op = _putlen(op, ml - 15);
+    }
+    return op;
+}
+
+/* Compress 'len' bytes at window offset 'pos' into 'out'.  Returns the
+ * compressed size, which may be up to len + len/255 + 16.
+ */
+static int
+_compress(lz_t z, int pos, int len, unsigned char *out)
+{
+    unsigned char *base = z->win;
+    unsigned char *op = out;
+    int ip = pos, anchor = pos, end = pos + len;
+
+    while (ip + LZ_MINMATCH <= end) {
+        uint32_t seq = _read32(base + ip);
+        int h = _hash(seq);
+        int cand = z->ht[h];
+        int mlen;
+
+        z->ht[h] = ip;
+        if (cand < 0 || ip - cand > LZ_MAXOFF || _read32(base + cand) != seq) {
+            ip++;
+            continue;
+        }
+        mlen = LZ_MINMATCH;
+        while (ip + mlen < end && base[cand + mlen] == base[ip + mlen])
+            mlen++;
+        op = _emit(op, base + anchor, ip - anchor, ip - cand, mlen);
+        ip += mlen;
+        anchor = ip;
+    }
+    op = _emit(op, base + anchor, end - anchor, 0, 0);
+    return op - out;
+}
+
+PRIVATE int
+lz_encode(lz_t z, void *buf, int len, char **outp, int *outlenp)
+{
+    unsigned char *out, *op;
+    double t0 = _now();
+    int n, coded;
+
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    if (!(out = malloc(2 + len + len / 255 + (len / LZ_FRAME + 1) 
+                       * (LZ_HDRLEN + 16))))
+        return ISP_ENOMEM;
+    op = out;
+    if (!z->started) {
+        *op++ = LZ_MAGIC;
+        *op++ = LZ_VERSION;
+        z->started = 1;
+    }
+    while (len > 0) {
+        n = len > LZ_FRAME ? LZ_FRAME : len;
+        _slide(z, n);
+        memcpy(z->win + z->wpos, buf, n);
+        coded = _compress(z, z->wpos, n, op + LZ_HDRLEN);
+        if (coded >= n) {
+            op[0] = 'R';
+            memcpy(op + LZ_HDRLEN, buf, n);
+            coded = n;
+        } else
+            op[0] = 'Z';
+        op[1] = n & 0xff;
+        op[2] = n >> 8;
+        op[3] = coded & 0xff;
+        op[4] = coded >> 8;
+        op += LZ_HDRLEN + coded;
+        z->wpos += n;
+        z->raw += n;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    z->coded += op - out;
+    z->secs += _now() - t0;
+    *outp = (char *)out;
+    *outlenp = op - out;
+    return ISP_ESUCCESS;
+}
+
+PRIVATE int
+lz_feed(lz_t z, void *buf, int len)
+{
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    if (z->inoff > 0) {
+        memmove(z->in, z->in + z->inoff, z->inlen - z->inoff);
+        z->inlen -= z->inoff;
+        z->inoff = 0;
+    }
+    if (z->inlen + len > z->insize) {
+        int size = z->inlen + len + LZ_FRAME;
+        unsigned char *in = realloc(z->in, size);
+
+        if (!in)
+            return ISP_ENOMEM;
+        z->in = in;
+        z->insize = size;
+    }
+    memcpy(z->in + z->inlen, buf, len);
+    z->inlen += len;
+    return ISP_ESUCCESS;
+}
+
+/* Decompress a 'Z' frame into the window at z->wpos.
+ */
+static int
+_decompress(lz_t z, unsigned char *ip, int len, int rawlen)
+{
+    unsigned char *iend = ip + len;
+    unsigned char *win = z->win;
+    int op = z->wpos, oend = z->wpos + rawlen;
+    int n, m, off, c;
+
+    while (ip < iend) {
+        c = *ip++;
+        n = c >> 4;
+        m = c & 15;
+        if (n == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                c = *ip++;
+                n += c;
+            } while (c == 255);
+        }
+        if (n > iend - ip || n > oend - op)
+            return -1;
+        memcpy(win + op, ip, n);
+        ip += n;
+        op += n;
+        if (ip == iend)
+            break;
+        if (iend - ip < 2)
+            return -1;
+        off = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (m == 15) {
+            do {
+                if (ip >= iend)
+                    return -1;
+                c = *ip++;
+                m += c;
+            } while (c == 255);
+        }
+        m += LZ_MINMATCH;
+        if (off == 0 || off > op || m > oend - op)
+            return -1;
+        for (; m > 0; m--, op++)    /* may overlap */
+            win[op] = win[op - off];
+    }
+    return (op == oend) ? 0 : -1;
+}
+
+PRIVATE int
+lz_decode(lz_t z, void *buf, int len)
+{
+    unsigned char *p;
+    int avail, rawlen, codedlen, n;
+    double t0;
+
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    if (z->outoff == z->outend) {
+        t0 = _now();
+        p = z->in + z->inoff;
+        avail = z->inlen - z->inoff;
+        if (!z->started) {
+            if (avail < 2)
+                return 0;
+            if (p[0] != LZ_MAGIC || p[1] != LZ_VERSION)
+                return -1;
+            z->started = 1;
+            z->inoff += 2;
+            z->coded += 2;
+            p += 2;
+            avail -= 2;
+        }
+        if (avail < LZ_HDRLEN)
+            return 0;
+        rawlen = p[1] | p[2] << 8;
+        codedlen = p[3] | p[4] << 8;
+        if (rawlen == 0 || rawlen > LZ_FRAME 
+                || (p[0] == 'R' && codedlen != rawlen)
+                || (p[0] != 'R' && p[0] != 'Z'))
+            return -1;
+        if (avail < LZ_HDRLEN + codedlen)
+            return 0;
+        _slide(z, rawlen);
+        if (p[0] == 'R')
+            memcpy(z->win + z->wpos, p + LZ_HDRLEN, rawlen);
+        else if (_decompress(z, p + LZ_HDRLEN, codedlen, rawlen) < 0)
+            return -1;
+        z->outoff = z->wpos;
+        z->wpos += rawlen;
+        z->outend = z->wpos;
+        z->inoff += LZ_HDRLEN + codedlen;
+        z->raw += rawlen;
+        z->coded += LZ_HDRLEN + codedlen;
+        z->secs += _now() - t0;
+    }
+    n = z->outend - z->outoff;
+    if (n > len)
+        n = len;
+    memcpy(buf, z->win + z->outoff, n);
+    z->outoff += n;
+    return n;
+}
+
+PRIVATE int
+lz_pending(lz_t z)
+{
+    unsigned char *p;
+    int avail;
+
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    if (z->outoff < z->outend)
+        return 1;
+    p = z->in + z->inoff;
+    avail = z->inlen - z->inoff;
+    if (!z->started) {
+        if (avail < 2)
+            return 0;
+        p += 2;
+        avail -= 2;
+    }
+    return (avail >= LZ_HDRLEN && avail >= LZ_HDRLEN + (p[3] | p[4] << 8));
+}
+
+PRIVATE int
+lz_partial(lz_t z)
+{
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    return (z->inlen > z->inoff);
+}
+
+PRIVATE void
+lz_stats(lz_t z, unsigned long *rawp, unsigned long *codedp, double *secsp)
+{
+    assert(z->magic == LZ_HANDLE_MAGIC);
+
+    *rawp = z->raw;
+    *codedp = z->coded;
+    *secsp = z->secs;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
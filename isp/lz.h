@@ -0,0 +1,81 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _LZ_H
+#define _LZ_H
+
+/* lz is a small LZ77 codec (in the style of LZ4) for compressing an XML 
+ * stream in frames.  Matches may reach back into earlier frames (64K),
+ * so even a stream of small elements, each sent as soon as it is written, 
+ * compresses well.  A compressed stream begins with LZ_MAGIC, which an XML 
+ * stream cannot, so a reader can tell the two apart from the first byte.
+ * Usage:
+ *   writer: lz_create(&z)
+ *           lz_encode(z, buf, len, &frames, &flen)  - for each element
+ *   reader: lz_create(&z)
+ *           lz_feed(z, buf, len)                   - as input arrives
+ *           lz_decode(z, buf, len)                 - until it returns 0
+ * Int functions return ISP_ESUCCESS or other error code unless otherwise
+ * noted.
+ */
+
+struct lz_struct;
+typedef struct lz_struct *lz_t;
+
+#define LZ_MAGIC        ((unsigned char)0xb7)
+
+int     lz_create(lz_t *zp);
+void    lz_destroy(lz_t z);
+
+/* Compress 'len' bytes into one or more frames in a malloc'ed buffer,
+ * preceded by the stream header on the first call.
+ */
+int     lz_encode(lz_t z, void *buf, int len, char **outp, int *outlenp);
+
+/* Buffer compressed input.
+ */
+int     lz_feed(lz_t z, void *buf, int len);
+
+/* Decompress up to 'len' bytes into 'buf'.  Returns bytes decompressed,
+ * 0 if a complete frame has not been fed yet, or -1 if the input is 
+ * corrupt.  lz_pending() is true if lz_decode() has something to return
+ * (or an error).  lz_partial() is true if any input is left over, e.g. 
+ * a frame was cut short.
+ */
+int     lz_decode(lz_t z, void *buf, int len);
+int     lz_pending(lz_t z);
+int     lz_partial(lz_t z);
+
+/* Assign uncompressed and compressed bytes so far and seconds spent 
+ * coding them.  This function always succeeds.
+ */
+void    lz_stats(lz_t z, unsigned long *rawp, unsigned long *codedp,
+                 double *secsp);
+
+#endif /* _LZ_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
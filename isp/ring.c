@@ -0,0 +1,554 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Shared memory ring buffer transport (see ring.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/poll.h>
+#if HAVE_SHMRING
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "util.h"
+#include "isp.h"
+#include "ring.h"
+#include "macros.h"
+
+#if HAVE_SHMRING
+
+#define RING_MAGIC      0x72696e67
+#define RING_SHM_MAGIC  0x49535052
+#define RING_MINSIZE    (64*1024)
+#define RING_MAXSIZE    (1024*1024*1024)
+#define CACHELINE       64
+
+/* Shared state at the start of the mapping, followed by the data.
+ * head and tail count bytes written and read, so head - tail bytes are
+ * in the ring.  Each is stored only by its own side, and kept in its own
+ * cache line along with the flag that side sets when it waits.
+ */
+struct ring_shm {
+    uint32_t magic;
+    uint32_t size;              /* bytes of data (a power of two) */
+    char     pad0[CACHELINE - 8];
+    uint64_t head;              /* stored by the writer */
+    int      rwait;             /* reader waits for data */
+    int      rclosed;           /* reader has destroyed its end */
+    char     pad1[CACHELINE - 16];
+    uint64_t tail;              /* stored by the reader */
+    int      wwait;             /* writer waits for space */
+    char     pad2[CACHELINE - 12];
+};
+
+struct ring_struct {
+    int magic;
+    int writer;                 /* this is the writer's end */
+    struct ring_shm *shm;
+    char *data;
+    size_t maplen;
+    int memfd;
+    int datafd;                 /* eventfd: data was written */
+    int spacefd;                /* eventfd: data was read */
+};
+
+static void
+_ring_free(ring_t r)
+{
+    if (r->shm)
+        (void)munmap(r->shm, r->maplen);
+    if (r->memfd >= 0)
+        (void)close(r->memfd);
+    if (r->datafd >= 0)
+        (void)close(r->datafd);
+    if (r->spacefd >= 0)
+        (void)close(r->spacefd);
+    r->magic = 0;
+    free(r);
+}
+
+static ring_t
+_ring_alloc(int writer)
+{
+    ring_t r;
+
+    if (!(r = (ring_t)calloc(1, sizeof(struct ring_struct))))
+        return NULL;
+    r->magic = RING_MAGIC;
+    r->writer = writer;
+    r->memfd = r->datafd = r->spacefd = -1;
+    return r;
+}
+
+static int
+_ring_map(ring_t r)
+{
+    r->shm = mmap(NULL, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, 
+                  r->memfd, 0);
+    if (r->shm == MAP_FAILED) {
+        r->shm = NULL;
+        return ISP_ENOMEM;
+    }
+    r->data = (char *)r->shm + sizeof(struct ring_shm);
+    return ISP_ESUCCESS;
+}
+
+/* Writer: create the ring, rounding 'size' up to a power of two.
+ */
+static int
+_ring_create(unsigned long size, ring_t *rp)
+{
+    unsigned long n = RING_MINSIZE;
+    ring_t r;
+    int res = ISP_ESUCCESS;
+
+    while (n < size && n < RING_MAXSIZE)
+        n <<= 1;
+    if (!(r = _ring_alloc(1)))
+        return ISP_ENOMEM;
+    r->maplen = sizeof(struct ring_shm) + n;
+    if ((r->memfd = memfd_create("isp-ring", MFD_CLOEXEC)) < 0
+            || ftruncate(r->memfd, r->maplen) < 0) {
+        res = ISP_ENOMEM;
+        goto error;
+    }
+    if ((res = _ring_map(r)) != ISP_ESUCCESS)
+        goto error;
+    r->shm->magic = RING_SHM_MAGIC;
+    r->shm->size = n;
+    if ((r->datafd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0
+            || (r->spacefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        res = ISP_EPIPE;
+        goto error;
+    }
+    *rp = r;
+    return ISP_ESUCCESS;
+error:
+    _ring_free(r);
+    return res;
+}
+
+/* Reader: map a ring from the writer's descriptors.
+ */
+static int
+_ring_attach(int fds[3], ring_t *rp)
+{
+    struct stat sb;
+    ring_t r;
+    int res = ISP_ESUCCESS;
+
+    if (!(r = _ring_alloc(0))) {
+        (void)close(fds[0]);
+        (void)close(fds[1]);
+        (void)close(fds[2]);
+        return ISP_ENOMEM;
+    }
+    r->memfd = fds[0];
+    r->datafd = fds[1];
+    r->spacefd = fds[2];
+    if (fstat(r->memfd, &sb) < 0 || sb.st_size < sizeof(struct ring_shm)) {
+        res = ISP_EPIPE;
+        goto error;
+    }
+    r->maplen = sb.st_size;
+    if ((res = _ring_map(r)) != ISP_ESUCCESS)
+        goto error;
+    if (r->shm->magic != RING_SHM_MAGIC 
+            || r->maplen != sizeof(struct ring_shm) + r->shm->size
+            || (r->shm->size & (r->shm->size - 1)) != 0) {
+        res = ISP_EPIPE;
+        goto error;
+    }
+    *rp = r;
+    return ISP_ESUCCESS;
+error:
+    _ring_free(r);
+    return res;
+}
+
+PRIVATE int
+ring_listen(int *lfdp, char *name, int len)
+{
+    struct sockaddr_un sa;
+    socklen_t salen = sizeof(sa_family_t);
+    int fd, n;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 
+                    0)) < 0)
+        return ISP_EPIPE;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    /* bind to an unused abstract name chosen by the kernel */
+    if (bind(fd, (struct sockaddr *)&sa, salen) < 0 || listen(fd, 1) < 0)
+        goto error;
+    salen = sizeof(sa);
+    if (getsockname(fd, (struct sockaddr *)&sa, &salen) < 0)
+        goto error;
+    n = salen - offsetof(struct sockaddr_un, sun_path) - 1;
+    if (sa.sun_path[0] != '\0' || n <= 0 || n >= len || n > RING_NAMELEN)
+        goto error;
+    memcpy(name, sa.sun_path + 1, n);
+    name[n] = '\0';
+    *lfdp = fd;
+    return ISP_ESUCCESS;
+error:
+    (void)close(fd);
+    return ISP_EPIPE;
+}
+
+PRIVATE int
+ring_connect(char *name, int *sfdp)
+{
+    struct sockaddr_un sa;
+    int fd, n = strlen(name);
+
+    if (n == 0 || n > RING_NAMELEN || n + 1 > sizeof(sa.sun_path))
+        return ISP_EINVAL;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 
+                    0)) < 0)
+        return ISP_EPIPE;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    memcpy(sa.sun_path + 1, name, n);
+    if (connect(fd, (struct sockaddr *)&sa, 
+                offsetof(struct sockaddr_un, sun_path) + 1 + n) < 0) {
+        (void)close(fd);
+        return ISP_EPIPE;
+    }
+    *sfdp = fd;
+    return ISP_ESUCCESS;
+}
+
+/* Accept a connection from the reader, create the ring, and send it the 
+ * descriptors.  Connections from other users are ignored.
+ */
+PRIVATE int
+ring_accept(int lfd, unsigned long size, ring_t *rp)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    char c = 'R';
+    int fds[3];
+    ring_t r = NULL;
+    int fd, res;
+
+    if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) 
+                ? ISP_EWOULDBLOCK : ISP_EPIPE;
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0
+            || cred.uid != getuid()) {
+        (void)close(fd);
+        return ISP_EWOULDBLOCK;
+    }
+    if ((res = _ring_create(size, &r)) != ISP_ESUCCESS)
+        goto done;
+    fds[0] = r->memfd;
+    fds[1] = r->datafd;
+    fds[2] = r->spacefd;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    while ((res = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (res != 1) {
+        res = ISP_EPIPE;
+        goto done;
+    }
+    res = ISP_ESUCCESS;
+    *rp = r;
+    r = NULL;
+done:
+    if (r)
+        _ring_free(r);
+    (void)close(fd);
+    return res;
+}
+
+/* Receive the ring from the writer.  It is sent before the switch is 
+ * marked on the pipe, so once the mark is seen this need not wait long.
+ */
+PRIVATE int
+ring_recv(int sfd, ring_t *rp)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    char c;
+    int fds[3];
+    int n, flags;
+
+    flags = fcntl(sfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sfd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+        return ISP_EFCNTL;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    while ((n = recvmsg(sfd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n != 1)
+        return ISP_EPIPE;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET 
+              || cmsg->cmsg_type != SCM_RIGHTS
+              || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+        return ISP_EPIPE;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    return _ring_attach(fds, rp);
+}
+
+/* Signal the other end if it is waiting.  The fence orders the head (or
+ * tail) update before the load of its wait flag; ring_prepoll() orders 
+ * the other way, so one of the two always sees the other.
+ */
+static void
+_wake(int *waitp, int fd)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waitp, __ATOMIC_RELAXED)) {
+        __atomic_store_n(waitp, 0, __ATOMIC_RELAXED);
+        (void)write(fd, &one, sizeof(one));
+    }
+}
+
+PRIVATE void
+ring_destroy(ring_t r)
+{
+    assert(r->magic == RING_MAGIC);
+
+    if (!r->writer) {
+        __atomic_store_n(&r->shm->rclosed, 1, __ATOMIC_RELEASE);
+        _wake(&r->shm->wwait, r->spacefd);
+    }
+    _ring_free(r);
+}
+
+PRIVATE int
+ring_write(ring_t r, void *buf, int len)
+{
+    struct ring_shm *s = r->shm;
+    uint64_t head = s->head;
+    uint32_t off, n, chunk;
+
+    assert(r->magic == RING_MAGIC);
+    assert(r->writer);
+
+    if (__atomic_load_n(&s->rclosed, __ATOMIC_ACQUIRE)) {
+        errno = EPIPE;
+        return -1;
+    }
+    n = s->size - (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE));
+    if (n > len)
+        n = len;
+    if (n == 0) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    off = head & (s->size - 1);
+    chunk = s->size - off;
+    if (chunk > n)
+        chunk = n;
+    memcpy(r->data + off, buf, chunk);
+    memcpy(r->data, (char *)buf + chunk, n - chunk);
+    __atomic_store_n(&s->head, head + n, __ATOMIC_RELEASE);
+    _wake(&s->rwait, r->datafd);
+
+    return n;
+}
+
+PRIVATE int
+ring_read(ring_t r, void *buf, int len)
+{
+    struct ring_shm *s = r->shm;
+    uint64_t tail = s->tail;
+    uint32_t off, n, chunk;
+
+    assert(r->magic == RING_MAGIC);
+    assert(!r->writer);
+
+    n = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) - tail;
+    if (n > len)
+        n = len;
+    if (n == 0) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+    off = tail & (s->size - 1);
+    chunk = s->size - off;
+    if (chunk > n)
+        chunk = n;
+    memcpy(buf, r->data + off, chunk);
+    memcpy((char *)buf + chunk, r->data, n - chunk);
+    __atomic_store_n(&s->tail, tail + n, __ATOMIC_RELEASE);
+    _wake(&s->wwait, r->spacefd);
+
+    return n;
+}
+
+/* Return true if ring_write() (ring_read()) would not fail EWOULDBLOCK.
+ */
+static int
+_ready(ring_t r)
+{
+    struct ring_shm *s = r->shm;
+    uint64_t used;
+
+    used = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) 
+         - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+    if (r->writer)
+        return (used < s->size || __atomic_load_n(&s->rclosed, 
+                                                  __ATOMIC_ACQUIRE));
+    return (used > 0);
+}
+
+PRIVATE int
+ring_prepoll(ring_t r, pfd_t pfd)
+{
+    int *waitp = r->writer ? &r->shm->wwait : &r->shm->rwait;
+    int fd = r->writer ? r->spacefd : r->datafd;
+    uint64_t one = 1;
+
+    assert(r->magic == RING_MAGIC);
+
+    __atomic_store_n(waitp, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (_ready(r))      /* don't sleep through it */
+        (void)write(fd, &one, sizeof(one));
+    return util_pfd_set(pfd, fd, POLLIN);
+}
+
+PRIVATE short
+ring_postpoll(ring_t r, pfd_t pfd)
+{
+    int fd = r->writer ? r->spacefd : r->datafd;
+    uint64_t count;
+    short flags;
+
+    assert(r->magic == RING_MAGIC);
+
+    flags = util_pfd_revents(pfd, fd);
+    if ((flags & POLLIN))
+        (void)read(fd, &count, sizeof(count));
+    return flags;
+}
+
+#else /* !HAVE_SHMRING */
+
+PRIVATE int
+ring_listen(int *lfdp, char *name, int len)
+{
+    return ISP_EINVAL;
+}
+
+PRIVATE int
+ring_accept(int lfd, unsigned long size, ring_t *rp)
+{
+    return ISP_EINVAL;
+}
+
+PRIVATE int
+ring_connect(char *name, int *sfdp)
+{
+    return ISP_EINVAL;
+}
+
+PRIVATE int
+ring_recv(int sfd, ring_t *rp)
+{
+    return ISP_EINVAL;
+}
+
+PRIVATE void
+ring_destroy(ring_t r)
+{
+}
+
+PRIVATE int
+ring_write(ring_t r, void *buf, int len)
+{
+    errno = EINVAL;
+    return -1;
+}
+
+PRIVATE int
+ring_read(ring_t r, void *buf, int len)
+{
+    errno = EINVAL;
+    return -1;
+}
+
+PRIVATE int
+ring_prepoll(ring_t r, pfd_t pfd)
+{
+    return ISP_EINVAL;
+}
+
+PRIVATE short
+ring_postpoll(ring_t r, pfd_t pfd)
+{
+    return 0;
+}
+
+#endif /* HAVE_SHMRING */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
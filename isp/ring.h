@@ -0,0 +1,82 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _RING_H
+#define _RING_H
+
+/* ring provides a single-producer, single-consumer byte stream in shared
+ * memory (memfd) for an xout handle and an xin handle on the same host,
+ * so XML need not be copied through the kernel.  The two are connected
+ * by a pipe, which is kept for the rendezvous and for EOF:
+ *   writer: ring_listen(&lfd, name, len) - offer name on the pipe
+ *   reader: ring_connect(name, &sfd)     - accept the offer
+ *   writer: ring_accept(lfd, size, &r)   - ISP_EWOULDBLOCK until connected,
+ *                                          then the fds are sent to sfd
+ *           (mark the switch on the pipe, then use r in place of the pipe)
+ *   reader: ring_recv(sfd, &r)           - after the mark, use r
+ *   ...
+ *   ring_write(r, buf, len)/ring_read(r, buf, len)
+ *   ...
+ *   ring_destroy(r)  - writer then closes the pipe to signal EOF
+ * ring_write() and ring_read() never block.  Like write(2) and read(2) on 
+ * a non-blocking fd they return bytes transferred, or -1 with errno set to 
+ * EWOULDBLOCK when the ring is full (empty).  ring_write() fails with 
+ * EPIPE once the reader has destroyed its end.
+ * To wait, a polling loop should include:
+ *   ring_prepoll(r, pfd)
+ *   util_poll(pfd)
+ *   ring_postpoll(r, pfd)
+ * Wakeups are signaled with an eventfd only when the other end is waiting.
+ */
+
+struct ring_struct;
+typedef struct ring_struct *ring_t;
+
+/* Rendezvous.  Names are abstract unix domain socket names of at most 
+ * RING_NAMELEN characters.  Int functions return ISP_ESUCCESS or other 
+ * error code.  ring_listen() returns ISP_EINVAL if rings are not supported.
+ */
+#define RING_NAMELEN    32
+int     ring_listen(int *lfdp, char *name, int len);
+int     ring_accept(int lfd, unsigned long size, ring_t *rp);
+int     ring_connect(char *name, int *sfdp);
+int     ring_recv(int sfd, ring_t *rp);
+
+void    ring_destroy(ring_t r);
+
+int     ring_write(ring_t r, void *buf, int len);
+int     ring_read(ring_t r, void *buf, int len);
+
+/* Select/poll management functions.  ring_prepoll() returns ISP_ESUCCESS
+ * or other error code, and ring_postpoll() the revents of the wakeup fd.
+ */
+int     ring_prepoll(ring_t r, pfd_t pfd);
+short   ring_postpoll(ring_t r, pfd_t pfd);
+
+#endif /* _RING_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
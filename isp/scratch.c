@@ -0,0 +1,255 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Placement of temporary files (util_mktmp()).
+ *
+ * By default they go in the current working directory.  If ISP_TMPDIR
+ * names a colon-separated list of (node-local) directories, they are
+ * spread over them round-robin, in a subdirectory per pipeline (shell
+ * process group) so that ISP_TMPQUOTA can limit the bytes the pipeline
+ * keeps there.  A filter that would exceed the quota waits for filters
+ * downstream to consume (and remove) their input.  Scratch file names
+ * carry the id of the filter that created them for that purpose.
+ *
+ * ISP_SCRATCHDIR overrides both: it is set by isprun --speculate to the
+ * private directory of each coproc it starts, so that the files of a 
+ * duplicate that loses its race can be removed with the directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "util.h"
+#include "isp.h"
+#include "isp_private.h"
+#include "macros.h"
+
+#define FILE_TMPL       "/isptmpXXXXXX"
+#define FILE_PFX        "isptmp."   /* scratch files: isptmp.<fid>.XXXXXX */
+#define QUOTA_POLL      100000      /* usec between quota checks */
+#define QUOTA_WAIT      600         /* quota checks before giving up */
+#define MKDIR_RETRY     10          /* mkdir/mkstemp attempts per directory */
+
+static int      initialized = 0;
+static char   **dirs = NULL;        /* pipeline subdirectories */
+static int      ndirs = 0;
+static int      next = 0;
+static unsigned long long quota = 0;
+
+static void
+_scratch_init(void)
+{
+    char *s, *cpy, *tok, *save;
+    char *q;
+
+    initialized = 1;
+    if (!(s = getenv("ISP_TMPDIR")) || !*s || !(cpy = strdup(s)))
+        return;
+    for (tok = strtok_r(cpy, ":", &save); tok; 
+            tok = strtok_r(NULL, ":", &save)) {
+        char **ndirsp = realloc(dirs, (ndirs + 1) * sizeof(char *));
+
+        if (!ndirsp)
+            break;
+        dirs = ndirsp;
+        if (asprintf(&dirs[ndirs], "%s/isp.%d.%d", tok, (int)getuid(), 
+                    (int)getpgrp()) < 0)
+            break;
+        ndirs++;
+    }
+    free(cpy);
+    next = getpid() % (ndirs > 0 ? ndirs : 1);
+
+    if ((q = getenv("ISP_TMPQUOTA")) 
+            && util_parse_size(q, &quota) != ISP_ESUCCESS) {
+        isp_dbgfail("ISP_TMPQUOTA: invalid size: %s", q);
+        quota = 0;
+    }
+}
+
+/* Bytes held by this pipeline in its scratch directories.  Assign to 
+ * *minep the bytes in files created by this filter or filters downstream.
+ */
+static unsigned long long
+_scratch_usage(unsigned long long *minep)
+{
+    unsigned long long used = 0, mine = 0;
+    struct dirent *d;
+    struct stat sb;
+    DIR *dir;
+    int i, fid;
+
+    for (i = 0; i < ndirs; i++) {
+        if (!(dir = opendir(dirs[i])))
+            continue;
+        while ((d = readdir(dir))) {
+            if (fstatat(dirfd(dir), d->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0
+                    || !S_ISREG(sb.st_mode))
+                continue;
+            used += sb.st_size;
+            if (sscanf(d->d_name, FILE_PFX "%d.", &fid) == 1 
+                    && fid >= isp_filterid_get())
+                mine += sb.st_size;
+        }
+        (void)closedir(dir);
+    }
+    *minep = mine;
+    return used;
+}
+
+/* Wait (for a while) until the pipeline is back under its quota.
+ * Filters downstream consume files created upstream, so to keep the 
+ * pipeline moving, only a filter whose own output or that of filters 
+ * after it is still around has to wait - the last one holding files 
+ * may always go ahead.
+ */
+static void
+_scratch_wait(void)
+{
+    unsigned long long mine;
+    int n = 0;
+
+    if (quota == 0)
+        return;
+    while (_scratch_usage(&mine) >= quota && mine > 0) {
+        if (++n > QUOTA_WAIT) {
+            isp_dbgfail("util_mktmp: ISP_TMPQUOTA exceeded, continuing");
+            break;
+        }
+        (void)usleep(QUOTA_POLL);
+    }
+}
+
+/* Create a temporary file, assigning its path to the 'len' byte buffer
+ * 'path' and an open file descriptor to *fdp.
+ */
+PRIVATE int
+isp_scratch_open(char *path, int len, int *fdp)
+{
+    char *dir;
+    int fd = -1;
+    int i, n, tries;
+
+    if ((dir = getenv("ISP_SCRATCHDIR")) && *dir)
+        return isp_scratch_open_dir(dir, path, len, fdp);
+    if (!initialized)
+        _scratch_init();
+    if (ndirs == 0) {
+        if (getcwd(path, len - strlen(FILE_TMPL)) == NULL) {
+            isp_dbgfail("util_mktmp: getcwd: %m");
+            return ISP_EGETCWD;
+        }
+        strcat(path, FILE_TMPL);
+        if ((fd = mkstemp(path)) < 0) {
+            isp_dbgfail("util_mktmp: mkstemp %s: %m", path);
+            return ISP_EMKTMP;
+        }
+        *fdp = fd;
+        return ISP_ESUCCESS;
+    }
+
+    /* Try each directory in turn, starting with the next one due.
+     */
+    _scratch_wait();
+    for (i = 0; i < ndirs && fd < 0; i++) {
+        n = (next + i) % ndirs;
+        /* Another filter's isp_scratch_fini() may remove the (empty)
+         * directory between mkdir and mkstemp - if so, make it again.
+         */
+        for (tries = 0; fd < 0 && tries < MKDIR_RETRY; tries++) {
+            if (mkdir(dirs[n], 0700) < 0 && errno != EEXIST) {
+                isp_dbgfail("util_mktmp: mkdir %s: %m", dirs[n]);
+                break;
+            }
+            snprintf(path, len, "%s/" FILE_PFX "%d.XXXXXX", dirs[n],
+                    isp_filterid_get());
+            if ((fd = mkstemp(path)) < 0
+                    && (errno != ENOENT || tries + 1 == MKDIR_RETRY)) {
+                isp_dbgfail("util_mktmp: mkstemp %s: %m", path);
+                break;
+            }
+        }
+    }
+    if (fd < 0)
+        return ISP_EMKTMP;
+    next = (n + 1) % ndirs;
+    *fdp = fd;
+    return ISP_ESUCCESS;
+}
+
+/* Create a temporary file in 'dir', which the caller has chosen (e.g. a
+ * stage-out destination), instead of where util_mktmp() would put it.
+ * It is named and waits on ISP_TMPQUOTA as other scratch files do.
+ */
+PRIVATE int
+isp_scratch_open_dir(char *dir, char *path, int len, int *fdp)
+{
+    int fd;
+
+    if (!initialized)
+        _scratch_init();
+    _scratch_wait();
+    if (snprintf(path, len, "%s/" FILE_PFX "%d.XXXXXX", dir, 
+                isp_filterid_get()) >= len) {
+        isp_dbgfail("util_mktmp: %s: path too long", dir);
+        return ISP_EMKTMP;
+    }
+    if ((fd = mkstemp(path)) < 0) {
+        isp_dbgfail("util_mktmp: mkstemp %s: %m", path);
+        return ISP_EMKTMP;
+    }
+    *fdp = fd;
+    return ISP_ESUCCESS;
+}
+
+/* Remove the pipeline's scratch directories if they are empty, i.e. 
+ * the last filter out cleans up.
+ */
+PRIVATE void
+isp_scratch_fini(void)
+{
+    int i;
+
+    if (!initialized)
+        _scratch_init();
+    for (i = 0; i < ndirs; i++)
+        (void)rmdir(dirs[i]);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -41,15 +41,19 @@
 #include <unistd.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <assert.h>
 
 #include "util.h"
 #include "xml.h"
 #include "isp.h"
 #include "isp_private.h"
+#include "list.h"
 #include "macros.h"
 
 static int _unit_check(isp_unit_t u);
+static void _file_unmap(isp_unit_t u);
 
 /**
  ** Metadata functions
@@ -233,6 +237,8 @@ isp_meta_set(isp_unit_t u, char *key, isp_type_t type, ...)
         return ISP_EINVAL;
     if (!(e = xml_el_find_first(u, (xml_el_match_t)_match_live_meta, key)))
         return ISP_ENOKEY;
+    if ((res = xml_el_own(u, &e)) != ISP_ESUCCESS)
+        return res;
 
     /* FIXME: need to sink old value and source new one for provenance trail */
     va_start(ap, type);
@@ -270,6 +276,32 @@ isp_meta_get(isp_unit_t u, char *key, isp_type_t type, ...)
     return ISP_ESUCCESS;
 }
 
+/* Point *valp at the string form of a live metadata value (valid as 
+ * long as the unit is).
+ */
+PRIVATE int
+isp_meta_str_get(isp_unit_t u, char *key, char **valp)
+{
+    xml_el_t e;
+
+    if (!u || !_unit_check(u) || !key || !valp)
+        return ISP_EINVAL;
+    if (!(e = xml_el_find_first(u, (xml_el_match_t)_match_live_meta, key)))
+        return ISP_ENOKEY;
+    return xml_el_attr_val(e, "val", valp);
+}
+
+/* Convert a unit to a malloc'ed XML string (not null terminated), which
+ * can be written back out with isp_handle_write_str().
+ */
+PRIVATE int
+isp_unit_str(isp_unit_t u, char **bufp, int *sizep)
+{
+    if (!u || !_unit_check(u) || !bufp || !sizep)
+        return ISP_EINVAL;
+    return xml_el_to_str(u, bufp, sizep);
+}
+
 PUBLIC int
 isp_meta_sink(isp_unit_t u, char *key)
 {
@@ -281,6 +313,8 @@ isp_meta_sink(isp_unit_t u, char *key)
         return ISP_EINVAL;
     if (!(e = xml_el_find_first(u, (xml_el_match_t)_match_live_meta, key)))
         return ISP_ENOKEY;
+    if ((res = xml_el_own(u, &e)) != ISP_ESUCCESS)
+        return res;
 
     if ((res = xml_el_attr_setval(e, "sink", "%d", fid)) != ISP_ESUCCESS)
         return res;
@@ -291,14 +325,14 @@ isp_meta_sink(isp_unit_t u, char *key)
 }
 
 static int
-_meta_fini_one(xml_el_t e)
+_meta_fini_one(isp_unit_t u, xml_el_t e)
 {
     int res;
     int src;
 
     /* unit created before isp_init?  Ours then. */
     if ((res = xml_el_attr_scanval(e, 1, "src", "%d", &src)) == ISP_ESUCCESS)
-        if (src == NO_FID)
+        if (src == NO_FID && (res = xml_el_own(u, &e)) == ISP_ESUCCESS)
             res = xml_el_attr_setval(e, "src", "%d", isp_filterid_get());
 
     return res;
@@ -316,7 +350,7 @@ _meta_fini(isp_unit_t u)
     res = xml_el_iterator_create(u, &itr);
     while (res == ISP_ESUCCESS && (e = xml_el_next(itr)) != NULL) {
         if (_meta_check(e))
-            res = _meta_fini_one(e);
+            res = _meta_fini_one(u, e);
     }
     if (itr)
         xml_el_iterator_destroy(itr);
@@ -333,10 +367,33 @@ _file_check(xml_el_t f)
     return (!f || strcmp(xml_el_name(f), "file")) ? 0 : 1;
 }
 
+/* A file element may refer to only 'length' bytes of its path starting at
+ * 'offset', if it has those attributes.  Returns 1 if f is such a slice,
+ * with the range assigned, else 0 with the range set to the whole file.
+ */
+static int
+_file_slice(xml_el_t f, off_t *offp, off_t *lenp)
+{
+    unsigned long off, len;
+
+    if (xml_el_attr_scanval(f, 1, "offset", "%lu", &off) != ISP_ESUCCESS
+            || xml_el_attr_scanval(f, 1, "length", "%lu", &len) 
+                != ISP_ESUCCESS) {
+        *offp = 0;
+        *lenp = -1;
+        return 0;
+    }
+    *offp = off;
+    *lenp = len;
+    return 1;
+}
+
 /* Verify MD5 digest and size for file.
+ * The size is that of the whole file; the digest covers only the slice.
+ * If 'buf' is non-NULL, it holds the slice (or file) contents.
  */
 static int 
-_verify_file(xml_el_t f)
+_verify_file(xml_el_t f, void *buf, size_t buflen)
 {
     char *path; 
     char *odigest; 
@@ -344,9 +401,11 @@ _verify_file(xml_el_t f)
     int res = ISP_ESUCCESS;
     struct stat sb;
     unsigned long size;
+    off_t off, len;
 
     if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
         goto done;
+    (void)_file_slice(f, &off, &len);
 
     /* First check that the file size matches.
      */
@@ -369,7 +428,11 @@ _verify_file(xml_el_t f)
         goto done; /* the not filled in case (no error) */
 #if HAVE_OPENSSL
     if (isp_md5check_get()) {
-        if ((res = util_md5_digest(path, &digest)) != ISP_ESUCCESS)
+        if (buf)
+            res = util_md5_buf(buf, buflen, &digest);
+        else
+            res = util_md5_digest_range(path, off, len, &digest);
+        if (res != ISP_ESUCCESS)
             goto done;
         if (strcmp(digest, odigest) != 0) {
             res = ISP_ECORRUPT;
@@ -478,6 +541,165 @@ isp_rwfile_check(isp_unit_t u)
     return res;
 }
 
+/* Call 'fun' on each live read-write file in the unit.  Unlike read-only
+ * files, these may be modified or removed in place by a filter, so two 
+ * concurrent copies of a unit must not share them (see isprun --speculate).
+ */
+typedef int (*_rwfile_fun_t)(xml_el_t f, char *path, void *arg);
+
+static int
+_rwfile_foreach(isp_unit_t u, _rwfile_fun_t fun, void *arg)
+{
+    int res = ISP_ESUCCESS;
+    xml_el_iterator_t itr = NULL;
+    xml_el_t el;
+    int sink, flags;
+    char *path;
+
+    if (!u || !_unit_check(u))
+        return ISP_EINVAL;
+
+    res = xml_el_iterator_create(u, &itr);
+    while (res == ISP_ESUCCESS && (el = xml_el_next(itr)) != NULL) {
+        if (!_file_check(el))
+            continue;
+        if ((res = xml_el_attr_scanval(el, 1, "sink", "%d", &sink)) 
+                != ISP_ESUCCESS)
+            break;
+        if ((res = xml_el_attr_scanval(el, 1, "flags", "%d", &flags)) 
+                != ISP_ESUCCESS)
+            break;
+        if (sink != NO_FID || !(flags & ISP_RDWR))
+            continue;
+        if ((res = xml_el_own(u, &el)) != ISP_ESUCCESS)
+            break;
+        if ((res = xml_el_attr_val(el, "path", &path)) != ISP_ESUCCESS)
+            break;
+        res = fun(el, path, arg);
+    }
+    if (itr)
+        xml_el_iterator_destroy(itr);
+    return res;
+}
+
+static int
+_rwfile_copy(xml_el_t f, char *path, void *arg)
+{
+    char *npath;
+    int res;
+
+    if ((res = util_mktmp_copy(path, NULL, &npath)) != ISP_ESUCCESS)
+        return res;
+    res = xml_el_attr_setval(f, "path", "%s", npath);
+    if (res != ISP_ESUCCESS)
+        (void)unlink(npath);
+    free(npath);
+    return res;
+}
+
+static int
+_rwfile_move(xml_el_t f, char *path, void *arg)
+{
+    char *dir = (char *)arg;
+    char *npath;
+    int res;
+
+    if (strncmp(path, dir, strlen(dir)) != 0 || path[strlen(dir)] != '/')
+        return ISP_ESUCCESS;
+    if ((res = util_mktmp(NULL, &npath)) != ISP_ESUCCESS)
+        return res;
+    if ((res = util_move(path, npath)) != ISP_ESUCCESS) {
+        (void)unlink(npath);
+        free(npath);
+        return res;
+    }
+    res = xml_el_attr_setval(f, "path", "%s", npath);
+    free(npath);
+    return res;
+}
+
+static int
+_rwfile_unlink(xml_el_t f, char *path, void *arg)
+{
+    (void)unlink(path);  /* best effort - a filter may have removed it */
+    return ISP_ESUCCESS;
+}
+
+/* Give each live read-write file in the unit a private copy in the 
+ * current working directory.
+ */
+PRIVATE int
+isp_rwfile_copy(isp_unit_t u)
+{
+    return _rwfile_foreach(u, _rwfile_copy, NULL);
+}
+
+/* Move each live read-write file found under 'dir' to a new temporary 
+ * name in the current working directory.
+ */
+PRIVATE int
+isp_rwfile_move(isp_unit_t u, char *dir)
+{
+    if (!dir)
+        return ISP_EINVAL;
+    return _rwfile_foreach(u, _rwfile_move, dir);
+}
+
+/* Remove each live read-write file in the unit.
+ */
+PRIVATE int
+isp_rwfile_unlink(isp_unit_t u)
+{
+    return _rwfile_foreach(u, _rwfile_unlink, NULL);
+}
+
+/* Call 'fun' on each live file in the unit with the range of its path 
+ * that it refers to (see isp_file_slice_get()) and its flags.  The length 
+ * of a file that is not a slice is its recorded size.
+ */
+PRIVATE int
+isp_file_foreach(isp_unit_t u, isp_filefun_t fun, void *arg)
+{
+    int res = ISP_ESUCCESS;
+    xml_el_iterator_t itr = NULL;
+    xml_el_t el;
+    int sink, flags;
+    char *key, *path;
+    unsigned long size;
+    off_t off, len;
+
+    if (!u || !_unit_check(u) || !fun)
+        return ISP_EINVAL;
+
+    res = xml_el_iterator_create(u, &itr);
+    while (res == ISP_ESUCCESS && (el = xml_el_next(itr)) != NULL) {
+        if (!_file_check(el))
+            continue;
+        if ((res = xml_el_attr_scanval(el, 1, "sink", "%d", &sink)) 
+                != ISP_ESUCCESS)
+            break;
+        if (sink != NO_FID)
+            continue;
+        if ((res = xml_el_attr_val(el, "key", &key)) != ISP_ESUCCESS)
+            break;
+        if ((res = xml_el_attr_val(el, "path", &path)) != ISP_ESUCCESS)
+            break;
+        if ((res = xml_el_attr_scanval(el, 1, "flags", "%d", &flags)) 
+                != ISP_ESUCCESS)
+            break;
+        if (!_file_slice(el, &off, &len)) {
+            res = xml_el_attr_scanval(el, 1, "size", "%lu", &size);
+            if (res != ISP_ESUCCESS)
+                break;
+            len = size;
+        }
+        res = fun(key, path, off, len, flags, arg);
+    }
+    if (itr)
+        xml_el_iterator_destroy(itr);
+    return res;
+}
+
 /* Make a copy of path, ensuring it is fully qualified.
  * Caller must free() the result.
  */
@@ -555,7 +777,21 @@ isp_file_access(isp_unit_t u, char *key, char **pathp, int flags)
         res = ISP_ENOKEY;
         goto error;
     }
-    if ((res = _verify_file(f)) != ISP_ESUCCESS)
+    if (!(flags & ISP_RDONLY) && (res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+        goto error;
+
+    /* The path of a slice is that of the whole file, so only hand it to
+     * a reader that asked for it (and will use isp_file_slice_get()).
+     */
+    if ((flags & ISP_RDONLY) && !(flags & ISP_SLICEOK)) {
+        off_t off, len;
+
+        if (_file_slice(f, &off, &len)) {
+            res = ISP_EINVAL;
+            goto error;
+        }
+    }
+    if ((res = _verify_file(f, NULL, 0)) != ISP_ESUCCESS)
         goto error;
     if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
         goto error;
@@ -573,10 +809,13 @@ isp_file_access(isp_unit_t u, char *key, char **pathp, int flags)
         if (res != ISP_ESUCCESS)
             goto error;
         if ((fileflags & ISP_RDONLY)) {
+            off_t off, len;
+
             /* The file cannot be modified in place.
-             * Source a new file element with copy of file.
+             * Source a new file element with copy of file (or slice).
              */
-            res = util_mktmp_copy(path, NULL, &npath);
+            (void)_file_slice(f, &off, &len);
+            res = util_mktmp_copy_range(path, off, len, NULL, &npath);
             if (res != ISP_ESUCCESS)
                 goto error;
             if (stat(npath, &sb) < 0) {
@@ -645,20 +884,35 @@ isp_file_rename(isp_unit_t u, char *key, char *npath)
         res = ISP_ENOKEY;
         goto done;
     }
-    if ((res = _verify_file(f)) != ISP_ESUCCESS)
+    if ((res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _verify_file(f, NULL, 0)) != ISP_ESUCCESS)
         goto done;
     if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
         goto done;
     if ((res = xml_el_attr_scanval(f, 1, "flags", "%d", &flags)) != ISP_ESUCCESS)
         goto done;
     if ((flags & ISP_RDONLY)) {
-        if ((res = util_mkcopy(path, npath)) != ISP_ESUCCESS)
-            goto done;
+        off_t off, len;
+        char *tpath;
+
+        if (!_file_slice(f, &off, &len)) {
+            if ((res = util_mkcopy(path, npath)) != ISP_ESUCCESS)
+                goto done;
+        } else {
+            res = util_mktmp_copy_range(path, off, len, NULL, &tpath);
+            if (res != ISP_ESUCCESS)
+                goto done;
+            if ((res = util_move(tpath, npath)) != ISP_ESUCCESS) {
+                (void)unlink(tpath);
+                free(tpath);
+                goto done;
+            }
+            free(tpath);
+        }
     } else {
-        if (rename(path, npath) < 0) {
-            res = ISP_ERENAME;
+        if ((res = util_move(path, npath)) != ISP_ESUCCESS)
             goto done;
-        }
     }
     if (stat(npath, &sb) < 0) {
         res = ISP_ENOENT;
@@ -686,11 +940,75 @@ error:
     if (flags & ISP_RDONLY)
         (void)unlink(npath);
     else
-        (void)rename(npath, path);
+        (void)util_move(npath, path);
     return res;
 
 }
 
+/* Replace the reference under 'key' with one to 'npath', which the caller
+ * has filled with a copy of the file (or of just its slice), e.g. on 
+ * faster storage.  The copy is read-write and keeps the digest of the 
+ * original, and a read-write original is removed.
+ */
+PUBLIC int
+isp_file_stage(isp_unit_t u, char *key, char *npath)
+{
+    xml_el_t f, fnew = NULL;
+    char *path, *digest, *fqpath = NULL;
+    int flags;
+    int res = ISP_ESUCCESS;
+    struct stat sb;
+
+    if (!u || !_unit_check(u) || !key || !npath)
+        return ISP_EINVAL;
+
+    if (!(f = xml_el_find_first(u, (xml_el_match_t)_match_live_file, key))) {
+        res = ISP_ENOKEY;
+        goto done;
+    }
+    if ((res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_attr_val(f, "md5", &digest)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_attr_scanval(f, 1, "flags", "%d", &flags)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _qualify_path(npath, &fqpath)) != ISP_ESUCCESS)
+        goto done;
+    if (stat(fqpath, &sb) < 0) {
+        res = ISP_ENOENT;
+        goto done;
+    }
+    res = _file_create(&fnew, key, fqpath, isp_hostname_get(),
+            isp_filterid_get(), NO_FID, ISP_RDWR);
+    if (res != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_attr_setval(fnew, "size", "%lu", sb.st_size)) 
+            != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_attr_setval(fnew, "md5", "%s", digest)) != ISP_ESUCCESS)
+        goto done;
+    if ((res = _verify_file(fnew, NULL, 0)) != ISP_ESUCCESS)
+        goto done;
+    res = xml_el_attr_setval(f, "sink", "%d", isp_filterid_get());
+    if (res != ISP_ESUCCESS)
+        goto done;
+    if ((res = xml_el_push(u, fnew)) != ISP_ESUCCESS) {
+        (void)xml_el_attr_setval(f, "sink", "%d", NO_FID); /* unsink */
+        goto done;
+    }
+    fnew = NULL;
+    if (!(flags & ISP_RDONLY))
+        (void)unlink(path);  /* best effort only due to isp_unit_copy() */
+done:
+    if (fnew)
+        xml_el_destroy(fnew);
+    if (fqpath)
+        free(fqpath);
+    return res;
+}
+
 PUBLIC int
 isp_file_sink(isp_unit_t u, char *key)
 {
@@ -706,6 +1024,8 @@ isp_file_sink(isp_unit_t u, char *key)
         res = ISP_ENOKEY;
         goto done;
     }
+    if ((res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+        goto done;
     res = xml_el_attr_scanval(f, 1, "flags", "%d", &flags);
     if (res != ISP_ESUCCESS)
         goto done;
@@ -720,9 +1040,213 @@ done:
     return res;
 }
 
+/* Make the file we sourced under 'key' refer to just 'length' bytes of 
+ * its path starting at 'offset'.  A slice is read-only.
+ */
+PUBLIC int
+isp_file_slice_set(isp_unit_t u, char *key, unsigned long offset, 
+                   unsigned long length)
+{
+    xml_el_t f;
+    int src;
+    int res;
+
+    if (!u || !_unit_check(u) || !key)
+        return ISP_EINVAL;
+    if (!(f = xml_el_find_first(u, (xml_el_match_t)_match_live_file, key)))
+        return ISP_ENOKEY;
+    if ((res = xml_el_attr_scanval(f, 1, "src", "%d", &src)) != ISP_ESUCCESS)
+        return res;
+    if (src != isp_filterid_get())
+        return ISP_EINVAL;
+    if ((res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+        return res;
+    if ((res = xml_el_attr_setval(f, "flags", "%d", ISP_RDONLY)) 
+            != ISP_ESUCCESS)
+        return res;
+    if (xml_el_attr_val(f, "offset", NULL) == ISP_ESUCCESS) {
+        if ((res = xml_el_attr_setval(f, "offset", "%lu", offset)) 
+                != ISP_ESUCCESS)
+            return res;
+        res = xml_el_attr_setval(f, "length", "%lu", length);
+    } else {
+        if ((res = xml_attr_ulong_append(f, "offset", offset)) 
+                != ISP_ESUCCESS)
+            return res;
+        res = xml_attr_ulong_append(f, "length", length);
+    }
+    return res;
+}
+
+/* Get the range of its path that the file under 'key' refers to.
+ * For a file that is not a slice, that is all of it.
+ */
+PUBLIC int
+isp_file_slice_get(isp_unit_t u, char *key, unsigned long *offsetp, 
+                   unsigned long *lengthp)
+{
+    xml_el_t f;
+    off_t off, len;
+    char *path;
+    struct stat sb;
+    int res;
+
+    if (!u || !_unit_check(u) || !key || !offsetp || !lengthp)
+        return ISP_EINVAL;
+    if (!(f = xml_el_find_first(u, (xml_el_match_t)_match_live_file, key)))
+        return ISP_ENOKEY;
+    if (!_file_slice(f, &off, &len)) {
+        if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
+            return res;
+        if (stat(path, &sb) < 0)
+            return ISP_ENOENT;
+        len = sb.st_size;
+    }
+    *offsetp = off;
+    *lengthp = len;
+    return ISP_ESUCCESS;
+}
+
+/* Get the MD5 digest recorded for the file (or slice) under 'key'.
+ * The digest is the empty string if none has been computed.  
+ * The unit owns the result.
+ */
+PRIVATE int
+isp_file_md5_get(isp_unit_t u, char *key, char **digestp)
+{
+    xml_el_t f;
+
+    if (!u || !_unit_check(u) || !key || !digestp)
+        return ISP_EINVAL;
+    if (!(f = xml_el_find_first(u, (xml_el_match_t)_match_live_file, key)))
+        return ISP_ENOKEY;
+    return xml_el_attr_val(f, "md5", digestp);
+}
+
+/* Mappings made by isp_file_map(), released by isp_unit_fini() or
+ * isp_unit_destroy() of their unit.
+ */
+typedef struct {
+    isp_unit_t  u;
+    void       *addr;
+    size_t      len;
+} _map_t;
+
+static List maps = NULL;
+
+static void
+_map_destroy(_map_t *m)
+{
+    (void)munmap(m->addr, m->len);
+    free(m);
+}
+
+static int
+_map_match(_map_t *m, isp_unit_t u)
+{
+    return (m->u == u);
+}
+
+static void
+_file_unmap(isp_unit_t u)
+{
+    if (maps)
+        (void)list_delete_all(maps, (ListFindF)_map_match, u);
+}
+
+/* Map the file (or slice) under 'key' into memory, verifying it from the
+ * mapping.  With ISP_RDWR the mapping is private: changes are not written 
+ * back to the file.  The mapping lasts until the unit is finalized.
+ */
+PUBLIC int
+isp_file_map(isp_unit_t u, char *key, void **ptrp, size_t *lenp, int flags)
+{
+    static char empty[1];
+    xml_el_t f;
+    char *path;
+    off_t off, len, aoff;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    struct stat sb;
+    _map_t *m = NULL;
+    void *addr;
+    int fd = -1;
+    int res;
+
+    if (!u || !_unit_check(u) || !key || !ptrp || !lenp)
+        return ISP_EINVAL;
+    if (!(f = xml_el_find_first(u, (xml_el_match_t)_match_live_file, key)))
+        return ISP_ENOKEY;
+    if ((res = xml_el_attr_val(f, "path", &path)) != ISP_ESUCCESS)
+        return res;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return ISP_ENOENT;
+    if (fstat(fd, &sb) < 0) {
+        res = ISP_ENOENT;
+        goto done;
+    }
+    if (!_file_slice(f, &off, &len))
+        len = sb.st_size;
+    if (off + len > sb.st_size) {
+        res = ISP_ECORRUPT;
+        goto done;
+    }
+
+    /* mmap(2) won't map nothing */
+    if (len == 0) {
+        if ((res = _verify_file(f, empty, 0)) != ISP_ESUCCESS)
+            goto done;
+        *ptrp = NULL;
+        *lenp = 0;
+        goto done;
+    }
+
+    if (!maps && !(maps = list_create((ListDelF)_map_destroy))) {
+        res = ISP_ENOMEM;
+        goto done;
+    }
+    if (!(m = malloc(sizeof(_map_t)))) {
+        res = ISP_ENOMEM;
+        goto done;
+    }
+    aoff = off - off % pagesize;
+    m->u = u;
+    m->len = len + (off - aoff);
+    m->addr = mmap(NULL, m->len, (flags & ISP_RDWR) ? PROT_READ|PROT_WRITE 
+            : PROT_READ, (flags & ISP_RDWR) ? MAP_PRIVATE : MAP_SHARED, 
+            fd, aoff);
+    if (m->addr == MAP_FAILED) {
+        isp_dbgfail("mmap %s: %m", path);
+        free(m);
+        res = ISP_ENOMEM;
+        goto done;
+    }
+    addr = (char *)m->addr + (off - aoff);
+
+    /* We read the file front to back here, and presumably so does 
+     * the caller.
+     */
+    (void)madvise(m->addr, m->len, MADV_SEQUENTIAL);
+    (void)madvise(m->addr, m->len, MADV_WILLNEED);
+    if ((res = _verify_file(f, addr, len)) != ISP_ESUCCESS) {
+        _map_destroy(m);    /* the unit's other mappings stay */
+        goto done;
+    }
+    if (!list_append(maps, m)) {
+        _map_destroy(m);
+        res = ISP_ENOMEM;
+        goto done;
+    }
+
+    *ptrp = addr;
+    *lenp = len;
+done:
+    (void)close(fd);
+    return res;
+}
+
 /* helper for _file_fini() - finalize just one file */
 static int
-_file_fini_one(xml_el_t f)
+_file_fini_one(isp_unit_t u, xml_el_t f)
 {
     int res;
     int src, sink;
@@ -738,6 +1262,10 @@ _file_fini_one(xml_el_t f)
     /* unit created before isp_init?  Ours then. */
     if ((res = xml_el_attr_scanval(f, 1, "src", "%d", &src)) != ISP_ESUCCESS) 
         return res;
+    if (src == NO_FID || src == isp_filterid_get()) {
+        if ((res = xml_el_own(u, &f)) != ISP_ESUCCESS)
+            return res;
+    }
     if (src == NO_FID) {
         res = xml_el_attr_setval(f, "src", "%d", isp_filterid_get());
         if (res != ISP_ESUCCESS)
@@ -769,12 +1297,21 @@ _file_fini_one(xml_el_t f)
             return res;
     }
 
-    /* update the md5 digest - initially empty string */
+    /* update the md5 digest - initially empty string unless carried 
+     * over by isp_file_stage() */
 #if HAVE_OPENSSL
     if (isp_md5check_get()) {
         char *digest;
+        off_t off, len;
+
+        if ((res = xml_el_attr_val(f, "md5", &digest)) != ISP_ESUCCESS)
+            return res;
+        if (strlen(digest) > 0)
+            return ISP_ESUCCESS;
 
-        if ((res = util_md5_digest(path, &digest)) != ISP_ESUCCESS)
+        (void)_file_slice(f, &off, &len);
+        if ((res = util_md5_digest_range(path, off, len, &digest)) 
+                != ISP_ESUCCESS)
             return res;
         res = xml_el_attr_setval(f, "md5", "%s", digest);
         free(digest); /* xml made a copy */
@@ -798,7 +1335,7 @@ _file_fini(isp_unit_t u)
     res = xml_el_iterator_create(u, &itr);
     while (res == ISP_ESUCCESS && (el = xml_el_next(itr)) != NULL)
         if (_file_check(el))
-            res = _file_fini_one(el);
+            res = _file_fini_one(u, el);
     if (itr)
         xml_el_iterator_destroy(itr);
     return res;
@@ -914,6 +1451,8 @@ _result_fini(isp_unit_t u, int result)
 
     if (!(e = xml_el_find_first(u, (xml_el_match_t)_result_match, &fid)))
         return ISP_EELEMENT;
+    if ((res = xml_el_own(u, &e)) != ISP_ESUCCESS)
+        return res;
     if (tps < 0 || times(&p) < 0 || gettimeofday(&t, NULL) < 0)
         return ISP_ETIME;
     if ((res = xml_el_attr_scanval(e, 1, "utime", "%lu", &ut)) != ISP_ESUCCESS)
@@ -1027,6 +1566,44 @@ isp_result_get(isp_unit_t u, int fid, unsigned long *utimep,
     return ISP_ESUCCESS;
 }
 
+/* Record the result and CPU time (msec) of one stage of our work on the
+ * unit, e.g. one command of an ispexec pipeline, as a 'stage' element 
+ * inside our 'result'.  Call between isp_unit_init() and isp_unit_fini().
+ */
+PRIVATE int
+isp_result_stage_add(isp_unit_t u, int stage, unsigned long utime, 
+                     unsigned long stime, int code)
+{
+    xml_el_t r, e = NULL;
+    int res;
+
+    if (!_unit_check(u) || stage < 0)
+        return ISP_EINVAL;
+    if ((res = _result_find(u, &r, isp_filterid_get())) != ISP_ESUCCESS)
+        return res;
+    if ((res = xml_el_own(u, &r)) != ISP_ESUCCESS)
+        return res;
+
+    if ((res = xml_el_create("stage", &e)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_attr_int_append(e, "n", stage)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_attr_ulong_append(e, "utime", utime)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_attr_ulong_append(e, "stime", stime)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_attr_int_append(e, "code", code)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_el_append(r, e)) != ISP_ESUCCESS)
+        goto error;
+
+    return ISP_ESUCCESS;
+error:
+    if (e)
+        xml_el_destroy(e);
+    return res;
+}
+
 /**
  ** Unit functions
  **/
@@ -1037,12 +1614,98 @@ _unit_check(isp_unit_t u)
     return (u && strcmp(xml_el_name(u), "unit")) ? 0 : 1;
 }
 
+/* The copy shares the elements within the unit (results, metadata, and
+ * files) with the original.  Each is copied only when modified through
+ * one of the unit, meta, or file functions (see xml_el_own()), so a unit 
+ * with a long history can be copied many times cheaply.
+ */
 PUBLIC int
 isp_unit_copy(isp_unit_t *up, isp_unit_t u)
 {
     if (!u || !up || !_unit_check(u))
         return ISP_EINVAL;
-    return xml_el_copy(up, u);
+    return xml_el_share(up, u);
+}
+
+/* Copy element e (a live file or metadata) as a new one sourced by 'fid',
+ * under key 'nkey', onto u.
+ */
+static int
+_unit_merge_one(isp_unit_t u, xml_el_t e, char *nkey, int fid)
+{
+    xml_el_t enew;
+    int res;
+
+    if (xml_el_find_first(u, (xml_el_match_t)(_meta_check(e) 
+                    ? _match_live_meta : _match_live_file), nkey))
+        return ISP_EDUPKEY;
+    if ((res = xml_el_copy(&enew, e)) != ISP_ESUCCESS)
+        return res;
+    if ((res = xml_el_attr_setval(enew, "key", "%s", nkey)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_el_attr_setval(enew, "src", "%d", fid)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_el_push(u, enew)) != ISP_ESUCCESS)
+        goto error;
+    return ISP_ESUCCESS;
+error:
+    xml_el_destroy(enew);
+    return res;
+}
+
+/* Merge into u the live files and metadata that 'piece', one of the units
+ * ispunitsplit made from an original, acquired after the split, i.e. those
+ * sourced downstream of the filter that sourced metadata 'pkey'.  Each is 
+ * added under its key suffixed with "." and 'index'.  If piece is u, the 
+ * originals are also sunk (but files are not removed).
+ */
+PRIVATE int
+isp_unit_merge(isp_unit_t u, isp_unit_t piece, char *pkey, int index)
+{
+    xml_el_iterator_t itr;
+    int fid = isp_filterid_get();
+    int splitfid, src, sink;
+    char *key, *nkey;
+    xml_el_t e;
+    int res;
+
+    if (!_unit_check(u) || !_unit_check(piece) || !pkey || index < 0)
+        return ISP_EINVAL;
+    if (!(e = xml_el_find_first(piece, (xml_el_match_t)_match_live_meta, 
+                    pkey)))
+        return ISP_ENOKEY;
+    if ((res = xml_el_attr_scanval(e, 1, "src", "%d", &splitfid)) 
+            != ISP_ESUCCESS)
+        return res;
+
+    if ((res = xml_el_iterator_create(piece, &itr)) != ISP_ESUCCESS)
+        return res;
+    while (res == ISP_ESUCCESS && (e = xml_el_next(itr)) != NULL) {
+        if (!_meta_check(e) && !_file_check(e))
+            continue;
+        if ((res = xml_el_attr_scanval(e, 1, "sink", "%d", &sink)) 
+                != ISP_ESUCCESS)
+            break;
+        if ((res = xml_el_attr_scanval(e, 1, "src", "%d", &src)) 
+                != ISP_ESUCCESS)
+            break;
+        if (sink != NO_FID || src <= splitfid || src == fid)
+            continue;
+        if ((res = xml_el_attr_val(e, "key", &key)) != ISP_ESUCCESS)
+            break;
+        if (asprintf(&nkey, "%s.%d", key, index) < 0) {
+            res = ISP_ENOMEM;
+            break;
+        }
+        res = _unit_merge_one(u, e, nkey, fid);
+        free(nkey);
+        if (res == ISP_ESUCCESS && piece == u) {
+            if ((res = xml_el_own(u, &e)) == ISP_ESUCCESS)
+                res = xml_el_attr_setval(e, "sink", "%d", fid);
+        }
+    }
+    xml_el_iterator_destroy(itr);
+    return res;
 }
 
 PUBLIC int
@@ -1050,6 +1713,7 @@ isp_unit_destroy(isp_unit_t u)
 {
     if (!u || !_unit_check(u))
         return ISP_EINVAL;
+    _file_unmap(u);
     xml_el_destroy(u);
     return ISP_ESUCCESS;
 }
@@ -1077,6 +1741,7 @@ isp_unit_fini(isp_unit_t u, int result)
 
     if (!u || !_unit_check(u) || result < 0)
         return ISP_EINVAL;
+    _file_unmap(u);
     if ((res = _file_fini(u)) != ISP_ESUCCESS)
         return res;
     if ((res = _meta_fini(u)) != ISP_ESUCCESS)
@@ -1098,11 +1763,48 @@ isp_unit_read(isp_handle_t h, isp_unit_t *up)
         return res;
     if (!_unit_check(u))
         return ISP_EDOCUMENT; /* XXX leaked an element */
+    if ((res = isp_handle_credit(h)) != ISP_ESUCCESS) {
+        isp_unit_destroy(u);
+        return res;
+    }
 
     *up = u;
     return ISP_ESUCCESS;
 }
 
+/* Read a unit as isp_unit_read() does, except that if the caller has
+ * 'pending' work (e.g. units held back), return ISP_EWOULDBLOCK rather 
+ * than wait when none is available, so it can get on with that work.
+ */
+PRIVATE int
+isp_unit_read_nowait(isp_handle_t h, isp_unit_t *up, int pending)
+{
+    struct timeval tv = { 0, 0 };
+    pfd_t pfd;
+    int flags;
+    int res;
+
+    if (!pending)
+        return isp_unit_read(h, up);
+    if ((res = isp_handle_flags_get(h, &flags)) != ISP_ESUCCESS)
+        return res;
+    if ((res = isp_handle_flags_set(h, flags | ISP_NONBLOCK)) != ISP_ESUCCESS)
+        return res;
+    if ((res = isp_unit_read(h, up)) == ISP_EWOULDBLOCK) {
+        if ((res = util_pfd_create(&pfd)) == ISP_ESUCCESS) {
+            util_pfd_zero(pfd);
+            isp_handle_prepoll(h, pfd);
+            if ((res = util_poll(pfd, &tv)) == ISP_ESUCCESS)
+                isp_handle_postpoll(h, pfd);
+            util_pfd_destroy(pfd);
+        }
+        if (res == ISP_ESUCCESS)
+            res = isp_unit_read(h, up);
+    }
+    (void)isp_handle_flags_set(h, flags);
+    return res;
+}
+
 PUBLIC int
 isp_unit_write(isp_handle_t h, isp_unit_t u)
 {
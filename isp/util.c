@@ -39,6 +39,7 @@
 #include <stdarg.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -75,39 +76,61 @@ struct pfd_struct {
 #endif
 };
 
-/* Copy path to open file descriptor.
- * Returns ISP_ESUCCESS or other error code.
+/* Copy 'length' bytes of path starting at 'offset' to open file descriptor
+ * (length < 0 copies to the end of the file), 'bufsize' bytes at a time
+ * (0 for a default).  Returns ISP_ESUCCESS or other error code.
  */
-static int _copyfile(char *path, int nfd)
+PUBLIC int
+util_copyrange(char *path, off_t offset, off_t length, int nfd, 
+               size_t bufsize)
 {
-    char buf[8192];
-    int fd; 
+    char sbuf[8192];
+    char *buf = sbuf;
+    int fd = -1; 
     int res = ISP_ESUCCESS;
-    int n;
+    ssize_t n;
 
+    if (bufsize == 0)
+        bufsize = sizeof(sbuf);
+    else if (bufsize > sizeof(sbuf) && !(buf = malloc(bufsize))) {
+        res = ISP_ENOMEM;
+        goto done;
+    }
     if ((fd = open(path, O_RDONLY)) < 0) {
-        isp_dbgfail("_copyfile: open O_RDONLY %s: %m", path);
+        isp_dbgfail("util_copyrange: open O_RDONLY %s: %m", path);
+        res = ISP_ECOPY;
+        goto done;
+    }
+    if (offset > 0 && lseek(fd, offset, SEEK_SET) < 0) {
+        isp_dbgfail("util_copyrange: lseek %s: %m", path);
         res = ISP_ECOPY;
         goto done;
     }
     do {
-        if ((n = util_read(fd, buf, sizeof(buf))) < 0) {
-            isp_dbgfail("_copyfile: read %s: %m", path);
+        n = bufsize;
+        if (length >= 0 && length < n)
+            n = length;
+        if (n > 0 && (n = util_read(fd, buf, n)) < 0) {
+            isp_dbgfail("util_copyrange: read %s: %m", path);
             res = ISP_ECOPY;
             goto done;
         }
         if (n > 0 && (n = util_write(nfd, buf, n)) <= 0) {
-            isp_dbgfail("_copyfile: write: %m");
+            isp_dbgfail("util_copyrange: write: %m");
             res = ISP_ECOPY;
             goto done;
         }
+        if (length >= 0)
+            length -= n;
     } while (n > 0);
 
 done:
     if (fd >= 0 && close(fd) < 0) {
-        isp_dbgfail("_copyfile: close %s: %m", path);
+        isp_dbgfail("util_copyrange: close %s: %m", path);
         res = ISP_ECOPY;
     }
+    if (buf != sbuf)
+        free(buf);
     return res;
 }
 
@@ -125,7 +148,7 @@ util_mkcopy(char *path, char *npath)
         res = ISP_ECOPY;
         goto done;
     }
-    if ((res = _copyfile(path, nfd)) != ISP_ESUCCESS)
+    if ((res = util_copyrange(path, 0, -1, nfd, 0)) != ISP_ESUCCESS)
         goto done;
 
 done:
@@ -136,31 +159,42 @@ done:
     return res;
 }
 
-#define FILE_TMPL "/isptmpXXXXXX"
-/* Make a tmp copy of file.  If fdp is non-NULL assign open file
- * descriptor.  If path is non-NULL, assign path (caller must free).
- * Returns ESUCCESS or other error code.
+/* Move path to npath.  Unlike rename(2) this works across file systems
+ * (e.g. from node-local scratch to shared storage) by falling back to
+ * copy and unlink.
+ */
+PUBLIC int
+util_move(char *path, char *npath)
+{
+    int res;
+
+    if (rename(path, npath) == 0)
+        return ISP_ESUCCESS;
+    if (errno != EXDEV) {
+        isp_dbgfail("util_move: rename %s to %s: %m", path, npath);
+        return ISP_ERENAME;
+    }
+    if ((res = util_mkcopy(path, npath)) != ISP_ESUCCESS) {
+        (void)unlink(npath);
+        return res;
+    }
+    (void)unlink(path);
+    return ISP_ESUCCESS;
+}
+
+/* Make a tmp file (see scratch.c for where).  If fdp is non-NULL assign 
+ * open file descriptor.  If path is non-NULL, assign path (caller must 
+ * free).  Returns ESUCCESS or other error code.
  */
 PUBLIC int 
 util_mktmp(int *fdp, char **pathp)
 {
-    char buf[MAXPATHLEN+1];
-    char *path;
+    char path[MAXPATHLEN+1];
     int fd;
     int res = ISP_ESUCCESS;
 
-    path = getcwd(buf, MAXPATHLEN+1);
-    if (path == NULL)  {
-        isp_dbgfail("util_mktmp: getcwd: %m");
-        res = ISP_EGETCWD;
-        goto done;
-    }
-    strcat(path, FILE_TMPL);
-    if ((fd = mkstemp(path)) < 0) {
-        isp_dbgfail("util_mktmp: mkstemp %s: %m", path);
-        res = ISP_EMKTMP;
+    if ((res = isp_scratch_open(path, sizeof(path), &fd)) != ISP_ESUCCESS)
         goto done;
-    }
     if (pathp) {
         *pathp = strdup(path);
         if (!*pathp) {
@@ -194,6 +228,16 @@ done:
  */
 PUBLIC int 
 util_mktmp_copy(char *opath, int *fdp, char **pathp)
+{
+    return util_mktmp_copy_range(opath, 0, -1, fdp, pathp);
+}
+
+/* Like util_mktmp_copy() but copy only 'length' bytes of opath starting
+ * at 'offset' (length < 0 copies to the end of the file).
+ */
+PUBLIC int 
+util_mktmp_copy_range(char *opath, off_t offset, off_t length, 
+                      int *fdp, char **pathp)
 {
     char *path;
     int fd;
@@ -202,7 +246,7 @@ util_mktmp_copy(char *opath, int *fdp, char **pathp)
     res = util_mktmp(&fd, &path);
     if (res != ISP_ESUCCESS)
         goto done;
-    res = _copyfile(opath, fd);
+    res = util_copyrange(opath, offset, length, fd, 0);
     if (res != ISP_ESUCCESS) {
         (void)close(fd);
         (void)unlink(path);
@@ -247,56 +291,108 @@ _hexify(unsigned char *d, int len)
 
     return str;
 }
+
+/* Digest 'length' bytes read from fd (length < 0 means to eof), or if 
+ * fd < 0, the 'length' bytes at 'buf'.
+ */
+static int
+_md5(int fd, char *buf, off_t length, char **digestp)
+{
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    char rbuf[8192];
+    MD5_CTX ctx;
+    char *p;
+    int n;
+
+    MD5_Init(&ctx);
+    do {
+        n = sizeof(rbuf);
+        if (length >= 0 && length < n)
+            n = length;
+        if (fd < 0) {
+            p = buf;
+            buf += n;
+        } else {
+            p = rbuf;
+            if (n > 0)
+                n = util_read(fd, rbuf, n);
+            if (n < 0)
+                return ISP_EREAD;
+        }
+        if (n > 0)
+            MD5_Update(&ctx, p, n);
+        if (length >= 0)
+            length -= n;
+    } while (n > 0);
+
+    MD5_Final(digest, &ctx);
+
+    *digestp = _hexify(digest, MD5_DIGEST_LENGTH);
+    return (*digestp == NULL) ? ISP_ENOMEM : ISP_ESUCCESS;
+}
 #endif
 
 PUBLIC int 
 util_md5_digest(char *path, char **digestp)
+{
+    return util_md5_digest_range(path, 0, -1, digestp);
+}
+
+/* Compute the MD5 digest of 'length' bytes of path starting at 'offset'
+ * (length < 0 means to the end of the file).  Caller must free.
+ */
+PUBLIC int 
+util_md5_digest_range(char *path, off_t offset, off_t length, char **digestp)
 {
     int res = ISP_ESUCCESS;
 #if HAVE_OPENSSL
-    unsigned char digest[MD5_DIGEST_LENGTH];
-    char buf[8192];
-    MD5_CTX ctx;
-    int fd, n;
-
-    MD5_Init(&ctx);
+    int fd;
 
     if ((fd = open(path, O_RDONLY)) < 0) {
         isp_dbgfail("util_md5_digest: open %s: %m", path);
         res = ISP_ENOENT;
         goto done;
     }
-    do {
-        n = util_read(fd, buf, sizeof(buf));
-        if (n < 0) {
+    if (offset > 0 && lseek(fd, offset, SEEK_SET) < 0) {
+        isp_dbgfail("util_md5_digest: lseek %s: %m", path);
+        res = ISP_EREAD;
+        (void)close(fd);
+        goto done;
+    }
+    if ((res = _md5(fd, NULL, length, digestp)) != ISP_ESUCCESS) {
+        if (res == ISP_EREAD)
             isp_dbgfail("util_md5_digest: read %s: %m", path);
-            res = ISP_EREAD;
-            (void)close(fd);
-            goto done;
-        }
-        if (n > 0)
-            MD5_Update(&ctx, buf, n);
-    } while (n > 0);
+        (void)close(fd);
+        goto done;
+    }
     if (close(fd) < 0) {
         isp_dbgfail("util_md5_digest: close %s: %m", path);
+        free(*digestp);
         res = ISP_EREAD;
         goto done;
     }
-
-    MD5_Final(digest, &ctx);
-
-    *digestp = _hexify(digest, MD5_DIGEST_LENGTH);
 #else
-    *digestp = strdup("");
-#endif
-    if (*digestp == NULL) {
+    if ((*digestp = strdup("")) == NULL)
         res = ISP_ENOMEM;
-        goto done;
-    }
+#endif
 done:
     return res;
 }
 
+/* Compute the MD5 digest of a memory buffer as a hex string.
+ * Caller must free.  Empty string if built without OpenSSL.
+ */
+PUBLIC int 
+util_md5_buf(void *buf, size_t len, char **digestp)
+{
+#if HAVE_OPENSSL
+    return _md5(-1, (char *)buf, len, digestp);
+#else
+    *digestp = strdup("");
+    return (*digestp == NULL) ? ISP_ENOMEM : ISP_ESUCCESS;
+#endif
+}
+
 static int 
 _redirect_fd(int nfd, int ofd)
 {
@@ -322,6 +418,20 @@ _redirect_fd(int nfd, int ofd)
     return res;
 }
 
+/* Map a wait status to an ISP result code.
+ */
+static int
+_wstat_result(int s)
+{
+    if (WIFEXITED(s) && WEXITSTATUS(s) != 0)
+        return ISP_EEXITED;
+    if (WIFSIGNALED(s))
+        return ISP_ESIGNAL;
+    if (WIFSTOPPED(s))
+        return ISP_ESTOPPED;
+    return ISP_ESUCCESS;
+}
+
 PUBLIC int 
 util_runcmd(char **argv, int *wstat, int ifd, int ofd, int efd)
 {
@@ -354,12 +464,7 @@ util_runcmd(char **argv, int *wstat, int ifd, int ofd, int efd)
                 if (wstat)
                     *wstat = errno;
             } else {
-                if (WIFEXITED(s) && WEXITSTATUS(s) != 0)
-                    res = ISP_EEXITED;
-                else if (WIFSIGNALED(s))
-                    res = ISP_ESIGNAL;
-                else if (WIFSTOPPED(s))
-                    res = ISP_ESTOPPED;
+                res = _wstat_result(s);
                 if (wstat)
                     *wstat = s;
             }
@@ -369,6 +474,137 @@ util_runcmd(char **argv, int *wstat, int ifd, int ofd, int efd)
     return res;
 }
 
+/* Run argvs[0] | argvs[1] | ... | argvs[n-1] with the first command
+ * reading ifd and the last writing ofd, and efd as everyone's stderr.
+ * The result of each stage is returned in results[], and its resource
+ * usage in ru[] (either may be NULL).  Like the shell's pipefail, the
+ * return value is the result of the last stage to fail, since a stage
+ * that dies of SIGPIPE was only cut off by a later one.
+ */
+PUBLIC int
+util_runpipe(char ***argvs, int n, int *results, struct rusage *ru,
+             int ifd, int ofd, int efd)
+{
+    pid_t *pids;
+    int res = ISP_ESUCCESS;
+    int setup = ISP_ESUCCESS;
+    int rfd = ifd;  /* read end for the next stage */
+    int p[2];
+    int i, s, r;
+
+    if (!argvs || n < 1)
+        return ISP_EINVAL;
+    if (!(pids = malloc(n * sizeof(pid_t))))
+        return ISP_ENOMEM;
+
+    for (i = 0; i < n; i++) {
+        int wfd = ofd;
+
+        pids[i] = -1;
+        if (setup != ISP_ESUCCESS)
+            continue;
+        if (i < n - 1) {
+            if (pipe(p) < 0) {
+                setup = ISP_EPIPE;
+                continue;
+            }
+            wfd = p[1];
+        }
+        switch ((pids[i] = fork())) {
+            case -1:/* error */
+                setup = ISP_EFORK;
+                break;
+
+            case 0: /* child */
+                if (i < n - 1)
+                    (void)close(p[0]);
+                if (_redirect_fd(rfd, 0) != ISP_ESUCCESS)
+                    exit(1);
+                if (_redirect_fd(wfd, 1) != ISP_ESUCCESS)
+                    exit(1);
+                if (_redirect_fd(efd, 2) != ISP_ESUCCESS)
+                    exit(1);
+                if (i > 0)
+                    (void)close(rfd);
+                if (i < n - 1)
+                    (void)close(wfd);
+                (void)execvp(argvs[i][0], argvs[i]);
+                exit(1);
+                /*NOTREACHED*/
+        }
+        if (i > 0) {
+            (void)close(rfd);
+            rfd = ifd;
+        }
+        if (i < n - 1) {
+            (void)close(p[1]);
+            rfd = p[0];
+        }
+    }
+    if (rfd != ifd)     /* a stage failed to start */
+        (void)close(rfd);
+
+    /* Reap everything we started, even after a failure.
+     */
+    for (i = 0; i < n; i++) {
+        struct rusage rtmp;
+        pid_t pid;
+
+        memset(&rtmp, 0, sizeof(rtmp));
+        r = ISP_ENOTRUN;
+        if (pids[i] > 0) {
+            while ((pid = wait4(pids[i], &s, 0, &rtmp)) < 0 && errno == EINTR)
+                ;
+            r = (pid < 0) ? ISP_EWAIT : _wstat_result(s);
+        }
+        if (ru)
+            ru[i] = rtmp;
+        if (results)
+            results[i] = r;
+        if (r != ISP_ESUCCESS && pids[i] > 0)
+            res = r;
+    }
+    free(pids);
+
+    if (setup != ISP_ESUCCESS)
+        res = setup;
+
+    return res;
+}
+
+/* Open a pipe from which 'length' bytes of path starting at 'offset' can 
+ * be read, so that a program that reads its input to EOF sees only that 
+ * range.  The bytes are written by a child process whose pid is assigned 
+ * to *pidp; the caller must reap it.
+ */
+PUBLIC int
+util_openrange(char *path, off_t offset, off_t length, int *fdp, pid_t *pidp)
+{
+    int p[2];
+    pid_t pid;
+
+    if (!fdp || !pidp)
+        return ISP_EINVAL;
+    if (pipe(p) < 0)
+        return ISP_EPIPE;
+    switch ((pid = fork())) {
+        case -1:/* error */
+            (void)close(p[0]);
+            (void)close(p[1]);
+            return ISP_EFORK;
+        case 0: /* child */
+            (void)close(p[0]);
+            _exit(util_copyrange(path, offset, length, p[1], 0) == ISP_ESUCCESS
+                    ? 0 : 1);
+        default:/* parent */
+            break;
+    }
+    (void)close(p[1]);
+    *fdp = p[0];
+    *pidp = pid;
+    return ISP_ESUCCESS;
+}
+
 PUBLIC int 
 util_runcoproc(char **argv, pid_t *pidp, int *ifd, int *ofd, int *efd)
 {
@@ -586,6 +822,35 @@ done:
     return res;
 }
 
+/* Parse a size like "512M" (K, M, G, T suffixes).
+ */
+PUBLIC int
+util_parse_size(char *s, unsigned long long *sizep)
+{
+    unsigned long long n;
+    char *end;
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if (errno != 0 || end == s)
+        return ISP_EINVAL;
+    switch (*end) {
+        case 'T': case 't': n <<= 10;
+        case 'G': case 'g': n <<= 10;
+        case 'M': case 'm': n <<= 10;
+        case 'K': case 'k': n <<= 10;
+            end++;
+        case '\0':
+            break;
+        default:
+            return ISP_EINVAL;
+    }
+    if (*end != '\0')
+        return ISP_EINVAL;
+    *sizep = n;
+    return ISP_ESUCCESS;
+}
+
 PUBLIC int 
 util_read(int fd, void *p, int max)
 {
@@ -39,17 +39,31 @@
  */
 
 int     util_mkcopy(char *path, char *npath);
+int     util_move(char *path, char *npath);
+int     util_copyrange(char *path, off_t offset, off_t length, int nfd,
+                       size_t bufsize);
 int     util_mktmp(int *fdp, char **pathp);
 int     util_mktmp_copy(char *opath, int *fdp, char **pathp);
+int     util_mktmp_copy_range(char *opath, off_t offset, off_t length,
+                              int *fdp, char **pathp);
 
 int     util_md5_digest(char *path, char **digestp);
+int     util_md5_digest_range(char *path, off_t offset, off_t length,
+                              char **digestp);
+int     util_md5_buf(void *buf, size_t len, char **digestp);
 
 /* special fd values for util_runcmd() */
 #define FDCLOSE    (-1)
 #define FDIGNORE   (-2)
 
+struct rusage;
+
 int     util_runcmd(char **argv, int *wstat, int ifd, int ofd, int efd);
+int     util_runpipe(char ***argvs, int n, int *results, struct rusage *ru,
+                     int ifd, int ofd, int efd);
 int     util_runcoproc(char **argv, pid_t *pidp, int *ifd, int *ofd, int *efd);
+int     util_openrange(char *path, off_t offset, off_t length, 
+                       int *fdp, pid_t *pidp);
 
 /* Routines for manipulating null-terminated arrays of strings.
  */
@@ -60,6 +74,10 @@ int     util_argvdup(char **av, char ***avp);
 int     util_argvdupc(int ac, char **av, char ***avp);
 int     util_argstr(char **av, char **strp);
 
+/* Parse a size like "512M" (K, M, G, or T suffix) into bytes.
+ */
+int     util_parse_size(char *s, unsigned long long *sizep);
+
 /* These are wrappers around the read, write, and waitpid system
  * calls that retry on EINTR.  Return values are same as the system calls.
  */
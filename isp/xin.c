@@ -36,14 +36,22 @@
 #include <sys/poll.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
 #include "list.h"
 #include "util.h"
 #include "isp.h"
 #include "xml.h"
 #include "xin.h"
+#include "ring.h"
+#include "lz.h"
+#include "isp_private.h"
 #include "macros.h"
 
+#define XML_RING_EL "ring"  /* marks the switch to the ring (see xout.c) */
+#define XML_CREDIT_EL "credit" /* writer consumed an element (see xout.c) */
+
 #define XIN_HANDLE_MAGIC   0x22344322
 struct xin_handle_struct {
     int magic;
@@ -55,12 +63,52 @@ struct xin_handle_struct {
     XML_Parser parser;
     int end;            /* 1 when complete document has been parsed */
     int count;          /* count of complete document level els in backlog */
+    unsigned long maxbytes; /* max bytes of XML to buffer (0 = unlimited) */
+    unsigned long bytes;    /* XML bytes of the els in backlog */
+    unsigned long peak;     /* largest value of bytes */
+    List sizes;         /* XML bytes of each el in backlog, oldest first */
+    XML_Index last;     /* input offset of the end of the last complete el */
+    int suspended;      /* parser stopped at a full backlog */
+    int sfd;            /* connection to the writer's ring offer, or -1 */
+    ring_t ring;        /* shared memory ring, once switched to */
+    int ringeof;        /* writer has closed fd, so ring gets no more */
+    int checked;        /* first byte checked for compression */
+    lz_t lz;            /* decompressor, if the stream is compressed */
+    unsigned long credits; /* credit marks received */
 };
 
 static int _set_nonblock(int fd, int nonblockflag);
+static void _ring_connect(xin_handle_t h, const char **attr);
+static void _ring_switch(xin_handle_t h, xml_el_t el);
+static int _read(xin_handle_t h, void *buf, int len);
+static void _parse_input(xin_handle_t h);
+
+/* Return true if the backlog is at either limit.
+ */
+static int
+_full(xin_handle_t h)
+{
+    if (h->maxbacklog != 0 && h->count >= h->maxbacklog)
+        return 1;
+    if (h->maxbytes != 0 && h->bytes >= h->maxbytes)
+        return 1;
+    return 0;
+}
 
-/* XXX: more than h->maxbacklog elements will be buffered if they
- * are ready and fit in one XML_BUFSIZE.
+/* Input offset of the end of the current parser event.
+ */
+static XML_Index
+_offset(xin_handle_t h)
+{
+    return XML_GetCurrentByteIndex(h->parser) 
+         + XML_GetCurrentByteCount(h->parser);
+}
+
+/* When the backlog fills in the middle of a read buffer, the parser is 
+ * suspended and the rest of the buffer is parsed as elements are read, so
+ * at most h->maxbacklog elements (and h->maxbytes bytes plus one element)
+ * are buffered, besides the unparsed input.  Partially parsed elements 
+ * are not counted towards h->maxbytes.
  */
 #ifndef PIPE_BUF
 #define XML_BUFSIZE 4096
@@ -103,6 +151,8 @@ _parse_start(void *data, const char *name, const char **attr)
     if (h->current == NULL) {
         assert(h->document == NULL);
         h->document = new;
+        h->last = _offset(h);
+        _ring_connect(h, attr);
     /* If we are opening a level below <document>, append it to the current
      * element.
      */
@@ -123,6 +173,7 @@ static void
 _parse_end(void *data, const char *name)
 {
     xin_handle_t h = (xin_handle_t)data;
+    xml_el_t el = h->current;
 
     assert(h->magic == XIN_HANDLE_MAGIC);
     assert(h->current != NULL);
@@ -141,8 +192,58 @@ _parse_end(void *data, const char *name)
      * then we have a complete element that will satisfy a read request, 
      * so increment h->count.
      */
-    else if (h->current == h->document)
+    else if (h->current == h->document && h->sfd >= 0 
+                                        && !strcmp(name, XML_RING_EL)) {
+        _ring_switch(h, el);
+    } else if (h->current == h->document && !strcmp(name, XML_CREDIT_EL)) {
+        (void)xml_el_remove(h->document, el);
+        xml_el_destroy(el);
+        h->last = _offset(h);
+        h->credits++;
+    } else if (h->current == h->document) {
+        unsigned long *size = malloc(sizeof(unsigned long));
+        XML_Index end = _offset(h);
+
+        if (!size || !list_enqueue(h->sizes, size)) {
+            free(size);
+            h->errnum = ISP_ENOMEM;
+            return;
+        }
+        *size = end - h->last;
+        h->last = end;
+        h->bytes += *size;
+        if (h->bytes > h->peak)
+            h->peak = h->bytes;
         h->count++;
+        if (_full(h))
+            (void)XML_StopParser(h->parser, XML_TRUE);
+    }
+}
+
+/* Parse more of a suspended read buffer if there is room in the backlog.
+ * The buffer may be the last one (h->errnum == ISP_EEOF).
+ */
+static void
+_resume(xin_handle_t h)
+{
+    if (_full(h))
+        return;
+    if (h->suspended && (h->errnum == ISP_ESUCCESS || h->errnum == ISP_EEOF)) {
+        switch (XML_ResumeParser(h->parser)) {
+            case XML_STATUS_ERROR:
+                h->errnum = ISP_EPARSE;
+                break;
+            case XML_STATUS_OK:
+                h->suspended = 0;
+                break;
+            default:    /* XML_STATUS_SUSPENDED */
+                break;
+        }
+    }
+    /* input already decompressed won't make fd readable */
+    if (!h->suspended && !_full(h) && h->errnum == ISP_ESUCCESS 
+            && h->lz && lz_pending(h->lz))
+        _parse_input(h);
 }
 
 PRIVATE int
@@ -155,9 +256,16 @@ xin_read_el(xin_handle_t h, xml_el_t *elp)
 
     if (h->count > 0) {
         assert(h->document != NULL);
+        unsigned long *size;
+
         el = xml_el_pop(h->document);
         assert(el != NULL);
         h->count--;
+        size = list_dequeue(h->sizes);
+        assert(size != NULL);
+        h->bytes -= *size;
+        free(size);
+        _resume(h);
     } else {
         if (h->errnum != ISP_ESUCCESS)
             res = h->errnum;
@@ -184,6 +292,36 @@ xin_get_backlog(xin_handle_t h)
     return h->count;
 }
 
+PRIVATE unsigned long
+xin_get_backlog_bytes(xin_handle_t h, unsigned long *peakp)
+{
+    assert(h->magic == XIN_HANDLE_MAGIC);
+
+    if (peakp)
+        *peakp = h->peak;
+    return h->bytes;
+}
+
+PRIVATE unsigned long
+xin_get_credits(xin_handle_t h)
+{
+    assert(h->magic == XIN_HANDLE_MAGIC);
+
+    return h->credits;
+}
+
+PRIVATE int
+xin_get_compress_stats(xin_handle_t h, unsigned long *rawp, 
+                       unsigned long *codedp, double *secsp)
+{
+    assert(h->magic == XIN_HANDLE_MAGIC);
+
+    if (!h->lz)
+        return 0;
+    lz_stats(h->lz, rawp, codedp, secsp);
+    return 1;
+}
+
 PRIVATE int
 xin_handle_create(int fd, int maxbacklog, xin_handle_t *hp)
 {
@@ -194,10 +332,16 @@ xin_handle_create(int fd, int maxbacklog, xin_handle_t *hp)
 
     h->magic = XIN_HANDLE_MAGIC;
     h->fd = fd;
+    h->sfd = -1;
     h->errnum = ISP_ESUCCESS;
     h->maxbacklog = maxbacklog;
+    if (!(h->sizes = list_create((ListDelF)free))) {
+        free(h);
+        return ISP_ENOMEM;
+    }
     h->parser = XML_ParserCreate(NULL);
     if (h->parser == NULL) {
+        list_destroy(h->sizes);
         free(h);
         return ISP_ENOMEM;
     }
@@ -205,6 +349,7 @@ xin_handle_create(int fd, int maxbacklog, xin_handle_t *hp)
     XML_SetUserData(h->parser, h);
     if (_set_nonblock(h->fd, 1) != ISP_ESUCCESS) {
         XML_ParserFree(h->parser);
+        list_destroy(h->sizes);
         free(h);
         return ISP_EFCNTL;
     }
@@ -224,6 +369,15 @@ xin_backlog_set(xin_handle_t h, int backlog)
     return ISP_ESUCCESS;
 }
 
+PRIVATE int
+xin_backlog_bytes_set(xin_handle_t h, unsigned long maxbytes)
+{
+    assert(h->magic == XIN_HANDLE_MAGIC);
+    h->maxbytes = maxbytes;
+
+    return ISP_ESUCCESS;
+}
+
 PRIVATE int
 xin_handle_destroy(xin_handle_t h)
 {
@@ -231,11 +385,18 @@ xin_handle_destroy(xin_handle_t h)
 
     assert(h->magic == XIN_HANDLE_MAGIC);
 
+    if (h->ring)
+        ring_destroy(h->ring);
+    if (h->sfd >= 0)
+        (void)close(h->sfd);
+    if (h->lz)
+        lz_destroy(h->lz);
     if (close(h->fd) < 0)
         res = ISP_EREAD;
     XML_ParserFree(h->parser);
     if (h->document)
         xml_el_destroy(h->document);
+    list_destroy(h->sizes);
     h->magic = 0;
     free(h);
 
@@ -248,12 +409,15 @@ xin_preparse(xin_handle_t h)
     int res = ISP_ESUCCESS;
     pfd_t pfd;
     int savemaxbacklog;
+    unsigned long savemaxbytes;
 
     assert(h->magic == XIN_HANDLE_MAGIC);
 
     if ((res = util_pfd_create(&pfd)) == ISP_ESUCCESS) {
         savemaxbacklog = h->maxbacklog;
+        savemaxbytes = h->maxbytes;
         h->maxbacklog = 0; /* unlimited for this function call */
+        h->maxbytes = 0;
         while (h->errnum == ISP_ESUCCESS) {
             util_pfd_zero(pfd);
             xin_prepoll(h, pfd);
@@ -262,6 +426,7 @@ xin_preparse(xin_handle_t h)
             xin_postpoll(h, pfd);
         }
         h->maxbacklog = savemaxbacklog;
+        h->maxbytes = savemaxbytes;
         util_pfd_destroy(pfd);
     }
 
@@ -273,44 +438,175 @@ xin_prepoll(xin_handle_t h, pfd_t pfd)
 {
     assert(h->magic == XIN_HANDLE_MAGIC);
 
-    if (h->errnum == ISP_ESUCCESS && 
-            (h->maxbacklog == 0 || h->count < h->maxbacklog))
-        h->errnum = util_pfd_set(pfd, h->fd, POLLIN);
+    if (h->errnum == ISP_ESUCCESS && !h->suspended && !_full(h)) {
+        /* with a ring, fd is still polled for EOF */
+        if (h->ring)
+            h->errnum = ring_prepoll(h->ring, pfd);
+        if (h->errnum == ISP_ESUCCESS)
+            h->errnum = util_pfd_set(pfd, h->fd, POLLIN);
+    }
 }
 
 PRIVATE void
 xin_postpoll(xin_handle_t h, pfd_t pfd)
 {
     short flags; 
-    int r;
 
     assert(h->magic == XIN_HANDLE_MAGIC);
 
-    if (h->errnum == ISP_ESUCCESS && 
-            (h->maxbacklog == 0 || h->count < h->maxbacklog)) {
+    if (h->errnum == ISP_ESUCCESS && !h->suspended && !_full(h)) {
         flags = util_pfd_revents(pfd, h->fd); 
+        if (h->ring)
+            flags |= ring_postpoll(h->ring, pfd);
         if ((flags & POLLERR) || (flags & POLLNVAL))
             h->errnum = ISP_EPOLL;
-        else if ((flags & POLLIN) || (flags & POLLHUP)) {
-            do {
-                void *buf = XML_GetBuffer(h->parser, XML_BUFSIZE);
-                
-                r = util_read(h->fd, buf, XML_BUFSIZE);
-                if (r < 0 && errno == EWOULDBLOCK)
-                    break;
-                if (r < 0) {
-                    h->errnum = ISP_EREAD;
-                    break;
-                }
-                if (r == 0)
-                    h->errnum = ISP_EEOF;
-                if (!XML_ParseBuffer(h->parser, r, (h->errnum == ISP_EEOF))) {
-                    h->errnum = ISP_EPARSE;
-                    break;
-                }
-            } while (r > 0 && (h->maxbacklog == 0 || h->count < h->maxbacklog));
+        else if ((flags & POLLIN) || (flags & POLLHUP))
+            _parse_input(h);
+    }
+}
+
+/* Read and parse input until it would block, or the backlog fills.
+ */
+static void
+_parse_input(xin_handle_t h)
+{
+    int r;
+
+    do {
+        void *buf = XML_GetBuffer(h->parser, XML_BUFSIZE);
+        
+        r = _read(h, buf, XML_BUFSIZE);
+        if (r < 0 && errno == EWOULDBLOCK)
+            break;
+        if (r < 0) {
+            h->errnum = ISP_EREAD;
+            break;
+        }
+        if (r == 0)
+            h->errnum = ISP_EEOF;
+        switch (XML_ParseBuffer(h->parser, r, (h->errnum == ISP_EEOF))) {
+            case XML_STATUS_ERROR:
+                h->errnum = ISP_EPARSE;
+                break;
+            case XML_STATUS_SUSPENDED:
+                h->suspended = 1;
+                break;
+            default:
+                break;
+        }
+    } while (r > 0 && h->errnum == ISP_ESUCCESS && !h->suspended 
+            && !_full(h));
+}
+
+/* Take up the writer's ring offer from the <document> attributes if this
+ * fd is the very pipe it was made on (see xout.c).  The ring itself is 
+ * received when the switch is marked in the stream.  Failure just leaves 
+ * the data on the pipe.
+ */
+static void
+_ring_connect(xin_handle_t h, const char **attr)
+{
+    char *name = NULL, *host = NULL;
+    unsigned long ino = 0;
+    struct stat sb;
+    const char **pp;
+
+    for (pp = attr; *pp; pp += 2) {
+        if (!strcmp(pp[0], "ring"))
+            name = (char *)pp[1];
+        else if (!strcmp(pp[0], "host"))
+            host = (char *)pp[1];
+        else if (!strcmp(pp[0], "ringpipe"))
+            ino = strtoul(pp[1], NULL, 10);
+    }
+    if (!name || !host || isp_ringsize_get() == 0)
+        return;
+    if (strcmp(host, isp_hostname_get()) != 0)
+        return;
+    if (fstat(h->fd, &sb) < 0 || !S_ISFIFO(sb.st_mode) || sb.st_ino != ino)
+        return;
+    (void)ring_connect(name, &h->sfd);
+}
+
+/* The ring element marks the end of data on the pipe.  Drop it from the 
+ * document and receive the ring, which the writer sent before the mark.
+ */
+static void
+_ring_switch(xin_handle_t h, xml_el_t el)
+{
+    (void)xml_el_remove(h->document, el);
+    xml_el_destroy(el);
+    h->last = _offset(h);
+    if (ring_recv(h->sfd, &h->ring) != ISP_ESUCCESS)
+        h->errnum = ISP_EREAD;
+    (void)close(h->sfd);
+    h->sfd = -1;
+}
+
+/* Read from the ring once switched to it, otherwise from fd.  After the 
+ * switch, fd only reaches EOF when the writer is done, so once the ring 
+ * is empty, EOF on fd is EOF of the stream.
+ */
+static int
+_read_raw(xin_handle_t h, void *buf, int len)
+{
+    char c;
+    int n;
+
+    if (!h->ring)
+        return util_read(h->fd, buf, len);
+    if ((n = ring_read(h->ring, buf, len)) >= 0 || h->ringeof) 
+        return (n < 0 && errno == EWOULDBLOCK) ? 0 : n;
+    if ((n = util_read(h->fd, &c, 1)) == 0) {
+        h->ringeof = 1;
+        n = ring_read(h->ring, buf, len);
+        return (n < 0 && errno == EWOULDBLOCK) ? 0 : n;
+    }
+    if (n > 0) {                /* nothing may follow the mark */
+        errno = EPROTO;
+        n = -1;
+    }
+    return n;
+}
+
+/* Read the stream, decompressing it if it begins with LZ_MAGIC (see 
+ * xout.c).  Compressed input is consumed from fd ahead of the parser, so 
+ * _resume() parses what is left once the backlog drains.
+ */
+static int
+_read(xin_handle_t h, void *buf, int len)
+{
+    char raw[XML_BUFSIZE];
+    int n;
+
+    if (!h->lz) {
+        if ((n = _read_raw(h, buf, len)) <= 0 || h->checked)
+            return n;
+        h->checked = 1;
+        if (*(unsigned char *)buf != LZ_MAGIC)
+            return n;
+        if (lz_create(&h->lz) != ISP_ESUCCESS 
+                || lz_feed(h->lz, buf, n) != ISP_ESUCCESS) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    while ((n = lz_decode(h->lz, buf, len)) == 0) {
+        if ((n = _read_raw(h, raw, sizeof(raw))) <= 0) {
+            if (n == 0 && lz_partial(h->lz)) {
+                errno = EPROTO;
+                n = -1;
+            }
+            return n;
+        }
+        if (lz_feed(h->lz, raw, n) != ISP_ESUCCESS) {
+            errno = ENOMEM;
+            return -1;
         }
     }
+    if (n < 0)
+        errno = EPROTO;
+    return n;
 }
 
 static int
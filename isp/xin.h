@@ -71,6 +71,12 @@ int     xin_handle_create(int fd, int maxbacklog, xin_handle_t *h);
 
 int     xin_backlog_set(xin_handle_t h, int backlog);
 
+/* Also stop reading when the buffered elements add up to maxbytes of XML
+ * (with the same ~4K slack).  Elements still being parsed don't count.
+ * maxbytes may be XIN_BACKLOG_UNLIMITED (the default).
+ */
+int     xin_backlog_bytes_set(xin_handle_t h, unsigned long maxbytes);
+
 /* Destroy XML input handle.  Closes fd.  Any unread data is discarded.
  */
 int     xin_handle_destroy(xin_handle_t h);
@@ -89,6 +95,23 @@ int     xin_read_el(xin_handle_t h, xml_el_t *el);
  */
 int     xin_get_backlog(xin_handle_t h);
 
+/* Return the number of bytes of XML in the backlog, and if peakp is
+ * non-NULL, assign the most there has been.  This function always succedes.
+ */
+unsigned long xin_get_backlog_bytes(xin_handle_t h, unsigned long *peakp);
+
+/* Return the number of credit marks (see xout_write_credit()) parsed so 
+ * far.  They are not returned as elements.  This function always succedes.
+ */
+unsigned long xin_get_credits(xin_handle_t h);
+
+/* If the stream is compressed (see xout.h), assign compressed and 
+ * uncompressed bytes so far and seconds spent decompressing, and return 1,
+ * otherwise return 0.  Compression is detected from the first byte read.
+ */
+int     xin_get_compress_stats(xin_handle_t h, unsigned long *rawp,
+                        unsigned long *codedp, double *secsp);
+
 /* Preparse input, buffering entire document using blocking I/O.
  * The elements can then be read with xin_read_el() until ISP_EEOF as usual.
  */
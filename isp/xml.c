@@ -51,6 +51,7 @@ struct xml_el_struct {
     List attrs;     /* list of attributes for this element */
     List els;       /* list of elements defined within this element */
     struct xml_el_struct *parent;
+    int refs;       /* number of elements this one is within (min 1) */
 };
 
 #define XML_ATTR_MAGIC 0x43434343
@@ -81,6 +82,7 @@ xml_el_create(const char *name, xml_el_t *elp)
     if (!(new = (xml_el_t)calloc(1, size)))
         goto nomem;
     new->magic = XML_EL_MAGIC;
+    new->refs = 1;
     if (!(new->name = strdup(name)))
         goto nomem;
     if (!(new->attrs = list_create((ListDelF)xml_attr_destroy)))
@@ -162,13 +164,108 @@ error:
     return res;
 }
 
+/* helper for xml_el_destroy */
+static int
+_orphan(xml_el_t e, xml_el_t parent)
+{
+    if (e->refs > 1 && e->parent == parent)
+        e->parent = NULL;
+    return 0;
+}
+
+/* Copy an element and its attributes, but share the elements within it 
+ * with the original rather than copying them.  A shared element must not 
+ * be modified in place: use xml_el_own() to get a private copy first.
+ */
+PRIVATE int
+xml_el_share(xml_el_t *elp, xml_el_t el)
+{
+    xml_el_iterator_t ei;
+    xml_el_t new, elem;
+    int res;
+
+    assert(el != NULL);
+    assert(el->magic == XML_EL_MAGIC);
+
+    if ((res = xml_el_create(el->name, &new)) != ISP_ESUCCESS)
+        return res;
+    if ((res = _copy_attributes(new, el)) != ISP_ESUCCESS)
+        goto error;
+    if ((res = xml_el_iterator_create(el, &ei)) != ISP_ESUCCESS)
+        goto error;
+    while ((elem = xml_el_next(ei))) {
+        if (list_append(new->els, elem) == NULL) {
+            res = ISP_ENOMEM;
+            break;
+        }
+        elem->refs++;
+    }
+    xml_el_iterator_destroy(ei);
+    if (res != ISP_ESUCCESS)
+        goto error;
+
+    if (elp)
+        *elp = new;
+    return res;
+error:
+    xml_el_destroy(new);
+    return res;
+}
+
+/* If *el2p (within el) is shared, replace it in el with a private copy
+ * (see xml_el_share()) and return that in *el2p.
+ */
+PRIVATE int
+xml_el_own(xml_el_t el, xml_el_t *el2p)
+{
+    ListIterator itr;
+    xml_el_t e, new;
+    int res;
+
+    assert(el != NULL);
+    assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);
+    assert(el2p != NULL && *el2p != NULL);
+    assert((*el2p)->magic == XML_EL_MAGIC);
+
+    if ((*el2p)->refs == 1)
+        return ISP_ESUCCESS;
+    if ((res = xml_el_share(&new, *el2p)) != ISP_ESUCCESS)
+        return res;
+    if (!(itr = list_iterator_create(el->els))) {
+        xml_el_destroy(new);
+        return ISP_ENOMEM;
+    }
+    while ((e = list_next(itr)) && e != *el2p)
+        ;
+    if (!e)
+        res = ISP_ENOKEY;
+    else if (!list_insert(itr, new))    /* before e */
+        res = ISP_ENOMEM;
+    else {
+        (void)list_remove(itr);         /* e */
+        new->parent = el;
+        xml_el_destroy(e);              /* drop our reference */
+        *el2p = new;
+    }
+    list_iterator_destroy(itr);
+    if (res != ISP_ESUCCESS)
+        xml_el_destroy(new);
+    return res;
+}
+
 PRIVATE void
 xml_el_destroy(xml_el_t el) 
 {
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs > 0);
+    if (--el->refs > 0)
+        return;
     el->magic = 0;
 
+    if (el->els)  /* shared elements that survive us must not point back */
+        (void)list_for_each(el->els, (ListForF)_orphan, el);
     if (el->name)
         free(el->name);
     if (el->attrs)
@@ -194,8 +291,6 @@ xml_attr_create(char *name, xml_attr_t *attrp, char *fmt, ...)
         if (vasprintf(&new->value, fmt, ap) < 0)
             goto nomem;
         va_end(ap);
-        /* FIXME: need to escape embedded quotes */
-        assert(strchr(new->value, '"') == NULL); 
     }
 
     if (attrp)
@@ -341,6 +436,7 @@ xml_el_attr_setval(xml_el_t el, char *name, char *fmt, ...)
 
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
 
     attr = list_find_first(el->attrs, (ListFindF)_match_attr_name, name);
     if (attr) {
@@ -363,6 +459,7 @@ xml_attr_append(xml_el_t el, xml_attr_t attr)
 
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
     assert(attr != NULL);
     assert(attr->magic == XML_ATTR_MAGIC);
 
@@ -379,6 +476,7 @@ xml_el_append(xml_el_t el, xml_el_t el2)
 
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
     assert(el2 != NULL);
     assert(el2->magic == XML_EL_MAGIC);
 
@@ -397,6 +495,7 @@ xml_el_push(xml_el_t el, xml_el_t el2)
 
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
     assert(el2 != NULL);
     assert(el2->magic == XML_EL_MAGIC);
 
@@ -415,6 +514,7 @@ xml_el_pop(xml_el_t el)
 
     assert(el != NULL);
     assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
 
     e = list_pop(el->els);
     if (e)
@@ -494,6 +594,31 @@ xml_el_find_first(xml_el_t el, xml_el_match_t fun, void *key)
     return (xml_el_t)list_find_first(el->els, (ListFindF)fun, key);
 }
 
+/* Unlink el2 from the elements within el, without destroying it.
+ */
+PRIVATE int
+xml_el_remove(xml_el_t el, xml_el_t el2)
+{
+    ListIterator itr;
+    xml_el_t e;
+
+    assert(el != NULL);
+    assert(el->magic == XML_EL_MAGIC);
+    assert(el->refs == 1);          /* not shared */
+
+    if (!(itr = list_iterator_create(el->els)))
+        return ISP_ENOMEM;
+    while ((e = list_next(itr)) && e != el2)
+        ;
+    if (e) {
+        list_remove(itr);
+        e->parent = NULL;
+    }
+    list_iterator_destroy(itr);
+
+    return e ? ISP_ESUCCESS : ISP_ENOKEY;
+}
+
 PRIVATE int
 xml_el_count(xml_el_t el)
 {
@@ -537,7 +662,8 @@ done:
     return res;
 }
 
-/* helper for xml_el_to_str */
+/* helper for xml_el_to_str - elements within el may be shared (so
+ * their parent is ambiguous), but el itself is not */
 static int
 _indent(xml_el_t el)
 {
@@ -547,6 +673,44 @@ _indent(xml_el_t el)
     return 0;
 }
 
+/* helper for xml_el_to_str */
+static int
+_put_attr_val(char **bufp, int *sizep, char *val)
+{
+    const char *special = "&<>\"\t\n\r";
+    int res = ISP_ESUCCESS;
+    int n;
+
+    /* Escape markup, and whitespace that the parser would normalize.
+     */
+    while (res == ISP_ESUCCESS && *val) {
+        if ((n = strcspn(val, special)) > 0) {
+            res = _printf(bufp, sizep, "%.*s", n, val);
+            val += n;
+            continue;
+        }
+        switch (*val) {
+            case '&':
+                res = _printf(bufp, sizep, "&amp;");
+                break;
+            case '<':
+                res = _printf(bufp, sizep, "&lt;");
+                break;
+            case '>':
+                res = _printf(bufp, sizep, "&gt;");
+                break;
+            case '"':
+                res = _printf(bufp, sizep, "&quot;");
+                break;
+            default: /* whitespace */
+                res = _printf(bufp, sizep, "&#%d;", *val);
+                break;
+        }
+        val++;
+    }
+    return res;
+}
+
 /* helper for xml_el_to_str */
 static int
 _put_el_attrs(char **bufp, int *sizep, xml_el_t el)
@@ -559,7 +723,11 @@ _put_el_attrs(char **bufp, int *sizep, xml_el_t el)
     if (res != ISP_ESUCCESS)
         goto done;
     while ((attr = xml_attr_next(itr))) {
-        res = _printf(bufp, sizep, " %s=\"%s\"", attr->name, attr->value);
+        res = _printf(bufp, sizep, " %s=\"", attr->name);
+        if (res == ISP_ESUCCESS)
+            res = _put_attr_val(bufp, sizep, attr->value);
+        if (res == ISP_ESUCCESS)
+            res = _printf(bufp, sizep, "\"");
         if (res != ISP_ESUCCESS)
             goto done;
     }
@@ -571,12 +739,12 @@ done:
 
 /* helper for xml_el_to_str */
 static int
-_put_el(char **bufp, int *sizep, xml_el_t el)
+_put_el(char **bufp, int *sizep, xml_el_t el, int indent)
 {
     int res = ISP_ESUCCESS;
 
     if (list_is_empty(el->els)) {
-        res = _printf(bufp, sizep, "%*s<%s", _indent(el), "", el->name);
+        res = _printf(bufp, sizep, "%*s<%s", indent, "", el->name);
         if (res != ISP_ESUCCESS)
             goto done;
         res = _put_el_attrs(bufp, sizep, el);
@@ -589,7 +757,7 @@ _put_el(char **bufp, int *sizep, xml_el_t el)
         xml_el_iterator_t i;
         xml_el_t e;
 
-        res = _printf(bufp, sizep, "%*s<%s", _indent(el), "", el->name);
+        res = _printf(bufp, sizep, "%*s<%s", indent, "", el->name);
         if (res != ISP_ESUCCESS)
             goto done;
         res = _put_el_attrs(bufp, sizep, el);
@@ -603,12 +771,12 @@ _put_el(char **bufp, int *sizep, xml_el_t el)
         if (res != ISP_ESUCCESS)
             goto done;
         while (res == ISP_ESUCCESS && (e = xml_el_next(i)) != NULL)
-            res = _put_el(bufp, sizep, e); /* RECURSE */
+            res = _put_el(bufp, sizep, e, indent + 2); /* RECURSE */
         xml_el_iterator_destroy(i);
 
         if (res == ISP_ESUCCESS) {
             if ((res = _printf(bufp, sizep, "%*s</%s>\n", 
-                            _indent(el), "", el->name)) != ISP_ESUCCESS)
+                            indent, "", el->name)) != ISP_ESUCCESS)
                 goto done;
         }
     }
@@ -625,7 +793,7 @@ xml_el_to_str(xml_el_t el, char **bufp, int *sizep)
 
     assert(el != NULL);
 
-    if ((res = _put_el(&buf, &size, el)) == ISP_ESUCCESS) {
+    if ((res = _put_el(&buf, &size, el, _indent(el))) == ISP_ESUCCESS) {
         *bufp = buf;
         *sizep = size;
     } else if (size > 0) {
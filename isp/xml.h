@@ -52,6 +52,12 @@ int         xml_el_create(const char *name, xml_el_t *elp);
 void        xml_el_destroy(xml_el_t el);
 int         xml_el_copy(xml_el_t *elp, xml_el_t el);
 
+/* Copy-on-write: copy an element but share the elements within it, and
+ * replace a shared element within el with a private copy before changing it.
+ */
+int         xml_el_share(xml_el_t *elp, xml_el_t el);
+int         xml_el_own(xml_el_t el, xml_el_t *el2p);
+
 /* Create/destroy an attribute.
  */
 int         xml_attr_create(char *name, xml_attr_t *ap, char *fmt, ...);
@@ -86,6 +92,7 @@ int         xml_el_append(xml_el_t el, xml_el_t el2); /* to tail */
 int         xml_el_push(xml_el_t el, xml_el_t el2);   /* to head */
 xml_el_t    xml_el_pop(xml_el_t el);                 /* from head */
 xml_el_t    xml_el_peek(xml_el_t el);                /* from head */
+int         xml_el_remove(xml_el_t el, xml_el_t el2); /* unlink el2 */
 int         xml_el_count(xml_el_t el);
 
 xml_el_t    xml_el_parent_get(xml_el_t el);
@@ -36,15 +36,24 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/poll.h>
+#include <sys/stat.h>
 
 #include "list.h"
 #include "util.h"
 #include "isp.h"
 #include "xml.h"
 #include "xout.h"
+#include "ring.h"
+#include "lz.h"
+#include "isp_private.h"
 #include "macros.h"
 
-#define XML_OPEN  "<?xml version=\"1.0\" standalone=\"yes\"?>\n<document>\n"
+#define XML_OPEN  "<?xml version=\"1.0\" standalone=\"yes\"?>\n" \
+                  "<document host=\"%s\">\n"
+#define XML_OPEN_RING "<?xml version=\"1.0\" standalone=\"yes\"?>\n" \
+                  "<document host=\"%s\" ring=\"%s\" ringpipe=\"%lu\">\n"
+#define XML_RING  "<ring/>\n"
+#define XML_CREDIT "<credit/>\n"
 #define XML_CLOSE "</document>\n"
 
 #define XOUT_BUFFER_MAGIC   0x12344322
@@ -53,6 +62,7 @@ struct buffer_struct {
     char *buf;      /* string (not null terminated) */
     int size;       /* size of string */
     int written;    /* amount of data written to fd */
+    int ring;       /* switch to the ring once this is written */
 };
 typedef struct buffer_struct *buffer_t;
 
@@ -65,12 +75,27 @@ struct xout_handle_struct {
     int errnum;     /* deferred i/o error */
     List backlog;   /* queue of buffer_t's pending I/O */
     int maxbacklog; /* maximum queue depth (element count), 0=unlimited */
+    unsigned long maxbytes; /* maximum bytes queued, 0=unlimited */
+    unsigned long bytes;    /* bytes queued (including partly written) */
+    unsigned long peak;     /* largest value of bytes */
     state_t state;  /* handle state */
+    int lfd;        /* socket offering a ring to the reader, -1 if none */
+    char ringname[RING_NAMELEN + 1];
+    unsigned long ringpipe; /* inode of the pipe the offer is valid for */
+    unsigned long ringsize;
+    unsigned long piped;    /* bytes written to fd */
+    unsigned long offerlimit; /* withdraw the offer after this many */
+    ring_t ring;    /* shared memory ring */
+    int ringon;     /* data is going to the ring, fd only carries EOF */
+    lz_t lz;        /* compressor, if the stream is compressed */
 };
 
 static int _set_nonblock(int fd, int nonblockflag);
+static int _write(xout_handle_t h, xml_el_t el, char *str, int len);
 static int _flush(xout_handle_t h, int noewouldblock);
 static int _wait_for_io(xout_handle_t h);
+static void _ring_offer(xout_handle_t h);
+static int _ring_accept(xout_handle_t h, int withdraw);
 
 static void _buffer_destroy(buffer_t b)
 {
@@ -100,13 +125,54 @@ xout_get_backlog(xout_handle_t h)
     return list_count(h->backlog);
 }
 
+PRIVATE unsigned long
+xout_get_backlog_bytes(xout_handle_t h, unsigned long *peakp)
+{
+    assert(h->magic == XOUT_HANDLE_MAGIC);
+
+    if (peakp)
+        *peakp = h->peak;
+    return h->bytes;
+}
+
+/* Get the XML string of el, or a copy of str if el is NULL.
+ */
+static int
+_el_str(xml_el_t el, char *str, int len, char **bufp, int *sizep)
+{
+    if (el)
+        return xml_el_to_str(el, bufp, sizep);
+    if (!(*bufp = malloc(len)))
+        return ISP_ENOMEM;
+    memcpy(*bufp, str, len);
+    *sizep = len;
+    return ISP_ESUCCESS;
+}
+
 PRIVATE int
 xout_write_el(xout_handle_t h, xml_el_t el)
+{
+    return _write(h, el, NULL, 0);
+}
+
+PRIVATE int
+xout_write_str(xout_handle_t h, char *buf, int len)
+{
+    if (!buf || len < 0)
+        return ISP_EINVAL;
+    return _write(h, NULL, buf, len);
+}
+
+/* Queue el, or if el is NULL, the string str, or if that is NULL too, 
+ * the end of the document.
+ */
+static int
+_write(xout_handle_t h, xml_el_t el, char *str, int len)
 {
     int res = ISP_ESUCCESS;
     buffer_t b = NULL;
     char *buf; 
-    int size;
+    int size, n;
 
     assert(h->magic == XOUT_HANDLE_MAGIC);
 
@@ -117,31 +183,45 @@ xout_write_el(xout_handle_t h, xml_el_t el)
         res = ISP_EWOULDBLOCK;
         goto error;
     }
+    /* An element larger than maxbytes is accepted into an empty backlog.
+     */
+    if (h->maxbytes > XOUT_BACKLOG_UNLIMITED && h->bytes >= h->maxbytes) {
+        res = ISP_EWOULDBLOCK;
+        goto error;
+    }
     if ((b = _buffer_create()) == NULL) {
         res = ISP_ENOMEM;
         goto error;
     }
     switch (h->state) {
         case VIRGIN:
-            /* prepend XML open to element string */
-            if ((b->buf = malloc(strlen(XML_OPEN))) == NULL) {
+            /* prepend XML open (with any ring offer) to element string */
+            if (h->lfd >= 0)
+                n = asprintf(&b->buf, XML_OPEN_RING, isp_hostname_get(),
+                             h->ringname, h->ringpipe);
+            else
+                n = asprintf(&b->buf, XML_OPEN, isp_hostname_get());
+            if (n < 0) {
+                b->buf = NULL;
                 res = ISP_ENOMEM;
                 goto error;
             }
-            b->size = strlen(XML_OPEN);
-            memcpy(b->buf, XML_OPEN, b->size);
-            if ((res = xml_el_to_str(el, &buf, &size)) != ISP_ESUCCESS)
+            b->size = n;
+            if ((res = _el_str(el, str, len, &buf, &size)) != ISP_ESUCCESS)
                 goto error;
             if ((b->buf = realloc(b->buf, b->size + size)) == NULL) {
                 res = ISP_ENOMEM;
                 goto error;
             }
             memcpy(b->buf + b->size, buf, size);
+            free(buf);
             b->size += size;
             h->state = DOCOPEN;
             break;
         case DOCOPEN:
-            if (el == NULL) {   /* NULL signifies end of file */
+            if ((res = _ring_accept(h, !el && !str)) != ISP_ESUCCESS)
+                goto error;
+            if (!el && !str) {  /* NULL signifies end of file */
                 if ((b->buf = malloc(strlen(XML_CLOSE))) == NULL) {
                     res = ISP_ENOMEM;
                     goto error;
@@ -151,7 +231,8 @@ xout_write_el(xout_handle_t h, xml_el_t el)
                 h->state = DOCCLOSED;
                 break;
             } else {            /* just write the element string */
-                if ((res = xml_el_to_str(el, &b->buf, &b->size)) != ISP_ESUCCESS)
+                if ((res = _el_str(el, str, len, &b->buf, &b->size)) 
+                        != ISP_ESUCCESS)
                     goto error;
             } 
             break;
@@ -160,9 +241,23 @@ xout_write_el(xout_handle_t h, xml_el_t el)
             goto error;
             break;
     }
-    list_enqueue(h->backlog, b);
-    if ((res = _flush(h, 1)) != ISP_ESUCCESS)
+    if (h->lz) {
+        if ((res = lz_encode(h->lz, b->buf, b->size, &buf, &size)) 
+                != ISP_ESUCCESS)
+            goto error;
+        free(b->buf);
+        b->buf = buf;
+        b->size = size;
+    }
+    if (!list_enqueue(h->backlog, b)) {
+        res = ISP_ENOMEM;
         goto error;
+    }
+    h->bytes += b->size;
+    if (h->bytes > h->peak)
+        h->peak = h->bytes;
+    if ((res = _flush(h, 1)) != ISP_ESUCCESS)
+        return res;
 
     return res;
 error:
@@ -171,6 +266,51 @@ error:
     return res;
 }
 
+/* Queue a credit mark (see xin.c).  It is tiny and says the reader may
+ * send more, so it is queued even when the backlog is full.
+ */
+PRIVATE int
+xout_write_credit(xout_handle_t h)
+{
+    int res = ISP_ESUCCESS;
+    buffer_t b = NULL;
+    char *buf;
+    int size;
+
+    assert(h->magic == XOUT_HANDLE_MAGIC);
+
+    if (h->errnum != ISP_ESUCCESS)
+        return h->errnum;
+    if (h->state != DOCOPEN)
+        return ISP_EINVAL;
+    if ((res = _ring_accept(h, 0)) != ISP_ESUCCESS)
+        return res;
+    if ((b = _buffer_create()) == NULL)
+        return ISP_ENOMEM;
+    if ((res = _el_str(NULL, XML_CREDIT, strlen(XML_CREDIT), &b->buf, 
+                    &b->size)) != ISP_ESUCCESS)
+        goto error;
+    if (h->lz) {
+        if ((res = lz_encode(h->lz, b->buf, b->size, &buf, &size)) 
+                != ISP_ESUCCESS)
+            goto error;
+        free(b->buf);
+        b->buf = buf;
+        b->size = size;
+    }
+    if (!list_enqueue(h->backlog, b)) {
+        res = ISP_ENOMEM;
+        goto error;
+    }
+    h->bytes += b->size;
+    if (h->bytes > h->peak)
+        h->peak = h->bytes;
+    return _flush(h, 1);
+error:
+    _buffer_destroy(b);
+    return res;
+}
+
 PRIVATE int
 xout_handle_create(int fd, int maxbacklog, xout_handle_t *hp)
 {
@@ -191,11 +331,13 @@ xout_handle_create(int fd, int maxbacklog, xout_handle_t *hp)
     h->maxbacklog = maxbacklog;
     h->backlog = list_create((ListDelF)_buffer_destroy);
     h->state = VIRGIN;
+    h->lfd = -1;
     if (!h->backlog) {
         res = ISP_ENOMEM;
         goto error;
     }
     res = _set_nonblock(h->fd, 1);
+    _ring_offer(h);
 
     if (hp)
         *hp = h;
@@ -216,6 +358,58 @@ xout_backlog_set(xout_handle_t h, int backlog)
     return ISP_ESUCCESS;
 }
 
+PRIVATE int
+xout_backlog_bytes_set(xout_handle_t h, unsigned long maxbytes)
+{
+    assert(h->magic == XOUT_HANDLE_MAGIC);
+    h->maxbytes = maxbytes;
+
+    return ISP_ESUCCESS;
+}
+
+
+/* Compression can only be turned on before the first write, and not
+ * for a regular file, which may be read back with other tools.
+ */
+PRIVATE int
+xout_compress_set(xout_handle_t h, int on)
+{
+    struct stat sb;
+    int res;
+
+    assert(h->magic == XOUT_HANDLE_MAGIC);
+
+    if (h->state != VIRGIN)
+        return ISP_EINVAL;
+    if (!on) {
+        if (h->lz) {
+            lz_destroy(h->lz);
+            h->lz = NULL;
+        }
+        return ISP_ESUCCESS;
+    }
+    if (fstat(h->fd, &sb) < 0 || S_ISREG(sb.st_mode))
+        return ISP_EINVAL;
+    if (!h->lz && (res = lz_create(&h->lz)) != ISP_ESUCCESS)
+        return res;
+    if (h->lfd >= 0) {          /* a ring is only offered on one host */
+        (void)close(h->lfd);
+        h->lfd = -1;
+    }
+    return ISP_ESUCCESS;
+}
+
+PRIVATE int
+xout_get_compress_stats(xout_handle_t h, unsigned long *rawp, 
+                        unsigned long *codedp, double *secsp)
+{
+    assert(h->magic == XOUT_HANDLE_MAGIC);
+
+    if (!h->lz)
+        return 0;
+    lz_stats(h->lz, rawp, codedp, secsp);
+    return 1;
+}
 
 PRIVATE int
 xout_handle_destroy(xout_handle_t h)
@@ -246,6 +440,12 @@ xout_handle_destroy(xout_handle_t h)
     }
 
 done:
+    if (h->ring)
+        ring_destroy(h->ring);
+    if (h->lfd >= 0)
+        (void)close(h->lfd);
+    if (h->lz)
+        lz_destroy(h->lz);
     if (h->backlog)
         list_destroy(h->backlog);
     h->magic = 0;
@@ -258,9 +458,14 @@ xout_prepoll(xout_handle_t h, pfd_t pfd)
 {
     assert(h->magic == XOUT_HANDLE_MAGIC);
 
-    if (h->errnum == ISP_ESUCCESS)
-        if (list_count(h->backlog) > 0)
+    if (h->errnum == ISP_ESUCCESS && list_count(h->backlog) > 0) {
+        if (h->ringon) {
+            /* fd still reports POLLERR if the reader goes away */
+            if ((h->errnum = ring_prepoll(h->ring, pfd)) == ISP_ESUCCESS)
+                h->errnum = util_pfd_set(pfd, h->fd, 0);
+        } else
             h->errnum = util_pfd_set(pfd, h->fd, POLLOUT); /* defer error */
+    }
 }
 
 PRIVATE void
@@ -272,6 +477,8 @@ xout_postpoll(xout_handle_t h, pfd_t pfd)
 
     if (h->errnum == ISP_ESUCCESS) {
         flags = util_pfd_revents(pfd, h->fd); 
+        if (h->ringon && (ring_postpoll(h->ring, pfd) & POLLIN))
+            flags |= POLLOUT;
         if ((flags & POLLHUP) || (flags & POLLERR) || (flags & POLLNVAL))
             h->errnum = ISP_EPOLL;      /* defer error */
         else if ((flags & POLLOUT))
@@ -298,13 +505,22 @@ _flush(xout_handle_t h, int noewouldblock)
     }
     while ((b = list_next(itr))) {
         while (b->written < b->size) {
-            n = write(h->fd, b->buf + b->written, b->size - b->written);
+            if (h->ringon)
+                n = ring_write(h->ring, b->buf + b->written, 
+                               b->size - b->written);
+            else
+                n = write(h->fd, b->buf + b->written, b->size - b->written);
             if (n < 0) {
                 res = (errno == EWOULDBLOCK) ? ISP_EWOULDBLOCK : ISP_EWRITE;
                 goto done;
             }
             b->written += n;
+            if (!h->ringon)
+                h->piped += n;
         }
+        if (b->ring)
+            h->ringon = 1;
+        h->bytes -= b->size;
         n = list_delete(itr);
         assert(n == 1);
     }
@@ -315,6 +531,69 @@ done:
     return res;
 }
 
+/* Offer the reader a shared memory ring (see ring.h) if ISP_RING is set
+ * and fd is a pipe.  The offer is made in the <document> tag, and only a
+ * reader on the same host whose input is this very pipe takes it up, 
+ * so anything relaying the stream (dd, tee, ispworkerd) keeps it.
+ */
+static void
+_ring_offer(xout_handle_t h)
+{
+    struct stat sb;
+    int size;
+
+    if ((h->ringsize = isp_ringsize_get()) == 0)
+        return;
+    if (fstat(h->fd, &sb) < 0 || !S_ISFIFO(sb.st_mode))
+        return;
+    if (ring_listen(&h->lfd, h->ringname, sizeof(h->ringname)) 
+            != ISP_ESUCCESS)
+        return;
+    h->ringpipe = sb.st_ino;
+    /* the reader has parsed <document> once it has read more than 
+     * one pipe full past it */
+    if ((size = fcntl(h->fd, F_GETPIPE_SZ)) <= 0)
+        size = 65536;
+    h->offerlimit = 2 * size;
+}
+
+/* Before each element is queued, check whether the reader has connected.
+ * If so, send it the ring and queue the mark after which data goes there.
+ * Withdraw the offer at end of document, or once it is clearly declined.
+ */
+static int
+_ring_accept(xout_handle_t h, int withdraw)
+{
+    buffer_t b;
+    int res;
+
+    if (h->lfd < 0)
+        return ISP_ESUCCESS;
+    res = withdraw ? ISP_EWOULDBLOCK 
+                   : ring_accept(h->lfd, h->ringsize, &h->ring);
+    if (res == ISP_EWOULDBLOCK && !withdraw && h->piped < h->offerlimit)
+        return ISP_ESUCCESS;
+    (void)close(h->lfd);
+    h->lfd = -1;
+    if (res != ISP_ESUCCESS)    /* stay on the pipe */
+        return ISP_ESUCCESS;
+
+    if ((b = _buffer_create()) == NULL)
+        return ISP_ENOMEM;
+    if ((b->buf = strdup(XML_RING)) == NULL) {
+        _buffer_destroy(b);
+        return ISP_ENOMEM;
+    }
+    b->size = strlen(XML_RING);
+    b->ring = 1;
+    if (!list_enqueue(h->backlog, b)) {
+        _buffer_destroy(b);
+        return ISP_ENOMEM;
+    }
+    h->bytes += b->size;
+    return ISP_ESUCCESS;
+}
+
 static int
 _wait_for_io(xout_handle_t h)
 {
@@ -80,6 +80,24 @@ int     xout_handle_create(int fd, int maxbacklog, xout_handle_t *hp);
 
 int     xout_backlog_set(xout_handle_t h, int backlog);
 
+/* Also fail writes with ISP_EWOULDBLOCK while maxbytes of XML are buffered.
+ * A single element larger than maxbytes is accepted when the backlog is
+ * empty.  maxbytes may be XOUT_BACKLOG_UNLIMITED (the default).
+ */
+int     xout_backlog_bytes_set(xout_handle_t h, unsigned long maxbytes);
+
+/* Compress the stream (see lz.h) if 'on', which must be set before the
+ * first write.  Returns ISP_EINVAL if it is too late or fd is a regular 
+ * file.  A compressed stream is never offered a ring.
+ */
+int     xout_compress_set(xout_handle_t h, int on);
+
+/* If the stream is compressed, assign uncompressed and compressed bytes 
+ * so far and seconds spent compressing, and return 1, otherwise return 0.
+ */
+int     xout_get_compress_stats(xout_handle_t h, unsigned long *rawp,
+                        unsigned long *codedp, double *secsp);
+
 /* Destroy an xout handle. fd is closed and any backlogged I/O is flushed
  * synchronously.  If this call should not block, ensure that
  * xout_get_backlog() returns zero first.
@@ -96,11 +114,27 @@ int     xout_handle_destroy(xout_handle_t h);
  */
 int     xout_write_el(xout_handle_t h, xml_el_t el);
 
+/* Write an element that is already XML, 'len' bytes at 'buf' (copied).
+ * Return values are as for xout_write_el().
+ */
+int     xout_write_str(xout_handle_t h, char *buf, int len);
+
+/* Write a credit mark, telling the reader that an element was consumed
+ * (see xin_get_credits()).  The backlog limits do not apply, and the 
+ * document must already be open.
+ */
+int     xout_write_credit(xout_handle_t h);
+
 /* Return the number of elements in the backlog.
  * This function always succedes.
  */
 int     xout_get_backlog(xout_handle_t h);
 
+/* Return the number of bytes of XML in the backlog, and if peakp is
+ * non-NULL, assign the most there has been.  This function always succedes.
+ */
+unsigned long xout_get_backlog_bytes(xout_handle_t h, unsigned long *peakp);
+
 /* Select/Poll maangement functions.
  * Any errors are deferred to xout_write_*() or xout_handle_destroy().
  */
@@ -0,0 +1,70 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Map plugin for ispfuse tests: lines = number of lines in file.
+ * The file is mapped privately and scribbled on, which must not change it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <isp/isp.h>
+
+static struct isp_stab_struct stab[] = {
+    { .name = "file", .type = ISP_FILE, .flags = ISP_REQUIRES },
+    { .name = "lines", .type = ISP_UINT64, .flags = ISP_PROVIDES },
+    { .name = NULL },
+};
+
+static int
+countlines(isp_unit_t u, void *arg)
+{
+    uint64_t lines = 0;
+    size_t len, i;
+    char *p;
+    int res;
+
+    res = isp_file_map(u, "file", (void **)&p, &len, ISP_RDWR);
+    if (res != ISP_ESUCCESS)
+        goto done;
+    for (i = 0; i < len; i++) {
+        if (p[i] == '\n') {
+            p[i] = '\0';
+            lines++;
+        }
+    }
+    res = isp_meta_source(u, "lines", ISP_UINT64, lines);
+done:
+    return res;
+}
+
+struct isp_plugin_struct isp_plugin = {
+    .version = ISP_PLUGIN_VER,
+    .stab = stab,
+    .mapfun = countlines,
+};
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
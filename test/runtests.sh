@@ -31,6 +31,31 @@ runtest "isprename doesn't copy read-write files"        test3.sh
 runtest "run 10 files thru a pipeline"                   test4.sh 10
 runtest "run 10 files thru a direct || pipeline"         test5.sh 10 --direct
 runtest "run 10 files thru a slurm || pipeline"          test5.sh 10 --srun
+runtest "run 10 files thru an adaptive || pipeline"      test5.sh 10 --fanout=auto:1:4
+runtest "run 10 files thru a batched || pipeline"        test5.sh 10 --batch=3
+runtest "run 10 files thru a tapered || pipeline"        test5.sh 10 --batch=4 --taper
+runtest "run 10 files thru a pinned || pipeline"         test5.sh 10 --pin=numa
+runtest "run 10 files thru ispworkerd daemons"           test11.sh 10
+runtest "re-run a straggler with --speculate"            test12.sh 10 --speculate
+runtest "skip recomputation with the memo cache"         test13.sh 10
+runtest "fuse two map plugins into one process"          test14.sh 10
+runtest "run a per-unit pipeline inside ispexec"         test15.sh 10
+runtest "ispcat -r walks a tree with several threads"    test16.sh 20
+runtest "bind symbols with the live symbol table"        test17.sh 5
+runtest "record the environment compactly"               test18.sh
+runtest "skip the isprun probe with cached descriptions" test19.sh 5
+runtest "split units that share a long history"          test20.sh 3 100
+runtest "join split units, spilling to disk"             test21.sh 5 4
+runtest "process slices of one file in parallel"         test22.sh 100000
+runtest "count lines through file mappings"              test23.sh 50000
+runtest "prefetch files ahead of the next stage"         test24.sh 20
+runtest "scratch files in ISP_TMPDIR with a quota"       test25.sh 10
+runtest "stage files in to scratch and out again"        test26.sh 10
+runtest "src|sink 100000 XML elements (4K byte backlog)" test27.sh 100000 10 4096
+runtest "isprun output flow control (4K byte budget)"    test28.sh 3000 100 4096
+runtest "units over shared memory rings (64K)"           test29.sh 20000 64K
+runtest "compressed units relayed in pieces (bs=10)"     test30.sh 5000 10
+runtest "units saved and replayed (64K blocks)"          test31.sh 5000 64K
 runtest "catch file corruption with ISP_MD5CHECK=1"      test6.sh 1
 runtest "ignore file corruption with ISP_MD5CHECK=0"     test6.sh 0
 runtest "src|dd|sink 1000 XML elements (bs=10)"          test7.sh 1000 100 10
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 
 #include <isp/util.h>
 #include <isp/xml.h>
@@ -32,6 +33,8 @@ _wait_for_io(xin_handle_t h)
     return res;
 }
 
+static unsigned long maxbacklog = 0;
+
 static int 
 _read_el_blocking(xin_handle_t xin, xml_el_t *el)
 {
@@ -43,6 +46,14 @@ _read_el_blocking(xin_handle_t xin, xml_el_t *el)
             break;
         count++;
     }
+    /* xin should never buffer more than its backlog, however much it
+     * read at once.
+     */
+    if (maxbacklog > 0 && xin_get_backlog(xin) > maxbacklog) {
+        fprintf(stderr, "sinkxml: %d elements buffered (backlog %lu)\n",
+                xin_get_backlog(xin), maxbacklog);
+        exit(1);
+    }
     /* detect excessive spinning here.  We could have taken many trips through
      * _wait_for_io to read just one element, but we shouldn't have taken more
      * trips than the element has characters...
@@ -110,19 +121,27 @@ main(int argc, char *argv[])
     xml_el_t el;
     unsigned long i = 0;
     unsigned long backlog, nelements, nattrs, sleepsec = 0;
+    unsigned long maxbytes = 0, peak;
+    char *p;
 
     if (argc != 4 && argc != 5) {
-        fprintf(stderr, "Usage: sinkxml backlog nelements nattrs [sleepsec]\n");
+        fprintf(stderr, 
+            "Usage: sinkxml backlog[:bytes] nelements nattrs [sleepsec]\n");
         exit(1);
     }
-    backlog = strtoul(argv[1], NULL, 10);
+    backlog = strtoul(argv[1], &p, 10);
+    if (*p == ':')
+        maxbytes = strtoul(p + 1, NULL, 10);
     nelements = strtoul(argv[2], NULL, 10);
     nattrs = strtoul(argv[3], NULL, 10);
     if (argc == 5)
         sleepsec = strtoul(argv[4], NULL, 10);
 
+    maxbacklog = backlog;
     if ((res = xin_handle_create(0, backlog, &xin)) != ISP_ESUCCESS)
         _errx("xin_handle_create", res);
+    if ((res = xin_backlog_bytes_set(xin, maxbytes)) != ISP_ESUCCESS)
+        _errx("xin_backlog_bytes_set", res);
 
     /* A delay here should cause write buffer upstream to fill up.
      */
@@ -140,6 +159,15 @@ main(int argc, char *argv[])
             _errx("xin_read_el", res);
     }
 
+    /* The byte limit may be exceeded by one element.
+     */
+    (void)xin_get_backlog_bytes(xin, &peak);
+    if (maxbytes > 0 && peak > maxbytes + PIPE_BUF) {
+        fprintf(stderr, "sinkxml: buffered %lu bytes (limit %lu)\n", 
+                peak, maxbytes);
+        exit(1);
+    }
+
     if ((res = xin_handle_destroy(xin)) != ISP_ESUCCESS)
         _errx("xin_handle_destroy", res);
 
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <limits.h>
 
 #include <isp/util.h>
 #include <isp/xml.h>
@@ -103,12 +104,17 @@ main(int argc, char *argv[])
     int res;
     unsigned long i;
     unsigned long nelements, nattrs, backlog, sleepsec = 0;
+    unsigned long maxbytes = 0, peak;
+    char *p;
 
     if (argc != 4 && argc != 5) {
-        fprintf(stderr, "Usage: srcxml backlog nelements nattrs [sleepsec]\n");
+        fprintf(stderr, 
+            "Usage: srcxml backlog[:bytes] nelements nattrs [sleepsec]\n");
         exit(1);
     }
-    backlog = strtoul(argv[1], NULL, 10);
+    backlog = strtoul(argv[1], &p, 10);
+    if (*p == ':')
+        maxbytes = strtoul(p + 1, NULL, 10);
     nelements = strtoul(argv[2], NULL, 10);
     nattrs = strtoul(argv[3], NULL, 10);
     if (argc == 5)
@@ -116,6 +122,8 @@ main(int argc, char *argv[])
 
     if ((res = xout_handle_create(1, backlog, &xout)) != ISP_ESUCCESS)
         _errx("xout_handle_create", res);
+    if ((res = xout_backlog_bytes_set(xout, maxbytes)) != ISP_ESUCCESS)
+        _errx("xout_backlog_bytes_set", res);
 
     for (i = 0; i < nelements; i++)
         _src_element(xout, i, nattrs);
@@ -123,6 +131,15 @@ main(int argc, char *argv[])
     if ((res = _write_el_blocking(xout, NULL)) != ISP_ESUCCESS)
         _errx("xout_write_el", res);
 
+    /* The byte limit may be exceeded by one element (and the header).
+     */
+    (void)xout_get_backlog_bytes(xout, &peak);
+    if (maxbytes > 0 && peak > maxbytes + PIPE_BUF) {
+        fprintf(stderr, "srcxml: buffered %lu bytes (limit %lu)\n", 
+                peak, maxbytes);
+        exit(1);
+    }
+
     /* After writing <document>, downstream will quit.
      * Give that time to happen then destroy the handle.  If anything
      * further gets written by xout_handle_destroy, we will see a SIGPIPE.
@@ -0,0 +1,45 @@
+#!/bin/bash -x
+
+n=$1
+
+i=0
+while test $i -lt $n; do
+	filename=`printf "%-4.4d.txt" $i`
+	cp /etc/passwd $filename
+	i=`expr $i + 1`
+done
+
+ispworkerd --credits=2 ./w1.sock -- ispexec sort &
+w1=$!
+ispworkerd --credits=3 ./w2.sock -- ispexec sort &
+w2=$!
+trap "kill $w1 $w2" 0
+
+i=0
+while ! test -S w1.sock -a -S w2.sock; do
+	test $i -lt 50 || exit 1
+	sleep 0.1
+	i=`expr $i + 1`
+done
+
+find . -name \*.txt | ispcat \
+	     | isprun --workers=./w1.sock,./w2.sock,./w2.sock -- ispexec sort \
+	     | isprename >out.xml || exit 1
+
+test `grep '<unit>' out.xml | wc -l` -eq $n || exit 1
+
+# a worker that holds back every unit until EOF still gets them all,
+# since credit is returned as units are read, not written
+ispworkerd --credits=2 ./w3.sock -- ispbarrier &
+w3=$!
+trap "kill $w1 $w2 $w3" 0
+i=0
+while ! test -S w3.sock; do
+	test $i -lt 50 || exit 1
+	sleep 0.1
+	i=`expr $i + 1`
+done
+ispunit -n $n | isprun --workers=./w3.sock -- ispbarrier >out.xml || exit 1
+test `grep '<unit>' out.xml | wc -l` -eq $n || exit 1
+
+exit 0
@@ -0,0 +1,45 @@
+#!/bin/bash -x
+
+n=$1
+shift
+
+i=0
+while test $i -lt $n; do
+	filename=`printf "%-4.4d.txt" $i`
+	cp /etc/passwd $filename
+	i=`expr $i + 1`
+done
+echo straggler >>0000.txt
+
+# Copy stdin to stdout, but stall the first attempt on the straggler.
+# N.B. no ampersands or angle brackets - argv is passed as XML attributes.
+stall='tmp=`mktemp`; cat >$tmp; 
+	if grep -q straggler $tmp; then 
+		if mkdir $0 2>/dev/null; then sleep 30; fi; 
+	fi;
+	cat $tmp; rm -f $tmp'
+
+find . -name \*.txt | ispcat \
+	     | isprun $* -- ispexec -- sh -c "$stall" `pwd`/stalled \
+	     | isprename >out.xml || exit 1
+
+test `grep '<unit>' out.xml | wc -l` -eq $n || exit 1
+test `ls -d isprun* isptmp* 2>/dev/null | wc -l` -eq 0 || exit 1
+grep -q straggler 0000.out || exit 1
+
+# again with temporary files in ISP_TMPDIR: the losing copy's output
+# must not be left there
+rm -f *.out
+mkdir scratch
+find . -name \*.txt | ISP_TMPDIR=`pwd`/scratch ispcat \
+	     | ISP_TMPDIR=`pwd`/scratch isprun $* -- \
+	         ispexec -- sh -c "$stall" `pwd`/stalled2 \
+	     | isprename >out.xml || exit 1
+
+test `grep '<unit>' out.xml | wc -l` -eq $n || exit 1
+test -d stalled2 || exit 1
+test `ls -d isprun* isptmp* 2>/dev/null | wc -l` -eq 0 || exit 1
+test `find scratch -type f | wc -l` -eq 0 || exit 1
+grep -q straggler 0000.out || exit 1
+
+exit 0
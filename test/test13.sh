@@ -0,0 +1,31 @@
+#!/bin/bash -x
+
+n=$1
+shift
+
+i=0
+while test $i -lt $n; do
+	filename=`printf "%-4.4d.txt" $i`
+	cp /etc/passwd $filename
+	echo $i >>$filename
+	i=`expr $i + 1`
+done
+
+# cold cache: every unit misses
+(find . -name \*.txt | ispcat | ispexec -c cache -- sort \
+	     | isprename >out1.xml) 2>err1 || exit 1
+grep "0 hits, $n misses" err1 || exit 1
+for file in *.out; do mv $file $file.1; done
+
+# warm cache: every unit hits, with the same results
+(find . -name \*.txt | ispcat | isprun --cache=cache -- ispexec sort \
+	     | isprename >out2.xml) 2>err2 || exit 1
+grep "$n hits, 0 misses" err2 || exit 1
+for file in *.out; do cmp $file $file.1 || exit 1; done
+
+# a different command line misses
+(find . -name \*.txt | ispcat | ispexec -c cache -- sort -r \
+	     | isprename >out3.xml) 2>err3 || exit 1
+grep "0 hits, $n misses" err3 || exit 1
+
+exit 0
@@ -0,0 +1,16 @@
+#!/bin/bash -x
+
+n=$1
+
+# z=x*y then w=z+1, each with its own fid and result
+ispunit -n $n -i x=6 -i y=7 \
+	| ispfuse $TESTDIR/plugmult.so $TESTDIR/plugincr.so \
+	| ispdelay >out.xml || exit 1
+test `grep -c 'key="w" type="4" val="43" src="2"' out.xml` = $n || exit 1
+test `grep -c 'result fid="2" .* code="0"' out.xml` = $n || exit 1
+
+# stages are bound in order: w=z+1 cannot precede z=x*y
+ispunit -n 1 -i x=6 -i y=7 \
+	| ispfuse $TESTDIR/plugincr.so $TESTDIR/plugmult.so >/dev/null && exit 1
+
+exit 0
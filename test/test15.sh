@@ -0,0 +1,30 @@
+#!/bin/bash -x
+
+n=$1
+
+i=0
+while test $i -lt $n; do
+	filename=`printf "%-4.4d.txt" $i`
+	cp /etc/passwd $filename
+	echo $i >>$filename
+	i=`expr $i + 1`
+done
+
+# sort | tr | bzip2 per unit, with only the last output sourced
+find . -name \*.txt | ispcat | ispexec -- sort :: tr a-z A-Z :: bzip2 -9 \
+	     | isprename >out.xml || exit 1
+test `grep -c '<stage n="2" .* code="0"' out.xml` = $n || exit 1
+ls isptmp* && exit 1
+for file in *.txt; do
+	sort $file | tr a-z A-Z >expect
+	bunzip2 -c `basename $file .txt`.out | cmp - expect || exit 1
+done
+
+# a failing stage fails the unit
+ls 0000.txt | ispcat | ispexec -- sort :: false :: cat \
+	     | ispdelay >fail.xml || exit 1
+grep '<stage n="1" .* code="6"' fail.xml || exit 1
+grep '<result fid="1" .* code="6"' fail.xml || exit 1
+ls isptmp* && exit 1
+
+exit 0
@@ -0,0 +1,34 @@
+#!/bin/bash -x
+
+n=$1
+
+mkdir tree || exit 1
+i=0
+while test $i -lt $n; do
+	mkdir -p tree/$i/sub || exit 1
+	for f in a b c; do
+		echo $i$f >tree/$i/$f.txt
+		echo $i$f >tree/$i/sub/$f.txt
+	done
+	i=`expr $i + 1`
+done
+ln -s 0 tree/link || exit 1
+total=`find -L tree -type f | wc -l`
+
+# every file is found once, symlinked directories are followed
+ispcat -r -t 4 tree >out.xml || exit 1
+test `grep -c '<unit>' out.xml` -eq $total || exit 1
+test `grep -o 'path="[^"]*"' out.xml | sort -u | wc -l` -eq $total || exit 1
+
+# --sort output does not depend on the number of threads
+ispcat -r -s -t 1 tree | grep -o 'path="[^"]*"' >sorted1 || exit 1
+ispcat -r -s -t 8 tree | grep -o 'path="[^"]*"' >sorted8 || exit 1
+test `wc -l <sorted1` -eq $total || exit 1
+cmp sorted1 sorted8 || exit 1
+LC_ALL=C sort -c sorted1 || exit 1
+
+# anything that is not a regular file or directory is an error
+mkfifo tree/0/fifo || exit 1
+ispcat -r tree >/dev/null && exit 1
+
+exit 0
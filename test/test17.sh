@@ -0,0 +1,18 @@
+#!/bin/bash -x
+
+n=$1
+
+# the live symbol table is carried in the init element
+ispunit -n $n -i x=6 -i y=7 | ispfuse $TESTDIR/plugmult.so \
+	| tee live.xml | ispdelay >/dev/null || exit 1
+grep '<sym key="z" type="4" fid="1"/>' live.xml || exit 1
+
+# without it (older upstream), it is rebuilt from the filter stack
+ispunit -n $n -i x=6 -i y=7 | ispfuse $TESTDIR/plugmult.so \
+	| sed '/<live>/,/<\/live>/d' | ispfuse $TESTDIR/plugincr.so \
+	| ispdelay >out.xml || exit 1
+test `grep -c 'key="w" type="4" val="43"' out.xml` = $n || exit 1
+ispunit -n $n -i x=6 -i y=7 | sed '/<live>/,/<\/live>/d' \
+	| ispfuse $TESTDIR/plugincr.so >/dev/null && exit 1
+
+exit 0
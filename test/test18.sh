@@ -0,0 +1,28 @@
+#!/bin/bash -x
+
+# nothing is recorded by default
+unset ISP_ENVKEEP
+ispunit -n 1 -i x=1 | ispdelay | ispdelay >plain.xml || exit 1
+grep '<envv>\|<envdiff>' plain.xml && exit 1
+
+# the environment is stored once, with per-filter differences
+export ISP_ENVKEEP="ISPTEST_*"
+export ISPTEST_A='a&b<"c"'
+ISPTEST_B=1 ispunit -n 1 -i x=1 | ISPTEST_B=2 ispdelay | ispdelay \
+	| ispdelay >env.xml || exit 1
+test `grep -c '<envv>' env.xml` -eq 1 || exit 1
+grep -F '<env key="ISPTEST_A" val="a&amp;b&lt;&quot;c&quot;"/>' env.xml \
+	|| exit 1
+grep '<env key="ISPTEST_B" val="1"/>' env.xml || exit 1
+grep '<env key="ISPTEST_B" val="2"/>' env.xml || exit 1
+test `grep -c '<env key="ISPTEST_B"/>' env.xml` -eq 2 || exit 1
+test `grep -c '<envdiff>' env.xml` -eq 3 || exit 1
+test `grep -c '<env key="ISPTEST_A"' env.xml` -eq 1 || exit 1
+
+# attribute values are escaped, so any argv survives
+echo hello >in.txt
+ispcat in.txt | ispexec -- sh -c 'true && cat' \
+	| ispdelay >argv.xml || exit 1
+grep -F 'val="true &amp;&amp; cat"' argv.xml || exit 1
+
+exit 0
@@ -0,0 +1,50 @@
+#!/bin/bash -x
+
+n=$1
+export ISP_DESCRIBE_CACHE=`pwd`/cache
+entries() { ls cache | wc -l; }
+
+# a filter run with ISP_DESCRIBE=1 writes its filter element and exits
+ISP_DESCRIBE=1 isprename -f foo -b bar </dev/null >desc.xml || exit 1
+grep '<sym key="foo" type="0" flags="2"/>' desc.xml || exit 1
+
+# isprun caches the description and pushes the filter element itself
+ispunit -n $n | isprun -- ispdelay >out1.xml || exit 1
+test `entries` = 1 || exit 1
+ispunit -n $n | isprun -- ispdelay >out2.xml || exit 1
+test `entries` = 1 || exit 1
+test `grep -c '<unit>' out2.xml` = $n || exit 1
+grep -A2 '<filter fid="1"' out2.xml | grep 'val="ispdelay"' || exit 1
+
+# the cached description is what is used
+sed -i 's/val="ispdelay"/val="cached"/' cache/*
+ispunit -n $n | isprun -- ispdelay | grep 'val="cached"' || exit 1
+
+# bindings are checked against it, and the description is kept even
+# though the run fails
+ispunit -n $n | isprun -- isprename -f foo -b bar >/dev/null 2>bind.err \
+	&& exit 1
+grep '^isprun.*: Pipeline binding error' bind.err || exit 1
+test `entries` = 2 || exit 1
+ispunit -n $n | isprun -- isprename -f foo -b bar >/dev/null && exit 1
+
+# a changed binary is described again
+cp `which ispdelay` mydelay || exit 1
+ispunit -n $n | isprun -- ./mydelay >/dev/null || exit 1
+test `entries` = 3 || exit 1
+touch -d "1 hour ago" mydelay || exit 1
+ispunit -n $n | isprun -- ./mydelay >/dev/null || exit 1
+test `entries` = 4 || exit 1
+
+# a filter that cannot describe itself is probed instead
+ispunit -n $n -i x=6 -i y=7 | isprun -- ispfuse $TESTDIR/plugmult.so \
+	>out3.xml || exit 1
+test `grep -c 'key="z" type="4" val="42"' out3.xml` = $n || exit 1
+test `entries` = 4 || exit 1
+
+# isprun describes the filter it runs, which it alone caches
+ispunit -n $n | isprun -- isprun -- ./mydelay >out4.xml || exit 1
+test `grep -c '<unit>' out4.xml` = $n || exit 1
+test `entries` = 4 || exit 1
+
+exit 0
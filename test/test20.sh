@@ -0,0 +1,20 @@
+#!/bin/bash -x
+
+n=$1
+f=$2
+
+# give units a history of 10 results, then split each f ways
+ispunit -n $n -i x=1 | ispdelay | ispdelay | ispdelay | ispdelay | ispdelay \
+	| ispdelay | ispdelay | ispdelay | ispdelay >hist.xml || exit 1
+ispunitsplit -f $f -k i <hist.xml >split.xml || exit 1
+test `grep -c '<unit>' split.xml` = $(($n * $f)) || exit 1
+
+# every copy carries the shared history and its own result and key
+test `grep -c '<result fid="[0-9]"' split.xml` = $(($n * $f * 10)) || exit 1
+test `grep -c '<result fid="10"' split.xml` = $(($n * $f)) || exit 1
+test `grep -c 'key="x" type="4" val="1"' split.xml` = $(($n * $f)) || exit 1
+for i in 0 $(($f - 1)); do
+	test `grep -c "key=\"i\" type=\"3\" val=\"$i\"" split.xml` = $n || exit 1
+done
+
+exit 0
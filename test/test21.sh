@@ -0,0 +1,31 @@
+#!/bin/bash -x
+
+n=$1
+f=$2
+
+# split, compute on each piece, join
+ispunit -n $n -i x=6 -i y=7 | ispunitsplit -f $f -z 1 \
+	| isprun -- ispfuse $TESTDIR/plugmult.so >pieces.xml || exit 1
+ispunitjoin <pieces.xml >out.xml || exit 1
+test `grep -c '<unit>' out.xml` = $n || exit 1
+for i in 1 $f; do
+	test `grep -c "key=\"z.$i\" type=\"4\" val=\"42\" src=\"[0-9]*\" sink=\"-1\"" out.xml` = $n || exit 1
+done
+grep 'key="split[.a-z]*" .* sink="-1"' out.xml && exit 1
+
+# spill all but one piece to disk, and leave nothing behind
+ispunitjoin -m 1 <pieces.xml >out2.xml || exit 1
+test `grep -c '<unit>' out2.xml` = $n || exit 1
+test `grep -c "key=\"z.$f\"" out2.xml` = $n || exit 1
+ls isptmp* && exit 1
+
+# a lost piece fails the unit
+awk '/<unit>/ {u=1; d=0; b=""}
+	u {b = b $0 "\n"; if (/key="split" type="3" val="'$f'"/) d=1;
+	   if (/<\/unit>/) {if (!d) printf "%s", b; u=0}; next}
+	{print}' pieces.xml >lost.xml
+ispunitjoin <lost.xml >out3.xml || exit 1
+test `grep -c '<unit>' out3.xml` = $n || exit 1
+test `grep -c 'code="1025"' out3.xml` = $n || exit 1
+
+exit 0
@@ -0,0 +1,33 @@
+#!/bin/bash -x
+
+n=$1
+export ISP_MD5CHECK=1
+
+seq 1 $n >big.txt
+size=`stat -c %s big.txt`
+
+# slices are record aligned and cover the file without copying it
+ls big.txt | ispcat | ispunitsplit -b 16K >slices.xml || exit 1
+pieces=`grep -c '<unit>' slices.xml`
+test $pieces -gt 1 || exit 1
+test `grep -c "path=\"$PWD/big.txt\".*offset=" slices.xml` = $pieces || exit 1
+test `ls isptmp* 2>/dev/null | wc -l` = 0 || exit 1
+
+# process the slices in parallel and put them back together
+isprun -- ispexec -- wc -l <slices.xml | ispunitjoin >out.xml || exit 1
+test `grep -c '<unit>' out.xml` = 1 || exit 1
+total=`grep 'key="file.[0-9]*"' out.xml | sed 's/.*path="\([^"]*\)".*/\1/' \
+	| xargs cat | awk '{s += $1} END {print s}'`
+test "$total" = $n || exit 1
+
+# slice contents are what ispexec saw
+ispexec -- cat <slices.xml >cat.xml || exit 1
+grep 'key="file"' cat.xml | grep 'sink="-1"' \
+	| sed 's/.*path="\([^"]*\)".*/\1/' | xargs cat | cmp - big.txt || exit 1
+
+# damage to one slice fails only that piece
+printf X | dd of=big.txt bs=1 seek=$(($size / 2)) conv=notrunc || exit 1
+ispexec -- wc -l <slices.xml >bad.xml || exit 1
+test `grep -c 'code="4"' bad.xml` = 1 || exit 1
+
+exit 0
@@ -0,0 +1,29 @@
+#!/bin/bash -x
+
+n=$1
+export ISP_MD5CHECK=1
+
+seq 1 $n >big.txt
+cp big.txt orig.txt
+touch empty.txt
+
+# count lines of whole files and of slices through a mapping
+ls big.txt empty.txt | ispcat \
+	| ispfuse $TESTDIR/pluglines.so >whole.xml || exit 1
+grep -q "key=\"lines\" type=\"3\" val=\"$n\"" whole.xml || exit 1
+grep -q 'key="lines" type="3" val="0"' whole.xml || exit 1
+ls big.txt | ispcat | ispunitsplit -b 10K >slices.xml || exit 1
+ispfuse $TESTDIR/pluglines.so <slices.xml >counted.xml || exit 1
+total=`grep 'key="lines"' counted.xml | sed 's/.*val="\([0-9]*\)".*/\1/' \
+	| awk '{s += $1} END {print s}'`
+test "$total" = $n || exit 1
+
+# private mappings leave the file alone
+cmp big.txt orig.txt || exit 1
+
+# a damaged slice is caught when it is mapped
+printf X | dd of=big.txt bs=1 seek=100 conv=notrunc || exit 1
+ispfuse $TESTDIR/pluglines.so <slices.xml >bad.xml || exit 1
+test `grep -c 'code="4"' bad.xml` = 1 || exit 1
+
+exit 0
@@ -0,0 +1,24 @@
+#!/bin/bash -x
+
+n=$1
+
+i=0
+while test $i -lt $n; do
+	seq 1 10000 >`printf "%-4.4d.txt" $i`
+	i=`expr $i + 1`
+done
+
+# units pass through in order and the hit rate is reported
+ls *.txt | ispcat >in.xml || exit 1
+ispprefetch -n 4 -b 100K <in.xml >out.xml 2>rate.err || exit 1
+test `grep -c '<unit>' out.xml` = $n || exit 1
+test "`grep 'key="file"' in.xml`" = "`grep 'key="file"' out.xml`" || exit 1
+grep -q "pages resident" rate.err || exit 1
+
+# a slow upstream doesn't hold up the next stage
+SECONDS=0
+ls 0000.txt 0001.txt 0002.txt | ispcat | ispdelay -d 1 | ispprefetch -q \
+	| ispdelay -d 1 >slow.xml || exit 1
+test $SECONDS -lt 6 || exit 1
+
+exit 0
@@ -0,0 +1,36 @@
+#!/bin/bash -x
+
+n=$1
+
+i=0
+while test $i -lt $n; do
+	seq 1 20000 >`printf "%-4.4d.txt" $i`
+	i=`expr $i + 1`
+done
+# the second scratch directory is on another file system if possible
+mkdir a
+b=`mktemp -d /dev/shm/isptest.XXXXXX 2>/dev/null` || b=`mktemp -d b.XXXXXX`
+trap "rm -rf $b" 0
+export ISP_TMPDIR=`pwd`/a:$b
+
+# new files are spread over the scratch directories
+ls *.txt | ispcat | ispexec -- sort -rn >out.xml || exit 1
+test `grep -c "path=\"\`pwd\`/a/isp\." out.xml` -gt 0 || exit 1
+test `grep -c "path=\"$b/isp\." out.xml` -gt 0 || exit 1
+
+# and can be moved out of them
+isprename <out.xml >/dev/null || exit 1
+test `ls 0*.out | wc -l` = $n || exit 1
+test `ls -d a/isp.* $b/isp.* 2>/dev/null | wc -l` = 0 || exit 1
+sort -n 0000.out | cmp - 0000.txt || exit 1
+rm -f 0*.out
+
+# a quota of one file does not deadlock a pipeline that consumes its input
+ls *.txt | ISP_TMPQUOTA=100K ispcat \
+	| ISP_TMPQUOTA=100K ispexec -- sort -rn \
+	| ISP_TMPQUOTA=100K ispexec -- sort -n \
+	| ISP_TMPQUOTA=100K isprename >/dev/null || exit 1
+test `ls 0*.out | wc -l` = $n || exit 1
+test `ls -d a/isp.* $b/isp.* 2>/dev/null | wc -l` = 0 || exit 1
+
+exit 0
@@ -0,0 +1,35 @@
+#!/bin/bash -x
+
+n=$1
+
+i=0
+while test $i -lt $n; do
+	seq $i 20000 >`printf "%-4.4d.txt" $i`
+	i=`expr $i + 1`
+done
+mkdir scratch results
+export ISP_TMPDIR=`pwd`/scratch
+export ISP_MD5CHECK=1
+
+# inputs are copied to scratch with their digests, and the originals kept
+ls *.txt | ispcat >in.xml || exit 1
+ispstage -j 3 -n 4 -B 64K in <in.xml >staged.xml || exit 1
+test `grep -c "key=\"file\" path=\"\`pwd\`/scratch/" staged.xml` = $n || exit 1
+test "`grep -o 'md5="[0-9a-f]*"' in.xml | sort -u`" \
+	= "`grep -o 'md5="[0-9a-f]*"' staged.xml | sort -u`" || exit 1
+test `ls *.txt | wc -l` = $n || exit 1
+
+# outputs are copied back to the results directory, leaving scratch empty
+ispexec -- sort -rn <staged.xml | ispstage -j 3 -d results out >out.xml \
+	|| exit 1
+test `ls results | wc -l` = $n || exit 1
+test `find scratch -type f | wc -l` = 0 || exit 1
+isprename <out.xml >/dev/null || exit 1
+test `ls 0*.out | wc -l` = $n || exit 1
+sort -n 0000.out | cmp - 0000.txt || exit 1
+
+# read-only inputs are not staged out
+ls *.txt | ispcat | ispstage -d results out >ro.xml || exit 1
+test `grep -c "/results/" ro.xml` = 0 || exit 1
+
+exit 0
@@ -0,0 +1,26 @@
+#!/bin/bash -x
+
+# no element limit, so only the byte limits hold back a stalled reader
+srcxml 0:$3 $1 $2 | sinkxml 0:$3 $1 $2 2 || exit 1
+
+# and elements larger than the limit still get through
+srcxml 0:64 10 100 | sinkxml 0:64 10 100 || exit 1
+
+# a read that holds many elements doesn't overrun a backlog of one
+srcxml 0 $1 $2 | sinkxml 1 $1 $2 || exit 1
+
+# a filter takes its limits from ISP_BACKLOG and keeps to them
+ispunit -n 2000 | ISP_BACKLOG=0:$3 ispdelay -d 0 2>err.log \
+	| (sleep 1; cat) >out.xml || exit 1
+test `grep -c '<unit>' out.xml` -eq 2000 || exit 1
+peak=`sed -n 's/.*stdout: at most \([0-9]*\) bytes buffered/\1/p' err.log`
+test -n "$peak" || exit 1
+test $peak -le $(($3 + 1024)) || exit 1
+
+# without a byte limit, the same stall buffers more
+ispunit -n 2000 | ISP_BACKLOG=0 ispdelay -d 0 2>err.log \
+	| (sleep 1; cat) >out.xml || exit 1
+peak=`sed -n 's/.*stdout: at most \([0-9]*\) bytes buffered/\1/p' err.log`
+test $peak -gt $(($3 + 1024)) || exit 1
+
+exit 0
@@ -0,0 +1,24 @@
+#!/bin/bash -x
+
+# downstream doesn't read for a while, so isprun's stdout backs up
+ispunit -n $1 | isprun -b $2 -m $3 -- ispdelay -d 0 2>err.log \
+	| (sleep 2; cat) >out.xml || exit 1
+test `grep -c '<unit' out.xml` -eq $1 || exit 1
+
+# isprun stalled and kept the backlog within budget (plus one unit)
+peak=`sed -n 's/.*peak backlog \([0-9]*\) bytes.*/\1/p' err.log`
+test -n "$peak" || exit 1
+test $peak -le $(($3 + 1024)) || exit 1
+
+# a budget that is never reached is still reported
+ispunit -n $1 | isprun -b $2 -m 1G -- ispdelay -d 0 2>err.log \
+	>out.xml || exit 1
+grep -q 'peak backlog.*stalled 0 times' err.log || exit 1
+
+# without --membudget, the backlog is not bounded
+ispunit -n $1 | isprun -b $2 -- ispdelay -d 0 2>err.log \
+	| (sleep 2; cat) >out.xml || exit 1
+test `grep -c '<unit' out.xml` -eq $1 || exit 1
+grep -q 'peak backlog' err.log && exit 1
+
+exit 0
@@ -0,0 +1,33 @@
+#!/bin/bash -x
+
+# a chain of filters passes the same units over rings as over pipes
+ispunit -n $1 -i x=1 | ispdelay -d 0 | ispdelay -d 0 >pipe.xml || exit 1
+export ISP_RING=$2
+ispunit -n $1 -i x=1 | ispdelay -d 0 | ispdelay -d 0 >ring.xml || exit 1
+test `grep -c '<unit>' ring.xml` = $1 || exit 1
+test "`grep -v 'result\|<document' ring.xml`" \
+   = "`grep -v 'result\|<document' pipe.xml`" || exit 1
+
+# something relaying the stream keeps it on the pipe, and sees it all
+ispunit -n $1 -i x=1 | ispdelay -d 0 | tee mid.xml | ispdelay -d 0 \
+	>relay.xml || exit 1
+test `grep -c '<unit>' mid.xml` = $1 || exit 1
+test `grep -c '<unit>' relay.xml` = $1 || exit 1
+
+# while filters directly connected share a ring (the offer is taken up
+# before the first unit is written); look only at this pipeline's filters,
+# for as long as it runs
+(ispunit -n 3 | ispdelay -d 1 | ispdelay -d 0 >slow.xml) &
+pipeline=$!
+ring=0
+while test $ring = 0 && kill -0 $pipeline 2>/dev/null; do
+	for pid in `pgrep -P $pipeline -x ispdelay`; do
+		ls -l /proc/$pid/fd 2>/dev/null
+	done | grep -q 'memfd:isp-ring' && ring=1
+	sleep 0.1
+done
+wait $pipeline || exit 1
+test $ring = 1 || exit 1
+test `grep -c '<unit>' slow.xml` = 3 || exit 1
+
+exit 0
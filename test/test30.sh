@@ -0,0 +1,33 @@
+#!/bin/bash -x
+
+# units relayed in small pieces decompress to what went in
+ispunit -n $1 -i x=1 | ispdelay -d 0 >plain.xml || exit 1
+ISP_COMPRESS=1 ispunit -n $1 -i x=1 2>src.err | dd bs=$2 2>/dev/null \
+	| ISP_COMPRESS=0 ispdelay -d 0 2>sink.err | cat >z.xml || exit 1
+test "`grep -v 'result\|<document' z.xml`" \
+   = "`grep -v 'result\|<document' plain.xml`" || exit 1
+
+# the ratio and cpu time are reported at each end
+grep -q 'stdout: [0-9]* bytes compressed to [0-9]*' src.err || exit 1
+grep -q 'stdin: [0-9]* bytes decompressed from [0-9]*' sink.err || exit 1
+
+# the stream really shrinks, and a truncated one is an error
+ISP_COMPRESS=1 ispunit -n $1 -i x=1 2>/dev/null | cat >z.bin || exit 1
+test `stat -c %s z.bin` -lt $((`stat -c %s plain.xml` / 4)) || exit 1
+head -c $((`stat -c %s z.bin` / 2)) z.bin | ispdelay -d 0 >/dev/null \
+	2>/dev/null && exit 1
+
+# by default, filters on one host don't compress
+ispunit -n $1 -i x=1 | ispdelay -d 0 2>sink.err | cat >z.xml || exit 1
+head -1 z.xml | grep -q '^<?xml' || exit 1
+test -s sink.err && exit 1
+
+# only a filter told that its reader is remote compresses, unless told not to
+ispunit -n $1 -i x=1 | ISP_STDOUT_REMOTE=1 ispdelay -d 0 2>/dev/null \
+	| cat >z.bin || exit 1
+head -1 z.bin | grep -q '^<?xml' && exit 1
+ispunit -n $1 -i x=1 | ISP_STDOUT_REMOTE=1 ISP_COMPRESS=0 ispdelay -d 0 \
+	| cat >z.xml || exit 1
+head -1 z.xml | grep -q '^<?xml' || exit 1
+
+exit 0
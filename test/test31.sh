@@ -0,0 +1,31 @@
+#!/bin/bash -x
+
+# units replayed from an archive are the units that were saved
+ispunit -n $1 -i x=1 | ispdelay -d 0 | ispsave -b $2 -k x a.isa || exit 1
+ispunit -n $1 -i x=1 | ispdelay -d 0 | cat >plain.xml || exit 1
+ispload a.isa | cat >a.xml || exit 1
+test "`grep -v 'result\|<document' a.xml`" \
+   = "`grep -v 'result\|<document' plain.xml`" || exit 1
+ispload a.isa | ispcount 2>&1 >/dev/null | grep -q "^$1\$" || exit 1
+
+# blocks are compressed unless -u
+ispsave -u -k x u.isa <a.xml || exit 1
+test `stat -c %s a.isa` -lt $((`stat -c %s plain.xml` / 4)) || exit 1
+test `stat -c %s u.isa` -gt `stat -c %s plain.xml` || exit 1
+test "`ispload u.isa | grep -v '<document'`" \
+   = "`grep -v '<document' a.xml`" || exit 1
+
+# ranges and selections
+ispload -r 10-19 a.isa | ispcount 2>&1 >/dev/null | grep -q '^10$' || exit 1
+ispload -r $(($1 - 3))- a.isa | ispcount 2>&1 >/dev/null | grep -q '^3$' \
+	|| exit 1
+ispload -s x=1 -r 5 a.isa | ispcount 2>&1 >/dev/null | grep -q '^1$' || exit 1
+ispload -s x=2 a.isa | ispcount 2>&1 >/dev/null | grep -q '^0$' || exit 1
+ispload -l -r 7 a.isa | grep -q '^7 x=1$' || exit 1
+ispload -s y=1 a.isa >/dev/null 2>&1 && exit 1
+
+# a truncated archive is refused
+head -c $((`stat -c %s a.isa` / 2)) a.isa >t.isa
+ispload t.isa >/dev/null 2>&1 && exit 1
+
+exit 0
@@ -0,0 +1,626 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Indexed unit archive (see archive.h).
+ *
+ * Layout:
+ *   header (magic written last, so an unfinished archive is rejected)
+ *   init element XML
+ *   blocks of unit XML
+ *   block table, unit table, value table (nunits x nkeys string offsets)
+ *   string pool (key names, then values, each null terminated)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <isp/isp.h>
+#include <isp/lz.h>
+
+#include "archive.h"
+
+#define ARCHIVE_MAGIC       0x41524348
+#define ARCHIVE_MAGIC_STR   "ISPARCH"   /* 8 bytes with the null */
+#define ARCHIVE_VERSION     1
+#define ARCHIVE_LZ          0x1         /* blocks may be compressed */
+#define ARCHIVE_NOVAL       0xffffffffU
+#define ARCHIVE_MAXKEYS     1024
+
+struct archive_hdr {
+    char     magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t nunits;
+    uint64_t nblocks;
+    uint64_t nkeys;
+    uint64_t init_off;
+    uint64_t init_len;
+    uint64_t blocks_off;    /* struct archive_block[nblocks] */
+    uint64_t units_off;     /* struct archive_unit[nunits] */
+    uint64_t vals_off;      /* uint32_t[nunits][nkeys] */
+    uint64_t strs_off;
+    uint64_t strs_len;
+};
+
+struct archive_block {
+    uint64_t off;
+    uint32_t len;           /* stored size */
+    uint32_t rawlen;        /* compressed if less than this */
+};
+
+struct archive_unit {
+    uint32_t block;
+    uint32_t off;           /* within the uncompressed block */
+    uint32_t len;
+};
+
+struct archive_struct {
+    int magic;
+    int writing;
+    int fd;
+    struct archive_hdr hdr;
+    int nkeys;
+    unsigned long long raw; /* XML bytes in blocks */
+    unsigned long long coded; /* bytes stored for them */
+    /* writer */
+    int blocksize;
+    int compress;
+    char *blk;              /* block being filled */
+    int blklen, blkmax;
+    uint64_t off;           /* end of file */
+    struct archive_block *blocks;
+    unsigned long nblocks, maxblocks;
+    struct archive_unit *units;
+    unsigned long nunits, maxunits;
+    uint32_t *vals;
+    unsigned long maxvals;
+    char *strs;
+    unsigned long strslen, maxstrs;
+    uint32_t *lastval;      /* each key's value in the previous unit */
+    /* reader */
+    char *map;
+    size_t size;
+    char **keys;
+    long cur;               /* block in buf, -1 if none */
+    char *buf;
+    int bufmax;
+};
+
+/* Make room for 'need' elements of 'size' bytes in *pp.
+ */
+static int
+_grow(void *pp, unsigned long *maxp, unsigned long need, size_t size)
+{
+    unsigned long max = *maxp ? *maxp : 64;
+    void *p;
+
+    if (need <= *maxp)
+        return 0;
+    while (max < need)
+        max *= 2;
+    if (!(p = realloc(*(void **)pp, max * size)))
+        return -1;
+    *(void **)pp = p;
+    *maxp = max;
+    return 0;
+}
+
+static int
+_write(archive_t a, void *buf, size_t len)
+{
+    size_t n = 0;
+    ssize_t r;
+
+    while (n < len) {
+        if ((r = write(a->fd, (char *)buf + n, len - n)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        n += r;
+    }
+    a->off += len;
+    return 0;
+}
+
+/* Pad the file so the next table is aligned.
+ */
+static int
+_align(archive_t a)
+{
+    static char zero[8];
+
+    return _write(a, zero, (8 - a->off % 8) % 8);
+}
+
+/* Add a string to the pool and return its offset, or ARCHIVE_NOVAL 
+ * with errno set.
+ */
+static uint32_t
+_str_add(archive_t a, char *s)
+{
+    unsigned long len = strlen(s) + 1;
+    uint32_t off = a->strslen;
+
+    if (a->strslen + len >= ARCHIVE_NOVAL) {
+        errno = EFBIG;
+        return ARCHIVE_NOVAL;
+    }
+    if (_grow(&a->strs, &a->maxstrs, a->strslen + len, 1) < 0)
+        return ARCHIVE_NOVAL;
+    memcpy(a->strs + a->strslen, s, len);
+    a->strslen += len;
+    return off;
+}
+
+static void
+_free(archive_t a)
+{
+    if (a->fd >= 0)
+        (void)close(a->fd);
+    if (a->map)
+        (void)munmap(a->map, a->size);
+    free(a->blk);
+    free(a->blocks);
+    free(a->units);
+    free(a->vals);
+    free(a->strs);
+    free(a->lastval);
+    free(a->keys);
+    free(a->buf);
+    a->magic = 0;
+    free(a);
+}
+
+int
+archive_create(archive_t *ap, char *path, char **keys, int nkeys,
+               int blocksize, int compress)
+{
+    archive_t a;
+    int i;
+
+    if (nkeys < 0 || nkeys > ARCHIVE_MAXKEYS || blocksize <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!(a = calloc(1, sizeof(struct archive_struct))))
+        return -1;
+    a->magic = ARCHIVE_MAGIC;
+    a->writing = 1;
+    a->nkeys = nkeys;
+    a->blocksize = blocksize;
+    a->compress = compress;
+    if (!(a->lastval = malloc((nkeys + 1) * sizeof(uint32_t))))
+        goto error;
+    for (i = 0; i < nkeys; i++)
+        a->lastval[i] = ARCHIVE_NOVAL;
+    if ((a->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        goto error;
+    if (_write(a, &a->hdr, sizeof(a->hdr)) < 0)
+        goto error;
+    for (i = 0; i < nkeys; i++) {
+        if (_str_add(a, keys[i]) == ARCHIVE_NOVAL)
+            goto error;
+    }
+    *ap = a;
+    return 0;
+error:
+    _free(a);
+    return -1;
+}
+
+int
+archive_init_put(archive_t a, char *buf, int len)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    if (!a->writing || a->nunits > 0 || a->hdr.init_len > 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    a->hdr.init_off = a->off;
+    a->hdr.init_len = len;
+    return _write(a, buf, len);
+}
+
+/* Write out the block being filled, compressed if that makes it smaller.
+ */
+static int
+_flush_block(archive_t a)
+{
+    struct archive_block *b;
+    char *out = NULL;
+    int outlen = 0;
+    lz_t z;
+    int res;
+
+    if (a->blklen == 0)
+        return 0;
+    if (_grow(&a->blocks, &a->maxblocks, a->nblocks + 1, 
+              sizeof(struct archive_block)) < 0)
+        return -1;
+    if (a->compress) {
+        if ((res = lz_create(&z)) == ISP_ESUCCESS) {
+            res = lz_encode(z, a->blk, a->blklen, &out, &outlen);
+            lz_destroy(z);
+        }
+        if (res != ISP_ESUCCESS) {
+            errno = ENOMEM;
+            return -1;
+        }
+        if (outlen >= a->blklen) {
+            free(out);
+            out = NULL;
+        }
+    }
+    b = &a->blocks[a->nblocks];
+    b->off = a->off;
+    b->rawlen = a->blklen;
+    b->len = out ? outlen : a->blklen;
+    res = _write(a, out ? out : a->blk, b->len);
+    free(out);
+    if (res < 0)
+        return -1;
+    a->raw += b->rawlen;
+    a->coded += b->len;
+    a->nblocks++;
+    a->blklen = 0;
+    return 0;
+}
+
+int
+archive_unit_put(archive_t a, char *buf, int len, char **vals)
+{
+    struct archive_unit *u;
+    uint32_t *v;
+    unsigned long max;
+    int k;
+
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    if (!a->writing) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (a->blklen > 0 && a->blklen + len > a->blocksize)
+        if (_flush_block(a) < 0)
+            return -1;
+    if (a->blklen + len > a->blkmax) {
+        max = a->blkmax;
+        if (_grow(&a->blk, &max, a->blklen + len, 1) < 0)
+            return -1;
+        a->blkmax = max;
+    }
+    if (_grow(&a->units, &a->maxunits, a->nunits + 1, 
+              sizeof(struct archive_unit)) < 0)
+        return -1;
+    if (_grow(&a->vals, &a->maxvals, (a->nunits + 1) * a->nkeys, 
+              sizeof(uint32_t)) < 0)
+        return -1;
+    memcpy(a->blk + a->blklen, buf, len);
+    u = &a->units[a->nunits];
+    u->block = a->nblocks;
+    u->off = a->blklen;
+    u->len = len;
+    a->blklen += len;
+    v = a->vals + a->nunits * a->nkeys;
+    for (k = 0; k < a->nkeys; k++) {
+        v[k] = ARCHIVE_NOVAL;
+        if (!vals || !vals[k])
+            continue;
+        /* runs of units often share a value */
+        if (a->lastval[k] != ARCHIVE_NOVAL 
+                && !strcmp(a->strs + a->lastval[k], vals[k]))
+            v[k] = a->lastval[k];
+        else if ((v[k] = _str_add(a, vals[k])) == ARCHIVE_NOVAL)
+            return -1;
+        a->lastval[k] = v[k];
+    }
+    a->nunits++;
+    return 0;
+}
+
+int
+archive_close(archive_t a)
+{
+    struct archive_hdr *h = &a->hdr;
+    int res = -1;
+
+    assert(a->magic == ARCHIVE_MAGIC);
+    assert(a->writing);
+
+    if (_flush_block(a) < 0 || _align(a) < 0)
+        goto done;
+    h->blocks_off = a->off;
+    if (_write(a, a->blocks, a->nblocks * sizeof(struct archive_block)) < 0)
+        goto done;
+    h->units_off = a->off;
+    if (_write(a, a->units, a->nunits * sizeof(struct archive_unit)) < 0)
+        goto done;
+    h->vals_off = a->off;
+    if (_write(a, a->vals, a->nunits * a->nkeys * sizeof(uint32_t)) < 0)
+        goto done;
+    h->strs_off = a->off;
+    h->strs_len = a->strslen;
+    if (_write(a, a->strs, a->strslen) < 0)
+        goto done;
+    memcpy(h->magic, ARCHIVE_MAGIC_STR, sizeof(h->magic));
+    h->version = ARCHIVE_VERSION;
+    h->flags = a->compress ? ARCHIVE_LZ : 0;
+    h->nunits = a->nunits;
+    h->nblocks = a->nblocks;
+    h->nkeys = a->nkeys;
+    if (pwrite(a->fd, h, sizeof(*h), 0) != sizeof(*h))
+        goto done;
+    res = close(a->fd);
+    a->fd = -1;
+done:
+    _free(a);
+    return res;
+}
+
+/* True if 'count' items of 'size' bytes at 'off' lie within the file.
+ */
+static int
+_inside(archive_t a, uint64_t off, uint64_t count, size_t size)
+{
+    return (off <= a->size && count <= (a->size - off) / size);
+}
+
+int
+archive_open(archive_t *ap, char *path)
+{
+    struct archive_hdr *h;
+    struct archive_block *blocks;
+    struct stat sb;
+    archive_t a;
+    char *p, *end;
+    unsigned long i;
+    int k;
+
+    if (!(a = calloc(1, sizeof(struct archive_struct))))
+        return -1;
+    a->magic = ARCHIVE_MAGIC;
+    a->cur = -1;
+    h = &a->hdr;
+    if ((a->fd = open(path, O_RDONLY)) < 0 || fstat(a->fd, &sb) < 0)
+        goto error;
+    if (sb.st_size < sizeof(*h))
+        goto corrupt;
+    a->size = sb.st_size;
+    a->map = mmap(NULL, a->size, PROT_READ, MAP_SHARED, a->fd, 0);
+    if (a->map == MAP_FAILED) {
+        a->map = NULL;
+        goto error;
+    }
+    memcpy(h, a->map, sizeof(*h));
+    if (memcmp(h->magic, ARCHIVE_MAGIC_STR, sizeof(h->magic)) != 0
+            || h->version != ARCHIVE_VERSION || h->nkeys > ARCHIVE_MAXKEYS)
+        goto corrupt;
+    if (!_inside(a, h->init_off, h->init_len, 1)
+            || !_inside(a, h->blocks_off, h->nblocks, 
+                        sizeof(struct archive_block))
+            || !_inside(a, h->units_off, h->nunits, 
+                        sizeof(struct archive_unit))
+            || (h->nkeys > 0 && !_inside(a, h->vals_off, h->nunits,
+                        h->nkeys * sizeof(uint32_t)))
+            || !_inside(a, h->strs_off, h->strs_len, 1)
+            || (h->strs_len > 0 && a->map[h->strs_off + h->strs_len - 1]))
+        goto corrupt;
+    blocks = (struct archive_block *)(a->map + h->blocks_off);
+    for (i = 0; i < h->nblocks; i++) {
+        if (!_inside(a, blocks[i].off, blocks[i].len, 1) 
+                || blocks[i].len > blocks[i].rawlen
+                || (blocks[i].len < blocks[i].rawlen 
+                    && !(h->flags & ARCHIVE_LZ)))
+            goto corrupt;
+        a->raw += blocks[i].rawlen;
+        a->coded += blocks[i].len;
+    }
+    a->nkeys = h->nkeys;
+    if (a->nkeys > 0 && !(a->keys = malloc(a->nkeys * sizeof(char *))))
+        goto error;
+    p = a->map + h->strs_off;
+    end = p + h->strs_len;
+    for (k = 0; k < a->nkeys; k++) {
+        if (p >= end)
+            goto corrupt;
+        a->keys[k] = p;
+        p += strlen(p) + 1;
+    }
+    *ap = a;
+    return 0;
+corrupt:
+    errno = EINVAL;
+error:
+    k = errno;
+    _free(a);
+    errno = k;
+    return -1;
+}
+
+void
+archive_destroy(archive_t a)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+    assert(!a->writing);
+
+    _free(a);
+}
+
+unsigned long
+archive_count(archive_t a)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    return a->hdr.nunits;
+}
+
+int
+archive_nkeys(archive_t a)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    return a->nkeys;
+}
+
+char *
+archive_key(archive_t a, int k)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+    assert(k >= 0 && k < a->nkeys);
+
+    return a->keys[k];
+}
+
+int
+archive_key_find(archive_t a, char *name)
+{
+    int k;
+
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    for (k = 0; k < a->nkeys; k++)
+        if (!strcmp(a->keys[k], name))
+            return k;
+    return -1;
+}
+
+int
+archive_init_get(archive_t a, char **bufp, int *lenp)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    if (a->hdr.init_len == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    *bufp = a->map + a->hdr.init_off;
+    *lenp = a->hdr.init_len;
+    return 0;
+}
+
+/* Decompress block 'n' into a->buf.
+ */
+static int
+_load_block(archive_t a, struct archive_block *b, long n)
+{
+    unsigned long max = a->bufmax;
+    int got = 0, r = -1;
+    lz_t z;
+
+    if (_grow(&a->buf, &max, b->rawlen, 1) < 0)
+        return -1;
+    a->bufmax = max;
+    a->cur = -1;
+    if (lz_create(&z) != ISP_ESUCCESS)
+        return -1;
+    if (lz_feed(z, a->map + b->off, b->len) == ISP_ESUCCESS) {
+        while (got < b->rawlen 
+                && (r = lz_decode(z, a->buf + got, b->rawlen - got)) > 0)
+            got += r;
+    }
+    if (got == b->rawlen && !lz_partial(z))
+        a->cur = n;
+    lz_destroy(z);
+    if (a->cur != n) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int
+archive_unit_get(archive_t a, unsigned long n, char **bufp, int *lenp)
+{
+    struct archive_unit *u;
+    struct archive_block *b;
+
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    if (n >= a->hdr.nunits) {
+        errno = EINVAL;
+        return -1;
+    }
+    u = (struct archive_unit *)(a->map + a->hdr.units_off) + n;
+    b = (struct archive_block *)(a->map + a->hdr.blocks_off) + u->block;
+    if (u->block >= a->hdr.nblocks || u->off > b->rawlen 
+            || u->len > b->rawlen - u->off) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (b->len == b->rawlen)        /* stored as is */
+        *bufp = a->map + b->off + u->off;
+    else {
+        if (a->cur != u->block && _load_block(a, b, u->block) < 0)
+            return -1;
+        *bufp = a->buf + u->off;
+    }
+    *lenp = u->len;
+    return 0;
+}
+
+char *
+archive_val(archive_t a, unsigned long n, int k)
+{
+    uint32_t off;
+
+    assert(a->magic == ARCHIVE_MAGIC);
+    assert(k >= 0 && k < a->nkeys);
+
+    if (n >= a->hdr.nunits)
+        return NULL;
+    off = ((uint32_t *)(a->map + a->hdr.vals_off))[n * a->nkeys + k];
+    if (off == ARCHIVE_NOVAL || off >= a->hdr.strs_len)
+        return NULL;
+    return a->map + a->hdr.strs_off + off;
+}
+
+void
+archive_stats(archive_t a, unsigned long long *rawp, 
+              unsigned long long *codedp)
+{
+    assert(a->magic == ARCHIVE_MAGIC);
+
+    *rawp = a->raw;
+    *codedp = a->coded;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,99 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+/* Indexed unit archive written by ispsave and replayed by ispload.
+ * The XML of the init element is stored as is, then that of the units in 
+ * blocks, each optionally compressed on its own (see isp/lz.h), followed 
+ * by an index giving the block and offset of every unit and the values of
+ * selected metadata keys, so any unit can be found without reading the 
+ * ones before it.  The archive is read through mmap.  Integers are in host
+ * byte order.
+ *
+ * Functions returning int return 0 on success, -1 with errno set on 
+ * failure (EINVAL for a corrupt or truncated archive).
+ */
+
+typedef struct archive_struct *archive_t;
+
+#define ARCHIVE_BLOCKSIZE   (1024*1024)
+
+/* Create the archive at 'path', indexing the 'nkeys' metadata keys 
+ * named in 'keys'.  Units are gathered into blocks of about 'blocksize'
+ * bytes, which are compressed if 'compress' is set.
+ */
+int     archive_create(archive_t *ap, char *path, char **keys, int nkeys,
+                       int blocksize, int compress);
+
+/* Store the init element, then each unit in turn with the values of the
+ * indexed keys (vals[nkeys], NULL where a unit doesn't have one).
+ */
+int     archive_init_put(archive_t a, char *buf, int len);
+int     archive_unit_put(archive_t a, char *buf, int len, char **vals);
+
+/* Write out the index and close the archive.  Until then it is invalid.
+ * The handle is freed even on failure.
+ */
+int     archive_close(archive_t a);
+
+/* Open an archive for reading.
+ */
+int     archive_open(archive_t *ap, char *path);
+void    archive_destroy(archive_t a);
+
+/* Unit and indexed key counts, and the name of key 'k'.
+ */
+unsigned long archive_count(archive_t a);
+int     archive_nkeys(archive_t a);
+char   *archive_key(archive_t a, int k);
+
+/* Look up key 'k' by name.  Returns -1 if it isn't indexed.
+ */
+int     archive_key_find(archive_t a, char *name);
+
+/* Point *bufp at the XML of the init element or unit 'n'.  It remains
+ * valid until the next call.  Units in the same block are returned 
+ * without copying or decompressing it again.
+ */
+int     archive_init_get(archive_t a, char **bufp, int *lenp);
+int     archive_unit_get(archive_t a, unsigned long n, char **bufp, 
+                         int *lenp);
+
+/* Value of indexed key 'k' for unit 'n', or NULL if it has none.
+ */
+char   *archive_val(archive_t a, unsigned long n, int k);
+
+/* Bytes of XML stored and the size of the blocks holding it.
+ */
+void    archive_stats(archive_t a, unsigned long long *rawp, 
+                      unsigned long long *codedp);
+
+#endif /* _ARCHIVE_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
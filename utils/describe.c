@@ -0,0 +1,361 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Cached filter descriptions (see describe.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+
+#include "describe.h"
+
+#define DESCRIBE_MAGIC  0x44455343
+#define DESCRIBE_TMPL   "tmp.XXXXXX"
+#define DESCRIBE_PATH   "/bin:/usr/bin"
+
+struct describe_struct {
+    int magic;
+    char *path;                 /* cache entry, or NULL if not caching */
+    isp_init_t desc;            /* the description, once we have it */
+    int cached;                 /* desc came from the cache */
+    pid_t pid;                  /* filter writing the description, or 0 */
+    int fd;                     /* its stdout */
+};
+
+/* Find (creating if needed) the cache directory.  
+ * Returns NULL if caching is disabled or the directory is unusable.
+ */
+static char *
+_cachedir(char *buf, int len)
+{
+    char *dir = getenv("ISP_DESCRIBE_CACHE");
+    char *home;
+
+    if (dir) {
+        if (!*dir)
+            return NULL;
+        snprintf(buf, len, "%s", dir);
+    } else {
+        if (!(home = getenv("HOME")) || !*home)
+            return NULL;
+        snprintf(buf, len, "%s/.isp", home);
+        if (mkdir(buf, 0777) < 0 && errno != EEXIST)
+            return NULL;
+        snprintf(buf, len, "%s/.isp/describe", home);
+    }
+    if (mkdir(buf, 0777) < 0 && errno != EEXIST)
+        return NULL;
+    return buf;
+}
+
+/* Find 'cmd' the way execvp() will, and stat it.
+ */
+static int
+_resolve(char *cmd, char *path, int len, struct stat *sb)
+{
+    char *p, *dir, *save = NULL;
+
+    if (strchr(cmd, '/')) {
+        snprintf(path, len, "%s", cmd);
+        return stat(path, sb);
+    }
+    if (!(p = getenv("PATH")))
+        p = DESCRIBE_PATH;
+    if (!(p = strdup(p)))
+        return -1;
+    for (dir = strtok_r(p, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+        snprintf(path, len, "%s/%s", *dir ? dir : ".", cmd);
+        if (access(path, X_OK) == 0 && stat(path, sb) == 0 
+                                    && S_ISREG(sb->st_mode)) {
+            free(p);
+            return 0;
+        }
+    }
+    free(p);
+    errno = ENOENT;
+    return -1;
+}
+
+/* Digest the resolved binary path, its mtime, and argv.
+ */
+static char *
+_key(char **argv)
+{
+    char path[PATH_MAX];
+    char *buf, *key = NULL;
+    struct stat sb;
+    int i, len;
+
+    if (_resolve(argv[0], path, sizeof(path), &sb) < 0)
+        return NULL;
+    len = strlen(path) + 64;
+    for (i = 0; argv[i] != NULL; i++)
+        len += strlen(argv[i]) + 1;
+    if (!(buf = malloc(len)))
+        return NULL;
+    len = snprintf(buf, len, "%s%c%ld.%09ld%c", path, '\0', 
+                   (long)sb.st_mtim.tv_sec, (long)sb.st_mtim.tv_nsec, '\0');
+    for (i = 0; argv[i] != NULL; i++) {
+        strcpy(buf + len, argv[i]);
+        len += strlen(argv[i]) + 1;     /* keep the '\0' as a separator */
+    }
+    if (util_md5_buf(buf, len, &key) == ISP_ESUCCESS && !*key) {
+        free(key);                      /* no MD5 support */
+        key = NULL;
+    }
+    free(buf);
+    return key;
+}
+
+static int
+_load(char *path, isp_init_t *ip)
+{
+    isp_handle_t h;
+    int fd, res;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return ISP_ENOENT;
+    if ((res = isp_handle_create(&h, ISP_SINK, 1, 0, fd, -1)) != ISP_ESUCCESS) {
+        (void)close(fd);
+        return res;
+    }
+    res = isp_init_read(h, ip);
+    (void)isp_handle_destroy(h);
+    return res;
+}
+
+/* Write into a temporary name then rename into place, so concurrent
+ * readers never see a partial entry.
+ */
+static int
+_store(char *path, isp_init_t i)
+{
+    char tpath[PATH_MAX];
+    isp_handle_t h;
+    char *p;
+    int fd, res;
+
+    snprintf(tpath, sizeof(tpath), "%s", path);
+    if ((p = strrchr(tpath, '/')))
+        snprintf(p + 1, sizeof(tpath) - (p + 1 - tpath), "%s", DESCRIBE_TMPL);
+    if ((fd = mkstemp(tpath)) < 0)
+        return -1;
+    if ((res = isp_handle_create(&h, ISP_SOURCE, 1, 0, -1, fd)) 
+            != ISP_ESUCCESS) {
+        (void)close(fd);
+        goto error;
+    }
+    res = isp_init_write(h, i);
+    if (res == ISP_ESUCCESS)
+        res = isp_handle_write(h, NULL);
+    if (isp_handle_destroy(h) != ISP_ESUCCESS)
+        res = ISP_EWRITE;
+    if (res != ISP_ESUCCESS)
+        goto error;
+    if (rename(tpath, path) < 0)
+        goto error;
+    return 0;
+error:
+    (void)unlink(tpath);
+    return -1;
+}
+
+/* Run the filter with ISP_DESCRIBE set, no input, and stdout on a pipe.
+ * Its stderr is discarded, since a filter that predates descriptions
+ * will complain about the empty input before we fall back.  Our end of
+ * the pipe is close-on-exec so that coprocs started meanwhile do not
+ * hold it open.
+ */
+static int
+_spawn(describe_t d, char **argv)
+{
+    int p[2], fd;
+
+    if (pipe2(p, O_CLOEXEC) < 0)
+        return -1;
+    switch ((d->pid = fork())) {
+        case -1:
+            (void)close(p[0]);
+            (void)close(p[1]);
+            d->pid = 0;
+            return -1;
+        case 0:
+            (void)close(p[0]);
+            if (dup2(p[1], STDOUT_FILENO) < 0)
+                exit(1);
+            (void)close(p[1]);
+            if ((fd = open("/dev/null", O_RDWR)) < 0)
+                exit(1);
+            if (dup2(fd, STDIN_FILENO) < 0 || dup2(fd, STDERR_FILENO) < 0)
+                exit(1);
+            if (setenv("ISP_DESCRIBE", "1", 1) < 0)
+                exit(1);
+            execvp(argv[0], argv);
+            exit(1);
+            /*NOTREACHED*/
+        default:
+            (void)close(p[1]);
+            d->fd = p[0];
+            break;
+    }
+    return 0;
+}
+
+int
+describe_start(describe_t *dp, char **argv)
+{
+    char dir[PATH_MAX];
+    describe_t d;
+    char *key;
+
+    if (!(d = calloc(1, sizeof(struct describe_struct))))
+        return -1;
+    d->magic = DESCRIBE_MAGIC;
+    d->fd = -1;
+
+    if (_cachedir(dir, sizeof(dir)) && (key = _key(argv))) {
+        if (asprintf(&d->path, "%s/%s", dir, key) < 0)
+            d->path = NULL;
+        free(key);
+        if (d->path && _load(d->path, &d->desc) == ISP_ESUCCESS) {
+            d->cached = 1;
+            goto done;
+        }
+    }
+    if (_spawn(d, argv) < 0) {
+        describe_destroy(d);
+        return -1;
+    }
+done:
+    *dp = d;
+    return 0;
+}
+
+/* Read the rest of the filter's output, so that it is not killed by 
+ * SIGPIPE on its way out after we have the description.
+ */
+static void
+_drain(describe_t d)
+{
+    char buf[4096];
+    int flags;
+
+    if (d->fd < 0)
+        return;
+    if ((flags = fcntl(d->fd, F_GETFL, 0)) >= 0)
+        (void)fcntl(d->fd, F_SETFL, flags & ~O_NONBLOCK);
+    while (util_read(d->fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+static void
+_reap(describe_t d, int *sp)
+{
+    if (d->fd >= 0) {
+        (void)close(d->fd);
+        d->fd = -1;
+    }
+    if (d->pid > 0) {
+        if (util_waitpid(d->pid, sp, 0) < 0 && sp)
+            *sp = -1;
+        d->pid = 0;
+    }
+}
+
+int
+describe_finish(describe_t d, isp_init_t *ip)
+{
+    isp_filter_t f;
+    isp_handle_t h;
+    int fd, res, s = -1;
+
+    if (!d->desc && d->pid > 0) {
+        if ((fd = dup(d->fd)) < 0)      /* handle closes its copy */
+            res = ISP_EBADF;
+        else if ((res = isp_handle_create(&h, ISP_SINK, 1, 0, fd, -1)) 
+                != ISP_ESUCCESS)
+            (void)close(fd);
+        else {
+            res = isp_init_read(h, &d->desc);
+            (void)isp_handle_destroy(h);
+        }
+        if (res != ISP_ESUCCESS)
+            d->desc = NULL;
+        _drain(d);
+        _reap(d, &s);
+        if (d->desc && (s == -1 || !WIFEXITED(s) || WEXITSTATUS(s) != 0 
+                        || isp_init_peek(d->desc, &f) != ISP_ESUCCESS)) {
+            isp_init_destroy(d->desc);
+            d->desc = NULL;
+        }
+        if (d->desc && d->path && !isp_init_nocache_get(d->desc))
+            (void)_store(d->path, d->desc);
+    }
+    if (!d->desc)
+        return -1;
+    *ip = d->desc;
+    d->desc = NULL;
+    return 0;
+}
+
+int
+describe_cached(describe_t d)
+{
+    return d->cached;
+}
+
+void
+describe_destroy(describe_t d)
+{
+    if (d->magic != DESCRIBE_MAGIC)
+        return;
+    _reap(d, NULL);
+    if (d->desc)
+        isp_init_destroy(d->desc);
+    if (d->path)
+        free(d->path);
+    d->magic = 0;
+    free(d);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,64 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _DESCRIBE_H
+#define _DESCRIBE_H
+
+/* Descriptions of filters (see isp_init_describe()), obtained by running
+ * the filter with ISP_DESCRIBE=1 and no input.  Each description is cached
+ * on disk, keyed on a digest of the resolved path and mtime of the filter
+ * binary and its full argv, so the filter is run only the first time.
+ * The cache directory is $ISP_DESCRIBE_CACHE (an empty value disables
+ * the cache), or by default $HOME/.isp/describe.  Descriptions marked 
+ * with isp_init_nocache_set() are not cached.
+ */
+
+typedef struct describe_struct *describe_t;
+
+/* Look up the description of 'argv' in the cache, or if it is not there,
+ * start the filter to obtain it, without waiting for the result.
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int     describe_start(describe_t *dp, char **argv);
+
+/* Return the description in *ip (an init element the caller must 
+ * destroy), waiting for the filter if needed and caching the result.
+ * Returns 0 on success, -1 if the filter does not support descriptions.
+ */
+int     describe_finish(describe_t d, isp_init_t *ip);
+
+/* Reap the filter if still running and free.
+ */
+void    describe_destroy(describe_t d);
+
+/* Returns 1 if the description came from the cache.
+ */
+int     describe_cached(describe_t d);
+
+#endif /* _DESCRIBE_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,269 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Adaptive fanout for isprun.
+ *
+ * In auto mode, time is divided into measurement windows.  A window closes
+ * once at least FANOUT_WINDOW_SEC seconds have elapsed and at least 'cur'
+ * units have completed (so every slot has had a chance to contribute).
+ * At the close of each window the completion rate is compared with the
+ * previous window and the fanout is moved one step:
+ * - down, if free memory is below FANOUT_MINMEM_PCT of total, or the
+ *   1 minute load average exceeds the number of online CPUs;
+ * - in the same direction as the last step, if throughput improved;
+ * - in the opposite direction, if throughput got worse;
+ * - up, if throughput is unchanged (within FANOUT_NOISE_PCT) and there
+ *   are idle CPUs; otherwise it is left alone.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include <isp/isp.h>
+#include "fanout.h"
+
+#define FANOUT_MAGIC        0x46414e4f
+
+#define FANOUT_DEFAULT      4   /* fixed fanout, and auto mode start value */
+#define FANOUT_WINDOW_SEC   2.0 /* minimum measurement window */
+#define FANOUT_NOISE_PCT    5   /* rate changes below this are noise */
+#define FANOUT_MINMEM_PCT   10  /* back off when free memory is below this */
+
+struct fanout_struct {
+    int magic;
+    int autoflag;           /* 1 = adaptive, 0 = fixed */
+    unsigned long cur;      /* current fanout (0 = unlimited if fixed) */
+    unsigned long min;      /* auto: lower bound */
+    unsigned long max;      /* auto: upper bound */
+    int dir;                /* auto: direction of last step (+1/-1) */
+    long ncpus;             /* online CPUs */
+    struct timeval start;   /* auto: start of measurement window */
+    unsigned long done;     /* auto: completions in current window */
+    double rate;            /* auto: completions/sec in last window */
+};
+
+static long
+_ncpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? n : 1;
+}
+
+/* Return available memory as a percentage of total, using MemAvailable 
+ * from /proc/meminfo (which counts reclaimable page cache) if present,
+ * otherwise free physical pages.
+ */
+static int
+_memfree_pct(void)
+{
+    unsigned long long total = 0, avail = 0, val;
+    char line[128];
+    FILE *fp;
+
+    if ((fp = fopen("/proc/meminfo", "r"))) {
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "MemTotal: %llu", &val) == 1)
+                total = val;
+            else if (sscanf(line, "MemAvailable: %llu", &val) == 1)
+                avail = val;
+        }
+        fclose(fp);
+    }
+    if (total == 0 || avail == 0) {
+        long phys = sysconf(_SC_PHYS_PAGES);
+        long avphys = sysconf(_SC_AVPHYS_PAGES);
+
+        if (phys <= 0 || avphys < 0)
+            return 100; /* unknown - don't let it hold us back */
+        total = phys;
+        avail = avphys;
+    }
+    return (int)(avail * 100 / total);
+}
+
+static double
+_loadavg(void)
+{
+    double load[1];
+
+    if (getloadavg(load, 1) < 1)
+        return 0.0;
+    return load[0];
+}
+
+static double
+_elapsed(struct timeval *start)
+{
+    struct timeval now, delta;
+
+    if (gettimeofday(&now, NULL) < 0)
+        isp_errx(1, "gettimeofday: %m");
+    timersub(&now, start, &delta);
+    return delta.tv_sec + delta.tv_usec / 1E6;
+}
+
+/* Parse a count at 's', assigning it to *vp and the first character 
+ * after it to *endp.  Unlike bare strtoul(), refuse a sign (so "-1" does
+ * not wrap around to a huge value) and an overflow (errno is ERANGE).
+ */
+static int
+_parse_count(char *s, char **endp, unsigned long *vp)
+{
+    if (!isdigit((unsigned char)*s))
+        return -1;
+    errno = 0;
+    *vp = strtoul(s, endp, 10);
+    if (*vp == ULONG_MAX && errno == ERANGE)
+        return -1;
+    return 0;
+}
+
+int
+fanout_create(fanout_t *fp, char *spec)
+{
+    fanout_t f;
+    char *end;
+    int saved;
+
+    if (!(f = (fanout_t)calloc(1, sizeof(struct fanout_struct))))
+        isp_errx(1, "fanout_create: out of memory");
+    f->magic = FANOUT_MAGIC;
+    f->ncpus = _ncpus();
+    f->dir = 1;
+    errno = 0;
+
+    if (spec == NULL) {
+        f->cur = FANOUT_DEFAULT;
+    } else if (!strncmp(spec, "auto", 4)) {
+        f->autoflag = 1;
+        f->min = 1;
+        f->max = 2 * f->ncpus;
+        spec += 4;
+        if (*spec == ':') {
+            if (_parse_count(spec + 1, &end, &f->min) < 0 || *end != ':')
+                goto error;
+            spec = end;
+            if (_parse_count(spec + 1, &end, &f->max) < 0 || *end != '\0')
+                goto error;
+        } else if (*spec != '\0')
+            goto error;
+        if (f->min < 1 || f->max < f->min)
+            goto error;
+        f->cur = FANOUT_DEFAULT;
+        if (f->cur > f->max)
+            f->cur = f->max;
+        if (f->cur < f->min)
+            f->cur = f->min;
+        if (gettimeofday(&f->start, NULL) < 0)
+            isp_errx(1, "gettimeofday: %m");
+    } else {
+        if (_parse_count(spec, &end, &f->cur) < 0 || *end != '\0')
+            goto error;
+    }
+
+    *fp = f;
+    return 0;
+error:
+    saved = errno;
+    fanout_destroy(f);
+    errno = saved;
+    return -1;
+}
+
+void
+fanout_destroy(fanout_t f)
+{
+    assert(f->magic == FANOUT_MAGIC);
+    f->magic = 0;
+    free(f);
+}
+
+unsigned long
+fanout_get(fanout_t f)
+{
+    assert(f->magic == FANOUT_MAGIC);
+    return f->cur;
+}
+
+void
+fanout_complete(fanout_t f, unsigned long n)
+{
+    double elapsed, rate, load;
+    int memfree;
+    int step = 0;
+
+    assert(f->magic == FANOUT_MAGIC);
+    if (!f->autoflag)
+        return;
+
+    f->done += n;
+    if (f->done < f->cur || (elapsed = _elapsed(&f->start)) < FANOUT_WINDOW_SEC)
+        return;
+
+    rate = f->done / elapsed;
+    load = _loadavg();
+    memfree = _memfree_pct();
+
+    if (memfree < FANOUT_MINMEM_PCT || load > f->ncpus)
+        step = -1;
+    else if (rate > f->rate * (100 + FANOUT_NOISE_PCT) / 100)
+        step = f->dir;
+    else if (rate < f->rate * (100 - FANOUT_NOISE_PCT) / 100)
+        step = -f->dir;
+    else if (load < f->ncpus - 1)
+        step = 1;
+
+    if (step < 0 && f->cur == f->min)
+        step = 0;
+    if (step > 0 && f->cur == f->max)
+        step = 0;
+    if (step != 0) {
+        f->cur += step;
+        f->dir = step;
+        isp_err("fanout %lu (%.2f units/s, load %.2f, %d%% mem free)",
+                f->cur, rate, load, memfree);
+    }
+
+    f->rate = rate;
+    f->done = 0;
+    if (gettimeofday(&f->start, NULL) < 0)
+        isp_errx(1, "gettimeofday: %m");
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,57 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _FANOUT_H
+#define _FANOUT_H
+
+/* Fanout controller for isprun.  A fanout is either a fixed number of
+ * coprocesses (0 = unlimited), or "auto[:min:max]", in which case the
+ * number is adjusted between min and max by hill-climbing on the observed
+ * unit completion rate, backing off when the system load average exceeds
+ * the number of CPUs or free memory runs low.
+ */
+
+typedef struct fanout_struct *fanout_t;
+
+/* Parse spec and create a controller.  Returns 0 on success, -1 if spec
+ * is malformed (errno is ERANGE if a value in it overflows).
+ */
+int             fanout_create(fanout_t *fp, char *spec);
+void            fanout_destroy(fanout_t f);
+
+/* Current maximum number of concurrent coprocesses (0 = unlimited).
+ */
+unsigned long   fanout_get(fanout_t f);
+
+/* Note the completion of 'n' units.  In auto mode this may change
+ * the value returned by fanout_get().  Changes are reported on stderr.
+ */
+void            fanout_complete(fanout_t f, unsigned long n);
+
+#endif /* _FANOUT_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
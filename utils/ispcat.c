@@ -25,6 +25,13 @@
 
 /* Create a stream of units from a file glob on command line,
  * or a list of files on stdin.
+ *
+ * Directories are walked (-r) by a pool of threads, which use d_type to
+ * avoid a stat per entry and pass the regular files they find back to 
+ * the main thread.  Only the main thread calls into libisp.  Units are
+ * written as soon as files are found, in no particular order, unless 
+ * --sort is given, in which case all paths are collected and sorted 
+ * before any unit is written.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -42,14 +49,20 @@
 #include <unistd.h>
 #include <assert.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include <isp/isp.h>
 
-#define OPT_STRING "rf:b:"
+#define DEFAULT_THREADS 8
+
+#define OPT_STRING "rf:b:st:"
 static const struct option long_options[] = {
     {"recursive", no_argument, 0, 'r'},
     {"filekey", required_argument, 0, 'f'},
     {"basekey", required_argument, 0, 'b'},
+    {"sort", no_argument, 0, 's'},
+    {"threads", required_argument, 0, 't'},
     {0,0,0,0},
 };
 static const struct option *longopts = long_options;
@@ -59,70 +72,437 @@ static char *basekey = "basename";
 
 static char *progname = NULL;
 
+/* Paths found so far, when sorting.
+ */
+static char **sorted = NULL;
+static int nsorted = 0;
+static int sortlen = 0;
+static int sort = 0;
+
+/* An open directory whose subdirectories are still queued.  They are
+ * opened relative to it, so the walk never resolves a full path again.
+ * References are dropped under walk_lock.
+ */
+typedef struct {
+    int                     fd;
+    int                     refs;
+} walk_parent_t;
+
+/* Simple path queue.  The List type is not used here because its
+ * node allocator is not thread safe.
+ */
+typedef struct walk_ent_struct {
+    struct walk_ent_struct *next;
+    char                   *path;
+    walk_parent_t          *parent;  /* directories: NULL if named by user */
+    char                   *name;    /* last component of path */
+    int                     follow;  /* entry was a symlink when listed */
+} walk_ent_t;
+
+typedef struct {
+    walk_ent_t             *head;
+    walk_ent_t            **tail;
+} walk_q_t;
+
+/* State shared by the walkers and the main thread, under walk_lock.
+ */
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  walk_dirs_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  walk_files_cv = PTHREAD_COND_INITIALIZER;
+static walk_q_t        walk_dirs;       /* directories to scan */
+static walk_q_t        walk_files;      /* regular files found */
+static int             walk_busy = 0;   /* walkers scanning a directory */
+static int             walk_quit = 0;
+static char           *walk_err = NULL; /* first error encountered */
+static pthread_t      *walkers = NULL;
+static int             nwalkers = DEFAULT_THREADS;
+static int             walk_started = 0;
+
 static void 
 usage(void)
 {
     fprintf(stderr, 
-            "Usage: %s [-r] [-f filekey] [-b basekey] file1 [file2...]\n", 
-            progname);
+      "Usage: %s [-r [-t threads]] [-s] [-f filekey] [-b basekey]\n"
+      "          file1 [file2...]\n", progname);
     exit(1);
 }
 
+static void
+_q_init(walk_q_t *q)
+{
+    q->head = NULL;
+    q->tail = &q->head;
+}
+
+static walk_ent_t *
+_q_put(walk_q_t *q, char *path)
+{
+    walk_ent_t *e;
+
+    if (!(e = malloc(sizeof(walk_ent_t))))
+        isp_errx(1, "out of memory");
+    e->path = path;
+    e->parent = NULL;
+    e->name = path;
+    e->follow = 1;
+    e->next = NULL;
+    *q->tail = e;
+    q->tail = &e->next;
+    return e;
+}
+
+/* Returns entry (caller must free) or NULL if empty.
+ */
+static walk_ent_t *
+_q_get_ent(walk_q_t *q)
+{
+    walk_ent_t *e = q->head;
+
+    if (e && !(q->head = e->next))
+        q->tail = &q->head;
+    return e;
+}
+
+/* Returns path (caller must free) or NULL if empty.
+ */
+static char *
+_q_get(walk_q_t *q)
+{
+    walk_ent_t *e = _q_get_ent(q);
+    char *path;
+
+    if (!e)
+        return NULL;
+    path = e->path;
+    free(e);
+    return path;
+}
+
+/* Move the contents of q2 to the front of q1.
+ */
+static void
+_q_splice_front(walk_q_t *q1, walk_q_t *q2)
+{
+    if (q2->head) {
+        *q2->tail = q1->head;
+        if (!q1->head)
+            q1->tail = q2->tail;
+        q1->head = q2->head;
+        _q_init(q2);
+    }
+}
+
+/* Call with walk_lock held.
+ */
+static void
+_parent_put(walk_parent_t *p)
+{
+    if (p && --p->refs == 0) {
+        (void)close(p->fd);
+        free(p);
+    }
+}
+
+/* Move the contents of q2 to the end of q1.
+ */
+static void
+_q_splice(walk_q_t *q1, walk_q_t *q2)
+{
+    if (q2->head) {
+        *q1->tail = q2->head;
+        q1->tail = q2->tail;
+        _q_init(q2);
+    }
+}
+
+/* Create, fill in, and write one unit.
+ */
+static void
+_emit(isp_handle_t h, char *path)
+{
+    isp_unit_t u;
+    int res;
+    char *p, *base;
+
+    if ((res = isp_unit_create(&u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_create: %s", isp_errstr(res));
+    if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
+    if ((res = isp_file_source(u, filekey, path, ISP_RDONLY)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_file_source: %s", isp_errstr(res));
+    if (!(base = strdup(path)))
+        isp_errx(1, "out of memory");
+    if ((p = strrchr(base, '.')) && p != base)
+        *p = '\0';
+    if ((res = isp_meta_source(u, basekey, ISP_STR, basename(base))) 
+            != ISP_ESUCCESS)
+        isp_errx(1, "isp_meta_source: %s", isp_errstr(res));
+    free(base);
+    if ((res = isp_unit_fini(u, ISP_ESUCCESS)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_fini: %s", isp_errstr(res));
+    if ((res = isp_unit_write(h, u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    isp_unit_destroy(u);
+}
+
+/* Emit a unit for path now, or save it for later if sorting.
+ * Takes ownership of path.
+ */
+static void
+_found(isp_handle_t h, char *path)
+{
+    if (sort) {
+        if (nsorted == sortlen) {
+            sortlen = sortlen ? sortlen * 2 : 1024;
+            if (!(sorted = realloc(sorted, sortlen * sizeof(char *))))
+                isp_errx(1, "out of memory");
+        }
+        sorted[nsorted++] = path;
+    } else {
+        _emit(h, path);
+        free(path);
+    }
+}
+
+static int
+_pathcmp(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+/* Scan one directory, adding subdirectories to dirs and regular files to
+ * files.  The directory is opened relative to its parent, and unless it
+ * was listed as a symlink, a symlink put in its place since is not 
+ * followed.  On success *selfp holds a reference for each subdirectory 
+ * queued, plus one for the caller.  Returns NULL or an error message 
+ * (caller must free).
+ */
+static char *
+_walk_dir(walk_ent_t *e, walk_q_t *dirs, walk_q_t *files, 
+          walk_parent_t **selfp)
+{
+    DIR *dir = NULL;
+    struct dirent *d;
+    struct stat sb;
+    walk_parent_t *self;
+    walk_ent_t *sub;
+    char *newpath;
+    char *msg = NULL;
+    int fd, dfd = -1, type, follow;
+
+    fd = openat(e->parent ? e->parent->fd : AT_FDCWD, e->name, 
+                O_RDONLY | O_DIRECTORY | (e->follow ? 0 : O_NOFOLLOW));
+    if (fd < 0 || (dfd = dup(fd)) < 0 || !(dir = fdopendir(dfd))) {
+        if (asprintf(&msg, "%s: %m", e->path) < 0)
+            msg = NULL;
+        if (dfd >= 0)
+            (void)close(dfd);
+        if (fd >= 0)
+            (void)close(fd);
+        return msg ? msg : strdup("out of memory");
+    }
+    if (!(self = malloc(sizeof(walk_parent_t)))) {
+        (void)closedir(dir);
+        (void)close(fd);
+        return strdup("out of memory");
+    }
+    self->fd = fd;
+    self->refs = 1;
+    *selfp = self;
+    while (!msg && (d = readdir(dir))) {
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+            continue;
+        if (asprintf(&newpath, "%s/%s", e->path, d->d_name) < 0) {
+            msg = strdup("out of memory");
+            break;
+        }
+        /* Only stat if the file system doesn't tell us the type, 
+         * or to follow a symlink (relative to the open directory).
+         */
+        type = d->d_type;
+        if (type == DT_UNKNOWN) {
+            if (fstatat(fd, d->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0)
+                goto stat_err;
+            if (S_ISLNK(sb.st_mode))
+                type = DT_LNK;
+        }
+        follow = (type == DT_LNK);
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            if (fstatat(fd, d->d_name, &sb, 0) < 0)
+                goto stat_err;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR 
+                 : S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            sub = _q_put(dirs, newpath);
+            sub->parent = self;
+            sub->name = newpath + strlen(e->path) + 1;
+            sub->follow = follow;
+            self->refs++;
+        } else if (type == DT_REG)
+            (void)_q_put(files, newpath);
+        else {
+            if (asprintf(&msg, "%s: not a regular file", newpath) < 0)
+                msg = strdup("out of memory");
+            free(newpath);
+        }
+        continue;
+stat_err:
+        if (asprintf(&msg, "%s: %m", newpath) < 0)
+            msg = strdup("out of memory");
+        free(newpath);
+    }
+    if (closedir(dir) < 0 && !msg) {
+        if (asprintf(&msg, "%s: %m", e->path) < 0)
+            msg = strdup("out of memory");
+    }
+    return msg;
+}
+
+static void *
+_walker(void *arg)
+{
+    walk_q_t dirs, files;
+    walk_parent_t *self;
+    walk_ent_t *e;
+    char *msg;
+
+    _q_init(&dirs);
+    _q_init(&files);
+
+    pthread_mutex_lock(&walk_lock);
+    for (;;) {
+        while (!walk_quit && !(e = _q_get_ent(&walk_dirs)))
+            pthread_cond_wait(&walk_dirs_cv, &walk_lock);
+        if (walk_quit)
+            break;
+        walk_busy++;
+        pthread_mutex_unlock(&walk_lock);
+
+        self = NULL;
+        msg = _walk_dir(e, &dirs, &files, &self);
+
+        pthread_mutex_lock(&walk_lock);
+        _parent_put(e->parent);
+        _parent_put(self);
+        free(e->path);
+        free(e);
+        walk_busy--;
+        if (msg) {
+            if (!walk_err)
+                walk_err = msg;
+            else
+                free(msg);
+            walk_quit = 1;
+        }
+        /* Depth first, so a directory's descriptor is released as soon
+         * as its subdirectories are opened, not after a whole level.
+         */
+        _q_splice_front(&walk_dirs, &dirs);
+        _q_splice(&walk_files, &files);
+        pthread_cond_broadcast(&walk_dirs_cv);
+        pthread_cond_signal(&walk_files_cv);
+    }
+    pthread_mutex_unlock(&walk_lock);
+
+    return NULL;
+}
+
+/* Queue a directory for the walkers, starting them if necessary.
+ */
+static void
+_walk_add(char *path)
+{
+    int i, e;
+
+    if (!walk_started) {
+        _q_init(&walk_dirs);
+        _q_init(&walk_files);
+        if (!(walkers = malloc(nwalkers * sizeof(pthread_t))))
+            isp_errx(1, "out of memory");
+        for (i = 0; i < nwalkers; i++) {
+            if ((e = pthread_create(&walkers[i], NULL, _walker, NULL)))
+                isp_errx(1, "pthread_create: %s", strerror(e));
+        }
+        walk_started = 1;
+    }
+    pthread_mutex_lock(&walk_lock);
+    (void)_q_put(&walk_dirs, path);
+    pthread_cond_signal(&walk_dirs_cv);
+    pthread_mutex_unlock(&walk_lock);
+}
+
+/* Hand files found by the walkers to _found().  
+ * If wait is set, block until the walkers have run out of directories.
+ */
+static void
+_walk_drain(isp_handle_t h, int wait)
+{
+    walk_q_t files;
+    char *path;
+
+    if (!walk_started)
+        return;
+    _q_init(&files);
+    pthread_mutex_lock(&walk_lock);
+    for (;;) {
+        _q_splice(&files, &walk_files);
+        if (files.head) {
+            pthread_mutex_unlock(&walk_lock);
+            while ((path = _q_get(&files)))
+                _found(h, path);
+            pthread_mutex_lock(&walk_lock);
+            continue;
+        }
+        if (walk_err || !wait)
+            break;
+        if (walk_busy == 0 && !walk_dirs.head)
+            break;
+        pthread_cond_wait(&walk_files_cv, &walk_lock);
+    }
+    pthread_mutex_unlock(&walk_lock);
+
+    if (walk_err)
+        isp_errx(1, "%s", walk_err);
+}
+
+static void
+_walk_fini(void)
+{
+    int i;
+
+    if (!walk_started)
+        return;
+    pthread_mutex_lock(&walk_lock);
+    walk_quit = 1;
+    pthread_cond_broadcast(&walk_dirs_cv);
+    pthread_mutex_unlock(&walk_lock);
+    for (i = 0; i < nwalkers; i++)
+        pthread_join(walkers[i], NULL);
+    free(walkers);
+}
+
 static void 
 ispcat(isp_handle_t h, char *path, int recursive)
 {
     struct stat sb;
+    char *cpy;
 
     if (stat(path, &sb) < 0)
         isp_errx(1, "%s: %m", path);
+    if (!(cpy = strdup(path)))
+        isp_errx(1, "out of memory");
 
     if (recursive && S_ISDIR(sb.st_mode)) {
-        DIR *dir;
-        struct dirent *d;
-        char *newpath;
-
-        if (!(dir = opendir(path)))
-            isp_errx(1, "%s: %m", path);
-
-        while ((d = readdir(dir))) {
-            if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
-                continue;
-            if (asprintf(&newpath, "%s/%s", path, d->d_name) < 0)
-                isp_errx(1, "out of memory");
-            ispcat(h, newpath, recursive); /* RECURSE */
-            free(newpath);
-        }
-        if (closedir(dir) < 0)
-            isp_errx(1, "%s: %m", path);
+        _walk_add(cpy);
 
     } else if (! S_ISREG(sb.st_mode)) {
         isp_errx(1, "%s: not a regular file", path);
 
     } else { /* regular file */
-        isp_unit_t u;
-        int res;
-        char *p, *base;
-
         if (access(path, R_OK) != 0)
             isp_errx(1, "%s: no read access", path);
-        if ((res = isp_unit_create(&u)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_unit_create: %s", isp_errstr(res));
-        if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
-        if ((res = isp_file_source(u, filekey, path, ISP_RDONLY)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_file_source: %s", isp_errstr(res));
-        if (!(base = strdup(path)))
-            isp_errx(1, "out of memory");
-        if ((p = strrchr(base, '.')) && p != base)
-            *p = '\0';
-        if ((res = isp_meta_source(u, basekey, ISP_STR, basename(base))) != ISP_ESUCCESS)
-            isp_errx(1, "isp_meta_source: %s", isp_errstr(res));
-        free(base);
-        if ((res = isp_unit_fini(u, ISP_ESUCCESS)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_unit_fini: %s", isp_errstr(res));
-        if ((res = isp_unit_write(h, u)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
-        isp_unit_destroy(u);
+        _found(h, cpy);
     }
 }
 
@@ -174,6 +554,16 @@ main(int argc, char *argv[])
             case 'b':   /* --basekey */
                 basekey = optarg;
                 break;
+            case 's':   /* --sort */
+                sort = 1;
+                break;
+            case 't':   /* --threads */
+                nwalkers = strtoul(optarg, NULL, 10);
+                if (nwalkers < 1) {
+                    fprintf(stderr, "%s: invalid thread count\n", progname);
+                    exit(1);
+                }
+                break;
             default:
                 usage();
                 /*NOTREACHED*/
@@ -186,8 +576,10 @@ main(int argc, char *argv[])
 
     /* process list of files on cmd line */
     if (optind < argc) {
-        while (optind < argc)
+        while (optind < argc) {
             ispcat(h, argv[optind++], recursive);
+            _walk_drain(h, 0);
+        }
 
     /* process list of files on stdin */
     } else {
@@ -196,10 +588,25 @@ main(int argc, char *argv[])
         while (fgets(buf, sizeof(buf), stdin) != NULL) {
             if (buf[strlen(buf) - 1] == '\n')
                 buf[strlen(buf) - 1] = '\0';
-            if (strlen(buf) > 0)
+            if (strlen(buf) > 0) {
                 ispcat(h, buf, recursive);
+                _walk_drain(h, 0);
+            }
         }
     } 
+    _walk_drain(h, 1);
+    _walk_fini();
+
+    if (sort) {
+        int i;
+
+        qsort(sorted, nsorted, sizeof(char *), _pathcmp);
+        for (i = 0; i < nsorted; i++) {
+            _emit(h, sorted[i]);
+            free(sorted[i]);
+        }
+        free(sorted);
+    }
 
     _finalize(h);
 
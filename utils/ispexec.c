@@ -25,6 +25,10 @@
 
 /* This filter executes "cmd <infile >outfile".
  * "infile" is in the ISP stream on input; "outfile" is added if succesful.
+ * "cmd" may be a pipeline of commands separated by "::", in which case
+ * they are connected by pipes and only the last one writes "outfile".
+ * With a memo cache, a command already run on identical input (same
+ * command line, environment, and input digest) is not run again.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -41,61 +45,146 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <assert.h>
 #include <signal.h>
+#include <errno.h>
 
 #include <isp/util.h>
 #include <isp/isp.h>
+#include <isp/isp_private.h>
 
-#define OPT_STRING "f:"
+#include "memo.h"
+
+#define DEFAULT_CACHE_SIZE  "1G"
+#define STAGE_SEP           "::"
+
+typedef struct {
+    char          **argv;       /* whole command line (memo key) */
+    char         ***stages;     /* argv split at STAGE_SEP */
+    int             nstages;
+    int            *results;    /* per-stage results of the last run */
+    struct rusage  *ru;         /* per-stage resource usage, ditto */
+} cmd_t;
+
+#define OPT_STRING "f:c:s:"
 static const struct option long_options[] = {
     {"filekey", no_argument, 0, 'f'},
+    {"cache", required_argument, 0, 'c'},
+    {"cache-size", required_argument, 0, 's'},
     {0,0,0,0},
 };
 static const struct option *longopts = long_options;
 
 static char *progname = NULL;
 static char *filekey = "file";
+static memo_t memo = NULL;
 
 static void 
 usage(void)
 {
-    fprintf(stderr, "Usage: %s [-f filekey] -- command [args...]\n", progname);
+    fprintf(stderr, 
+        "Usage: %s [-f filekey] [-c cachedir [-s size]] -- command [args...]"
+        " [:: command [args...]]...\n", progname);
     exit(1);
 }
 
+/* Compute the memo key for running nargv on ipath (NULL on failure, which
+ * just means the cache is bypassed for this unit).  The input is hashed 
+ * only if the file element does not already carry its digest.
+ */
+static char *
+_memo_key(isp_unit_t u, char **nargv, char *ipath, off_t off, off_t len)
+{
+    char *inputs[2] = { NULL, NULL };
+    char *digest;
+    char *key = NULL;
+
+    if (isp_file_md5_get(u, filekey, &digest) == ISP_ESUCCESS 
+            && strlen(digest) > 0) {
+        inputs[0] = digest;
+        key = memo_key(memo, nargv, inputs);
+    } else if (util_md5_digest_range(ipath, off, len, &inputs[0]) 
+            == ISP_ESUCCESS) {
+        key = memo_key(memo, nargv, inputs);
+        free(inputs[0]);
+    }
+    return key;
+}
+
+static unsigned long
+_tvmsec(struct timeval *tv)
+{
+    return tv->tv_sec * 1000L + tv->tv_usec / 1000;
+}
+
 static int 
 runcmd(isp_unit_t u, void *arg)
 {
-    char **nargv = (char **)arg;
+    cmd_t *cmd = (cmd_t *)arg;
     int ifd, ofd;
     char *ipath, *opath;
-    int errnum;
-    int res;
+    char *key = NULL;
+    unsigned long off, len;
+    pid_t feeder = -1;
+    struct stat sb;
+    int res, i;
 
     /* Fetch the input file path name and open it on 'ifd'.
+     * If the file is a slice, feed just that range through a pipe.
      */
-    res = isp_file_access(u, filekey, &ipath, ISP_RDONLY);
+    res = isp_file_access(u, filekey, &ipath, ISP_RDONLY | ISP_SLICEOK);
     if (res != ISP_ESUCCESS)
         goto done;
-    if ((ifd = open(ipath, O_RDONLY)) < 0) {
+    if ((res = isp_file_slice_get(u, filekey, &off, &len)) != ISP_ESUCCESS)
+        goto done;
+    if (stat(ipath, &sb) < 0) {
         res = ISP_ENOENT;
         goto done;
     }
 
-    /* Create the output file and open it on 'ofd'.
+    /* If the result is in the memo cache, use a copy of it.
      */
-    if ((res = util_mktmp(&ofd, &opath)) != ISP_ESUCCESS)
+    if (memo && (key = _memo_key(u, cmd->argv, ipath, off, len))) {
+        if (memo_lookup(memo, key, &opath) == 1)
+            goto splice;
+    }
+
+    if (off == 0 && len == sb.st_size) {
+        if ((ifd = open(ipath, O_RDONLY)) < 0) {
+            res = ISP_ENOENT;
+            goto done;
+        }
+    } else if ((res = util_openrange(ipath, off, len, &ifd, &feeder))
+            != ISP_ESUCCESS)
         goto done;
 
-    /* Run the filter with stdin redirected from ifd, 
+    /* Create the output file and open it on 'ofd'.
+     */
+    if ((res = util_mktmp(&ofd, &opath)) != ISP_ESUCCESS) {
+        (void)close(ifd);
+        goto reap;
+    }
+
+    /* Run the filter (pipeline) with stdin redirected from ifd, 
      * stdout redirected to ofd.  Stderr is not redirected.
+     * Record each stage's result and CPU time, even on failure.
      */
-    res = util_runcmd(nargv, &errnum, ifd, ofd, FDIGNORE);
+    res = util_runpipe(cmd->stages, cmd->nstages, cmd->results, cmd->ru,
+                       ifd, ofd, FDIGNORE);
+    for (i = 0; i < cmd->nstages; i++) {
+        int r = isp_result_stage_add(u, i, _tvmsec(&cmd->ru[i].ru_utime),
+                                     _tvmsec(&cmd->ru[i].ru_stime), 
+                                     cmd->results[i]);
+        if (res == ISP_ESUCCESS)
+            res = r;
+    }
     if (res != ISP_ESUCCESS) {
+        (void)close(ifd);
+        (void)close(ofd);
         unlink(opath);
-        goto done;
+        goto reap;
     }
 
     /* Close the input and output files.
@@ -103,14 +192,29 @@ runcmd(isp_unit_t u, void *arg)
     if (close(ifd) < 0) {
         res = ISP_EREAD; /* unlikeley */
         unlink(opath);
-        goto done;
+        goto reap;
     }
     if (close(ofd) < 0) {
         res = ISP_EWRITE;
         unlink(opath);
-        goto done;
+        goto reap;
     }
 
+reap:
+    /* The feeder's status is not interesting: a command that stops 
+     * reading early gets it killed with SIGPIPE.
+     */
+    if (feeder != -1)
+        (void)util_waitpid(feeder, NULL, 0);
+    if (res != ISP_ESUCCESS)
+        goto done;
+
+    /* Remember the result (best effort).
+     */
+    if (key && memo_store(memo, key, opath) < 0)
+        isp_err("memo_store: %m");
+
+splice:
     /* Source new file and sink old one.
      */
     if ((res = isp_file_sink(u, filekey)) != ISP_ESUCCESS) {
@@ -124,9 +228,59 @@ runcmd(isp_unit_t u, void *arg)
     }
 
 done:
+    if (key)
+        free(key);
     return res;
 }
 
+/* Split the command line at STAGE_SEP into a pipeline of commands.
+ * Returns -1 if any command is empty.
+ */
+static int
+_cmd_create(cmd_t *cmd, int argc, char *argv[])
+{
+    char **split;
+    int res, i;
+
+    if ((res = util_argvdupc(argc, argv, &cmd->argv)) != ISP_ESUCCESS)
+        isp_errx(1, "util_argvdupc: %s", isp_errstr(res));
+    if ((res = util_argvdupc(argc, argv, &split)) != ISP_ESUCCESS)
+        isp_errx(1, "util_argvdupc: %s", isp_errstr(res));
+
+    cmd->nstages = 1;
+    for (i = 0; i < argc; i++)
+        if (!strcmp(argv[i], STAGE_SEP))
+            cmd->nstages++;
+    cmd->stages = malloc(cmd->nstages * sizeof(char **));
+    cmd->results = malloc(cmd->nstages * sizeof(int));
+    cmd->ru = malloc(cmd->nstages * sizeof(struct rusage));
+    if (!cmd->stages || !cmd->results || !cmd->ru)
+        isp_errx(1, "out of memory");
+
+    cmd->nstages = 0;
+    cmd->stages[cmd->nstages++] = split;
+    for (i = 0; i < argc; i++) {
+        if (!strcmp(split[i], STAGE_SEP)) {
+            split[i] = NULL;
+            cmd->stages[cmd->nstages++] = &split[i + 1];
+        }
+    }
+    for (i = 0; i < cmd->nstages; i++)
+        if (cmd->stages[i][0] == NULL)
+            return -1;
+    return 0;
+}
+
+static void
+_cmd_destroy(cmd_t *cmd)
+{
+    free(cmd->stages[0]);
+    free(cmd->stages);
+    free(cmd->results);
+    free(cmd->ru);
+    free(cmd->argv);
+}
+
 static void
 _initialize(isp_handle_t *hp, int flags, int argc, char *argv[])
 {
@@ -157,7 +311,12 @@ main(int argc, char *argv[])
     int flags = ISP_SOURCE | ISP_SINK;
     int res;
     isp_handle_t h;
-    char **nargv;
+    cmd_t cmd;
+    char *cachedir = getenv("ISP_CACHE");
+    char *cachesize = getenv("ISP_CACHE_SIZE");
+    int verbose = 0;
+    unsigned long long maxbytes;
+    unsigned long hits, misses;
 
     progname = basename(argv[0]);
     opterr = 0;
@@ -167,6 +326,13 @@ main(int argc, char *argv[])
             case 'f':   /* --filekey */
                 filekey = optarg;
                 break;
+            case 'c':   /* --cache */
+                cachedir = optarg;
+                verbose = 1;
+                break;
+            case 's':   /* --cache-size */
+                cachesize = optarg;
+                break;
             default:
                 usage();
         }
@@ -174,18 +340,43 @@ main(int argc, char *argv[])
 
     if (optind >= argc)
         usage();
-    res = util_argvdupc(argc - optind, argv + optind, &nargv);
-    if (res != ISP_ESUCCESS)
-        isp_errx(1, "util_argvdupc: %s", isp_errstr(res));
+    if (_cmd_create(&cmd, argc - optind, argv + optind) < 0)
+        usage();
+
+    if (cachedir) {
+        if (!cachesize)
+            cachesize = DEFAULT_CACHE_SIZE;
+        if (util_parse_size(cachesize, &maxbytes) != ISP_ESUCCESS) {
+            fprintf(stderr, "%s: invalid cache size: %s\n", progname, 
+                    cachesize);
+            exit(1);
+        }
+        if (memo_create(&memo, cachedir, maxbytes) < 0) {
+            fprintf(stderr, "%s: %s: %s\n", progname, cachedir, 
+                    strerror(errno));
+            exit(1);
+        }
+    }
 
     _initialize(&h, flags, argc, argv);
 
-    if ((res = isp_unit_map(h, runcmd, nargv)))
+    if ((res = isp_unit_map(h, runcmd, &cmd)))
         isp_errx(1, "isp_unit_map: %s", isp_errstr(res));
 
     _finalize(h);
 
-    free(nargv);
+    /* Only report if asked for on the command line.  A cache inherited 
+     * through the environment (e.g. from isprun) is reported by the parent.
+     */
+    if (memo) {
+        memo_stats(memo, &hits, &misses);
+        if (verbose && hits + misses > 0)
+            fprintf(stderr, "%s: cache: %lu hits, %lu misses (%.0f%% hit rate)\n",
+                    progname, hits, misses, 100.0 * hits / (hits + misses));
+        memo_destroy(memo);
+    }
+
+    _cmd_destroy(&cmd);
 
     exit(0);
 }
@@ -0,0 +1,193 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Run several map plugins back-to-back on each unit in one process.
+ * Each plugin is a stage with its own filter id, filter element (and
+ * symbol table binding check), and result element, so downstream
+ * filters cannot tell the difference from a pipeline of separate
+ * processes, except that the unit is parsed and serialized only once.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <dlfcn.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+
+#define OPT_STRING ""
+static const struct option long_options[] = {
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+typedef struct {
+    char                     *path;
+    void                     *dlh;
+    struct isp_plugin_struct *plugin;
+} fuse_stage_t;
+
+static char *progname = NULL;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s plugin.so [plugin.so ...]\n", progname);
+    exit(1);
+}
+
+static void
+_plugin_load(fuse_stage_t *s, char *path)
+{
+    s->path = path;
+    if (!(s->dlh = dlopen(path, RTLD_NOW | RTLD_LOCAL)))
+        isp_errx(1, "%s", dlerror());
+    if (!(s->plugin = dlsym(s->dlh, ISP_PLUGIN_SYM)))
+        isp_errx(1, "%s: no %s symbol", path, ISP_PLUGIN_SYM);
+    if (s->plugin->version != ISP_PLUGIN_VER)
+        isp_errx(1, "%s: plugin version %d, expected %d", path, 
+                s->plugin->version, ISP_PLUGIN_VER);
+    if (s->plugin->mapfun == NULL)
+        isp_errx(1, "%s: no map function", path);
+}
+
+/* Like isp_unit_map(), but with one init/map/fini per stage.
+ * Upstream results include those of the stages before this one.
+ */
+static int
+_fuse_map(isp_handle_t h, fuse_stage_t *stages, int nstages, int basefid)
+{
+    isp_unit_t u;
+    int res = ISP_ESUCCESS;
+    int n;
+
+    while ((res = isp_unit_read(h, &u)) == ISP_ESUCCESS) {
+        for (n = 0; n < nstages; n++) {
+            struct isp_plugin_struct *p = stages[n].plugin;
+            int mapres = ISP_ESUCCESS;
+            int oldres;
+
+            isp_filterid_set(basefid + n);
+            if ((res = isp_result_upstream_get(u, &oldres)) != ISP_ESUCCESS)
+                goto fail;
+            if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
+                goto fail;
+            if ((p->flags & ISP_IGNERR) || oldres == ISP_ESUCCESS)
+                mapres = p->mapfun(u, NULL);
+            else
+                mapres = ISP_ENOTRUN;
+            if ((res = isp_unit_fini(u, mapres)) != ISP_ESUCCESS)
+                goto fail;
+        }
+        if ((res = isp_unit_write(h, u)) != ISP_ESUCCESS)
+            goto fail;
+        if ((res = isp_unit_destroy(u)) != ISP_ESUCCESS)
+            break;
+    }
+    goto done;
+fail:
+    (void)isp_unit_destroy(u);
+done:
+    if (res == ISP_EEOF)   /* this is expected at the end */
+        res = ISP_ESUCCESS;
+    if (res == ISP_ESUCCESS)
+        res = isp_unit_write(h, NULL);
+
+    return res;
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c;
+    int longindex;
+    int res;
+    isp_handle_t h;
+    fuse_stage_t *stages;
+    struct isp_stage_struct *hs;
+    int nstages, n;
+   
+    opterr = 0;
+    progname = basename(argv[0]);
+
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) { 
+        switch (c) { 
+            default:
+                usage();
+                /*NOTREACHED*/
+        }
+    }
+    if (optind == argc)
+        usage();
+
+    /* ISP_PROXY skips the usual handshake so we can push one filter 
+     * element per stage instead of one for ourselves.
+     */
+    res = isp_init(&h, ISP_SOURCE|ISP_SINK|ISP_PROXY, argc, argv, NULL, 1);
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+
+    nstages = argc - optind;
+    if (!(stages = malloc(nstages * sizeof(fuse_stage_t))))
+        isp_errx(1, "out of memory");
+    if (!(hs = malloc(nstages * sizeof(struct isp_stage_struct))))
+        isp_errx(1, "out of memory");
+    for (n = 0; n < nstages; n++) {
+        _plugin_load(&stages[n], argv[optind + n]);
+        hs[n].stab = stages[n].plugin->stab;
+        hs[n].argc = 1;
+        hs[n].argv = &stages[n].path;
+    }
+
+    if ((res = isp_init_handshake_stages(h, nstages, hs, 1)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+
+    res = _fuse_map(h, stages, nstages, isp_filterid_get());
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_map: %s", isp_errstr(res));
+
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+
+    for (n = 0; n < nstages; n++)
+        (void)dlclose(stages[n].dlh);
+    free(hs);
+    free(stages);
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
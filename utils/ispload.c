@@ -0,0 +1,222 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Replay units saved by ispsave, all of them or those in a range and/or
+ * with given values of indexed metadata keys, preceded by the original 
+ * init element.  The archive is mapped and the stored XML is passed on 
+ * without being parsed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+
+#include "archive.h"
+
+#define OPT_STRING "r:s:l"
+static const struct option long_options[] = {
+    {"range", required_argument, 0, 'r'},
+    {"select", required_argument, 0, 's'},
+    {"list", no_argument, 0, 'l'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+static char *progname = NULL;
+
+typedef struct {
+    char *key;
+    char *val;
+    int k;          /* index of key in the archive */
+} sel_t;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-l] [-r first[-last]] [-s key=value]... "
+            "archive\n", progname);
+    exit(1);
+}
+
+/* Parse "first", "first-" or "first-last" (unit numbers from 0).
+ */
+static int
+_parse_range(char *s, unsigned long *firstp, unsigned long *lastp)
+{
+    char *end;
+
+    *firstp = strtoul(s, &end, 10);
+    if (end == s)
+        return -1;
+    if (*end == '\0') {
+        *lastp = *firstp;
+        return 0;
+    }
+    if (*end++ != '-')
+        return -1;
+    if (*end == '\0') {
+        *lastp = ~0UL;
+        return 0;
+    }
+    s = end;
+    *lastp = strtoul(s, &end, 10);
+    if (end == s || *end != '\0' || *lastp < *firstp)
+        return -1;
+    return 0;
+}
+
+static int
+_selected(archive_t a, unsigned long n, sel_t *sel, int nsel)
+{
+    char *val;
+    int i;
+
+    for (i = 0; i < nsel; i++) {
+        if (!(val = archive_val(a, n, sel[i].k)) || strcmp(val, sel[i].val))
+            return 0;
+    }
+    return 1;
+}
+
+static void
+_list(archive_t a, unsigned long n)
+{
+    char *val;
+    int k;
+
+    printf("%lu", n);
+    for (k = 0; k < archive_nkeys(a); k++)
+        if ((val = archive_val(a, n, k)))
+            printf(" %s=%s", archive_key(a, k), val);
+    printf("\n");
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c;
+    int longindex;
+    int res;
+    int i, nsel = 0, list = 0;
+    unsigned long n, first = 0, last = ~0UL;
+    sel_t *sel = NULL;
+    isp_handle_t h = NULL;
+    archive_t a;
+    char *buf;
+    int len;
+   
+    progname = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) { 
+        switch (c) { 
+            case 'r':   /* --range */
+                if (_parse_range(optarg, &first, &last) < 0) {
+                    fprintf(stderr, "%s: invalid range: %s\n", progname,
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 's':   /* --select */
+                if (!(sel = realloc(sel, (nsel + 1) * sizeof(sel_t))))
+                    isp_errx(1, "out of memory");
+                sel[nsel].key = optarg;
+                if (!(sel[nsel].val = strchr(optarg, '=')))
+                    usage();
+                *sel[nsel].val++ = '\0';
+                nsel++;
+                break;
+            case 'l':   /* --list */
+                list = 1;
+                break;
+            default:
+                usage();
+                /*NOTREACHED*/
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+
+    if (archive_open(&a, argv[optind]) < 0)
+        isp_errx(1, "%s: %m", argv[optind]);
+    for (i = 0; i < nsel; i++) {
+        if ((sel[i].k = archive_key_find(a, sel[i].key)) < 0) {
+            fprintf(stderr, "%s: key %s is not indexed in %s\n", progname,
+                    sel[i].key, argv[optind]);
+            exit(1);
+        }
+    }
+    if (archive_count(a) == 0)
+        first = 1;  /* nothing to replay */
+    else if (last >= archive_count(a))
+        last = archive_count(a) - 1;
+
+    /* As a proxy, we write the saved init element unchanged, so the 
+     * filters downstream see the pipeline that produced the units.
+     */
+    if (!list) {
+        res = isp_init(&h, ISP_PROXY|ISP_SOURCE, argc, argv, NULL, 1);
+        if (res != ISP_ESUCCESS)
+            isp_errx(1, "isp_init: %s", isp_errstr(res));
+        if (archive_init_get(a, &buf, &len) < 0)
+            isp_errx(1, "%s: %m", argv[optind]);
+        if ((res = isp_handle_write_str(h, buf, len)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_handle_write_str: %s", isp_errstr(res));
+    }
+    for (n = first; n <= last && n < archive_count(a); n++) {
+        if (!_selected(a, n, sel, nsel))
+            continue;
+        if (list) {
+            _list(a, n);
+            continue;
+        }
+        if (archive_unit_get(a, n, &buf, &len) < 0)
+            isp_errx(1, "%s: unit %lu: %m", argv[optind], n);
+        if ((res = isp_handle_write_str(h, buf, len)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_handle_write_str: %s", isp_errstr(res));
+    }
+    if (!list) {
+        if ((res = isp_unit_write(h, NULL)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+        if ((res = isp_fini(h)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_fini: %s", isp_errstr(res));
+    }
+    archive_destroy(a);
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
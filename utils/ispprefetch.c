@@ -0,0 +1,250 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Pass units through, asking the kernel to read their files into the
+ * page cache while they wait in a window of up to N units (or M bytes
+ * of file data) ahead of the next stage.  When a unit leaves the window,
+ * record how much of its files is resident, and report the hit rate on 
+ * stderr at exit.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+#include <isp/list.h>
+
+#define DEFAULT_UNITS   16
+#define DEFAULT_BYTES   "256M"
+
+#define OPT_STRING "n:b:q"
+static const struct option long_options[] = {
+    {"units", required_argument, 0, 'n'},
+    {"bytes", required_argument, 0, 'b'},
+    {"quiet", no_argument, 0, 'q'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+typedef struct {
+    isp_unit_t          u;
+    unsigned long long  bytes;  /* file data referenced by u */
+} ent_t;
+
+static char *progname = NULL;
+static unsigned long maxunits = DEFAULT_UNITS;
+static unsigned long long maxbytes = 0;
+static long pagesize;
+
+/* pages of files found resident/examined as units leave the window */
+static unsigned long long hits = 0;
+static unsigned long long pages = 0;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-q] [-n units] [-b bytes]\n", progname);
+    exit(1);
+}
+
+static int
+_sum(char *key, char *path, unsigned long off, unsigned long len, 
+     int flags, void *arg)
+{
+    *(unsigned long long *)arg += len;
+    return ISP_ESUCCESS;
+}
+
+/* Start reading the range into the page cache (best effort).
+ */
+static int
+_advise(char *key, char *path, unsigned long off, unsigned long len, 
+        int flags, void *arg)
+{
+    int fd;
+
+    if (len > 0 && (fd = open(path, O_RDONLY)) >= 0) {
+        (void)posix_fadvise(fd, off, len, POSIX_FADV_WILLNEED);
+        (void)close(fd);
+    }
+    return ISP_ESUCCESS;
+}
+
+/* Count the pages of the range that are in the page cache (best effort).
+ */
+static int
+_resident(char *key, char *path, unsigned long off, unsigned long len,
+          int flags, void *arg)
+{
+    unsigned long aoff = off - off % pagesize;
+    size_t maplen = len + (off - aoff);
+    size_t n = (maplen + pagesize - 1) / pagesize;
+    unsigned char *vec;
+    void *addr;
+    size_t i;
+    int fd;
+
+    if (len == 0 || (fd = open(path, O_RDONLY)) < 0)
+        return ISP_ESUCCESS;
+    addr = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, aoff);
+    (void)close(fd);
+    if (addr == MAP_FAILED)
+        return ISP_ESUCCESS;
+    if ((vec = malloc(n)) && mincore(addr, maplen, vec) == 0) {
+        for (i = 0; i < n; i++)
+            if (vec[i] & 1)
+                hits++;
+        pages += n;
+    }
+    free(vec);
+    (void)munmap(addr, maplen);
+    return ISP_ESUCCESS;
+}
+
+static void
+_emit(isp_handle_t h, List window, unsigned long long *bytesp)
+{
+    ent_t *e = list_dequeue(window);
+    int res;
+
+    (void)isp_file_foreach(e->u, _resident, NULL);
+    if ((res = isp_unit_fini(e->u, ISP_ESUCCESS)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_fini: %s", isp_errstr(res));
+    if ((res = isp_unit_write(h, e->u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    isp_unit_destroy(e->u);
+    *bytesp -= e->bytes;
+    free(e);
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c;
+    int longindex;
+    int res;
+    int quiet = 0;
+    isp_handle_t h;
+    isp_unit_t u;
+    List window;
+    ent_t *e;
+    unsigned long long bytes = 0;
+    char *bytestr = DEFAULT_BYTES;
+   
+    progname = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) { 
+        switch (c) { 
+            case 'n':   /* --units */
+                maxunits = strtoul(optarg, NULL, 10);
+                if (maxunits < 1)
+                    usage();
+                break;
+            case 'b':   /* --bytes */
+                bytestr = optarg;
+                break;
+            case 'q':   /* --quiet */
+                quiet = 1;
+                break;
+            default:
+                usage();
+                /*NOTREACHED*/
+        }
+    }
+    if (optind < argc)
+        usage();
+    if (util_parse_size(bytestr, &maxbytes) != ISP_ESUCCESS) {
+        fprintf(stderr, "%s: invalid size: %s\n", progname, bytestr);
+        exit(1);
+    }
+    pagesize = sysconf(_SC_PAGESIZE);
+
+    res = isp_init(&h, ISP_SOURCE|ISP_SINK|ISP_IGNERR, argc, argv, NULL, 1);
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+
+    if (!(window = list_create(NULL)))
+        isp_errx(1, "list_create: out of memory");
+
+    /* Let the next stage have a unit whenever upstream has none for us, 
+     * else we would hold it up waiting to fill the window.
+     */
+    for (;;) {
+        res = isp_unit_read_nowait(h, &u, !list_is_empty(window));
+        if (res == ISP_EWOULDBLOCK) {
+            _emit(h, window, &bytes);
+            continue;
+        }
+        if (res != ISP_ESUCCESS)
+            break;
+        if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
+        if (!(e = malloc(sizeof(ent_t))))
+            isp_errx(1, "out of memory");
+        e->u = u;
+        e->bytes = 0;
+        (void)isp_file_foreach(u, _sum, &e->bytes);
+
+        while (!list_is_empty(window) && (list_count(window) >= maxunits
+                    || bytes + e->bytes > maxbytes))
+            _emit(h, window, &bytes);
+        (void)isp_file_foreach(u, _advise, NULL);
+        if (!list_enqueue(window, e))
+            isp_errx(1, "out of memory");
+        bytes += e->bytes;
+    }
+    if (res != ISP_EEOF)
+        isp_errx(1, "isp_unit_read: %s", isp_errstr(res));
+    while (!list_is_empty(window))
+        _emit(h, window, &bytes);
+    list_destroy(window);
+    if ((res = isp_unit_write(h, NULL)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+
+    if (!quiet && pages > 0)
+        fprintf(stderr, "%s: %llu of %llu pages resident (%.0f%% hit rate)\n",
+                progname, hits, pages, 100.0 * hits / pages);
+
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
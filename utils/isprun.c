@@ -24,7 +24,8 @@
 \*****************************************************************************/
 
 /* Parallelize an ISP stream by starting multiple copies of a filter
- * as coprocesses and feeding each of them one unit to work on concurrently.
+ * as coprocesses and feeding each of them one unit (or a batch of units)
+ * to work on concurrently.
  */
 
 /* NOTE:
@@ -34,19 +35,39 @@
  * process and have it block until resources are available.
  */
 
+/* NOTE:
+ * With --workers, coprocesses are not spawned per unit but are persistent
+ * filters served by ispworkerd on other hosts, one per connection.  
+ * Units are dealt to the connection with the most unused credit, and 
+ * each connection may have at most its credit in flight, so a slow host 
+ * is given less work rather than a deep queue.
+ */
+
+/* NOTE:
+ * With --speculate, each coproc runs in its own scratch directory so that 
+ * if it loses a race with a duplicate, its temporary files can be removed 
+ * along with it.  The winner's read-write files are moved out of its 
+ * scratch directory before its unit is passed downstream.
+ */
+
 /* NOTE: 
- * We configure stdout with unlimited backlog, so there is a danger that our
- * stdout backlog will grow to an obscene size.  On the other hand, we avoid
- * deadlock that would occur should stdout stall and we stop reading stdin of
- * the sruns--perhaps those sruns need to terminate so CPU's can be allocated
- * downstream to consume the stdout backlog.
+ * We configure stdout with unlimited backlog so a unit read from a coproc
+ * can always be queued.  By default the backlog is unlimited: there is a 
+ * danger that it will grow to an obscene size, but we avoid the deadlock 
+ * that would occur should stdout stall and we stop reading stdin of the 
+ * sruns--perhaps those sruns need to terminate so CPU's can be allocated 
+ * downstream to consume the stdout backlog.  If asked with --membudget,
+ * once the queued bytes reach the budget we stop reading coproc output 
+ * and stop starting new coprocs until stdout drains.  A coproc whose 
+ * output is not being read soon blocks, so a slow downstream backs up 
+ * through us instead of into our memory.
  */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
-#include <stdlib.h>
 #define _GNU_SOURCE
+#include <stdlib.h>
 #include <getopt.h>
 #include <assert.h>
 #include <sys/wait.h>
@@ -55,15 +76,30 @@
 #include <errno.h>
 #include <limits.h>
 #include <libgen.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include <isp/util.h>
 #include <isp/isp.h>
 #include <isp/isp_private.h>
 #include <isp/list.h>
+#include "fanout.h"
+#include "topo.h"
+#include "worker.h"
+#include "memo.h"
+#include "describe.h"
 
 #define PATH_SRUN       "/usr/bin/srun"
 
-#define DEFAULT_FANOUT  4
+/* speculative execution tunables */
+#define SPEC_MINSAMPLES 5       /* completed units needed to estimate p95 */
+#define SPEC_WINDOW     256     /* recent unit runtimes the p95 is taken from */
+#define SPEC_MINTIME    1.0     /* never speculate on units faster than this */
+#define SPEC_TICK       250000  /* usec between straggler checks */
 
 /* coprocess backlog limits */
 #define IBACKLOG 1 /* stdin, coproc stdout: 1 unit */
@@ -84,16 +120,88 @@ struct par_handle_struct {
     int ifd;            /* pipe to coproc's stdin */
     int ofd;            /* pipe to coproc's stdout */
     int res;            /* last isp_unit_read result from coproc */
+    int nunits;         /* number of units in this coproc's batch */
+    int slot;           /* fanout slot occupied by this coproc */
+    struct timeval start; /* time coproc was started */
+    char *addr;         /* worker address (--workers only) */
+    int credits;        /* max units in flight (--workers only) */
+    int inflight;       /* units sent but not yet consumed (--workers only) */
+    unsigned long credited; /* credits returned by the worker so far */
+    int closed;         /* end of stream has been sent (--workers only) */
+    isp_unit_t unit;    /* copy of unit, for a duplicate (--speculate only) */
+    char *scratch;      /* private working directory (--speculate only) */
+    par_handle_t twin;  /* original <-> speculative duplicate */
+    int dup;            /* this coproc is a speculative duplicate */
+    int lost;           /* twin produced a result first - kill this one */
     procstate_t state;
 };
 
-typedef enum { RUNCMD_SRUN, RUNCMD_DIRECT } runcmd_t;
+typedef enum { RUNCMD_SRUN, RUNCMD_DIRECT, RUNCMD_WORKERS } runcmd_t;
+
+/* Settings that control how coprocesses are run.
+ */
+typedef struct {
+    runcmd_t how;       /* start coprocs directly or via srun */
+    char **cmdargv;     /* filter command line */
+    fanout_t fanout;    /* max concurrent coprocs */
+    int batch;          /* max units per coproc */
+    int taper;          /* shrink batches once stdin reaches EOF */
+    pin_t pin;          /* CPU/NUMA placement of slots */
+    topo_t topo;        /* CPU/NUMA topology (NULL if pin == PIN_NONE) */
+    char **workers;     /* ispworkerd addresses (how == RUNCMD_WORKERS) */
+    int nworkers;
+    double speculate;   /* straggler threshold as multiple of p95, 0=off */
+    unsigned long long membudget; /* max stdout backlog in bytes, 0=none */
+} par_opts_t;
+
+/* Per-slot accounting, reported at exit with --pin or --workers.
+ */
+typedef struct {
+    unsigned long units;    /* units completed in this slot */
+    unsigned long procs;    /* coprocs run in this slot */
+    double busy;            /* seconds a coproc was running in this slot */
+} slot_stat_t;
+
+static slot_stat_t *slot_stats = NULL;
+static int slot_count = 0;
 
-#define OPT_STRING "sdf:"
+/* Runtimes of the most recently completed units (a ring), their p95 
+ * once worked out, and speculation counts.
+ */
+static double rt_samples[SPEC_WINDOW];
+static int rt_count = 0;            /* units completed */
+static double rt_p95 = -1;          /* < 0: not worked out since last add */
+static unsigned long spec_launched = 0;
+static unsigned long spec_wins = 0;
+
+/* Times (and seconds) stdout was over its budget, see _stdout_full().
+ */
+static unsigned long out_stalls = 0;
+static double out_stalltime = 0;
+static int out_stalled = 0;
+static struct timeval out_stallstart;
+
+/* Pending handshake (see init_handshake()).
+ */
+static describe_t   init_desc = NULL;   /* description still to come */
+static isp_init_t   init_i;             /* unprocessed init element */
+static par_opts_t  *init_o;
+static void       (*init_osig)(int);    /* SIGPIPE disposition meanwhile */
+
+static void init_complete(isp_handle_t h);
+
+#define OPT_STRING "sdf:b:tp::w:x::c:m:"
 static const struct option long_options[] = {
     {"direct", no_argument, 0, 'd'},
     {"srun", no_argument, 0, 's'},
     {"fanout", required_argument, 0, 'f'},
+    {"batch", required_argument, 0, 'b'},
+    {"taper", no_argument, 0, 't'},
+    {"pin", optional_argument, 0, 'p'},
+    {"workers", required_argument, 0, 'w'},
+    {"speculate", optional_argument, 0, 'x'},
+    {"cache", required_argument, 0, 'c'},
+    {"membudget", required_argument, 0, 'm'},
     {0,0,0,0},
 };
 static const struct option *longopts = long_options;
@@ -101,7 +209,10 @@ static const struct option *longopts = long_options;
 void
 usage(void)
 {
-    fprintf(stderr, "Usage: isprun [-f #] [-s|-d] -- isp filter [args]\n");
+    fprintf(stderr, 
+        "Usage: isprun [-f #|auto[:min:max]] [-b #] [-t] [-p[core|numa|node]]"
+        " [-x[factor]] [-c dir]\n"
+        "              [-m size] [-s|-d|-w addr,...] -- isp filter [args]\n");
     exit(1);
 }
 
@@ -117,9 +228,15 @@ runcmd_srun(char **cmdargv, pid_t *pidp, int *ifdp, int *ofdp)
     if ((res = util_argvcat(srun, cmdargv, &av)) != ISP_ESUCCESS)
         isp_errx(1, "util_argvcat: %s", isp_errstr(res));
 
+    /* srun passes our environment on to the coproc, whose output will 
+     * likely cross the network back to us.
+     */
+    if (setenv("ISP_STDOUT_REMOTE", "1", 1) < 0)
+        isp_errx(1, "setenv: %m");
     res = util_runcoproc(av, pidp, ifdp, ofdp, NULL);
     if (res != ISP_ESUCCESS)
         isp_errx(1, "util_runcoproc: %s", isp_errstr(res));
+    (void)unsetenv("ISP_STDOUT_REMOTE");
 
     free(av);
 }
@@ -136,66 +253,377 @@ runcmd_direct(char **cmdargv, pid_t *pidp, int *ifdp, int *ofdp)
         isp_errx(1, "util_runcoproc: %s", isp_errstr(res));
 }
 
-static par_handle_t 
-par_handle_create(runcmd_t how, char **cmdargv, isp_init_t i, isp_unit_t u)
+/* Connect to an ispworkerd and ask it for 'cmdargv'.  Return separate
+ * descriptors for reading and writing so each can be owned by its half 
+ * of an isp handle.
+ */
+static void
+runcmd_worker(char *addr, char **cmdargv, int *ifdp, int *ofdp, int *creditsp,
+              int *remotep)
+{
+    char why[WORKER_MAXLINE], host[WORKER_MAXLINE];
+    int fd, credits;
+
+    if ((fd = worker_connect(addr)) < 0)
+        isp_errx(1, "worker %s: %m", addr);
+    if (worker_hello(fd, cmdargv, &credits, host, sizeof(host), 
+                     why, sizeof(why)) < 0) {
+        if (errno == EACCES)
+            isp_errx(1, "worker %s: %s", addr, why);
+        isp_errx(1, "worker %s: handshake: %m", addr);
+    }
+    if ((*ofdp = dup(fd)) < 0)
+        isp_errx(1, "dup: %m");
+    *ifdp = fd;
+    if (creditsp)
+        *creditsp = credits;
+    if (remotep)
+        *remotep = (host[0] && strcmp(host, isp_hostname_get()) != 0);
+}
+
+/* Compress the stream to a coproc on another host (a remote worker, or
+ * with --srun), unless ISP_COMPRESS says otherwise.  Its stream back is
+ * compressed if ispworkerd or srun tells it that we are remote in turn.
+ */
+static void
+_peer_compress(isp_handle_t h, int remote)
 {
-    size_t size = sizeof(struct par_handle_struct);
-    par_handle_t ph;
     int res;
 
-    if ((ph = (par_handle_t)calloc(1, size)) == NULL)
-        isp_errx(1, "par_handle_create: out of memory");
-    ph->magic = PAR_HANDLE_MAGIC;
+    if (remote && isp_compress_get() == COMPRESS_AUTO) {
+        if ((res = isp_handle_compress_set(h, 1)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_handle_compress_set: %s", isp_errstr(res));
+    }
+}
 
-    assert(u != NULL && i != NULL);
+static double
+_elapsed(struct timeval *start)
+{
+    struct timeval now, delta;
+
+    if (gettimeofday(&now, NULL) < 0)
+        isp_errx(1, "gettimeofday: %m");
+    timersub(&now, start, &delta);
+    return delta.tv_sec + delta.tv_usec / 1E6;
+}
+
+static void
+_rt_add(double t)
+{
+    rt_samples[rt_count++ % SPEC_WINDOW] = t;
+    rt_p95 = -1;
+}
+
+static int
+_rt_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
 
-    /* start the coprocess */
-    switch (how) { 
+/* The 95th percentile of recent unit runtimes, sorted out only when
+ * a unit has completed since the last call.
+ */
+static double
+_rt_p95(void)
+{
+    double sorted[SPEC_WINDOW];
+    int n = rt_count < SPEC_WINDOW ? rt_count : SPEC_WINDOW;
+
+    assert(n > 0);
+    if (rt_p95 < 0) {
+        memcpy(sorted, rt_samples, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), _rt_cmp);
+        rt_p95 = sorted[(n * 95 - 1) / 100];
+    }
+    return rt_p95;
+}
+
+static char *
+_mkscratch(void)
+{
+    char buf[PATH_MAX];
+    char *dir;
+
+    if (!getcwd(buf, sizeof(buf) - 16))
+        isp_errx(1, "getcwd: %m");
+    strcat(buf, "/isprunXXXXXX");
+    if (!mkdtemp(buf))
+        isp_errx(1, "mkdtemp %s: %m", buf);
+    if (!(dir = strdup(buf)))
+        isp_errx(1, "_mkscratch: out of memory");
+    return dir;
+}
+
+static int
+_rmscratch_one(const char *path, const struct stat *sb, int flag, 
+               struct FTW *ftwbuf)
+{
+    (void)remove(path);
+    return 0;
+}
+
+static void
+_rmscratch(char *dir)
+{
+    (void)nftw(dir, _rmscratch_one, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void
+_sigpipe_noop(int sig)
+{
+}
+
+/* Find the lowest numbered slot not occupied by a running coproc.
+ */
+static int
+_slot_alloc(List phl)
+{
+    ListIterator itr;
+    par_handle_t ph;
+    int slot = 0;
+
+    if (!(itr = list_iterator_create(phl)))
+        isp_errx(1, "_slot_alloc: out of memory");
+    while ((ph = list_next(itr)) != NULL) {
+        if (ph->slot == slot) {
+            slot++;
+            list_iterator_reset(itr);
+        }
+    }
+    list_iterator_destroy(itr);
+
+    if (slot >= slot_count) {
+        slot_stats = realloc(slot_stats, sizeof(slot_stat_t) * (slot + 1));
+        if (!slot_stats)
+            isp_errx(1, "_slot_alloc: out of memory");
+        memset(&slot_stats[slot_count], 0, 
+               sizeof(slot_stat_t) * (slot + 1 - slot_count));
+        slot_count = slot + 1;
+    }
+    return slot;
+}
+
+static void
+_slot_report(par_opts_t *o)
+{
+    char where[64];
+    int slot;
+
+    isp_err("%-5s %-14s %-7s %-7s %-9s %-9s", 
+            "slot", "placement", "procs", "units", "busy(s)", "units/s");
+    for (slot = 0; slot < slot_count; slot++) {
+        slot_stat_t *st = &slot_stats[slot];
+
+        if (o->how == RUNCMD_WORKERS)
+            snprintf(where, sizeof(where), "%s", o->workers[slot]);
+        else
+            topo_describe(o->topo, o->pin, slot, where, sizeof(where));
+        isp_err("%-5d %-14s %-7lu %-7lu %-9.2f %-9.2f", slot, where,
+                st->procs, st->units, st->busy, 
+                st->busy > 0 ? st->units / st->busy : 0.0);
+    }
+}
+
+/* Start the coproc for 'ph' in its slot, and in its scratch directory
+ * (with ISP_SCRATCHDIR pointing there) if it has one.  A speculative 
+ * duplicate first gets private copies of its unit's read-write files 
+ * there.
+ */
+static void
+_par_spawn(par_opts_t *o, par_handle_t ph)
+{
+    char *oscratch = NULL;
+    int cwd = -1;
+    int res;
+
+    if (ph->scratch) {
+        if ((cwd = open(".", O_RDONLY)) < 0)
+            isp_errx(1, "open .: %m");
+        if (chdir(ph->scratch) < 0)
+            isp_errx(1, "chdir %s: %m", ph->scratch);
+        if ((oscratch = getenv("ISP_SCRATCHDIR")) 
+                && !(oscratch = strdup(oscratch)))
+            isp_errx(1, "_par_spawn: out of memory");
+        if (setenv("ISP_SCRATCHDIR", ph->scratch, 1) < 0)
+            isp_errx(1, "setenv: %m");
+        if (ph->dup && (res = isp_rwfile_copy(ph->unit)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_rwfile_copy: %s", isp_errstr(res));
+    }
+
+    /* start the coprocess - it inherits our placement across fork/exec */
+    if (o->pin != PIN_NONE && topo_bind(o->topo, o->pin, ph->slot) < 0)
+        isp_errx(1, "topo_bind slot %d: %m", ph->slot);
+    switch (o->how) { 
         case RUNCMD_SRUN:
-            runcmd_srun(cmdargv, &ph->pid, &ph->ifd, &ph->ofd);
+            runcmd_srun(o->cmdargv, &ph->pid, &ph->ifd, &ph->ofd);
             break;
         case RUNCMD_DIRECT:
-            runcmd_direct(cmdargv, &ph->pid, &ph->ifd, &ph->ofd);
+            runcmd_direct(o->cmdargv, &ph->pid, &ph->ifd, &ph->ofd);
+            break;
+        case RUNCMD_WORKERS:    /* see worker_handle_create() */
+            assert(0);
             break;
     }
+    if (o->pin != PIN_NONE)
+        topo_unbind(o->topo);
+    if (cwd >= 0) {
+        if (fchdir(cwd) < 0)
+            isp_errx(1, "fchdir: %m");
+        (void)close(cwd);
+        if (oscratch) {
+            (void)setenv("ISP_SCRATCHDIR", oscratch, 1);
+            free(oscratch);
+        } else
+            (void)unsetenv("ISP_SCRATCHDIR");
+    }
+
+    if (gettimeofday(&ph->start, NULL) < 0)
+        isp_errx(1, "gettimeofday: %m");
     res = isp_handle_create(&ph->h, 
             ISP_SOURCE | ISP_SINK | ISP_NONBLOCK | ISP_PROXY, 
             IBACKLOG, OBACKLOG, ph->ofd, ph->ifd);
     if (res != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_create: %s", isp_errstr(res));
+    _peer_compress(ph->h, o->how == RUNCMD_SRUN);
+    ph->res = ISP_ESUCCESS;
+    ph->state = PROC_STARTING;
+}
+
+/* Start a coproc in 'slot' and hand it the first n units from the 
+ * 'pending' list.
+ */
+static par_handle_t 
+par_handle_create(par_opts_t *o, isp_init_t i, List pending, int n, int slot)
+{
+    size_t size = sizeof(struct par_handle_struct);
+    par_handle_t ph;
+    isp_unit_t u;
+    int res;
 
-#if (OBACKLOG != 0 && OBACKLOG < 3)
-#error OBACKLOG must be 0 or >= 3
+    if ((ph = (par_handle_t)calloc(1, size)) == NULL)
+        isp_errx(1, "par_handle_create: out of memory");
+    ph->magic = PAR_HANDLE_MAGIC;
+    ph->slot = slot;
+
+    assert(i != NULL);
+    assert(n > 0 && list_count(pending) >= n);
+
+    if (o->speculate) {
+        assert(n == 1);
+        ph->scratch = _mkscratch();
+        if ((res = isp_unit_copy(&ph->unit, list_peek(pending))) 
+                != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_copy: %s", isp_errstr(res));
+    }
+    _par_spawn(o, ph);
+
+#if (OBACKLOG != 0)
+#error OBACKLOG must be 0 (unlimited) so a whole batch can be queued
 #endif
-    /* Write init element, work unit, and NULL.
+    /* Write init element, work units, and NULL.
      * NOTE: even though we are in ISP_NONBLOCK mode, none of these calls 
-     * should fail with ISP_EWOULDBLOCK because OBACKLOG is >= 3 and we 
-     * haven't written anything before.
+     * should fail with ISP_EWOULDBLOCK because OBACKLOG is unlimited.
+     * Before our handshake is complete, a coproc may already have failed
+     * its own (see init_handshake()); that write error is left for 
+     * par_handle_io() to find as the end of its output.
      */
+    if ((res = isp_init_write(ph->h, i)) != ISP_ESUCCESS 
+            && !(res == ISP_EWRITE && init_desc))
+        isp_errx(1, "isp_init_write: %s", isp_errstr(res));
+    for (ph->nunits = 0; ph->nunits < n; ph->nunits++) {
+        u = list_dequeue(pending);
+        assert(u != NULL);
+        if ((res = isp_unit_write(ph->h, u)) != ISP_ESUCCESS
+                && !(res == ISP_EWRITE && init_desc))
+            isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+        if ((res = isp_unit_destroy(u)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_destroy: %s", isp_errstr(res));
+    }
+    if ((res = isp_unit_write(ph->h, NULL)) != ISP_ESUCCESS
+            && !(res == ISP_EWRITE && init_desc))
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+
+    return ph;
+}
+
+/* Start a duplicate of straggler 'orig' in 'slot'.
+ */
+static par_handle_t
+par_handle_speculate(par_opts_t *o, isp_init_t i, par_handle_t orig, int slot)
+{
+    par_handle_t ph;
+    int res;
+
+    assert(orig->unit != NULL && orig->twin == NULL);
+
+    if ((ph = (par_handle_t)calloc(1, sizeof(struct par_handle_struct))) == NULL)
+        isp_errx(1, "par_handle_speculate: out of memory");
+    ph->magic = PAR_HANDLE_MAGIC;
+    ph->slot = slot;
+    ph->dup = 1;
+    ph->scratch = _mkscratch();
+    if ((res = isp_unit_copy(&ph->unit, orig->unit)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_copy: %s", isp_errstr(res));
+    _par_spawn(o, ph);
+
     if ((res = isp_init_write(ph->h, i)) != ISP_ESUCCESS)
         isp_errx(1, "isp_init_write: %s", isp_errstr(res));
-    if ((res = isp_unit_write(ph->h, u)) != ISP_ESUCCESS)
+    if ((res = isp_unit_write(ph->h, ph->unit)) != ISP_ESUCCESS)
         isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
     if ((res = isp_unit_write(ph->h, NULL)) != ISP_ESUCCESS)
         isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    ph->nunits = 1;
 
-    if ((res = isp_unit_destroy(u)) != ISP_ESUCCESS)
-        isp_errx(1, "isp_unit_destroy: %s", isp_errstr(res));
-
-    ph->res = ISP_ESUCCESS;
-    ph->state = PROC_STARTING;
+    ph->twin = orig;
+    orig->twin = ph;
+    spec_launched++;
 
     return ph;
 }
 
+/* Called when 'ph' has produced its result: its twin (if any) lost.
+ */
+static void
+_twin_resolve(par_handle_t ph)
+{
+    if (ph->twin && !ph->twin->lost) {
+        ph->twin->lost = 1;
+        if (ph->dup)
+            spec_wins++;
+    }
+}
+
 static void
 par_handle_destroy(par_handle_t ph)
 {
     int s, n;
+    void (*osig)(int);
 
     assert(ph->magic == PAR_HANDLE_MAGIC);
+
+    /* A coproc that lost a speculative race is killed, and everything 
+     * it might have written is removed.  If it was the original, the 
+     * read-write files it was given are no longer referenced by anyone.
+     * Catch SIGPIPE while its handle is flushed, since it is gone.
+     */
+    if (ph->lost) {
+        (void)kill(ph->pid, SIGKILL);
+        (void)util_waitpid(ph->pid, &s, 0);
+        osig = signal(SIGPIPE, _sigpipe_noop);
+        (void)isp_handle_destroy(ph->h);
+        signal(SIGPIPE, osig);
+        if (!ph->dup)
+            (void)isp_rwfile_unlink(ph->unit);
+        goto cleanup;
+    }
     assert(ph->res == ISP_EEOF);
 
+    if (ph->pid == 0) { /* worker connection - nothing to reap */
+        isp_handle_zreport(ph->h, ph->addr, ph->addr);
+        goto done;
+    }
     if ((n = util_waitpid(ph->pid, &s, 0)) != ph->pid)
         isp_errx(1, "util_waitpid: %m");
     if (WIFEXITED(s)) {
@@ -205,8 +633,17 @@ par_handle_destroy(par_handle_t ph)
         isp_errx(1, "util_waitpid: coproc died on signal %d", WTERMSIG(s));
     else if (WIFSTOPPED(s))
         isp_errx(1, "util_waitpid: coproc stopped on signal %d", WSTOPSIG(s));
-
+done:
     isp_handle_destroy(ph->h);
+cleanup:
+    if (ph->twin)
+        ph->twin->twin = NULL;
+    if (ph->scratch) {
+        _rmscratch(ph->scratch);
+        free(ph->scratch);
+    }
+    if (ph->unit)
+        isp_unit_destroy(ph->unit);
 
     ph->magic = 0;
     free(ph);
@@ -217,7 +654,7 @@ par_handle_destroy(par_handle_t ph)
  * buffers for new data to process.
  */
 static void
-_wait_for_pio(isp_handle_t h, List phl)
+_wait_for_pio(isp_handle_t h, List phl, struct timeval *tv)
 {
     pfd_t pfd;
     ListIterator itr;
@@ -237,7 +674,7 @@ _wait_for_pio(isp_handle_t h, List phl)
     if (h)
         isp_handle_prepoll(h, pfd);
                                                 /* wait 'till ready */
-    if ((res = util_poll(pfd, NULL)) != ISP_ESUCCESS)   
+    if ((res = util_poll(pfd, tv)) != ISP_ESUCCESS)   
         isp_errx(1, "util_poll: %s", isp_errstr(res));
 
     list_iterator_reset(itr);                   /* perform the io */
@@ -250,16 +687,85 @@ _wait_for_pio(isp_handle_t h, List phl)
     list_iterator_destroy(itr);
 }
 
+/* Return true if the stdout backlog has reached its byte budget.
+ * Keep track of how often and for how long output was stalled.
+ */
+static int
+_stdout_full(isp_handle_t h, par_opts_t *o)
+{
+    struct isp_handle_stats_struct st;
+    int res, full;
+
+    if (o->membudget == 0)
+        return 0;
+    if ((res = isp_handle_stats(h, &st)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_stats: %s", isp_errstr(res));
+    full = (st.obytes >= o->membudget);
+    if (full && !out_stalled) {
+        out_stalls++;
+        if (gettimeofday(&out_stallstart, NULL) < 0)
+            isp_errx(1, "gettimeofday: %m");
+    } else if (!full && out_stalled)
+        out_stalltime += _elapsed(&out_stallstart);
+    out_stalled = full;
+    return full;
+}
+
+/* Report peak stdout backlog and our own memory use.
+ */
 static void
-par_handle_io(isp_handle_t h, par_handle_t ph)
+_mem_report(isp_handle_t h, par_opts_t *o)
+{
+    struct isp_handle_stats_struct st;
+    struct rusage ru;
+    int res;
+
+    if ((res = isp_handle_stats(h, &st)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_stats: %s", isp_errstr(res));
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        isp_errx(1, "getrusage: %m");
+    if (out_stalled)
+        out_stalltime += _elapsed(&out_stallstart);
+    isp_err("stdout: peak backlog %lu bytes (budget %llu), "
+            "stalled %lu times for %.2fs, max RSS %ld KB", 
+            st.opeak, o->membudget, out_stalls, out_stalltime, ru.ru_maxrss);
+}
+
+/* The worker's filter returns a credit as it reads each unit, not as it
+ * writes one, so filters that hold back, drop, or split units still free
+ * room for more.
+ */
+static void
+_worker_credit(par_handle_t ph)
+{
+    unsigned long credited;
+    int res;
+
+    if ((res = isp_handle_credits_get(ph->h, &credited)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_credits_get: %s", isp_errstr(res));
+    ph->inflight -= credited - ph->credited;
+    ph->credited = credited;
+    if (ph->inflight < 0)
+        isp_errx(1, "worker %s: returned more credit than it was given", 
+                 ph->addr);
+}
+
+/* Read and discard the coproc init element, then pass its units to 
+ * stdout, stopping early if the stdout backlog reaches its budget.
+ */
+static void
+par_handle_io(isp_handle_t h, par_handle_t ph, par_opts_t *o)
 {
     isp_init_t i;
     isp_unit_t u;
     int res;
 
-    /* read and discard coproc init element (i) */
+    /* read and discard coproc init element (i), but first finish our
+     * own handshake so a binding error is reported once, by us */
     if (ph->state == PROC_STARTING) {
-        if ((ph->res = isp_init_read(ph->h, &i)) == ISP_ESUCCESS) {
+        if ((ph->res = isp_init_read(ph->h, &i)) != ISP_EWOULDBLOCK)
+            init_complete(h);
+        if (ph->res == ISP_ESUCCESS) {
             if ((res = isp_init_destroy(i)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_init_destroy: %s", isp_errstr(res));
             ph->state = PROC_RUNNING;
@@ -270,37 +776,109 @@ par_handle_io(isp_handle_t h, par_handle_t ph)
 
     /* read units from coproc and write them to stdout */
     if (ph->state == PROC_RUNNING) {
-        while ((ph->res = isp_unit_read(ph->h, &u)) == ISP_ESUCCESS) {
+        while (!_stdout_full(h, o)) {
+            if ((ph->res = isp_unit_read(ph->h, &u)) != ISP_ESUCCESS)
+                break;
+            if (ph->scratch) {
+                if ((res = isp_rwfile_move(u, ph->scratch)) != ISP_ESUCCESS)
+                    isp_errx(1, "isp_rwfile_move: %s", isp_errstr(res));
+                _twin_resolve(ph);
+            }
             if ((res = isp_unit_write(h, u)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_unit_write (stdout): %s", isp_errstr(res));
             /* write backlog unlimited so we should not see ISP_EWOULDBLOCK */
         }
+        if (ph->addr)
+            _worker_credit(ph);
         if (ph->res == ISP_EEOF) {
             ph->state = PROC_COMPLETE;
-        } else if (ph->res != ISP_EWOULDBLOCK)
+        } else if (ph->res != ISP_EWOULDBLOCK && ph->res != ISP_ESUCCESS)
             isp_errx(1, "isp_unit_read (coproc %lu): %s", 
                     ph->pid, isp_errstr(ph->res));
     }
 }
 
+/* Decide how many pending units to hand to the next coproc (0 = none yet).
+ * Full batches are preferred, but a short batch is started rather than
+ * leave every slot idle while stdin is stalled.  Once stdin reaches EOF 
+ * and 'taper' is set, the remaining units are spread evenly over the 
+ * fanout slots so the last few batches finish together.
+ */
+static int
+_batchsize(int batch, int taper, unsigned long fanout, int npending, 
+           int nrunning, int inres)
+{
+    int n = 0;
+
+    if (inres == ISP_EEOF) {
+        n = batch;
+        if (taper && fanout > 0)
+            n = (npending + fanout - 1) / fanout;
+    } else if (npending >= batch)
+        n = batch;
+    else if (nrunning == 0)
+        n = npending;
+
+    if (n > batch)
+        n = batch;
+    if (n > npending)
+        n = npending;
+    return n;
+}
+
+/* Return a running coproc that has taken longer than the speculation
+ * threshold and has no duplicate yet, or NULL.
+ */
+static par_handle_t
+_straggler(par_opts_t *o, List phl)
+{
+    ListIterator itr;
+    par_handle_t ph;
+    double thresh;
+
+    if (rt_count < SPEC_MINSAMPLES)
+        return NULL;
+    thresh = o->speculate * _rt_p95();
+    if (thresh < SPEC_MINTIME)
+        thresh = SPEC_MINTIME;
+
+    if (!(itr = list_iterator_create(phl)))
+        isp_errx(1, "_straggler: out of memory");
+    while ((ph = list_next(itr)) != NULL) {
+        if (!ph->dup && !ph->twin && !ph->lost && ph->state != PROC_COMPLETE
+                && _elapsed(&ph->start) > thresh)
+            break;
+    }
+    list_iterator_destroy(itr);
+    return ph;
+}
+
 static void 
-runpipe(isp_handle_t h, runcmd_t how, List phl, char **cmdargv, isp_init_t i, 
-        unsigned long fanout)
+runpipe(isp_handle_t h, List phl, isp_init_t i, par_opts_t *o)
 {
     par_handle_t ph;
     isp_unit_t u;
     ListIterator itr;
+    List pending;
     int inres = ISP_ESUCCESS;
-    int res;
+    int res, n, full;
+    unsigned long fanout, readahead;
+    struct timeval tick, *tv;
 
-    while (inres != ISP_EEOF || !list_is_empty(phl)) {
-        /* Manage stdin - start one coproc per unit.
+    if (!(pending = list_create((ListDelF)isp_unit_destroy)))
+        isp_errx(1, "list_create: out of memory");
+
+    while (inres != ISP_EEOF || !list_is_empty(pending) 
+                             || !list_is_empty(phl)) {
+        /* Manage stdin - read ahead enough units to give every slot 
+         * a full batch.
          */
+        fanout = fanout_get(o->fanout);
+        readahead = fanout ? fanout * o->batch : o->batch;
         if (inres != ISP_EEOF) {
-            while ((!fanout || list_count(phl) < fanout) 
+            while (list_count(pending) < readahead
                     && (inres = isp_unit_read(h, &u)) == ISP_ESUCCESS)  {
-                ph = par_handle_create(how, cmdargv, i, u);
-                if (list_append(phl, ph) == NULL) {
+                if (list_append(pending, u) == NULL) {
                     res = ISP_ENOMEM;
                     isp_errx(1, "list_append: %s", isp_errstr(res));
                 }
@@ -309,78 +887,288 @@ runpipe(isp_handle_t h, runcmd_t how, List phl, char **cmdargv, isp_init_t i,
                 isp_errx(1, "isp_unit_read (stdin): %s", isp_errstr(inres));
         }
 
+        /* Start one coproc per batch of pending units, unless stdout
+         * is over budget.
+         */
+        while ((!fanout || list_count(phl) < fanout) && !_stdout_full(h, o)
+                && (n = _batchsize(o->batch, o->taper, fanout, 
+                        list_count(pending), list_count(phl), inres)) > 0) {
+            ph = par_handle_create(o, i, pending, n, _slot_alloc(phl));
+            if (list_append(phl, ph) == NULL) {
+                res = ISP_ENOMEM;
+                isp_errx(1, "list_append: %s", isp_errstr(res));
+            }
+        }
+
         /* Manage coprocesses.
          */
         itr = list_iterator_create(phl);
         while ((ph = list_next(itr)) != NULL) {
             assert(ph->magic == PAR_HANDLE_MAGIC);
-            par_handle_io(h, ph);
-            if (ph->state == PROC_COMPLETE)
+            if (ph->lost) {
+                slot_stats[ph->slot].procs++;
+                slot_stats[ph->slot].busy += _elapsed(&ph->start);
+                list_delete(itr); /* calls par_handle_destroy() */
+                continue;
+            }
+            par_handle_io(h, ph, o);
+            if (ph->state == PROC_COMPLETE) {
+                n = ph->nunits;
+                _twin_resolve(ph);
+                if (o->speculate)
+                    _rt_add(_elapsed(&ph->start) / n);
+                slot_stats[ph->slot].procs++;
+                slot_stats[ph->slot].units += n;
+                slot_stats[ph->slot].busy += _elapsed(&ph->start);
                 list_delete(itr); /* calls par_handle_destroy() */
+                fanout_complete(o->fanout, n);
+            }
         }
         list_iterator_destroy(itr);
 
-        if (fanout && inres == ISP_ESUCCESS) {
-            if (list_count(phl) == fanout)
-                _wait_for_pio(NULL, phl);
-        } else if (inres != ISP_EEOF || !list_is_empty(phl))
-            _wait_for_pio(h, phl);
+        /* Give idle slots to duplicates of stragglers.
+         */
+        fanout = fanout_get(o->fanout);
+        if (o->speculate && list_is_empty(pending)) {
+            while ((!fanout || list_count(phl) < fanout)
+                    && (ph = _straggler(o, phl)) != NULL) {
+                ph = par_handle_speculate(o, i, ph, _slot_alloc(phl));
+                if (list_append(phl, ph) == NULL) {
+                    res = ISP_ENOMEM;
+                    isp_errx(1, "list_append: %s", isp_errstr(res));
+                }
+            }
+        }
+
+        /* N.B. the fanout may have shrunk below the number of running 
+         * coprocs, in which case we just wait for some to complete.
+         * Wake up periodically to look for stragglers once we know 
+         * enough about unit runtimes.  If stdout is over budget, nothing 
+         * can proceed until it drains, so it must be polled.
+         */
+        tick.tv_sec = 0;
+        tick.tv_usec = SPEC_TICK;
+        tv = (o->speculate && rt_count >= SPEC_MINSAMPLES) ? &tick : NULL;
+        full = _stdout_full(h, o);
+        if (inres == ISP_ESUCCESS && !full) {
+            if (fanout && list_count(phl) >= fanout)
+                _wait_for_pio(NULL, phl, tv);
+        } else if (inres != ISP_EEOF || !list_is_empty(phl) || full)
+            _wait_for_pio(h, phl, tv);
     }   
 
     assert(list_is_empty(phl));
+    assert(list_is_empty(pending));
     assert(inres == ISP_EEOF);
+    list_destroy(pending);
 }
 
-/* This is the initial handshake with the pipeline.
+/* Open a persistent connection to the worker at 'addr' and send it the
+ * init element.  Units are written later as credit allows.
  */
-static void
-init_handshake(isp_handle_t h, isp_init_t *ip, int flags, char **cmdargv, List phl)
+static par_handle_t
+worker_handle_create(par_opts_t *o, isp_init_t i, char *addr, int slot)
 {
-    int fid, res, n, s, ifd, ofd;
-    isp_init_t i, i2;
-    isp_filter_t ftmp;
-    isp_handle_t ch;
-    pid_t pid;
+    par_handle_t ph;
+    int res, remote;
 
-    assert(ip != NULL);
-    assert((flags & ISP_SOURCE) && (flags & ISP_SINK)); /* FIXME */
+    if ((ph = (par_handle_t)calloc(1, sizeof(struct par_handle_struct))) == NULL)
+        isp_errx(1, "worker_handle_create: out of memory");
+    ph->magic = PAR_HANDLE_MAGIC;
+    ph->addr = addr;
+    ph->slot = slot;
+    runcmd_worker(addr, o->cmdargv, &ph->ifd, &ph->ofd, &ph->credits, &remote);
+    if (gettimeofday(&ph->start, NULL) < 0)
+        isp_errx(1, "gettimeofday: %m");
+    res = isp_handle_create(&ph->h, 
+            ISP_SOURCE | ISP_SINK | ISP_NONBLOCK | ISP_PROXY, 
+            IBACKLOG, OBACKLOG, ph->ofd, ph->ifd);
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_create: %s", isp_errstr(res));
+    _peer_compress(ph->h, remote);
+    if ((res = isp_init_write(ph->h, i)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_write: %s", isp_errstr(res));
+    ph->res = ISP_ESUCCESS;
+    ph->state = PROC_STARTING;
 
-    /* Read init element from stdin (i).
-     */
-    if (flags & ISP_SINK) {
-        if ((res = isp_init_read(h, &i)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_init_read (pipeline): %s", isp_errstr(res));
-        if ((res = isp_init_peek(i, &ftmp)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_init_peek (pipeline): %s", isp_errstr(res));
-        if ((res = isp_filter_fid_get(ftmp, &fid)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_filter_fid_get (pipeline): %s", isp_errstr(res));
-        isp_filterid_set(fid + 1);
-    } else {
-        isp_filterid_set(0);
+    return ph;
+}
+
+/* Return the open worker connection with the most unused credit, 
+ * or NULL if all are saturated.  Optionally total the unused credit.
+ */
+static par_handle_t
+_worker_pick(List phl, int *freep)
+{
+    ListIterator itr;
+    par_handle_t ph, best = NULL;
+    int avail = 0;
+
+    if (!(itr = list_iterator_create(phl)))
+        isp_errx(1, "_worker_pick: out of memory");
+    while ((ph = list_next(itr)) != NULL) {
+        if (ph->closed || ph->inflight >= ph->credits)
+            continue;
+        avail += ph->credits - ph->inflight;
+        if (!best 
+                || ph->credits - ph->inflight > best->credits - best->inflight)
+            best = ph;
     }
+    list_iterator_destroy(itr);
+    if (freep)
+        *freep = avail;
+    return best;
+}
+
+static void 
+runpipe_workers(isp_handle_t h, List phl, isp_init_t i, par_opts_t *o)
+{
+    par_handle_t ph;
+    isp_unit_t u;
+    ListIterator itr;
+    List pending;
+    int inres = ISP_ESUCCESS;
+    int res, n, avail;
+
+    if (!(pending = list_create((ListDelF)isp_unit_destroy)))
+        isp_errx(1, "list_create: out of memory");
+
+    for (n = 0; n < o->nworkers; n++) {
+        ph = worker_handle_create(o, i, o->workers[n], _slot_alloc(phl));
+        if (list_append(phl, ph) == NULL) {
+            res = ISP_ENOMEM;
+            isp_errx(1, "list_append: %s", isp_errstr(res));
+        }
+    }
+
+    while (inres != ISP_EEOF || !list_is_empty(pending) 
+                             || !list_is_empty(phl)) {
+        /* Manage worker connections first, so credit they return is 
+         * spent before we wait again.
+         */
+        itr = list_iterator_create(phl);
+        while ((ph = list_next(itr)) != NULL) {
+            assert(ph->magic == PAR_HANDLE_MAGIC);
+            par_handle_io(h, ph, o);
+            if (ph->state == PROC_COMPLETE) {
+                if (!ph->closed)
+                    isp_errx(1, "worker %s: connection closed early", ph->addr);
+                slot_stats[ph->slot].procs++;
+                slot_stats[ph->slot].units += ph->nunits;
+                slot_stats[ph->slot].busy += _elapsed(&ph->start);
+                list_delete(itr); /* calls par_handle_destroy() */
+            }
+        }
+        list_iterator_destroy(itr);
+
+        /* Manage stdin - read only as far ahead as the workers have 
+         * credit, so a stalled cluster backs up the pipeline.
+         */
+        (void)_worker_pick(phl, &avail);
+        if (inres != ISP_EEOF) {
+            while (list_count(pending) < avail
+                    && (inres = isp_unit_read(h, &u)) == ISP_ESUCCESS)  {
+                if (list_append(pending, u) == NULL) {
+                    res = ISP_ENOMEM;
+                    isp_errx(1, "list_append: %s", isp_errstr(res));
+                }
+            }
+            if (inres != ISP_EWOULDBLOCK && inres != ISP_EEOF && inres != ISP_ESUCCESS)
+                isp_errx(1, "isp_unit_read (stdin): %s", isp_errstr(inres));
+        }
+
+        /* Deal pending units to the least loaded workers, unless stdout
+         * is over budget.  OBACKLOG is unlimited so these writes do not block.
+         */
+        while (!list_is_empty(pending) && !_stdout_full(h, o)
+                && (ph = _worker_pick(phl, NULL))) {
+            u = list_dequeue(pending);
+            if ((res = isp_unit_write(ph->h, u)) != ISP_ESUCCESS)
+                isp_errx(1, "isp_unit_write (worker %s): %s", ph->addr,
+                         isp_errstr(res));
+            if ((res = isp_unit_destroy(u)) != ISP_ESUCCESS)
+                isp_errx(1, "isp_unit_destroy: %s", isp_errstr(res));
+            ph->inflight++;
+            ph->nunits++;
+        }
+
+        /* Once stdin is drained, end each worker's stream.
+         */
+        if (inres == ISP_EEOF && list_is_empty(pending)) {
+            itr = list_iterator_create(phl);
+            while ((ph = list_next(itr)) != NULL) {
+                if (!ph->closed) {
+                    if ((res = isp_unit_write(ph->h, NULL)) != ISP_ESUCCESS)
+                        isp_errx(1, "isp_unit_write (worker %s): %s", 
+                                 ph->addr, isp_errstr(res));
+                    ph->closed = 1;
+                }
+            }
+            list_iterator_destroy(itr);
+        }
+
+        if (inres != ISP_EEOF || !list_is_empty(phl))
+            _wait_for_pio(h, phl, NULL);
+    }   
+
+    assert(list_is_empty(pending));
+    list_destroy(pending);
+}
+
+/* Probe for the processed init element by running the coproc on the 
+ * unprocessed one (i) with no units, directly or on the first worker 
+ * with --workers.
+ */
+static isp_init_t
+_init_probe(isp_init_t i, par_opts_t *o)
+{
+    int res, n, s, ifd, ofd, remote = 0;
+    isp_init_t i2;
+    isp_handle_t ch;
+    pid_t pid;
 
     /* Start coprocess and give it an isp handle (ch).
      */
-    if ((res = util_runcoproc(cmdargv, &pid, &ifd, &ofd, NULL)) != ISP_ESUCCESS)
+    if (o->how == RUNCMD_WORKERS) {
+        runcmd_worker(o->workers[0], o->cmdargv, &ifd, &ofd, NULL, &remote);
+        pid = 0;
+    } else if ((res = util_runcoproc(o->cmdargv, &pid, &ifd, &ofd, NULL)) 
+            != ISP_ESUCCESS)
         isp_errx(1, "util_runcoproc: %s", isp_errstr(res));
     if ((res = isp_handle_create(&ch, ISP_SOURCE | ISP_SINK, 
                     IBACKLOG, OBACKLOG, ofd, ifd)) != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_create: %s", isp_errstr(res));
+    _peer_compress(ch, remote);
 
     /* Write init element (i) to coprocess (ch) and write a NULL unit (EOF).
+     * A write error means the coproc is gone, which is reported below.
      */
-    if ((res = isp_init_write(ch, i)) != ISP_ESUCCESS)
+    if ((res = isp_init_write(ch, i)) != ISP_ESUCCESS && res != ISP_EWRITE)
         isp_errx(1, "isp_init_write: %s", isp_errstr(res));
-    if ((res = isp_unit_write(ch, NULL)) != ISP_ESUCCESS)
+    if ((res = isp_unit_write(ch, NULL)) != ISP_ESUCCESS && res != ISP_EWRITE)
         isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
 
-    /* Read init element (i2) from coprocess.
+    /* Read init element (i2) from coprocess.  If there is none, the
+     * coproc has failed the handshake (e.g. on a binding error, which
+     * it reports itself), so report how it ended rather than the empty
+     * document that it left.
      */
-    if ((res = isp_init_read(ch, &i2)) != ISP_ESUCCESS)
+    if ((res = isp_init_read(ch, &i2)) != ISP_ESUCCESS && pid > 0 
+            && util_waitpid(pid, &s, 0) == pid) {
+        if (WIFEXITED(s) && WEXITSTATUS(s) != 0)
+            isp_errx(1, "coproc failed its handshake (exit %d)", 
+                     WEXITSTATUS(s));
+        else if (WIFSIGNALED(s))
+            isp_errx(1, "coproc died on signal %d in its handshake", 
+                     WTERMSIG(s));
+    }
+    if (res != ISP_ESUCCESS)
         isp_errx(1, "isp_init_read (coproc): %s", isp_errstr(res));
 
     /* Wait for coprocess to terminate (triggered by writing NULL above)
      */
+    if (pid == 0)
+        goto done;
     if ((n = util_waitpid(pid, &s, 0)) != pid)
         isp_errx(1, "util_waitpid: %m");
     if (WIFEXITED(s)) {
@@ -390,16 +1178,94 @@ init_handshake(isp_handle_t h, isp_init_t *ip, int flags, char **cmdargv, List p
         isp_errx(1, "util_waitpid: coproc died on signal %d", WTERMSIG(s));
     else if (WIFSTOPPED(s))
         isp_errx(1, "util_waitpid: coproc stopped on signal %d", WSTOPSIG(s));
+done:
     isp_handle_destroy(ch);
+    return i2;
+}
 
-    /* Write processed init element (i2) to stdout and destroy it.
-     */
-    if (flags & ISP_SOURCE) {
-        if ((res = isp_init_write(h, i2)) != ISP_ESUCCESS)
-            isp_errx(1, "isp_init_write: %s", isp_errstr(res));
-    }
+/* Finish the handshake, if still pending, by writing the processed init 
+ * element (i2) to stdout.  This must precede the first unit written there.
+ * If the coproc cannot describe itself, fall back to a probe.
+ */
+static void
+init_complete(isp_handle_t h)
+{
+    isp_init_t d, i2;
+    int res;
+
+    if (!init_desc)
+        return;
+    if (describe_finish(init_desc, &d) == 0) {
+        if ((res = isp_init_splice(init_i, d, &i2)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_init_splice: %s", isp_errstr(res));
+        isp_init_destroy(d);
+    } else
+        i2 = _init_probe(init_i, init_o);
+    describe_destroy(init_desc);
+    init_desc = NULL;
+    signal(SIGPIPE, init_osig);
+
+    if ((res = isp_init_write(h, i2)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_write: %s", isp_errstr(res));
     if ((res = isp_init_destroy(i2)) != ISP_ESUCCESS)
         isp_errx(1, "isp_init_destroy: %s", isp_errstr(res));
+}
+
+/* This is the initial handshake with the pipeline.
+ * Rather than probe the coproc with the init element, we push its filter 
+ * element ourselves from a description (see describe.h).  If that is not 
+ * cached, the coproc is run to describe itself while runpipe() reads the
+ * first units and starts coprocs, and the handshake is completed by 
+ * init_complete() just before the first result goes downstream.
+ * With --workers the coproc runs elsewhere, so it is always probed there.
+ */
+static void
+init_handshake(isp_handle_t h, isp_init_t *ip, int flags, par_opts_t *o, 
+               List phl)
+{
+    int fid, res;
+    isp_init_t i, i2;
+    isp_filter_t ftmp;
+
+    assert(ip != NULL);
+    assert((flags & ISP_SOURCE) && (flags & ISP_SINK)); /* FIXME */
+
+    /* Read init element from stdin (i).
+     */
+    if (flags & ISP_SINK) {
+        if ((res = isp_init_read(h, &i)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_init_read (pipeline): %s", isp_errstr(res));
+        if ((res = isp_init_peek(i, &ftmp)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_init_peek (pipeline): %s", isp_errstr(res));
+        if ((res = isp_filter_fid_get(ftmp, &fid)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_filter_fid_get (pipeline): %s", isp_errstr(res));
+        isp_filterid_set(fid + 1);
+    } else {
+        isp_filterid_set(0);
+    }
+
+    if (o->how != RUNCMD_WORKERS 
+            && describe_start(&init_desc, o->cmdargv) == 0) {
+        init_i = i;
+        init_o = o;
+        /* Until the handshake is complete, a coproc that fails its own
+         * (e.g. on a binding error) must not take us down with SIGPIPE
+         * before we have reported the error and cached the description.
+         */
+        init_osig = signal(SIGPIPE, _sigpipe_noop);
+        if (describe_cached(init_desc))
+            init_complete(h);
+    } else {
+        /* Write processed init element (i2) to stdout and destroy it.
+         */
+        i2 = _init_probe(i, o);
+        if (flags & ISP_SOURCE) {
+            if ((res = isp_init_write(h, i2)) != ISP_ESUCCESS)
+                isp_errx(1, "isp_init_write: %s", isp_errstr(res));
+        }
+        if ((res = isp_init_destroy(i2)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_init_destroy: %s", isp_errstr(res));
+    }
 
     /* Store a copy of the unprocessed init element for future use.
      */
@@ -407,6 +1273,62 @@ init_handshake(isp_handle_t h, isp_init_t *ip, int flags, char **cmdargv, List p
         *ip = i;
 }
 
+/* With ISP_DESCRIBE set, describe the filter we would run, as if we were it.
+ */
+static void
+describe_self(isp_handle_t h, par_opts_t *o)
+{
+    char *flag = getenv("ISP_DESCRIBE");
+    describe_t d;
+    isp_init_t i;
+    int res;
+
+    if (!flag || strtol(flag, NULL, 10) == 0)
+        return;
+    if (o->how == RUNCMD_WORKERS)
+        exit(1);
+    if (describe_start(&d, o->cmdargv) < 0 || describe_finish(d, &i) < 0)
+        exit(1);
+    describe_destroy(d);
+    if ((res = isp_init_nocache_set(i)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_nocache_set: %s", isp_errstr(res));
+    if ((res = isp_init_write(h, i)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_write: %s", isp_errstr(res));
+    if ((res = isp_handle_write(h, NULL)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_write: %s", isp_errstr(res));
+    isp_init_destroy(i);
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+    exit(0);
+}
+
+/* Split comma-separated worker addresses.
+ */
+static int
+_parse_workers(char *list, char ***wp, int *np)
+{
+    char *cpy, *tok, *save = NULL;
+    char **w;
+    int n = 1;
+
+    for (tok = list; *tok; tok++)
+        if (*tok == ',')
+            n++;
+    if (!(cpy = strdup(list)) || !(w = calloc(n + 1, sizeof(char *))))
+        isp_errx(1, "_parse_workers: out of memory");
+    n = 0;
+    for (tok = strtok_r(cpy, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+        w[n++] = tok;
+    if (n == 0 || w[0] != cpy) {
+        free(w);
+        free(cpy);
+        return -1;
+    }
+    *wp = w;
+    *np = n;
+    return 0;
+}
+
 int 
 main(int argc, char *argv[])
 {
@@ -414,27 +1336,78 @@ main(int argc, char *argv[])
     isp_handle_t h;
     isp_init_t i;
     List phl;
-    char **cmdargv;
     int c, longindex;
-    runcmd_t how = RUNCMD_DIRECT;
     int flags = ISP_PROXY | ISP_SOURCE | ISP_SINK;
-    unsigned long fanout = DEFAULT_FANOUT;
+    char *fanoutspec = NULL;
+    par_opts_t o;
     char *progname;
+    char *cachedir = NULL;
+    unsigned long hits0 = 0, misses0 = 0, hits, misses;
+
+    memset(&o, 0, sizeof(o));
+    o.how = RUNCMD_DIRECT;
+    o.batch = 1;
+    o.pin = PIN_NONE;
+    o.membudget = 0;
 
     progname = basename(argv[0]);
     while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
             &longindex)) != -1) { 
         switch (c) { 
             case 's':   /* --srun */
-                how = RUNCMD_SRUN;
+                o.how = RUNCMD_SRUN;
                 break;
             case 'd':   /* --direct */
-                how = RUNCMD_DIRECT;
+                o.how = RUNCMD_DIRECT;
                 break;
             case 'f':   /* --fanout */
-                fanout = strtoul(optarg, NULL, 10);
-                if (fanout == ULONG_MAX && errno == ERANGE) {
-                    fprintf(stderr, "%s: fanout value overflow", progname);
+                fanoutspec = optarg;
+                break;
+            case 'b':   /* --batch */
+                o.batch = strtol(optarg, NULL, 10);
+                if (o.batch < 1) {
+                    fprintf(stderr, "%s: batch must be >= 1\n", progname);
+                    exit(1);
+                }
+                break;
+            case 't':   /* --taper */
+                o.taper = 1;
+                break;
+            case 'p':   /* --pin */
+                if (!optarg || !strcmp(optarg, "core"))
+                    o.pin = PIN_CORE;
+                else if (!strcmp(optarg, "numa"))
+                    o.pin = PIN_NUMA;
+                else if (!strcmp(optarg, "node"))
+                    o.pin = PIN_NODE;
+                else {
+                    fprintf(stderr, "%s: invalid pin: %s\n", progname, optarg);
+                    exit(1);
+                }
+                break;
+            case 'w':   /* --workers */
+                if (_parse_workers(optarg, &o.workers, &o.nworkers) < 0) {
+                    fprintf(stderr, "%s: invalid workers: %s\n", progname,
+                            optarg);
+                    exit(1);
+                }
+                o.how = RUNCMD_WORKERS;
+                break;
+            case 'c':   /* --cache */
+                cachedir = optarg;
+                break;
+            case 'm':   /* --membudget */
+                if (util_parse_size(optarg, &o.membudget) != ISP_ESUCCESS) {
+                    fprintf(stderr, "%s: invalid membudget: %s\n", progname,
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 'x':   /* --speculate */
+                o.speculate = optarg ? strtod(optarg, NULL) : 2.0;
+                if (o.speculate < 1.0) {
+                    fprintf(stderr, "%s: speculate factor must be >= 1\n", 
+                            progname);
                     exit(1);
                 }
                 break;
@@ -445,26 +1418,60 @@ main(int argc, char *argv[])
     }
     if (argc == optind)
         usage();
+    if (o.pin != PIN_NONE && o.how != RUNCMD_DIRECT) {
+        fprintf(stderr, "%s: --pin can only be used with --direct\n", 
+                progname);
+        exit(1);
+    }
+    if (o.speculate && (o.batch > 1 || o.how == RUNCMD_WORKERS)) {
+        fprintf(stderr, "%s: --speculate cannot be used with --batch or "
+                "--workers\n", progname);
+        exit(1);
+    }
+    /* Coprocs we start (but not ispworkerd's) find the memo cache 
+     * through the environment and record hits in dir/stats.
+     */
+    if (cachedir) {
+        if (setenv("ISP_CACHE", cachedir, 1) < 0)
+            isp_errx(1, "setenv: %m");
+        (void)memo_stats_read(cachedir, &hits0, &misses0);
+    }
+    if (fanout_create(&o.fanout, fanoutspec) < 0) {
+        if (errno == ERANGE)
+            fprintf(stderr, "%s: fanout value overflow\n", progname);
+        else
+            fprintf(stderr, "%s: invalid fanout: %s\n", progname, fanoutspec);
+        exit(1);
+    }
 
     /* Initialize.
      */
     if ((res = isp_init(&h, flags, argc, argv, NULL, 1)) != ISP_ESUCCESS)
         isp_errx(1, "isp_init: %s", isp_errstr(res));
 
+    /* Our own backlogs are fixed (see NOTE above); ISP_BACKLOG is left 
+     * to the coprocs.
+     */
     if ((res = isp_handle_backlog_set(h, IBACKLOG, OBACKLOG)) != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_backlog_set: %s", isp_errstr(res));
+    if ((res = isp_handle_backlog_bytes_set(h, 0, 0)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_backlog_bytes_set: %s", isp_errstr(res));
 
     argc -= optind;
     argv += optind;
-    if ((res = util_argvdupc(argc, argv, &cmdargv)) != ISP_ESUCCESS)
+    if ((res = util_argvdupc(argc, argv, &o.cmdargv)) != ISP_ESUCCESS)
         isp_errx(1, "util_argvdupc: %s", isp_errstr(res));
 
     if (!(phl = list_create((ListDelF)par_handle_destroy)))
         isp_errx(1, "list_create: out of memory");
 
+    describe_self(h, &o);
+
     /* Perform the initial handshake with the pipeline.
      */
-    init_handshake(h, &i, flags, cmdargv, phl);
+    init_handshake(h, &i, flags, &o, phl);
+    if (o.pin != PIN_NONE)
+        topo_create(&o.topo);
 
     /* Process the pipeline with coprocesses.
      * Put stdin/stdout handle in non-blocking mode during this phase.
@@ -472,7 +1479,10 @@ main(int argc, char *argv[])
     if ((res = isp_handle_flags_set(h, flags | ISP_NONBLOCK)) != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_flags_set", isp_errstr(res));
 
-    runpipe(h, how, phl, cmdargv, i, fanout);
+    if (o.how == RUNCMD_WORKERS)
+        runpipe_workers(h, phl, i, &o);
+    else
+        runpipe(h, phl, i, &o);
 
     if ((res = isp_handle_flags_set(h, flags)) != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_flags_set", isp_errstr(res));
@@ -480,13 +1490,37 @@ main(int argc, char *argv[])
     /* Clean up.
      */
     list_destroy(phl);
+    if (o.pin != PIN_NONE || o.how == RUNCMD_WORKERS)
+        _slot_report(&o);
+    if (o.membudget)
+        _mem_report(h, &o);
+    if (cachedir && memo_stats_read(cachedir, &hits, &misses) == 0
+                 && hits + misses > hits0 + misses0) {
+        hits -= hits0;
+        misses -= misses0;
+        isp_err("cache: %lu hits, %lu misses (%.0f%% hit rate)", hits, misses,
+                100.0 * hits / (hits + misses));
+    }
+    if (o.speculate)
+        isp_err("speculated %lu units, %lu duplicates won", 
+                spec_launched, spec_wins);
+    if (o.pin != PIN_NONE)
+        topo_destroy(o.topo);
+    if (slot_stats)
+        free(slot_stats);
+    if (o.workers) {
+        free(o.workers[0]);     /* strdup'ed list that the rest point into */
+        free(o.workers);
+    }
+    fanout_destroy(o.fanout);
+    init_complete(h);                           /* if no units were output */
     if ((res = isp_init_destroy(i)) != ISP_ESUCCESS)
         isp_errx(1, "isp_init_destroy: %s", isp_errstr(res));
     if ((res = isp_handle_write(h, NULL)) != ISP_ESUCCESS)
         isp_errx(1, "isp_handle_write: %s", isp_errstr(res));
     if ((res = isp_fini(h)) != ISP_ESUCCESS)
         isp_errx(1, "isp_fini: %s", isp_errstr(res));
-    free(cmdargv);
+    free(o.cmdargv);
 
     exit(0);
 }
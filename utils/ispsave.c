@@ -0,0 +1,174 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Save the stream on stdin to an indexed archive (see archive.h), 
+ * including the init element as it arrived, for replay by ispload.
+ * The values of the metadata keys given with -k are indexed so units can 
+ * be selected by them.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+
+#include "archive.h"
+
+#define OPT_STRING "k:b:uv"
+static const struct option long_options[] = {
+    {"key", required_argument, 0, 'k'},
+    {"blocksize", required_argument, 0, 'b'},
+    {"uncompressed", no_argument, 0, 'u'},
+    {"verbose", no_argument, 0, 'v'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+static char *progname = NULL;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-uv] [-b blocksize] [-k key]... archive\n",
+            progname);
+    exit(1);
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c;
+    int longindex;
+    int res;
+    int k, nkeys = 0;
+    int compress = 1, verbose = 0;
+    char **keys = NULL, **vals;
+    unsigned long long blocksize = ARCHIVE_BLOCKSIZE, raw, coded;
+    unsigned long count = 0;
+    isp_handle_t h;
+    isp_init_t i;
+    isp_unit_t u;
+    archive_t a;
+    char *buf;
+    int len;
+   
+    progname = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) { 
+        switch (c) { 
+            case 'k':   /* --key */
+                if (!(keys = realloc(keys, (nkeys + 2) * sizeof(char *))))
+                    isp_errx(1, "out of memory");
+                keys[nkeys++] = optarg;
+                keys[nkeys] = NULL;
+                break;
+            case 'b':   /* --blocksize */
+                if (util_parse_size(optarg, &blocksize) != ISP_ESUCCESS
+                        || blocksize == 0 || blocksize > (1UL << 30)) {
+                    fprintf(stderr, "%s: invalid size: %s\n", progname, 
+                            optarg);
+                    exit(1);
+                }
+                break;
+            case 'u':   /* --uncompressed */
+                compress = 0;
+                break;
+            case 'v':   /* --verbose */
+                verbose = 1;
+                break;
+            default:
+                usage();
+                /*NOTREACHED*/
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    if (!(vals = calloc(nkeys + 1, sizeof(char *))))
+        isp_errx(1, "out of memory");
+
+    /* As a proxy, we take the init element as it is, without adding 
+     * ourselves to it, so that ispload can hand it on unchanged.
+     */
+    res = isp_init(&h, ISP_PROXY|ISP_SINK, argc, argv, NULL, 1);
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+    if (archive_create(&a, argv[optind], keys, nkeys, blocksize, 
+                       compress) < 0)
+        isp_errx(1, "%s: %m", argv[optind]);
+
+    if ((res = isp_init_read(h, &i)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_read: %s", isp_errstr(res));
+    if ((res = isp_init_str(i, &buf, &len)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init_str: %s", isp_errstr(res));
+    if (archive_init_put(a, buf, len) < 0)
+        isp_errx(1, "%s: %m", argv[optind]);
+    free(buf);
+    (void)isp_init_destroy(i);
+
+    while ((res = isp_unit_read(h, &u)) == ISP_ESUCCESS) {
+        if ((res = isp_unit_str(u, &buf, &len)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_str: %s", isp_errstr(res));
+        for (k = 0; k < nkeys; k++)
+            if (isp_meta_str_get(u, keys[k], &vals[k]) != ISP_ESUCCESS)
+                vals[k] = NULL;
+        if (archive_unit_put(a, buf, len, vals) < 0)
+            isp_errx(1, "%s: %m", argv[optind]);
+        free(buf);
+        if ((res = isp_unit_destroy(u)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_destroy: %s", isp_errstr(res));
+        count++;
+    }
+    if (res != ISP_EEOF)
+        isp_errx(1, "isp_unit_read: %s", isp_errstr(res));
+
+    if (archive_close(a) < 0)
+        isp_errx(1, "%s: %m", argv[optind]);
+    if (verbose) {
+        if (archive_open(&a, argv[optind]) < 0)
+            isp_errx(1, "%s: %m", argv[optind]);
+        archive_stats(a, &raw, &coded);
+        archive_destroy(a);
+        isp_err("saved %lu units, %llu bytes of XML in %llu", count, 
+                raw, coded);
+    }
+
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,425 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Stage the files of units in to node-local scratch (see ISP_TMPDIR in
+ * isp_init(3)), or staged out to a destination directory, copying the 
+ * files of a window of units with several parallel streams of large I/O.  
+ * The file references are rewritten with isp_file_stage() so provenance 
+ * and digests carry through.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+#include <isp/list.h>
+
+#define DEFAULT_STREAMS 4
+#define DEFAULT_UNITS   16
+#define DEFAULT_BUFSIZE "4M"
+
+#define OPT_STRING "j:n:B:k:d:"
+static const struct option long_options[] = {
+    {"streams", required_argument, 0, 'j'},
+    {"units", required_argument, 0, 'n'},
+    {"bufsize", required_argument, 0, 'B'},
+    {"key", required_argument, 0, 'k'},
+    {"directory", required_argument, 0, 'd'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+typedef struct {
+    isp_unit_t      u;
+    List            jobs;
+    int             pending;    /* jobs not yet copied */
+} ent_t;
+
+typedef struct {
+    char           *key;
+    char           *path;       /* source */
+    char           *npath;      /* destination, already created */
+    unsigned long   off;
+    unsigned long   len;
+    int             res;
+    ent_t          *ent;
+} job_t;
+
+static char *progname = NULL;
+static int stageout = 0;
+static char *destdir = NULL;
+static char **keys = NULL;
+static size_t bufsize;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+static List queue;              /* jobs waiting for a stream */
+static int finished = 0;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-j streams] [-n units] [-B bufsize] "
+            "[-k key]... in|out -d dir\n", progname);
+    exit(1);
+}
+
+static void
+_job_destroy(job_t *j)
+{
+    free(j->key);
+    free(j->path);
+    free(j->npath);
+    free(j);
+}
+
+static int
+_copy(job_t *j)
+{
+    int fd, res;
+
+    if ((fd = open(j->npath, O_WRONLY | O_TRUNC)) < 0)
+        return ISP_ECOPY;
+    res = util_copyrange(j->path, j->off, j->len, fd, bufsize);
+    if (close(fd) < 0 && res == ISP_ESUCCESS)
+        res = ISP_ECOPY;
+
+    /* A staged out file won't be read here again.
+     */
+    if (stageout && (fd = open(j->path, O_RDONLY)) >= 0) {
+        (void)posix_fadvise(fd, j->off, j->len, POSIX_FADV_DONTNEED);
+        (void)close(fd);
+    }
+    return res;
+}
+
+static void *
+_stream(void *arg)
+{
+    job_t *j;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (list_is_empty(queue) && !finished)
+            pthread_cond_wait(&work_cv, &lock);
+        if (!(j = list_dequeue(queue)))
+            break;
+        pthread_mutex_unlock(&lock);
+        j->res = _copy(j);
+        pthread_mutex_lock(&lock);
+        j->ent->pending--;
+        pthread_cond_broadcast(&done_cv);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static int
+_selected(char *key)
+{
+    int i;
+
+    if (!keys)
+        return 1;
+    for (i = 0; keys[i] != NULL; i++)
+        if (strcmp(keys[i], key) == 0)
+            return 1;
+    return 0;
+}
+
+/* Create the file a copy will go to.
+ */
+static int
+_mkdest(char **npathp)
+{
+    char path[PATH_MAX];
+    int fd, res;
+
+    if (!stageout)
+        return util_mktmp(NULL, npathp);
+    res = isp_scratch_open_dir(destdir, path, sizeof(path), &fd);
+    if (res != ISP_ESUCCESS)
+        return res;
+    (void)close(fd);
+    if (!(*npathp = strdup(path))) {
+        (void)unlink(path);
+        return ISP_ENOMEM;
+    }
+    return ISP_ESUCCESS;
+}
+
+/* isp_filefun_t: add a job to copy the file, if it is to be staged.
+ * Only read-write files (outputs) not already in the destination 
+ * directory are staged out.
+ */
+static int
+_add(char *key, char *path, unsigned long off, unsigned long len, 
+     int flags, void *arg)
+{
+    ent_t *e = (ent_t *)arg;
+    job_t *j;
+    int res;
+
+    if (!_selected(key))
+        return ISP_ESUCCESS;
+    if (stageout && ((flags & ISP_RDONLY) 
+                || (strncmp(path, destdir, strlen(destdir)) == 0 
+                    && path[strlen(destdir)] == '/')))
+        return ISP_ESUCCESS;
+    if (!(j = calloc(1, sizeof(job_t))))
+        return ISP_ENOMEM;
+    j->ent = e;
+    j->off = off;
+    j->len = len;
+    if (!(j->key = strdup(key)) || !(j->path = strdup(path))) {
+        _job_destroy(j);
+        return ISP_ENOMEM;
+    }
+    if ((res = _mkdest(&j->npath)) != ISP_ESUCCESS) {
+        _job_destroy(j);
+        return res;
+    }
+    if (!list_append(e->jobs, j)) {
+        (void)unlink(j->npath);
+        _job_destroy(j);
+        return ISP_ENOMEM;
+    }
+    return ISP_ESUCCESS;
+}
+
+/* Queue the copies for a unit that has just been read.
+ */
+static ent_t *
+_submit(isp_unit_t u)
+{
+    ListIterator itr;
+    ent_t *e;
+    job_t *j;
+    int res, oldres;
+
+    if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
+    if (!(e = malloc(sizeof(ent_t))) 
+            || !(e->jobs = list_create((ListDelF)_job_destroy)))
+        isp_errx(1, "out of memory");
+    e->u = u;
+    e->pending = 0;
+    if ((res = isp_result_upstream_get(u, &oldres)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_result_upstream_get: %s", isp_errstr(res));
+    if (oldres != ISP_ESUCCESS)
+        return e;
+    if ((res = isp_file_foreach(u, _add, e)) != ISP_ESUCCESS)
+        isp_errx(1, "%s: %s", stageout ? destdir : "util_mktmp", 
+                isp_errstr(res));
+
+    pthread_mutex_lock(&lock);
+    if (!(itr = list_iterator_create(e->jobs)))
+        isp_errx(1, "out of memory");
+    while ((j = list_next(itr))) {
+        if (!list_enqueue(queue, j))
+            isp_errx(1, "out of memory");
+        e->pending++;
+    }
+    list_iterator_destroy(itr);
+    pthread_cond_broadcast(&work_cv);
+    pthread_mutex_unlock(&lock);
+    return e;
+}
+
+/* Wait for the oldest unit's copies, rewrite its file references, and
+ * pass it on.
+ */
+static void
+_emit(isp_handle_t h, List window)
+{
+    ent_t *e = list_dequeue(window);
+    int res = ISP_ESUCCESS;
+    int oldres;
+    job_t *j;
+
+    pthread_mutex_lock(&lock);
+    while (e->pending > 0)
+        pthread_cond_wait(&done_cv, &lock);
+    pthread_mutex_unlock(&lock);
+
+    while ((j = list_dequeue(e->jobs))) {
+        if (j->res == ISP_ESUCCESS && res == ISP_ESUCCESS)
+            j->res = isp_file_stage(e->u, j->key, j->npath);
+        else if (j->res == ISP_ESUCCESS)
+            j->res = res;
+        if (j->res != ISP_ESUCCESS) {
+            isp_err("%s: %s", j->path, isp_errstr(j->res));
+            (void)unlink(j->npath);
+            res = j->res;
+        }
+        _job_destroy(j);
+    }
+    list_destroy(e->jobs);
+    if ((res == ISP_ESUCCESS) && isp_result_upstream_get(e->u, &oldres) 
+            == ISP_ESUCCESS && oldres != ISP_ESUCCESS)
+        res = ISP_ENOTRUN;
+
+    if ((res = isp_unit_fini(e->u, res)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_fini: %s", isp_errstr(res));
+    if ((res = isp_unit_write(h, e->u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    isp_unit_destroy(e->u);
+    free(e);
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c;
+    int longindex;
+    int res;
+    int i, e;
+    int nkeys = 0;
+    unsigned long nstreams = DEFAULT_STREAMS;
+    unsigned long maxunits = DEFAULT_UNITS;
+    unsigned long long size;
+    char *bufstr = DEFAULT_BUFSIZE;
+    pthread_t *streams;
+    isp_handle_t h;
+    isp_unit_t u;
+    List window;
+   
+    progname = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) { 
+        switch (c) { 
+            case 'j':   /* --streams */
+                nstreams = strtoul(optarg, NULL, 10);
+                if (nstreams < 1)
+                    usage();
+                break;
+            case 'n':   /* --units */
+                maxunits = strtoul(optarg, NULL, 10);
+                if (maxunits < 1)
+                    usage();
+                break;
+            case 'B':   /* --bufsize */
+                bufstr = optarg;
+                break;
+            case 'k':   /* --key */
+                if (!(keys = realloc(keys, (nkeys + 2) * sizeof(char *))))
+                    isp_errx(1, "out of memory");
+                keys[nkeys++] = optarg;
+                keys[nkeys] = NULL;
+                break;
+            case 'd':   /* --directory */
+                destdir = optarg;
+                break;
+            default:
+                usage();
+                /*NOTREACHED*/
+        }
+    }
+    if (optind != argc - 1)
+        usage();
+    if (strcmp(argv[optind], "out") == 0)
+        stageout = 1;
+    else if (strcmp(argv[optind], "in") != 0)
+        usage();
+    if (stageout && !destdir) {
+        fprintf(stderr, "%s: out requires --directory\n", progname);
+        exit(1);
+    }
+    if (util_parse_size(bufstr, &size) != ISP_ESUCCESS || size == 0) {
+        fprintf(stderr, "%s: invalid size: %s\n", progname, bufstr);
+        exit(1);
+    }
+    bufsize = size;
+
+    res = isp_init(&h, ISP_SOURCE|ISP_SINK, argc, argv, NULL, 1);
+    if (res != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+
+    if (!(window = list_create(NULL)) || !(queue = list_create(NULL)))
+        isp_errx(1, "list_create: out of memory");
+    if (!(streams = malloc(nstreams * sizeof(pthread_t))))
+        isp_errx(1, "out of memory");
+    for (i = 0; i < nstreams; i++)
+        if ((e = pthread_create(&streams[i], NULL, _stream, NULL)))
+            isp_errx(1, "pthread_create: %s", strerror(e));
+
+    /* As with ispprefetch, pass a unit on whenever upstream has none for 
+     * us rather than hold up the next stage.
+     */
+    for (;;) {
+        res = isp_unit_read_nowait(h, &u, !list_is_empty(window));
+        if (res == ISP_EWOULDBLOCK) {
+            _emit(h, window);
+            continue;
+        }
+        if (res != ISP_ESUCCESS)
+            break;
+        while (list_count(window) >= maxunits)
+            _emit(h, window);
+        if (!list_enqueue(window, _submit(u)))
+            isp_errx(1, "out of memory");
+    }
+    if (res != ISP_EEOF)
+        isp_errx(1, "isp_unit_read: %s", isp_errstr(res));
+    while (!list_is_empty(window))
+        _emit(h, window);
+    list_destroy(window);
+
+    pthread_mutex_lock(&lock);
+    finished = 1;
+    pthread_cond_broadcast(&work_cv);
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < nstreams; i++)
+        (void)pthread_join(streams[i], NULL);
+    free(streams);
+    list_destroy(queue);
+    if (keys)
+        free(keys);
+
+    if ((res = isp_unit_write(h, NULL)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,375 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Read the units ispunitsplit made from one original, write one unit out.
+ * Files and metadata each piece acquired after the split are added to
+ * the joined unit with the piece's index appended to their keys.
+ * Pieces of incomplete groups are held until the rest arrive; past
+ * 'max' pieces held in memory, the largest group is spilled to a 
+ * temporary file in the working directory.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <isp/util.h>
+#include <isp/isp.h>
+#include <isp/isp_private.h>
+#include <isp/list.h>
+
+#define OPT_STRING "k:m:"
+static const struct option long_options[] = {
+    {"key", required_argument, 0, 'k'},
+    {"max", required_argument, 0, 'm'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+typedef struct {
+    char           *id;         /* value of "split.parent" */
+    uint64_t        factor;     /* number of pieces expected */
+    uint64_t        count;      /* number of pieces seen */
+    List            pieces;     /* pieces held in memory */
+    isp_handle_t    spill;      /* pieces written to disk, if any */
+    char           *path;
+} group_t;
+
+static char *prog = NULL;
+static char *key = "split";
+static char *pkey = NULL;
+static char *fkey = NULL;
+static unsigned long max = 1024;
+static unsigned long incore = 0;   /* pieces held in memory, all groups */
+
+static void 
+usage(void) 
+{
+    fprintf(stderr, "Usage %s [-k val] [-m N]\n", prog);
+    exit(1);
+}
+
+static group_t *
+_group_create(char *id, uint64_t factor)
+{
+    group_t *g;
+
+    if (!(g = malloc(sizeof(group_t))))
+        isp_errx(1, "out of memory");
+    g->id = id;
+    g->factor = factor;
+    g->count = 0;
+    if (!(g->pieces = list_create((ListDelF)isp_unit_destroy)))
+        isp_errx(1, "list_create: out of memory");
+    g->spill = NULL;
+    g->path = NULL;
+    return g;
+}
+
+static void
+_group_destroy(group_t *g)
+{
+    incore -= list_count(g->pieces);
+    list_destroy(g->pieces);
+    if (g->spill)
+        (void)isp_handle_destroy(g->spill);
+    if (g->path) {
+        (void)unlink(g->path);
+        free(g->path);
+    }
+    free(g->id);
+    free(g);
+}
+
+static int
+_group_match(group_t *g, char *id)
+{
+    return (strcmp(g->id, id) == 0);
+}
+
+static int
+_group_is(group_t *g, group_t *g2)
+{
+    return (g == g2);
+}
+
+static int
+_group_bigger(group_t *g, group_t **bigp)
+{
+    if (!*bigp || list_count(g->pieces) > list_count((*bigp)->pieces))
+        *bigp = g;
+    return 0;
+}
+
+/* Move the in-memory pieces of g to its spill file.
+ */
+static void
+_group_spill(group_t *g)
+{
+    isp_unit_t u;
+    int fd, res;
+
+    if (!g->spill) {
+        if ((res = util_mktmp(&fd, &g->path)) != ISP_ESUCCESS)
+            isp_errx(1, "util_mktmp: %s", isp_errstr(res));
+        res = isp_handle_create(&g->spill, ISP_SOURCE, 1, 0, -1, fd);
+        if (res != ISP_ESUCCESS)
+            isp_errx(1, "isp_handle_create: %s", isp_errstr(res));
+    }
+    while ((u = list_dequeue(g->pieces))) {
+        if ((res = isp_unit_write(g->spill, u)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_write %s: %s", g->path, isp_errstr(res));
+        isp_unit_destroy(u);
+        incore--;
+    }
+}
+
+/* Bring the pieces of g back from its spill file, if any.
+ */
+static void
+_group_unspill(group_t *g)
+{
+    isp_handle_t h;
+    isp_unit_t u;
+    int fd, res;
+
+    if (!g->spill)
+        return;
+    if ((res = isp_unit_write(g->spill, NULL)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write %s: %s", g->path, isp_errstr(res));
+    if ((res = isp_handle_destroy(g->spill)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_destroy %s: %s", g->path, isp_errstr(res));
+    g->spill = NULL;
+
+    if ((fd = open(g->path, O_RDONLY)) < 0)
+        isp_errx(1, "open %s: %m", g->path);
+    if ((res = isp_handle_create(&h, ISP_SINK, 1, 0, fd, -1)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_handle_create: %s", isp_errstr(res));
+    while ((res = isp_unit_read(h, &u)) == ISP_ESUCCESS) {
+        if (!list_append(g->pieces, u))
+            isp_errx(1, "list_append: out of memory");
+        incore++;
+    }
+    if (res != ISP_EEOF)
+        isp_errx(1, "isp_unit_read %s: %s", g->path, isp_errstr(res));
+    (void)isp_handle_destroy(h);
+    (void)unlink(g->path);
+    free(g->path);
+    g->path = NULL;
+}
+
+static uint64_t
+_piece_index(isp_unit_t u)
+{
+    uint64_t i;
+    int res;
+
+    if ((res = isp_meta_get(u, key, ISP_UINT64, &i)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_meta_get %s: %s", key, isp_errstr(res));
+    return i;
+}
+
+static int
+_piece_cmp(isp_unit_t u1, isp_unit_t u2)
+{
+    uint64_t i1 = _piece_index(u1);
+    uint64_t i2 = _piece_index(u2);
+
+    return (i1 < i2 ? -1 : i1 > i2 ? 1 : 0);
+}
+
+/* Join the pieces of g into the lowest indexed one and write it out.
+ * 'code' is the result recorded if no piece failed upstream.
+ */
+static void
+_group_join(isp_handle_t h, group_t *g, int code)
+{
+    ListIterator itr;
+    isp_unit_t u, piece;
+    int res, upres;
+
+    _group_unspill(g);
+    list_sort(g->pieces, (ListCmpF)_piece_cmp);
+    if (!(u = list_peek(g->pieces)))
+        return;
+
+    if (!(itr = list_iterator_create(g->pieces)))
+        isp_errx(1, "list_iterator_create: out of memory");
+    while ((piece = list_next(itr))) {
+        if ((res = isp_result_upstream_get(piece, &upres)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_result_upstream_get: %s", isp_errstr(res));
+        if (upres != ISP_ESUCCESS) {
+            code = upres;
+            break;
+        }
+    }
+    list_iterator_reset(itr);
+
+    if ((res = isp_unit_init(u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
+    while ((piece = list_next(itr))) {
+        res = isp_unit_merge(u, piece, key, (int)_piece_index(piece));
+        if (res != ISP_ESUCCESS)
+            isp_errx(1, "isp_unit_merge: %s", isp_errstr(res));
+    }
+    list_iterator_destroy(itr);
+    if ((res = isp_meta_sink(u, key)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_meta_sink %s: %s", key, isp_errstr(res));
+    if ((res = isp_meta_sink(u, pkey)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_meta_sink %s: %s", pkey, isp_errstr(res));
+    if ((res = isp_meta_sink(u, fkey)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_meta_sink %s: %s", fkey, isp_errstr(res));
+    if ((res = isp_unit_fini(u, code)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_fini: %s", isp_errstr(res));
+    if ((res = isp_unit_write(h, u)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+}
+
+static void
+_initialize(isp_handle_t *hp, int flags, int argc, char *argv[])
+{
+    struct isp_stab_struct stab[] = {
+        {key, ISP_UINT64, ISP_REQUIRES | ISP_REMOVES},
+        {NULL, ISP_STR, ISP_REQUIRES | ISP_REMOVES},
+        {NULL, ISP_UINT64, ISP_REQUIRES | ISP_REMOVES},
+        {0,0,0},
+    };
+    int res;
+
+    if (asprintf(&pkey, "%s.parent", key) < 0)
+        isp_errx(1, "out of memory");
+    if (asprintf(&fkey, "%s.factor", key) < 0)
+        isp_errx(1, "out of memory");
+    stab[1].name = pkey;
+    stab[2].name = fkey;
+
+    if ((res = isp_init(hp, flags, argc, argv, stab, 1)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_init: %s", isp_errstr(res));
+}
+
+static void
+_finalize(isp_handle_t h)
+{
+    int res;
+
+    if ((res = isp_unit_write(h, NULL)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
+        isp_errx(1, "isp_fini: %s", isp_errstr(res));
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int res;
+    isp_handle_t h;
+    isp_unit_t u;
+    List groups;
+    group_t *g;
+    char *id;
+    uint64_t factor;
+    int c;
+    int longindex;
+    int flags = ISP_SOURCE | ISP_SINK | ISP_IGNERR;
+
+    /* Parse options */
+    prog = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, 
+                    &longindex)) != -1) {
+        switch (c) {
+            case 'k':   /* --key */
+                key = optarg;
+                break;
+            case 'm':   /* --max */
+                max = strtoul(optarg, NULL, 10);
+                if (max < 1)
+                    usage();
+                break;
+            default:
+                usage();
+                break;
+        }
+    }
+    if (optind < argc)
+        usage();
+
+    _initialize(&h, flags, argc, argv);
+
+    if (!(groups = list_create((ListDelF)_group_destroy)))
+        isp_errx(1, "list_create: out of memory");
+
+    while ((res = isp_unit_read(h, &u)) == ISP_ESUCCESS) {
+        if ((res = isp_meta_get(u, pkey, ISP_STR, &id)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_meta_get %s: %s", pkey, isp_errstr(res));
+        if ((res = isp_meta_get(u, fkey, ISP_UINT64, &factor)) != ISP_ESUCCESS)
+            isp_errx(1, "isp_meta_get %s: %s", fkey, isp_errstr(res));
+
+        if ((g = list_find_first(groups, (ListFindF)_group_match, id)))
+            free(id);
+        else if (!list_append(groups, (g = _group_create(id, factor))))
+            isp_errx(1, "list_append: out of memory");
+
+        if (!list_append(g->pieces, u))
+            isp_errx(1, "list_append: out of memory");
+        incore++;
+
+        if (++g->count >= g->factor) {
+            _group_join(h, g, ISP_ESUCCESS);
+            list_delete_all(groups, (ListFindF)_group_is, g);
+        } else if (incore > max) {
+            g = NULL;
+            list_for_each(groups, (ListForF)_group_bigger, &g);
+            _group_spill(g);
+        }
+    }
+    if (res != ISP_EEOF)
+        isp_errx(1, "isp_unit_read: %s", isp_errstr(res));
+
+    /* Pieces were lost upstream, so emit what we have as failed.
+     */
+    while ((g = list_dequeue(groups))) {
+        isp_err("%s: %llu of %llu pieces", g->id, 
+                (unsigned long long)g->count, (unsigned long long)g->factor);
+        _group_join(h, g, ISP_EUSER);
+        _group_destroy(g);
+    }
+    list_destroy(groups);
+
+    _finalize(h);
+
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
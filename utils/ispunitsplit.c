@@ -25,6 +25,11 @@
 
 /* Read one unit in, write 'factor' units out.
  * Put the split index in metadata called "split" (normally zero origin).
+ * Also record "split.parent", an id shared by all pieces of one unit,
+ * and "split.factor" so ispunitjoin can put them back together.
+ * With --bytes, the number of pieces depends on the size of the unit's
+ * file: each piece gets a slice of it of about N bytes, ending on a line
+ * boundary, so the file can be processed in parallel without copying it.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -39,26 +44,35 @@
 #include <math.h>
 #include <limits.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include <isp/util.h>
 #include <isp/isp.h>
 
-#define OPT_STRING "k:z:f:"
+#define OPT_STRING "k:z:f:b:F:"
 static const struct option long_options[] = {
     {"key", required_argument, 0, 'k'},
     {"zero", required_argument, 0, 'z'},
     {"factor", required_argument, 0, 'f'},
+    {"bytes", required_argument, 0, 'b'},
+    {"filekey", required_argument, 0, 'F'},
     {0,0,0,0},
 };
 static const struct option *longopts = long_options;
 
 static char *prog = NULL;
 static char *key = "split";
+static char *pkey = NULL;
+static char *fkey = NULL;
+static char *filekey = "file";
+static unsigned long long bytes = 0;
 
 static void 
 usage(void) 
 {
-    fprintf(stderr, "Usage %s [-k val] [-z N] -f N\n", prog);
+    fprintf(stderr, "Usage %s [-k val] [-z N] -f N | -b N [-F filekey]\n", 
+            prog);
     exit(1);
 }
 
@@ -68,14 +82,79 @@ _initialize(isp_handle_t *hp, int flags, int argc, char *argv[],
 {
     struct isp_stab_struct stab[] = {
         {key, ISP_UINT64, ISP_PROVIDES},
+        {NULL, ISP_STR, ISP_PROVIDES},
+        {NULL, ISP_UINT64, ISP_PROVIDES},
+        {NULL, ISP_FILE, ISP_REQUIRES},
         {0,0,0},
     };
     int res;
 
+    if (asprintf(&pkey, "%s.parent", key) < 0)
+        isp_errx(1, "out of memory");
+    if (asprintf(&fkey, "%s.factor", key) < 0)
+        isp_errx(1, "out of memory");
+    stab[1].name = pkey;
+    stab[2].name = fkey;
+    if (bytes > 0)
+        stab[3].name = filekey;
     if ((res = isp_init(hp, flags, argc, argv, stab, factor)) != ISP_ESUCCESS)
         isp_errx(1, "isp_init: %s", isp_errstr(res));
 }
 
+/* Return the offset just past the first newline at or after 'pos' and 
+ * before 'end' in the file open on fd, or 'end' if there is none.
+ */
+static off_t
+_record_end(int fd, char *path, off_t pos, off_t end)
+{
+    char buf[8192];
+    char *p;
+    int n;
+
+    if (lseek(fd, pos, SEEK_SET) < 0)
+        isp_errx(1, "lseek %s: %m", path);
+    while (pos < end) {
+        n = end - pos < sizeof(buf) ? end - pos : sizeof(buf);
+        if ((n = util_read(fd, buf, n)) < 0)
+            isp_errx(1, "read %s: %m", path);
+        if (n == 0)
+            break;
+        if ((p = memchr(buf, '\n', n)))
+            return pos + (p - buf) + 1;
+        pos += n;
+    }
+    return end;
+}
+
+/* Cut the slice [off, off+len) of path into pieces of about 'bytes' bytes 
+ * ending on line boundaries.  Returns the number of pieces, with the 
+ * start offsets assigned to *startsp (plus one for the end).
+ */
+static int
+_slices(char *path, off_t off, off_t len, off_t **startsp)
+{
+    off_t *starts = NULL;
+    off_t pos = off, end = off + len;
+    int n = 0;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        isp_errx(1, "open %s: %m", path);
+    do {
+        if (!(starts = realloc(starts, (n + 2) * sizeof(off_t))))
+            isp_errx(1, "out of memory");
+        starts[n++] = pos;
+        if (end - pos > bytes)
+            pos = _record_end(fd, path, pos + bytes - 1, end);
+        else
+            pos = end;
+    } while (pos < end);
+    starts[n] = end;
+    (void)close(fd);
+    *startsp = starts;
+    return n;
+}
+
 static void
 _finalize(isp_handle_t h)
 {
@@ -83,7 +162,7 @@ _finalize(isp_handle_t h)
 
     if ((res = isp_unit_write(h, NULL)) != ISP_ESUCCESS)
         isp_errx(1, "isp_unit_write: %s", isp_errstr(res));
-    if ((res = isp_fini(h)) == ISP_ESUCCESS)
+    if ((res = isp_fini(h)) != ISP_ESUCCESS)
         isp_errx(1, "isp_fini: %s", isp_errstr(res));
 }
 
@@ -92,6 +171,9 @@ main(int argc, char *argv[])
 {
     int factor = 0; 
     int zero = 0;
+    off_t *starts = NULL;
+    char *path;
+    unsigned long off, len;
     int res;
     isp_handle_t h;
     isp_unit_t u, new;
@@ -99,6 +181,9 @@ main(int argc, char *argv[])
     int c;
     int longindex;
     int flags = ISP_SOURCE | ISP_SINK | ISP_IGNERR;
+    char host[64];
+    char *parent;
+    unsigned long seq = 0;
 
     /* Parse options */
     prog = basename(argv[0]);
@@ -116,15 +201,29 @@ main(int argc, char *argv[])
                 if (factor < 1)
                     usage();
                 break;
+            case 'b':   /* --bytes */
+                if (util_parse_size(optarg, &bytes) != ISP_ESUCCESS 
+                        || bytes == 0) {
+                    fprintf(stderr, "%s: invalid size: %s\n", prog, optarg);
+                    exit(1);
+                }
+                break;
+            case 'F':   /* --filekey */
+                filekey = optarg;
+                break;
             default:
                 usage();
                 break;
         }
     }
-    if (factor == 0)
+    if ((factor == 0) == (bytes == 0))
         usage();
 
-    _initialize(&h, flags, argc, argv, factor);
+    _initialize(&h, flags, argc, argv, bytes > 0 ? 1 : factor);
+
+    if (gethostname(host, sizeof(host)) < 0)
+        isp_errx(1, "gethostname: %m");
+    host[sizeof(host) - 1] = '\0';
 
     while ((res = isp_unit_read(h, &u)) == ISP_ESUCCESS) {
 
@@ -134,6 +233,20 @@ main(int argc, char *argv[])
         if (isp_rwfile_check(u) != ISP_ESUCCESS)
             isp_errx(1, "isp_rwfile_check: %s", isp_errstr(res));
 
+        if (asprintf(&parent, "%s:%d:%lu", host, (int)getpid(), seq++) < 0)
+            isp_errx(1, "out of memory");
+
+        if (bytes > 0) {
+            res = isp_file_access(u, filekey, &path, 
+                                  ISP_RDONLY | ISP_SLICEOK);
+            if (res != ISP_ESUCCESS)
+                isp_errx(1, "isp_file_access: %s", isp_errstr(res));
+            res = isp_file_slice_get(u, filekey, &off, &len);
+            if (res != ISP_ESUCCESS)
+                isp_errx(1, "isp_file_slice_get: %s", isp_errstr(res));
+            factor = _slices(path, off, len, &starts);
+        }
+
         for (i = 0; i < factor; i++) {
             if ((res = isp_unit_copy(&new, u)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_unit_copy: %s", isp_errstr(res));
@@ -141,8 +254,24 @@ main(int argc, char *argv[])
             if ((res = isp_unit_init(new)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
 
+            if (starts) {
+                if ((res = isp_file_sink(new, filekey)) != ISP_ESUCCESS)
+                    isp_errx(1, "isp_file_sink: %s", isp_errstr(res));
+                res = isp_file_source(new, filekey, path, ISP_RDONLY);
+                if (res != ISP_ESUCCESS)
+                    isp_errx(1, "isp_file_source: %s", isp_errstr(res));
+                res = isp_file_slice_set(new, filekey, starts[i], 
+                                         starts[i + 1] - starts[i]);
+                if (res != ISP_ESUCCESS)
+                    isp_errx(1, "isp_file_slice_set: %s", isp_errstr(res));
+            }
+
             if ((res = isp_meta_source(new, key, ISP_UINT64, (uint64_t)i+zero)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_meta_source: %s", isp_errstr(res));
+            if ((res = isp_meta_source(new, pkey, ISP_STR, parent)) != ISP_ESUCCESS)
+                isp_errx(1, "isp_meta_source: %s", isp_errstr(res));
+            if ((res = isp_meta_source(new, fkey, ISP_UINT64, (uint64_t)factor)) != ISP_ESUCCESS)
+                isp_errx(1, "isp_meta_source: %s", isp_errstr(res));
 
             if ((res = isp_unit_fini(new, ISP_ESUCCESS)) != ISP_ESUCCESS)
                 isp_errx(1, "isp_unit_init: %s", isp_errstr(res));
@@ -152,6 +281,11 @@ main(int argc, char *argv[])
 
             isp_unit_destroy(new);
         }
+        free(parent);
+        if (starts) {
+            free(starts);
+            starts = NULL;
+        }
         isp_unit_destroy(u);
     }
 
@@ -0,0 +1,169 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Serve an ISP filter to remote isprun --workers clients.  Each accepted 
+ * connection gets its own persistent coprocess, which reads the init 
+ * element and units straight off the socket and writes its results back.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "worker.h"
+
+#define DEFAULT_CREDITS 2
+
+#define OPT_STRING "c:"
+static const struct option long_options[] = {
+    {"credits", required_argument, 0, 'c'},
+    {0,0,0,0},
+};
+static const struct option *longopts = long_options;
+
+static char *progname = NULL;
+
+static void 
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [-c credits] host:port|path -- filter [args]\n",
+            progname);
+    exit(1);
+}
+
+static void
+_reap(int sig)
+{
+    int saved_errno = errno;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+    errno = saved_errno;
+}
+
+/* Child: handshake with the client, then become the filter with the 
+ * connection on stdin and stdout.
+ */
+static void
+_serve(int fd, char **cmdargv, int credits)
+{
+    if (worker_welcome(fd, cmdargv, credits) < 0)
+        exit(1);
+    if (dup2(fd, 0) < 0 || dup2(fd, 1) < 0) {
+        fprintf(stderr, "%s: dup2: %s\n", progname, strerror(errno));
+        exit(1);
+    }
+    (void)close(fd);
+    /* Have the filter return a credit for each unit it reads, and 
+     * compress its output if the client is on another host.
+     */
+    if (setenv("ISP_CREDIT", "1", 1) < 0 || (worker_peer_remote(0)
+                && setenv("ISP_STDOUT_REMOTE", "1", 1) < 0)) {
+        fprintf(stderr, "%s: setenv: %s\n", progname, strerror(errno));
+        exit(1);
+    }
+    execvp(cmdargv[0], cmdargv);
+    fprintf(stderr, "%s: %s: %s\n", progname, cmdargv[0], strerror(errno));
+    exit(1);
+}
+
+int 
+main(int argc, char *argv[])
+{
+    int c, lfd, fd, credits = DEFAULT_CREDITS;
+    struct sigaction sa;
+    char *addr;
+    pid_t pid;
+
+    progname = basename(argv[0]);
+    while ((c = getopt_long(argc, argv, OPT_STRING, longopts, NULL)) != -1) {
+        switch (c) {
+            case 'c':   /* --credits */
+                credits = strtol(optarg, NULL, 10);
+                if (credits < 1) {
+                    fprintf(stderr, "%s: credits must be >= 1\n", progname);
+                    exit(1);
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind < 2)
+        usage();
+    addr = argv[optind++];
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _reap;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((lfd = worker_listen(addr)) < 0) {
+        fprintf(stderr, "%s: %s: %s\n", progname, addr, strerror(errno));
+        exit(1);
+    }
+
+    for (;;) {
+        if ((fd = accept(lfd, NULL, NULL)) < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "%s: accept: %s\n", progname, strerror(errno));
+            exit(1);
+        }
+        switch ((pid = fork())) {
+            case -1:
+                fprintf(stderr, "%s: fork: %s\n", progname, strerror(errno));
+                break;
+            case 0:
+                (void)close(lfd);
+                signal(SIGCHLD, SIG_DFL);
+                signal(SIGPIPE, SIG_DFL);
+                _serve(fd, &argv[optind], credits);
+                /*NOTREACHED*/
+            default:
+                break;
+        }
+        (void)close(fd);
+    }
+    /*NOTREACHED*/
+    exit(0);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,471 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* On-disk memo cache of filter results (see memo.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>   /* FICLONE */
+#endif
+
+#include <isp/util.h>
+#include <isp/isp.h>
+
+#include "memo.h"
+
+#define MEMO_MAGIC      0x4d454d4f
+#define MEMO_STATS      "stats"
+#define MEMO_TMPL       "tmp.XXXXXX"
+
+struct memo_struct {
+    int magic;
+    char *dir;                  /* cache directory */
+    unsigned long long maxbytes;/* size limit, 0 = unlimited */
+    unsigned long hits;         /* lookups satisfied by this process */
+    unsigned long misses;       /* lookups not satisfied by this process */
+};
+
+struct entry {
+    char *path;
+    off_t size;
+    time_t mtime;
+};
+
+int
+memo_create(memo_t *mp, char *dir, unsigned long long maxbytes)
+{
+    struct stat sb;
+    memo_t m;
+
+    if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+        return -1;
+    if (stat(dir, &sb) < 0)
+        return -1;
+    if (!S_ISDIR(sb.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    if (!(m = calloc(1, sizeof(struct memo_struct))))
+        return -1;
+    if (!(m->dir = strdup(dir))) {
+        free(m);
+        return -1;
+    }
+    m->magic = MEMO_MAGIC;
+    m->maxbytes = maxbytes;
+    *mp = m;
+    return 0;
+}
+
+/* Open dir/stats and take an exclusive lock on it, reading its counts and
+ * running byte total.  Returns the fd (-1 on failure) and sets *countedp 
+ * to 0 if the file has no byte total yet (an empty or older cache).
+ */
+static int
+_stats_lock(memo_t m, unsigned long *hitsp, unsigned long *missesp,
+            unsigned long long *bytesp, int *countedp)
+{
+    char path[PATH_MAX], buf[96];
+    int fd, n;
+
+    *hitsp = *missesp = 0;
+    *bytesp = 0;
+    *countedp = 0;
+    snprintf(path, sizeof(path), "%s/%s", m->dir, MEMO_STATS);
+    if ((fd = open(path, O_RDWR | O_CREAT, 0666)) < 0)
+        return -1;
+    if (flock(fd, LOCK_EX) < 0) {
+        (void)close(fd);
+        return -1;
+    }
+    if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[n] = '\0';
+        *countedp = (sscanf(buf, "%lu %lu %llu", hitsp, missesp, bytesp) == 3);
+    }
+    return fd;
+}
+
+/* Write back the counts (and byte total, if counted) and drop the lock.
+ */
+static void
+_stats_unlock(int fd, unsigned long hits, unsigned long misses,
+              unsigned long long bytes, int counted)
+{
+    char buf[96];
+    int n;
+
+    if (counted)
+        n = snprintf(buf, sizeof(buf), "%lu %lu %llu\n", hits, misses, bytes);
+    else
+        n = snprintf(buf, sizeof(buf), "%lu %lu\n", hits, misses);
+    if (ftruncate(fd, 0) == 0)
+        (void)pwrite(fd, buf, n, 0);
+    (void)close(fd);    /* drops lock */
+}
+
+/* Add this process's counts to dir/stats under an exclusive lock.
+ */
+static void
+_stats_flush(memo_t m)
+{
+    unsigned long hits, misses;
+    unsigned long long bytes;
+    int fd, counted;
+
+    if (m->hits + m->misses == 0)
+        return;
+    if ((fd = _stats_lock(m, &hits, &misses, &bytes, &counted)) < 0)
+        return;
+    _stats_unlock(fd, hits + m->hits, misses + m->misses, bytes, counted);
+}
+
+void
+memo_destroy(memo_t m)
+{
+    assert(m->magic == MEMO_MAGIC);
+    _stats_flush(m);
+    m->magic = 0;
+    free(m->dir);
+    free(m);
+}
+
+void
+memo_stats(memo_t m, unsigned long *hitsp, unsigned long *missesp)
+{
+    assert(m->magic == MEMO_MAGIC);
+    *hitsp = m->hits;
+    *missesp = m->misses;
+}
+
+int
+memo_stats_read(char *dir, unsigned long *hitsp, unsigned long *missesp)
+{
+    char path[PATH_MAX], buf[64];
+    int fd, n;
+
+    *hitsp = *missesp = 0;
+    snprintf(path, sizeof(path), "%s/%s", dir, MEMO_STATS);
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    if (flock(fd, LOCK_SH) == 0 && (n = pread(fd, buf, sizeof(buf)-1, 0)) > 0) {
+        buf[n] = '\0';
+        (void)sscanf(buf, "%lu %lu", hitsp, missesp);
+    }
+    (void)close(fd);
+    return 0;
+}
+
+/* Append 'len' bytes of 'data' to a growing buffer.
+ */
+static int
+_append(char **bufp, int *lenp, int *sizep, char *data, int len)
+{
+    while (*lenp + len > *sizep) {
+        *sizep = *sizep ? *sizep * 2 : 1024;
+        if (!(*bufp = realloc(*bufp, *sizep)))
+            return -1;
+    }
+    memcpy(*bufp + *lenp, data, len);
+    *lenp += len;
+    return 0;
+}
+
+static int
+_append_env(char **bufp, int *lenp, int *sizep, char *names)
+{
+    char *cpy, *name, *val, *save = NULL;
+    int res = 0;
+
+    if (!(cpy = strdup(names)))
+        return -1;
+    for (name = strtok_r(cpy, ",", &save); name && res == 0; 
+            name = strtok_r(NULL, ",", &save)) {
+        res = _append(bufp, lenp, sizep, name, strlen(name));
+        if (res == 0 && (val = getenv(name))) {
+            res = _append(bufp, lenp, sizep, "=", 1);
+            if (res == 0)
+                res = _append(bufp, lenp, sizep, val, strlen(val));
+        }
+        if (res == 0)
+            res = _append(bufp, lenp, sizep, "", 1);
+    }
+    free(cpy);
+    return res;
+}
+
+char *
+memo_key(memo_t m, char **argv, char **inputs)
+{
+    char *buf = NULL, *key = NULL, *extra;
+    int len = 0, size = 0, res = 0;
+    int i;
+
+    assert(m->magic == MEMO_MAGIC);
+
+    /* argv, then env, then inputs, each list NUL separated and 
+     * terminated by an empty string.
+     */
+    for (i = 0; argv[i] != NULL && res == 0; i++)
+        res = _append(&buf, &len, &size, argv[i], strlen(argv[i]) + 1);
+    if (res == 0)
+        res = _append(&buf, &len, &size, "", 1);
+    if (res == 0)
+        res = _append_env(&buf, &len, &size, MEMO_ENV_DEFAULT);
+    if (res == 0 && (extra = getenv("ISP_CACHE_ENV")))
+        res = _append_env(&buf, &len, &size, extra);
+    if (res == 0)
+        res = _append(&buf, &len, &size, "", 1);
+    for (i = 0; inputs[i] != NULL && res == 0; i++)
+        res = _append(&buf, &len, &size, inputs[i], strlen(inputs[i]) + 1);
+
+    if (res == 0 && util_md5_buf(buf, len, &key) == ISP_ESUCCESS 
+            && strlen(key) == 0) {
+        free(key);
+        key = NULL;
+    }
+    if (buf)
+        free(buf);
+    return key;
+}
+
+static void
+_entry_path(memo_t m, char *key, char *path, int len)
+{
+    snprintf(path, len, "%s/%.2s/%s", m->dir, key, key);
+}
+
+/* Copy ifd to ofd, sharing blocks if the file system can (FICLONE).
+ */
+static int
+_clone(int ifd, int ofd)
+{
+    char buf[65536];
+    int n;
+
+#ifdef FICLONE
+    if (ioctl(ofd, FICLONE, ifd) == 0)
+        return 0;
+#endif
+    while ((n = util_read(ifd, buf, sizeof(buf))) > 0) {
+        if (util_write(ofd, buf, n) != n)
+            return -1;
+    }
+    return n;
+}
+
+int
+memo_lookup(memo_t m, char *key, char **pathp)
+{
+    char path[PATH_MAX];
+    char *npath;
+    int ifd, ofd;
+
+    assert(m->magic == MEMO_MAGIC);
+
+    _entry_path(m, key, path, sizeof(path));
+    if ((ifd = open(path, O_RDONLY)) < 0) {
+        if (errno != ENOENT)
+            return -1;
+        m->misses++;
+        return 0;
+    }
+    if (util_mktmp(&ofd, &npath) != ISP_ESUCCESS) {
+        (void)close(ifd);
+        return -1;
+    }
+    if (_clone(ifd, ofd) < 0 || close(ofd) < 0) {
+        (void)close(ifd);
+        (void)unlink(npath);
+        free(npath);
+        return -1;
+    }
+    (void)close(ifd);
+    (void)utimes(path, NULL);   /* most recently used */
+    m->hits++;
+    *pathp = npath;
+    return 1;
+}
+
+static int
+_entry_cmp(const void *a, const void *b)
+{
+    const struct entry *ea = a, *eb = b;
+
+    return (ea->mtime < eb->mtime) ? -1 : (ea->mtime > eb->mtime) ? 1 : 0;
+}
+
+/* Total up the cache and, if it is over its limit, remove least recently
+ * used entries until it is 10% under, so we don't have to do this on 
+ * every store.  Called with dir/stats locked.  Returns the bytes left.
+ */
+static unsigned long long
+_evict(memo_t m)
+{
+    struct entry *ents = NULL;
+    int n = 0, size = 0, i;
+    unsigned long long total = 0;
+    char path[PATH_MAX];
+    DIR *top, *sub;
+    struct dirent *d, *e;
+    struct stat sb;
+
+    if (!(top = opendir(m->dir)))
+        return 0;
+    while ((d = readdir(top))) {
+        if (strlen(d->d_name) != 2 || d->d_name[0] == '.')
+            continue;   /* not a dir/xx subdirectory (e.g. "..") */
+        snprintf(path, sizeof(path), "%s/%s", m->dir, d->d_name);
+        if (!(sub = opendir(path)))
+            continue;
+        while ((e = readdir(sub))) {
+            if (e->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s/%s", m->dir, d->d_name, 
+                     e->d_name);
+            if (stat(path, &sb) < 0)
+                continue;
+            if (n == size) {
+                size = size ? size * 2 : 256;
+                if (!(ents = realloc(ents, size * sizeof(struct entry)))) {
+                    closedir(sub);
+                    goto done;
+                }
+            }
+            if (!(ents[n].path = strdup(path)))
+                continue;
+            ents[n].size = sb.st_size;
+            ents[n].mtime = sb.st_mtime;
+            total += sb.st_size;
+            n++;
+        }
+        closedir(sub);
+    }
+    if (m->maxbytes > 0 && total > m->maxbytes) {
+        qsort(ents, n, sizeof(struct entry), _entry_cmp);
+        for (i = 0; i < n && total > m->maxbytes / 10 * 9; i++) {
+            if (unlink(ents[i].path) == 0)
+                total -= ents[i].size;
+        }
+    }
+done:
+    closedir(top);
+    for (i = 0; i < n; i++)
+        free(ents[i].path);
+    if (ents)
+        free(ents);
+    return total;
+}
+
+int
+memo_store(memo_t m, char *key, char *path)
+{
+    char epath[PATH_MAX], tpath[PATH_MAX];
+    unsigned long hits, misses;
+    unsigned long long bytes;
+    struct stat sb;
+    off_t size;
+    int ifd, ofd, sfd, e, counted;
+
+    assert(m->magic == MEMO_MAGIC);
+
+    _entry_path(m, key, epath, sizeof(epath));
+    snprintf(tpath, sizeof(tpath), "%s/%.2s", m->dir, key);
+    if (mkdir(tpath, 0777) < 0 && errno != EEXIST)
+        return -1;
+
+    /* Copy into a temporary name then rename into place, so concurrent 
+     * readers never see a partial entry.
+     */
+    snprintf(tpath, sizeof(tpath), "%s/%s", m->dir, MEMO_TMPL);
+    if ((ofd = mkstemp(tpath)) < 0)
+        return -1;
+    if ((ifd = open(path, O_RDONLY)) < 0)
+        goto error;
+    if (_clone(ifd, ofd) < 0) {
+        (void)close(ifd);
+        goto error;
+    }
+    (void)close(ifd);
+    if (fchmod(ofd, 0444) < 0 || fstat(ofd, &sb) < 0)
+        goto error;
+    size = sb.st_size;
+    if (close(ofd) < 0) {
+        ofd = -1;
+        goto error;
+    }
+    ofd = -1;
+
+    /* Rename and account for the entry under the stats lock, so the
+     * running total stays in step with what is in the directory.
+     * The directory is only rescanned if there is no total yet or
+     * the cache has grown over its limit.
+     */
+    if ((sfd = _stats_lock(m, &hits, &misses, &bytes, &counted)) < 0)
+        goto error;
+    if (stat(epath, &sb) == 0 && bytes >= sb.st_size)
+        bytes -= sb.st_size;
+    if (rename(tpath, epath) < 0) {
+        e = errno;
+        _stats_unlock(sfd, hits, misses, bytes, counted);
+        (void)unlink(tpath);
+        errno = e;
+        return -1;
+    }
+    bytes += size;
+    if (!counted || (m->maxbytes > 0 && bytes > m->maxbytes)) {
+        bytes = _evict(m);
+        counted = 1;
+    }
+    _stats_unlock(sfd, hits, misses, bytes, counted);
+    return 0;
+error:
+    e = errno;
+    if (ofd >= 0)
+        (void)close(ofd);
+    (void)unlink(tpath);
+    errno = e;
+    return -1;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,83 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _MEMO_H
+#define _MEMO_H
+
+/* On-disk memo cache of filter results, keyed on a digest of the filter 
+ * command line, the environment variables that can change its output, 
+ * and the digests of its inputs.  Entries are stored under 
+ * dir/xx/digest and evicted least-recently-used first once the cache 
+ * grows beyond its size limit (0 = unlimited).  Many processes may share 
+ * a cache directory.  Cumulative hit/miss counts and a running total of
+ * the entries' size are kept in dir/stats.
+ */
+
+typedef struct memo_struct *memo_t;
+
+/* Environment variables that feed the key, besides those named in
+ * $ISP_CACHE_ENV (comma separated).
+ */
+#define MEMO_ENV_DEFAULT    "PATH,LANG,LANGUAGE,LC_ALL,LC_COLLATE,LC_CTYPE,TZ"
+
+/* Open cache directory 'dir', creating it if needed.  
+ * Returns 0 on success, -1 with errno set on failure.
+ */
+int     memo_create(memo_t *mp, char *dir, unsigned long long maxbytes);
+
+/* Flush hit/miss counts to dir/stats and free.
+ */
+void    memo_destroy(memo_t m);
+
+/* Compute the key for running 'argv' on inputs with digests 'inputs'
+ * (NULL terminated).  Caller must free.  Returns NULL if digests are
+ * unavailable (no OpenSSL).
+ */
+char   *memo_key(memo_t m, char **argv, char **inputs);
+
+/* Look up 'key'.  On a hit, return 1 with a private copy of the stored 
+ * output (reflinked if the file system allows) at a new temporary path in
+ * the current directory, *pathp, which the caller must free.  Returns 0 on
+ * a miss, -1 on error.
+ */
+int     memo_lookup(memo_t m, char *key, char **pathp);
+
+/* Store a copy of the file at 'path' as the output for 'key', evicting 
+ * old entries as needed.  Returns 0 on success, -1 on error.
+ */
+int     memo_store(memo_t m, char *key, char *path);
+
+/* Hit/miss counts for this process (if m != NULL) or cumulative ones 
+ * recorded in dir/stats.
+ */
+void    memo_stats(memo_t m, unsigned long *hitsp, unsigned long *missesp);
+int     memo_stats_read(char *dir, unsigned long *hitsp, 
+                        unsigned long *missesp);
+
+#endif /* _MEMO_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
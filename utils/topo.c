@@ -0,0 +1,295 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Discover which CPUs we may run on and how they group into NUMA nodes,
+ * by reading /sys/devices/system/node/node<N>/cpulist.  If there is no
+ * node information, all CPUs are placed in node 0.  Only CPUs in our
+ * initial affinity mask are used, so isprun honors any cpuset it was 
+ * started in.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+#include <isp/isp.h>
+#include "topo.h"
+
+#define PATH_SYSNODE    "/sys/devices/system/node"
+
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT    0
+#define MPOL_PREFERRED  1
+#endif
+
+#define TOPO_MAGIC      0x544f504f
+
+struct node_struct {
+    int id;             /* kernel node number */
+    int ncpus;
+    int *cpus;          /* usable CPUs on this node */
+};
+
+struct topo_struct {
+    int magic;
+    cpu_set_t saved;    /* affinity mask at startup */
+    int ncpus;          /* usable CPUs (all nodes) */
+    int nnodes;
+    struct node_struct *nodes;
+};
+
+static void
+_node_addcpu(struct node_struct *n, int cpu)
+{
+    if (!(n->cpus = realloc(n->cpus, sizeof(int) * (n->ncpus + 1))))
+        isp_errx(1, "topo: out of memory");
+    n->cpus[n->ncpus++] = cpu;
+}
+
+static struct node_struct *
+_topo_addnode(topo_t t, int id)
+{
+    struct node_struct *n;
+
+    t->nodes = realloc(t->nodes, sizeof(struct node_struct) * (t->nnodes + 1));
+    if (!t->nodes)
+        isp_errx(1, "topo: out of memory");
+    n = &t->nodes[t->nnodes++];
+    n->id = id;
+    n->ncpus = 0;
+    n->cpus = NULL;
+    return n;
+}
+
+/* Parse a kernel cpulist such as "0-3,8-11" and add usable CPUs to node.
+ */
+static void
+_parse_cpulist(topo_t t, struct node_struct *n, char *s)
+{
+    char *tok, *saveptr = NULL;
+    int lo, hi, cpu;
+
+    for (tok = strtok_r(s, ",\n", &saveptr); tok != NULL; 
+                                tok = strtok_r(NULL, ",\n", &saveptr)) {
+        switch (sscanf(tok, "%d-%d", &lo, &hi)) {
+            case 1:
+                hi = lo;
+                break;
+            case 2:
+                break;
+            default:
+                continue;
+        }
+        for (cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &t->saved)) {
+                _node_addcpu(n, cpu);
+                t->ncpus++;
+            }
+        }
+    }
+}
+
+static int
+_cmpnode(const void *a, const void *b)
+{
+    return ((struct node_struct *)a)->id - ((struct node_struct *)b)->id;
+}
+
+static void
+_read_nodes(topo_t t)
+{
+    DIR *dir;
+    struct dirent *d;
+    char path[256], buf[4096];
+    FILE *fp;
+    int id;
+
+    if (!(dir = opendir(PATH_SYSNODE)))
+        return;
+    while ((d = readdir(dir))) {
+        if (sscanf(d->d_name, "node%d", &id) != 1)
+            continue;
+        snprintf(path, sizeof(path), "%s/node%d/cpulist", PATH_SYSNODE, id);
+        if (!(fp = fopen(path, "r")))
+            continue;
+        if (fgets(buf, sizeof(buf), fp))
+            _parse_cpulist(t, _topo_addnode(t, id), buf);
+        fclose(fp);
+        if (t->nodes[t->nnodes - 1].ncpus == 0) {   /* memory-only node */
+            free(t->nodes[t->nnodes - 1].cpus);
+            t->nnodes--;
+        }
+    }
+    closedir(dir);
+    if (t->nnodes > 1)
+        qsort(t->nodes, t->nnodes, sizeof(struct node_struct), _cmpnode);
+}
+
+void
+topo_create(topo_t *tp)
+{
+    topo_t t;
+    int cpu;
+
+    if (!(t = (topo_t)calloc(1, sizeof(struct topo_struct))))
+        isp_errx(1, "topo: out of memory");
+    t->magic = TOPO_MAGIC;
+    if (sched_getaffinity(0, sizeof(t->saved), &t->saved) < 0)
+        isp_errx(1, "sched_getaffinity: %m");
+
+    _read_nodes(t);
+    if (t->nnodes == 0) {
+        struct node_struct *n = _topo_addnode(t, 0);
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &t->saved)) {
+                _node_addcpu(n, cpu);
+                t->ncpus++;
+            }
+        }
+    }
+    assert(t->ncpus > 0);
+    *tp = t;
+}
+
+void
+topo_destroy(topo_t t)
+{
+    int i;
+
+    assert(t->magic == TOPO_MAGIC);
+    for (i = 0; i < t->nnodes; i++)
+        free(t->nodes[i].cpus);
+    free(t->nodes);
+    t->magic = 0;
+    free(t);
+}
+
+/* Map slot to a node and a CPU on that node.
+ * PIN_CORE walks the CPUs of node 0, then node 1, and so on.
+ * Otherwise slots are dealt round-robin over nodes, then over CPUs 
+ * within a node.
+ */
+static struct node_struct *
+_placement(topo_t t, pin_t how, int slot, int *cpup)
+{
+    struct node_struct *n;
+    int i;
+
+    if (how == PIN_CORE) {
+        slot %= t->ncpus;
+        for (i = 0; slot >= t->nodes[i].ncpus; i++)
+            slot -= t->nodes[i].ncpus;
+        n = &t->nodes[i];
+        *cpup = n->cpus[slot];
+    } else {
+        n = &t->nodes[slot % t->nnodes];
+        *cpup = n->cpus[(slot / t->nnodes) % n->ncpus];
+    }
+    return n;
+}
+
+static void
+_set_mempolicy(int mode, int node)
+{
+#ifdef SYS_set_mempolicy
+    unsigned long mask[CPU_SETSIZE / (8 * sizeof(unsigned long))];
+
+    memset(mask, 0, sizeof(mask));
+    if (mode != MPOL_DEFAULT)
+        mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+    /* best effort: fails with ENOSYS on kernels without NUMA support */
+    (void)syscall(SYS_set_mempolicy, mode, 
+                  mode == MPOL_DEFAULT ? NULL : mask, 
+                  mode == MPOL_DEFAULT ? 0 : 8 * sizeof(mask));
+#endif
+}
+
+int
+topo_bind(topo_t t, pin_t how, int slot)
+{
+    struct node_struct *n;
+    cpu_set_t set;
+    int i, cpu;
+
+    assert(t->magic == TOPO_MAGIC);
+    if (how == PIN_NONE)
+        return 0;
+
+    n = _placement(t, how, slot, &cpu);
+    CPU_ZERO(&set);
+    if (how == PIN_NODE)
+        for (i = 0; i < n->ncpus; i++)
+            CPU_SET(n->cpus[i], &set);
+    else
+        CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        return -1;
+    if (how != PIN_CORE && t->nnodes > 1)
+        _set_mempolicy(MPOL_PREFERRED, n->id);
+    return 0;
+}
+
+void
+topo_unbind(topo_t t)
+{
+    assert(t->magic == TOPO_MAGIC);
+    if (sched_setaffinity(0, sizeof(t->saved), &t->saved) < 0)
+        isp_errx(1, "sched_setaffinity: %m");
+    if (t->nnodes > 1)
+        _set_mempolicy(MPOL_DEFAULT, 0);   /* presumed our initial policy */
+}
+
+char *
+topo_describe(topo_t t, pin_t how, int slot, char *buf, int len)
+{
+    struct node_struct *n;
+    int cpu;
+
+    assert(t->magic == TOPO_MAGIC);
+    if (how == PIN_NONE) {
+        snprintf(buf, len, "-");
+    } else {
+        n = _placement(t, how, slot, &cpu);
+        if (how == PIN_NODE)
+            snprintf(buf, len, "node%d", n->id);
+        else
+            snprintf(buf, len, "node%d:cpu%d", n->id, cpu);
+    }
+    return buf;
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
@@ -0,0 +1,65 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _TOPO_H
+#define _TOPO_H
+
+/* CPU/NUMA topology discovery (from /sys) and coprocess placement
+ * for isprun.  Slots are numbered from zero.  
+ * PIN_CORE binds each slot to one CPU, filling CPUs in numerical order.
+ * PIN_NUMA binds each slot to one CPU, dealing slots round-robin across
+ * NUMA nodes so consecutive slots land on different nodes.
+ * PIN_NODE binds each slot to all the CPUs of one node (round-robin).
+ * With PIN_NUMA and PIN_NODE the slot's memory policy prefers its node,
+ * if the kernel supports set_mempolicy(2).
+ */
+
+typedef enum { PIN_NONE, PIN_CORE, PIN_NUMA, PIN_NODE } pin_t;
+
+typedef struct topo_struct *topo_t;
+
+void    topo_create(topo_t *tp);
+void    topo_destroy(topo_t t);
+
+/* Bind the calling process to the placement for 'slot' so that children 
+ * forked before topo_unbind() inherit it.  Returns 0 on success, -1 
+ * on failure.
+ */
+int     topo_bind(topo_t t, pin_t how, int slot);
+
+/* Restore the affinity mask saved by topo_create() and the default 
+ * memory policy.
+ */
+void    topo_unbind(topo_t t);
+
+/* Describe the placement for 'slot' in 'buf' (e.g. "node0:cpu3").
+ */
+char   *topo_describe(topo_t t, pin_t how, int slot, char *buf, int len);
+
+#endif /* _TOPO_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
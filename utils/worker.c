@@ -0,0 +1,321 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+/* Socket plumbing for remote coprocesses (see worker.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "worker.h"
+
+#define WORKER_MAGIC_STR    "isp-worker"
+#define LISTEN_BACKLOG      64
+
+/* Split "host:port" into its parts.  Returns 0 on success, -1 if there 
+ * is no port.  Caller frees *hostp (NULL means wildcard).
+ */
+static int
+_split_addr(char *addr, char **hostp, char **portp)
+{
+    char *p;
+
+    if (!(p = strrchr(addr, ':')) || *(p + 1) == '\0')
+        return -1;
+    *portp = p + 1;
+    if (p == addr)
+        *hostp = NULL;
+    else if (!(*hostp = strndup(addr, p - addr)))
+        return -1;
+    return 0;
+}
+
+static int
+_unix_sock(char *path, int listening)
+{
+    struct sockaddr_un sun;
+    int fd, e;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (listening) {
+        /* Bind to a temporary name and rename it into place once we are 
+         * listening, so clients never see a socket that refuses them.
+         */
+        if (snprintf(sun.sun_path, sizeof(sun.sun_path), "%s.%d", path, 
+                    (int)getpid()) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            goto error;
+        }
+        (void)unlink(sun.sun_path);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+            goto error;
+        if (listen(fd, LISTEN_BACKLOG) < 0 || rename(sun.sun_path, path) < 0) {
+            e = errno;
+            (void)unlink(sun.sun_path);
+            errno = e;
+            goto error;
+        }
+    } else {
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+            goto error;
+    }
+    return fd;
+error:
+    e = errno;
+    (void)close(fd);
+    errno = e;
+    return -1;
+}
+
+static int
+_tcp_sock(char *addr, int listening)
+{
+    struct addrinfo hints, *res, *r;
+    char *host, *port;
+    int fd = -1, on = 1, e;
+
+    if (_split_addr(addr, &host, &port) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (listening)
+        hints.ai_flags = AI_PASSIVE;
+    e = getaddrinfo(host, port, &hints, &res);
+    if (host)
+        free(host);
+    if (e != 0) {
+        errno = (e == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+        return -1;
+    }
+    for (r = res; r != NULL; r = r->ai_next) {
+        if ((fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol)) < 0)
+            continue;
+        if (listening) {
+            (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(fd, r->ai_addr, r->ai_addrlen) == 0 
+                    && listen(fd, LISTEN_BACKLOG) == 0)
+                break;
+        } else {
+            if (connect(fd, r->ai_addr, r->ai_addrlen) == 0) {
+                /* units are small and latency matters more than packing */
+                (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                break;
+            }
+        }
+        e = errno;
+        (void)close(fd);
+        errno = e;
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+int
+worker_listen(char *addr)
+{
+    return strchr(addr, '/') ? _unix_sock(addr, 1) : _tcp_sock(addr, 1);
+}
+
+int
+worker_connect(char *addr)
+{
+    return strchr(addr, '/') ? _unix_sock(addr, 0) : _tcp_sock(addr, 0);
+}
+
+/* Read one newline-terminated line a byte at a time, so nothing past the 
+ * newline (i.e. the start of the ISP stream) is consumed.  The newline is 
+ * stripped.  Returns 0 on success, -1 on error/EOF/overlong line.
+ */
+static int
+_readline(int fd, char *buf, int len)
+{
+    int n = 0, r;
+
+    while (n < len - 1) {
+        if ((r = read(fd, &buf[n], 1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (buf[n] == '\n') {
+            buf[n] = '\0';
+            return 0;
+        }
+        n++;
+    }
+    errno = EPROTO;
+    return -1;
+}
+
+static int
+_writeline(int fd, char *buf)
+{
+    int n = 0, r, len = strlen(buf);
+
+    while (n < len) {
+        if ((r = write(fd, buf + n, len - n)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        n += r;
+    }
+    return 0;
+}
+
+/* Build "isp-worker 1 filter [args]".
+ */
+static int
+_hello_str(char **cmdargv, char *buf, int len)
+{
+    int n, i;
+
+    n = snprintf(buf, len, "%s %d", WORKER_MAGIC_STR, WORKER_PROTO);
+    for (i = 0; cmdargv[i] != NULL && n < len; i++)
+        n += snprintf(buf + n, len - n, " %s", cmdargv[i]);
+    if (n >= len - 1) {
+        errno = E2BIG;
+        return -1;
+    }
+    return 0;
+}
+
+int
+worker_hello(int fd, char **cmdargv, int *creditsp, char *host, int hostlen,
+             char *why, int whylen)
+{
+    char buf[WORKER_MAXLINE], peer[WORKER_MAXLINE];
+    int credits, n;
+
+    if (_hello_str(cmdargv, buf, sizeof(buf)) < 0)
+        return -1;
+    strcat(buf, "\n");
+    if (_writeline(fd, buf) < 0)
+        return -1;
+    if (_readline(fd, buf, sizeof(buf)) < 0)
+        return -1;
+    if ((n = sscanf(buf, "ok %d %s", &credits, peer)) >= 1 && credits > 0) {
+        *creditsp = credits;
+        if (host)
+            snprintf(host, hostlen, "%s", n == 2 ? peer : "");
+        return 0;
+    }
+    if (!strncmp(buf, "error ", 6)) {
+        if (why)
+            snprintf(why, whylen, "%s", buf + 6);
+        errno = EACCES;
+    } else
+        errno = EPROTO;
+    return -1;
+}
+
+int
+worker_peer_remote(int fd)
+{
+    struct sockaddr_storage me, peer;
+    socklen_t melen = sizeof(me), peerlen = sizeof(peer);
+
+    if (getsockname(fd, (struct sockaddr *)&me, &melen) < 0
+            || getpeername(fd, (struct sockaddr *)&peer, &peerlen) < 0)
+        return 0;
+    if (peer.ss_family == AF_INET) {
+        struct in_addr *a = &((struct sockaddr_in *)&me)->sin_addr;
+        struct in_addr *b = &((struct sockaddr_in *)&peer)->sin_addr;
+
+        if (ntohl(b->s_addr) >> 24 == 127)      /* loopback */
+            return 0;
+        return (a->s_addr != b->s_addr);
+    }
+    if (peer.ss_family == AF_INET6) {
+        struct in6_addr *a = &((struct sockaddr_in6 *)&me)->sin6_addr;
+        struct in6_addr *b = &((struct sockaddr_in6 *)&peer)->sin6_addr;
+
+        if (IN6_IS_ADDR_LOOPBACK(b))
+            return 0;
+        return memcmp(a, b, sizeof(*a)) != 0;
+    }
+    return 0;                                   /* AF_UNIX */
+}
+
+int
+worker_welcome(int fd, char **cmdargv, int credits)
+{
+    char want[WORKER_MAXLINE], buf[WORKER_MAXLINE], host[256];
+
+    if (_hello_str(cmdargv, want, sizeof(want)) < 0)
+        return -1;
+    if (_readline(fd, buf, sizeof(buf)) < 0)
+        return -1;
+    if (strncmp(buf, WORKER_MAGIC_STR " ", strlen(WORKER_MAGIC_STR) + 1)) {
+        (void)_writeline(fd, "error not an isp-worker client\n");
+        errno = EPROTO;
+        return -1;
+    }
+    if (strcmp(buf, want) != 0) {
+        (void)_writeline(fd, "error filter mismatch\n");
+        errno = EACCES;
+        return -1;
+    }
+    if (gethostname(host, sizeof(host) - 1) < 0)
+        strcpy(host, "localhost");
+    host[sizeof(host) - 1] = '\0';
+    snprintf(buf, sizeof(buf), "ok %d %s\n", credits, host);
+    return _writeline(fd, buf);
+}
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */
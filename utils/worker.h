@@ -0,0 +1,77 @@
+/*****************************************************************************\
+ *  $Id$
+ *****************************************************************************
+ *  Copyright (C) 2005 The Regents of the University of California.
+ *  Produced at Lawrence Livermore National Laboratory (cf, DISCLAIMER).
+ *  Written by Jim Garlick <garlick@llnl.gov>.
+ *  
+ *  This file is part of ISP, a toolkit for constructing pipeline applications.
+ *  For details, see <http://isp.sourceforge.net>.
+
+ *  ISP is free software; you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation; either version 2 of the License, or (at your option)
+ *  any later version.
+ *  
+ *  ISP is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *  details.
+ *  
+ *  You should have received a copy of the GNU General Public License along
+ *  with ISP; if not, write to the Free Software Foundation, Inc.,
+ *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA.
+\*****************************************************************************/
+
+#ifndef _WORKER_H
+#define _WORKER_H
+
+/* Socket plumbing shared by isprun --workers and ispworkerd.
+ * A worker address is "host:port" (TCP, host may be empty for the 
+ * wildcard address when listening), or a Unix domain socket path, 
+ * recognized by containing a '/'.
+ *
+ * After connecting, the client sends one line naming the filter:
+ *     isp-worker 1 filter [args]\n
+ * and the daemon answers with one line, either
+ *     ok credits [host]\n
+ * where credits is the maximum number of units the client may have 
+ * outstanding on the connection and host is the daemon's hostname (older
+ * daemons leave it out), or
+ *     error reason\n
+ * followed by close.  The connection then carries an ordinary ISP 
+ * stream (init element, units, end of document) in each direction.
+ */
+
+#define WORKER_PROTO        1
+#define WORKER_MAXLINE      4096
+
+/* Listen on/connect to 'addr'.  Return fd or -1 with errno set.
+ */
+int     worker_listen(char *addr);
+int     worker_connect(char *addr);
+
+/* Client side of handshake.  Return 0 with *creditsp set on success, and
+ * the daemon's hostname copied to 'host' if non-NULL ("" if not given).
+ * On failure, return -1 with errno set (EPROTO for a garbled reply, 
+ * EACCES if the daemon refused, in which case its reason is copied to 
+ * 'why' if non-NULL).
+ */
+int     worker_hello(int fd, char **cmdargv, int *creditsp, char *host,
+                     int hostlen, char *why, int whylen);
+
+/* Server side of handshake.  Read the client's line and accept it if it 
+ * names 'cmdargv', granting 'credits'.  Return 0 if accepted, -1 if not.
+ */
+int     worker_welcome(int fd, char **cmdargv, int credits);
+
+/* Return 1 if the other end of connection 'fd' is on another host, 
+ * judging by its address, otherwise 0 (including for Unix domain sockets).
+ */
+int     worker_peer_remote(int fd);
+
+#endif /* _WORKER_H */
+
+/*
+ * vi:tabstop=4 shiftwidth=4 expandtab
+ */